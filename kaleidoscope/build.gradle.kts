@@ -19,7 +19,7 @@ android {
         externalNativeBuild {
             cmake {
                 cppFlags.add("-std=c++2a")
-                abiFilters.addAll(listOf("arm64-v8a"))
+                abiFilters.addAll(listOf("arm64-v8a", "x86_64"))
             }
         }
     }
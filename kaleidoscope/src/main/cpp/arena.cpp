@@ -0,0 +1,301 @@
+/*
+ * MIT License
+ *
+ * Copyright (C) 2021 M.D.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include <algorithm>
+#include <iterator>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "arena.h"
+
+namespace moe::aoramd::kaleidoscope::internal {
+
+    static std::size_t align_up(std::size_t size, std::size_t alignment) {
+        return (size + alignment - 1) / alignment * alignment;
+    }
+
+    CodeArena::CodeArena(std::size_t slot_size) :
+            slot_size_(align_up(slot_size, kAlignment)),
+            page_size_(sysconf(_SC_PAGESIZE)) {}
+
+    CodeArena::~CodeArena() {
+        for (auto &[start, slab] : slabs_) munmap(start, slab.size);
+    }
+
+    void *CodeArena::AllocateSlot() {
+        std::lock_guard<std::recursive_mutex> lock(mutex_);
+        if (write_depth_ == 0) return nullptr;
+
+        for (auto free_slot = free_slots_.rbegin(); free_slot != free_slots_.rend(); ++free_slot) {
+            void *slot = *free_slot;
+            if (!Unseal(slot, slot_size_)) continue;
+            free_slots_.erase(std::next(free_slot).base());
+            return slot;
+        }
+
+        while (slot_cursor_ != nullptr && slot_cursor_ + slot_size_ <= slot_end_) {
+            void *slot = slot_cursor_;
+            slot_cursor_ += slot_size_;
+            if (Unseal(slot, slot_size_)) return slot;
+            // The slot shares a page with sealed slots, so it is kept until they are freed.
+            free_slots_.push_back(slot);
+        }
+
+        char *start = MapSlab(kSlabSize);
+        if (start == nullptr) return nullptr;
+        slot_cursor_ = start + slot_size_;
+        slot_end_ = start + kSlabSize;
+        Unseal(start, slot_size_);
+        return start;
+    }
+
+    void CodeArena::FreeSlot(void *slot) {
+        std::lock_guard<std::recursive_mutex> lock(mutex_);
+        Release(slot, slot_size_);
+        free_slots_.push_back(slot);
+    }
+
+    void *CodeArena::Allocate(std::size_t size) {
+        std::lock_guard<std::recursive_mutex> lock(mutex_);
+        if (write_depth_ == 0 || size == 0) return nullptr;
+        size = align_up(size, kAlignment);
+
+        // Reuse the smallest free block which is large enough.
+        for (auto free_block = free_blocks_.lower_bound(size);
+             free_block != free_blocks_.end(); ++free_block) {
+            void *block = free_block->second;
+            if (!Unseal(block, free_block->first)) continue;
+            block_sizes_[block] = free_block->first;
+            free_blocks_.erase(free_block);
+            return block;
+        }
+
+        char *block;
+        if (size > kSlabSize) {
+            block = MapSlab(align_up(size, page_size_));
+            if (block == nullptr) return nullptr;
+            Unseal(block, size);
+        } else {
+            while (block_cursor_ != nullptr && block_cursor_ + size <= block_end_ &&
+                   !Unseal(block_cursor_, size)) {
+                // Skip the page shared with sealed blocks, and keep the rest of it for later.
+                auto next = std::min(block_end_, reinterpret_cast<char *>(align_up(
+                        reinterpret_cast<std::size_t>(block_cursor_) + 1, page_size_)));
+                free_blocks_.emplace(next - block_cursor_, block_cursor_);
+                block_cursor_ = next;
+            }
+            if (block_cursor_ == nullptr || block_cursor_ + size > block_end_) {
+                char *start = MapSlab(kSlabSize);
+                if (start == nullptr) return nullptr;
+                block_cursor_ = start;
+                block_end_ = start + kSlabSize;
+                Unseal(block_cursor_, size);
+            }
+            block = block_cursor_;
+            block_cursor_ += size;
+        }
+        block_sizes_[block] = size;
+        return block;
+    }
+
+    void *CodeArena::AllocateNear(std::size_t size, void *address, std::size_t range) {
+        std::lock_guard<std::recursive_mutex> lock(mutex_);
+        if (write_depth_ == 0 || size == 0 || size > kSlabSize) return nullptr;
+        size = align_up(size, kAlignment);
+
+        auto target = reinterpret_cast<std::size_t>(address);
+        auto in_range = [target, range, size](const void *block) {
+            auto start = reinterpret_cast<std::size_t>(block);
+            std::size_t distance = start > target ? start + size - target : target - start;
+            return distance <= range;
+        };
+
+        // Reuse a free block in range.
+        for (auto free_block = free_blocks_.lower_bound(size);
+             free_block != free_blocks_.end(); ++free_block) {
+            void *block = free_block->second;
+            if (!in_range(block) || !Unseal(block, free_block->first)) continue;
+            block_sizes_[block] = free_block->first;
+            free_blocks_.erase(free_block);
+            return block;
+        }
+
+        // Bump in a near slab in range, or map a new one.
+        char *block = nullptr;
+        for (auto &[start, slab] : slabs_) {
+            char *end = start + slab.size;
+            while (slab.near_cursor != nullptr && slab.near_cursor + size <= end &&
+                   in_range(slab.near_cursor)) {
+                if (Unseal(slab.near_cursor, size)) {
+                    block = slab.near_cursor;
+                    slab.near_cursor += size;
+                    break;
+                }
+                // Skip the page shared with sealed blocks, and keep the rest of it for later.
+                auto next = std::min(end, reinterpret_cast<char *>(align_up(
+                        reinterpret_cast<std::size_t>(slab.near_cursor) + 1, page_size_)));
+                free_blocks_.emplace(next - slab.near_cursor, slab.near_cursor);
+                slab.near_cursor = next;
+            }
+            if (block != nullptr) break;
+        }
+        if (block == nullptr) {
+            char *start = MapSlabNear(kSlabSize, address, range);
+            if (start == nullptr) return nullptr;
+            block = start;
+            slabs_[start].near_cursor = start + size;
+            Unseal(block, size);
+        }
+        block_sizes_[block] = size;
+        return block;
+    }
+
+    void CodeArena::Free(void *block) {
+        std::lock_guard<std::recursive_mutex> lock(mutex_);
+        auto block_size = block_sizes_.find(block);
+        if (block_size == block_sizes_.end()) return;
+        Release(block, block_size->second);
+        free_blocks_.emplace(block_size->second, block);
+        block_sizes_.erase(block_size);
+    }
+
+    char *CodeArena::MapSlab(std::size_t size) {
+        void *start = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                           MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (start == MAP_FAILED) return nullptr;
+        AddSlab(static_cast<char *>(start), size);
+        return static_cast<char *>(start);
+    }
+
+    char *CodeArena::MapSlabNear(std::size_t size, void *address, std::size_t range) {
+        // Try hints on both sides of the address, from the adjacent slabs to the edges of the
+        // range, because the kernel maps somewhere else if the hinted space is occupied.
+        auto origin = reinterpret_cast<std::size_t>(address);
+        std::size_t target = origin / kSlabSize * kSlabSize;
+        std::size_t step = std::max(kSlabSize,
+                                    align_up(range / (kMapNearAttemptCount / 2), kSlabSize));
+        for (int attempt = 0; attempt < kMapNearAttemptCount; attempt++) {
+            int distance_index = attempt / 2;
+            std::size_t offset = distance_index == 0 ? kSlabSize : distance_index * step;
+            if (offset + size > range) break;
+            bool below = attempt % 2 == 1;
+            if (below && offset > target) continue;
+            std::size_t hint = below ? target - offset : target + offset;
+
+            void *start = mmap(reinterpret_cast<void *>(hint), size, PROT_READ | PROT_WRITE,
+                               MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (start == MAP_FAILED) continue;
+            auto mapped = reinterpret_cast<std::size_t>(start);
+            std::size_t distance = mapped > origin ? mapped + size - origin : origin - mapped;
+            if (distance > range) {
+                munmap(start, size);
+                continue;
+            }
+            AddSlab(static_cast<char *>(start), size);
+            return static_cast<char *>(start);
+        }
+        return nullptr;
+    }
+
+    void CodeArena::AddSlab(char *start, std::size_t size) {
+        std::size_t page_count = size / page_size_;
+        Slab &slab = slabs_[start];
+        slab.size = size;
+        slab.writable = true;
+        slab.near_cursor = nullptr;
+        slab.writable_pages.assign(page_count, true);
+        slab.allocation_counts.assign(page_count, 0);
+    }
+
+    bool CodeArena::Unseal(void *pointer, std::size_t size) {
+        // Find the slab whose start address is the greatest one not greater than pointer.
+        auto slab = slabs_.upper_bound(static_cast<char *>(pointer));
+        if (slab == slabs_.begin()) return false;
+        --slab;
+        char *start = slab->first;
+        Slab &data = slab->second;
+        std::size_t first = (static_cast<char *>(pointer) - start) / page_size_;
+        std::size_t last = (static_cast<char *>(pointer) + size - 1 - start) / page_size_;
+
+        for (std::size_t page = first; page <= last; page++) {
+            if (!data.writable_pages[page] && data.allocation_counts[page] != 0) return false;
+        }
+        for (std::size_t page = first; page <= last; page++) {
+            if (data.writable_pages[page]) continue;
+            if (mprotect(start + page * page_size_, page_size_, PROT_READ | PROT_WRITE) != 0)
+                return false;
+            data.writable_pages[page] = true;
+            data.writable = true;
+        }
+        for (std::size_t page = first; page <= last; page++) data.allocation_counts[page]++;
+        return true;
+    }
+
+    void CodeArena::Release(void *pointer, std::size_t size) {
+        auto slab = slabs_.upper_bound(static_cast<char *>(pointer));
+        if (slab == slabs_.begin()) return;
+        --slab;
+        Slab &data = slab->second;
+        std::size_t first = (static_cast<char *>(pointer) - slab->first) / page_size_;
+        std::size_t last = (static_cast<char *>(pointer) + size - 1 - slab->first) / page_size_;
+        for (std::size_t page = first; page <= last; page++) data.allocation_counts[page]--;
+    }
+
+    void CodeArena::Seal() {
+        for (auto &[start, slab] : slabs_) {
+            if (!slab.writable) continue;
+            bool sealed = true;
+            std::size_t page_count = slab.writable_pages.size();
+            for (std::size_t page = 0; page < page_count;) {
+                if (!slab.writable_pages[page]) {
+                    page++;
+                    continue;
+                }
+                // Seal continuous writable pages together.
+                std::size_t end = page;
+                while (end < page_count && slab.writable_pages[end]) end++;
+                char *begin = start + page * page_size_;
+                std::size_t size = (end - page) * page_size_;
+                __builtin___clear_cache(begin, begin + size);
+                if (mprotect(begin, size, PROT_READ | PROT_EXEC) == 0) {
+                    std::fill(slab.writable_pages.begin() + page,
+                              slab.writable_pages.begin() + end, false);
+                } else {
+                    sealed = false;
+                }
+                page = end;
+            }
+            slab.writable = !sealed;
+        }
+    }
+
+    CodeArena::ScopedWrite::ScopedWrite(CodeArena *arena) : arena_(arena) {
+        arena_->mutex_.lock();
+        arena_->write_depth_++;
+    }
+
+    CodeArena::ScopedWrite::~ScopedWrite() {
+        if (--arena_->write_depth_ == 0) arena_->Seal();
+        arena_->mutex_.unlock();
+    }
+}
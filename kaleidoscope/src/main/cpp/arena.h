@@ -0,0 +1,232 @@
+/*
+ * MIT License
+ *
+ * Copyright (C) 2021 M.D.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef KALEIDOSCOPE_ARENA_H
+#define KALEIDOSCOPE_ARENA_H
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <vector>
+
+#include "declare.h"
+
+namespace moe::aoramd::kaleidoscope::internal {
+
+    /**
+     * An allocator of executable memory for bridge code.
+     *
+     * Memory is mapped in slabs, which are readable and executable only by default. Fixed-size
+     * slots are carved from slot slabs and variable-size blocks are bumped from code slabs, and
+     * freed memory is kept in free lists for reuse.
+     *
+     * Memory can only be allocated in a write scope (see ScopedWrite). Pages allocated from in
+     * the scope are made readable and writable only once when they are first touched and sealed
+     * again when the outermost scope exits, so the count of memory protection switches does not
+     * grow with the count of bridges created in a scope. Memory is never writable and executable
+     * at the same time, so a page is only made writable if no allocated slot or block which may
+     * be reached by other threads lies in it.
+     */
+    class CodeArena final {
+    public:
+        /**
+         * @param slot_size size of fixed-size slots.
+         */
+        explicit CodeArena(std::size_t slot_size);
+
+        ~CodeArena();
+
+        CodeArena(const CodeArena &) = delete;
+
+        CodeArena &operator=(const CodeArena &) = delete;
+
+        /**
+         * Allocate a fixed-size slot. It must be invoked in write scope.
+         *
+         * @return pointer of slot or nullptr on failure.
+         */
+        void *AllocateSlot();
+
+        /**
+         * Return a slot allocated by AllocateSlot() to the arena.
+         *
+         * @param slot pointer of slot.
+         */
+        void FreeSlot(void *slot);
+
+        /**
+         * Allocate a variable-size block. It must be invoked in write scope.
+         *
+         * @param size size of block.
+         * @return pointer of block or nullptr on failure.
+         */
+        void *Allocate(std::size_t size);
+
+        /**
+         * Allocate a variable-size block in the specified distance from an address, so that
+         * code at the address can reach the block by a PC-relative branch. It must be invoked
+         * in write scope.
+         *
+         * @param size size of block.
+         * @param address address the block is allocated near.
+         * @param range max distance from the address to any byte of the block.
+         * @return pointer of block or nullptr if no memory in range is available.
+         */
+        void *AllocateNear(std::size_t size, void *address, std::size_t range);
+
+        /**
+         * Return a block allocated by Allocate() or AllocateNear() to the arena.
+         *
+         * @param block pointer of block.
+         */
+        void Free(void *block);
+
+        /**
+         * Make all pages made writable in current write scope readable and executable only, and
+         * flush instruction cache of them. It is invoked when the outermost write scope exits,
+         * and it must be invoked in write scope before code written in it can be reached by
+         * other threads. Pages are made writable again if they are allocated from later.
+         */
+        void Seal();
+
+        /**
+         * A tool class for scoped writing memory allocated from arena.
+         *
+         * Scopes can be nested, and the arena is locked for the current thread until the
+         * outermost scope exits.
+         */
+        class ScopedWrite final {
+        public:
+            explicit ScopedWrite(CodeArena *arena);
+
+            ~ScopedWrite();
+
+        private:
+            CodeArena *arena_;
+        };
+
+        /**
+         * Default size of slab. Blocks larger than this are allocated in a dedicated slab.
+         */
+        static constexpr std::size_t kSlabSize = 64 * 1024;
+
+        /**
+         * Alignment of slots and blocks.
+         */
+        static constexpr std::size_t kAlignment = 16;
+
+        /**
+         * Max count of addresses tried for mapping a slab near an address.
+         */
+        static constexpr int kMapNearAttemptCount = 64;
+
+    private:
+        struct Slab {
+            std::size_t size;
+
+            /**
+             * Whether any page of the slab is writable.
+             */
+            bool writable;
+
+            /**
+             * Cursor of the next near block, or null if the slab is not mapped for near blocks.
+             */
+            char *near_cursor;
+
+            /**
+             * Whether each page is writable.
+             */
+            std::vector<bool> writable_pages;
+
+            /**
+             * Count of allocated slots and blocks lying in each page.
+             */
+            std::vector<std::uint32_t> allocation_counts;
+        };
+
+        /**
+         * Map a new slab which is writable until current write scope exits.
+         *
+         * @param size size of slab.
+         * @return start address of slab or nullptr on failure.
+         */
+        char *MapSlab(std::size_t size);
+
+        /**
+         * Map a new slab in range of an address which is writable until current write scope
+         * exits, see AllocateNear().
+         *
+         * @return start address of slab or nullptr on failure.
+         */
+        char *MapSlabNear(std::size_t size, void *address, std::size_t range);
+
+        /**
+         * Register a mapped slab whose pages are all writable.
+         */
+        void AddSlab(char *start, std::size_t size);
+
+        /**
+         * Make pages of memory writable until current write scope exits and count the memory as
+         * allocated. Pages which are sealed are not made writable if other allocated memory lies
+         * in them, because code in it may be running.
+         *
+         * @param pointer start address of memory.
+         * @param size size of memory.
+         * @return true if the memory is writable and allocated.
+         */
+        bool Unseal(void *pointer, std::size_t size);
+
+        /**
+         * Count memory allocated by Unseal() as free.
+         *
+         * @param pointer start address of memory.
+         * @param size size of memory.
+         */
+        void Release(void *pointer, std::size_t size);
+
+        std::recursive_mutex mutex_;
+        int write_depth_ = 0;
+
+        std::size_t slot_size_;
+        std::size_t page_size_;
+
+        /**
+         * Mapped slabs indexed by start address.
+         */
+        std::map<char *, Slab> slabs_;
+
+        char *slot_cursor_ = nullptr;
+        char *slot_end_ = nullptr;
+        std::vector<void *> free_slots_;
+
+        char *block_cursor_ = nullptr;
+        char *block_end_ = nullptr;
+        std::map<void *, std::size_t> block_sizes_;
+        std::multimap<std::size_t, void *> free_blocks_;
+    };
+}
+
+#endif
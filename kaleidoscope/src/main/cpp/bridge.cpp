@@ -22,20 +22,69 @@
  * SOFTWARE.
  */
 
+#include <cstddef>
+#include <cstring>
+
 #include "bridge.h"
 
+#include "arena.h"
 #include "log.h"
-#include "internal.h"
-
-#include "mirror.h"
+#include "memory.h"
 
 namespace moe::aoramd::kaleidoscope::bridge {
 
-    bool Bridge::SetMain(void *origin_entrance, void *secondary_bridge) {
+    // Secondary bridge reads hook records by these offsets.
+    static_assert(offsetof(HookRecord, bridge_method_) == 0 &&
+                  offsetof(HookRecord, bridge_entrance_) == 8 &&
+                  offsetof(HookRecord, sample_interval_) == 16 &&
+                  offsetof(HookRecord, sample_countdown_) == 24 &&
+                  offsetof(HookRecord, paused_) == 36,
+                  "Layout of hook record must be matched with bridge code.");
+    static_assert(offsetof(NativeListener, before_) == 0 &&
+                  offsetof(NativeListener, user_) == 8 &&
+                  offsetof(NativeListener, origin_bridge_) == 16,
+                  "Layout of native listener must be matched with bridge code.");
+    static_assert(offsetof(kaleidoscope_hook_context, registers) == 16 &&
+                  offsetof(kaleidoscope_hook_context, floating_registers) == 72 &&
+                  offsetof(kaleidoscope_hook_context, stack) == 136 &&
+                  sizeof(kaleidoscope_hook_context) == 144,
+                  "Layout of hook context must be matched with bridge code.");
+
+#if defined(__x86_64__)
+
+    std::size_t Bridge::thread_self_offset_ = 0;
+
+#endif
+
+    bool Bridge::Initialize(mirror::Thread *current_thread) {
+#if defined(__x86_64__) && defined(__ANDROID__)
+        for (std::size_t offset = 0; offset < kThreadSelfOffsetLimit; offset += sizeof(void *)) {
+            mirror::Thread *value;
+            __asm__ volatile("mov %%gs:(%1), %0" : "=r"(value) : "r"(offset));
+            if (value == current_thread) {
+                thread_self_offset_ = offset;
+                return true;
+            }
+        }
+        errorLog("Unable to find thread native peer " __log_memory_specifier__ " in gs segment.",
+                 reinterpret_cast<std::size_t>(current_thread))
+        return false;
+#else
+        // Thread native peer is kept in register x19 in arm64, and host builds use the thread
+        // pointer at offset 0 of fs segment instead.
+        (void) current_thread;
+        return true;
+#endif
+    }
+
+    bool Bridge::SetMain(void *origin_entrance, void *secondary_bridge, void *origin_bridge) {
+        auto patch_size = *reinterpret_cast<std::size_t *>(
+                reinterpret_cast<std::size_t>(origin_bridge) + kOriginBridgePatchSizeOffset);
+
         // Check whether compiled code size is less than main bridge.
         auto *size_pointer = reinterpret_cast<std::int32_t *>(
                 reinterpret_cast<std::size_t>(origin_entrance) - sizeof(std::int32_t));
-        if (*size_pointer < kMainBridgeSize) {
+        if (*size_pointer < static_cast<std::int32_t>(patch_size)) {
             errorLog(
                     "Method code length is less than main bridge code length, so it cannot be inserted.")
             return false;
@@ -47,84 +96,200 @@ namespace moe::aoramd::kaleidoscope::bridge {
                     reinterpret_cast<std::size_t>(origin_entrance))
             return false;
         }
-        internal::Memory::Copy(origin_entrance, reinterpret_cast<void *>(MainBridge),
-                               kMainBridgeSize);
 
-        // Set parameter - target.
-        *reinterpret_cast<void **>(
-                reinterpret_cast<std::size_t>(origin_entrance) + kMainBridgeTargetOffset
-        ) = secondary_bridge;
+        if (patch_size == kBranchSize) {
+            // Branch to veneer, which jumps to secondary bridge.
+            auto address = reinterpret_cast<std::int64_t>(origin_entrance);
+            auto veneer = reinterpret_cast<std::int64_t>(origin_bridge) + kOriginBridgeVeneerOffset;
+#if defined(__aarch64__)
+            // b veneer
+            std::uint32_t branch = 0x14000000 | ((veneer - address) >> 2 & 0x3ffffff);
+#else
+            // jmp veneer
+            std::uint8_t branch[kBranchSize] = {0xe9};
+            auto displacement = static_cast<std::int32_t>(veneer - (address + kBranchSize));
+            memcpy(branch + 1, &displacement, sizeof(displacement));
+#endif
+            StoreAtomically(origin_entrance, &branch, kBranchSize);
+        } else {
+            internal::Memory::Copy(origin_entrance, reinterpret_cast<void *>(MainBridge),
+                                   kMainBridgeSize);
 
+            // Set parameter - target.
+            *reinterpret_cast<void **>(
+                    reinterpret_cast<std::size_t>(origin_entrance) + kMainBridgeTargetOffset
+            ) = secondary_bridge;
+        }
+
+        auto *start = static_cast<char *>(origin_entrance);
+        __builtin___clear_cache(start, start + patch_size);
         return true;
     }
 
     void Bridge::RecoverMain(void *entrance, void *origin_bridge) {
-        internal::Memory::Copy(entrance, origin_bridge, kMainBridgeSize);
+        void *backup = reinterpret_cast<void *>(
+                reinterpret_cast<std::size_t>(origin_bridge) + kOriginBridgeBackupOffset);
+        if (IsAtomicMain(origin_bridge)) {
+            StoreAtomically(entrance, backup, kBranchSize);
+        } else {
+            internal::Memory::Copy(entrance, backup, kMainBridgeSize);
+        }
+        auto *start = static_cast<char *>(entrance);
+        __builtin___clear_cache(start, start + kMainBridgeSize);
+    }
+
+    bool Bridge::IsAtomicMain(void *origin_bridge) {
+        return *reinterpret_cast<std::size_t *>(
+                reinterpret_cast<std::size_t>(origin_bridge) + kOriginBridgePatchSizeOffset
+        ) == kBranchSize;
+    }
+
+    bool Bridge::CanBranch(void *entrance, void *target) {
+        auto address = reinterpret_cast<std::int64_t>(entrance);
+        if (address % 8 + kBranchSize > 8) return false;
+#if defined(__aarch64__)
+        std::int64_t displacement = reinterpret_cast<std::int64_t>(target) - address;
+        return displacement >= -static_cast<std::int64_t>(kBranchRange) &&
+               displacement < static_cast<std::int64_t>(kBranchRange);
+#else
+        std::int64_t displacement =
+                reinterpret_cast<std::int64_t>(target) - (address + kBranchSize);
+        return displacement >= INT32_MIN && displacement <= INT32_MAX;
+#endif
+    }
+
+    void Bridge::StoreAtomically(void *code, const void *bytes, std::size_t size) {
+        auto address = reinterpret_cast<std::size_t>(code);
+        auto *word = reinterpret_cast<std::uint64_t *>(address / 8 * 8);
+        std::uint64_t value = __atomic_load_n(word, __ATOMIC_RELAXED);
+        memcpy(reinterpret_cast<std::uint8_t *>(&value) + address % 8, bytes, size);
+#if defined(__aarch64__)
+        // Complete cache maintenance of the branch target before the branch can be fetched.
+        __asm__ volatile("dsb ish\n\tisb" : : : "memory");
+#endif
+        __atomic_store_n(word, value, __ATOMIC_RELEASE);
+    }
+
+    internal::CodeArena *Bridge::GetArena() {
+        static internal::CodeArena arena(kSecondaryBridgeSize);
+        return &arena;
     }
 
-    void *Bridge::CreateSecondary(mirror::Method *source_method, mirror::Method *bridge_method,
-                                  void *bridge_entrance, runtime::Box *box,
+    void *Bridge::CreateSecondary(DispatchTable *dispatch_table, runtime::Box *box_table,
                                   void *origin_bridge) {
-        void *result = malloc(kSecondaryBridgeSize);
+        void *result = GetArena()->AllocateSlot();
+        if (result == nullptr) {
+            errorLog("Unable to allocate memory for secondary bridge.")
+            return nullptr;
+        }
         debugLog("Create secondary bridge pointer : " __log_memory_specifier__ ".",
                  reinterpret_cast<std::size_t>(result))
         internal::Memory::Copy(result, reinterpret_cast<void *>(SecondaryBridge),
                                kSecondaryBridgeSize);
 
-        // Set parameter - source method.
-        *reinterpret_cast<mirror::Method **>(
-                reinterpret_cast<std::size_t>(result) + kSecondaryBridgeSourceMethodOffset
-        ) = source_method;
-        // Set parameter - bridge method.
-        *reinterpret_cast<mirror::Method **>(
-                reinterpret_cast<std::size_t>(result) + kSecondaryBridgeBridgeMethodOffset
-        ) = bridge_method;
-        // Set parameter - bridge entrance.
-        *reinterpret_cast<void **>(
-                reinterpret_cast<std::size_t>(result) + kSecondaryBridgeBridgeEntranceOffset
-        ) = bridge_entrance;
-        // Set parameter - bridge box.
+#if defined(__x86_64__)
+        // Set parameter - thread self offset.
+        *reinterpret_cast<std::size_t *>(
+                reinterpret_cast<std::size_t>(result) + kSecondaryBridgeThreadSelfOffsetOffset
+        ) = thread_self_offset_;
+#endif
+        // Set parameter - dispatch table.
+        *reinterpret_cast<DispatchTable **>(
+                reinterpret_cast<std::size_t>(result) + kSecondaryBridgeDispatchTableOffset
+        ) = dispatch_table;
+        // Set parameter - bridge box table.
         *reinterpret_cast<runtime::Box **>(
                 reinterpret_cast<std::size_t>(result) + kSecondaryBridgeBoxPointerOffset
-        ) = box;
+        ) = box_table;
         // Set parameter - origin bridge.
         *reinterpret_cast<void **>(
                 reinterpret_cast<std::size_t>(result) + kSecondaryBridgeOriginBridgeOffset
         ) = origin_bridge;
 
-        // Unprotect memory.
-        if (!internal::Memory::Unprotect(result, kSecondaryBridgeSize)) {
-            errorLog(
-                    "Unable to disable memory protection on secondary bridge " __log_memory_specifier__ ".",
-                    reinterpret_cast<std::size_t>(result))
-            free(result);
-            return nullptr;
-        }
+        // Set veneer of origin bridge - target.
+        *reinterpret_cast<void **>(
+                reinterpret_cast<std::size_t>(origin_bridge) + kOriginBridgeVeneerTargetOffset
+        ) = result;
+
         return result;
     }
 
     void *Bridge::CreateOrigin(void *origin_entrance) {
+        // Allocate near the entrance for a branch-sized main bridge, or anywhere otherwise.
+        std::size_t patch_size = kMainBridgeSize;
+        void *result = GetArena()->AllocateNear(kOriginBridgeSize, origin_entrance, kBranchRange);
+        if (result != nullptr && CanBranch(
+                origin_entrance,
+                reinterpret_cast<void *>(
+                        reinterpret_cast<std::size_t>(result) + kOriginBridgeVeneerOffset))) {
+            patch_size = kBranchSize;
+#if defined(__x86_64__)
+            if (X86_64Relocator::GetInstructionLength(
+                    static_cast<std::uint8_t *>(origin_entrance)) < kBranchSize) {
+                patch_size = kMainBridgeSize;
+            }
+#endif
+        }
+        if (result == nullptr) result = GetArena()->Allocate(kOriginBridgeSize);
+        if (result == nullptr) {
+            errorLog("Unable to allocate memory for origin bridge.")
+            return nullptr;
+        }
+        debugLog("Create origin bridge pointer : " __log_memory_specifier__ ", main bridge size : %zu.",
+                 reinterpret_cast<std::size_t>(result), patch_size)
 
-        std::int32_t code_size = *reinterpret_cast<std::int32_t *>(
-                reinterpret_cast<std::size_t>(origin_entrance) - sizeof(std::int32_t));
-
-        debugLog("Get origin code size %d", code_size)
-
-        void *result = malloc(code_size);
-        debugLog("Create origin bridge pointer : " __log_memory_specifier__ ".",
-                 reinterpret_cast<std::size_t>(result))
-
-        // Unprotect memory.
-        if (!internal::Memory::Unprotect(result, code_size)) {
-            errorLog(
-                    "Unable to disable memory protection on origin bridge " __log_memory_specifier__ ".",
-                    reinterpret_cast<std::size_t>(result))
-            free(result);
+        auto address = reinterpret_cast<std::uint64_t>(origin_entrance);
+#if defined(__aarch64__)
+        std::size_t relocated_size = patch_size;
+        std::size_t size = Arm64Relocator::Relocate(
+                static_cast<std::uint32_t *>(origin_entrance),
+                patch_size / sizeof(std::uint32_t), address,
+                static_cast<std::uint32_t *>(result));
+#else
+        std::size_t relocated_size;
+        std::size_t size = X86_64Relocator::Relocate(
+                static_cast<std::uint8_t *>(origin_entrance), patch_size, address,
+                static_cast<std::uint8_t *>(result), &relocated_size);
+#endif
+        if (size == 0) {
+            errorLog("Unable to relocate code of runtime method entry point " __log_memory_specifier__ ".",
+                     reinterpret_cast<std::size_t>(origin_entrance))
+            GetArena()->Free(result);
             return nullptr;
         }
 
-        internal::Memory::Copy(result, origin_entrance, code_size);
+        // Jump back to the rest of origin code.
+        auto *jump = static_cast<std::uint8_t *>(result) + size;
+#if defined(__aarch64__)
+        Arm64Relocator::WriteJump(reinterpret_cast<std::uint32_t *>(jump),
+                                  address + relocated_size);
+#else
+        X86_64Relocator::WriteJump(jump, address + relocated_size);
+#endif
+
+        // Save origin code overwritten by main bridge.
+        internal::Memory::Copy(
+                reinterpret_cast<void *>(
+                        reinterpret_cast<std::size_t>(result) + kOriginBridgeBackupOffset),
+                origin_entrance, kMainBridgeSize);
+
+        // Create veneer, whose target is set by CreateSecondary().
+        internal::Memory::Copy(
+                reinterpret_cast<void *>(
+                        reinterpret_cast<std::size_t>(result) + kOriginBridgeVeneerOffset),
+                reinterpret_cast<void *>(MainBridge), kMainBridgeSize);
+        *reinterpret_cast<std::size_t *>(
+                reinterpret_cast<std::size_t>(result) + kOriginBridgePatchSizeOffset
+        ) = patch_size;
 
         return result;
     }
+
+    void Bridge::FreeSecondary(void *secondary_bridge) {
+        GetArena()->FreeSlot(secondary_bridge);
+    }
+
+    void Bridge::FreeOrigin(void *origin_bridge) {
+        GetArena()->Free(origin_bridge);
+    }
 }
\ No newline at end of file
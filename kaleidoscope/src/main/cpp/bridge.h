@@ -28,11 +28,21 @@
 #include <cstddef>
 
 #include "declare.h"
+#include "dispatch.h"
+#include "relocator.h"
 
 extern "C" void MainBridge();
 
 extern "C" void SecondaryBridge();
 
+/**
+ * Bridge method entrance of native listeners, which secondary bridge jumps to with the native
+ * listener as the bridge method, see bridge::NativeListener. It calls the listener with data
+ * of the box, releases the box and jumps to origin bridge with registers recovered, so that
+ * managed code is never entered.
+ */
+extern "C" void NativeBridge();
+
 namespace moe::aoramd::kaleidoscope::bridge {
 
     /**
@@ -41,20 +51,35 @@ namespace moe::aoramd::kaleidoscope::bridge {
     class Bridge {
     public:
 
+        /**
+         * Initialize bridge related configurations.
+         *
+         * In x86_64, Android Runtime keeps current thread in gs segment instead of a register,
+         * so the offset of thread native peer in the segment is searched for secondary bridge.
+         *
+         * @param current_thread current thread native peer.
+         * @return true if initialize successfully.
+         */
+        static bool Initialize(mirror::Thread *current_thread);
+
         /**
          * Insert main bridge code into runtime method entrance.
          *
          * The main bridge is used to jump to the entrance of secondary bridge, and its code length
-         * must be as short as possible.
+         * must be as short as possible. If origin bridge is near the entrance, the main bridge is
+         * a single branch to the veneer in origin bridge and it is written by an atomic store,
+         * see IsAtomicMain(). Otherwise threads must be suspended.
          *
          * @param origin_entrance runtime method entrance.
          * @param secondary_bridge secondary bridge code pointer of runtime method.
+         * @param origin_bridge origin bridge code pointer of runtime method.
          * @return true if insert successfully.
          */
-        static bool SetMain(void *origin_entrance, void *secondary_bridge);
+        static bool SetMain(void *origin_entrance, void *secondary_bridge, void *origin_bridge);
 
         /**
-         * Recover runtime method entrance with origin bridge code.
+         * Recover runtime method entrance with the origin code saved in origin bridge.
+         * Threads must be suspended unless main bridge is atomic, see IsAtomicMain().
          *
          * @param entrance runtime method entrance.
          * @param origin_bridge origin bridge code pointer of runtime method.
@@ -62,22 +87,41 @@ namespace moe::aoramd::kaleidoscope::bridge {
         static void RecoverMain(void *entrance, void *origin_bridge);
 
         /**
-         * Create secondary bridge code for runtime method.
-         *
-         * The secondary bridge is used to check whether runtime method matches and
-         * capture registers and stack data.
+         * Check whether main bridge is inserted and recovered by a single atomic store, so that
+         * other threads execute either the origin code or the main bridge, and they need not
+         * be suspended.
          *
-         * @param source_method runtime method will be inserted into bridge code.
-         * @param bridge_method runtime method of bridge method.
-         * @param bridge_entrance entrance of runtime method of bridge method.
-         * @param box box for saving data.
          * @param origin_bridge origin bridge code pointer of runtime method.
+         * @return true if main bridge is atomic.
+         */
+        static bool IsAtomicMain(void *origin_bridge);
+
+        /**
+         * Get code arena for allocating memory of bridge code.
+         *
+         * Secondary bridge and origin bridge can only be created in write scope of the arena,
+         * see internal::CodeArena::ScopedWrite.
+         *
+         * @return code arena of bridge code.
+         */
+        static internal::CodeArena *GetArena();
+
+        /**
+         * Create secondary bridge code for runtime method entrance.
+         *
+         * The secondary bridge is used to find the invoked runtime method in dispatch table and
+         * capture registers and stack data. Runtime methods sharing the entrance share the
+         * secondary bridge, and methods not found in dispatch table jump to origin bridge.
+         *
+         * @param dispatch_table dispatch table of runtime methods sharing the entrance, it must
+         *        not be empty when secondary bridge is running.
+         * @param box_table table of boxes for saving data.
+         * @param origin_bridge origin bridge code pointer of runtime method entrance, whose veneer
+         *        is set to jump to the secondary bridge.
          * @return created secondary bridge code pointer.
          */
-        static void *CreateSecondary(mirror::Method *source_method,
-                                     mirror::Method *bridge_method,
-                                     void *bridge_entrance,
-                                     runtime::Box *box,
+        static void *CreateSecondary(DispatchTable *dispatch_table,
+                                     runtime::Box *box_table,
                                      void *origin_bridge);
 
         /**
@@ -86,48 +130,118 @@ namespace moe::aoramd::kaleidoscope::bridge {
          * The origin bridge is for invoking origin code if runtime method is not match and
          * recover runtime method entrance.
          *
+         * Only the instructions overwritten by main bridge are relocated into origin bridge,
+         * followed by a jump back to the rest of origin code. A copy of the overwritten code is
+         * saved behind them for RecoverMain(), and a veneer for jumping to secondary bridge
+         * follows it.
+         *
+         * Origin bridge is allocated near the entrance if possible, so that main bridge can be
+         * a single branch to the veneer, which is the only instruction overwritten. On x86_64
+         * the first instruction must also be long enough to hold the branch, because threads
+         * may be running the instructions behind it.
+         *
          * @param origin_entrance entrance of runtime method will be inserted into bridge code.
          * @return created origin bridge code pointer.
          */
         static void *CreateOrigin(void *origin_entrance);
 
+        /**
+         * Free secondary bridge code created by CreateSecondary().
+         *
+         * @param secondary_bridge secondary bridge code pointer.
+         */
+        static void FreeSecondary(void *secondary_bridge);
+
+        /**
+         * Free origin bridge code created by CreateOrigin().
+         *
+         * @param origin_bridge origin bridge code pointer.
+         */
+        static void FreeOrigin(void *origin_bridge);
+
     private:
 #if defined(__aarch64__)
 
         static const int kMainBridgeSize = 16;
         static const int kMainBridgeTargetOffset = kMainBridgeSize - sizeof(std::size_t);
 
-        static const int kSecondaryBridgeSize = 156;
-        static const int kSecondaryBridgeSourceMethodOffset =
-                kSecondaryBridgeSize - sizeof(std::size_t) * 5;
-        static const int kSecondaryBridgeBridgeMethodOffset =
-                kSecondaryBridgeSize - sizeof(std::size_t) * 4;
-        static const int kSecondaryBridgeBridgeEntranceOffset =
+        static const int kSecondaryBridgeSize = 288;
+        static const int kSecondaryBridgeDispatchTableOffset =
                 kSecondaryBridgeSize - sizeof(std::size_t) * 3;
         static const int kSecondaryBridgeBoxPointerOffset =
                 kSecondaryBridgeSize - sizeof(std::size_t) * 2;
         static const int kSecondaryBridgeOriginBridgeOffset =
                 kSecondaryBridgeSize - sizeof(std::size_t) * 1;
 
-// TODO: Replace to correct value.
-#else
+        /**
+         * Size and reach of branch instruction B.
+         */
+        static const int kBranchSize = 4;
+        static const std::size_t kBranchRange = 128 * 1024 * 1024;
 
-        static const int kMainBridgeSize = 16;
+        static const int kOriginBridgeCodeSize =
+                kMainBridgeSize / 4 * Arm64Relocator::kMaxRelocatedInstructionSize +
+                Arm64Relocator::kJumpSize;
+
+#elif defined(__x86_64__)
+
+        static const int kMainBridgeSize = 14;
         static const int kMainBridgeTargetOffset = kMainBridgeSize - sizeof(std::size_t);
 
-        static const int kSecondaryBridgeSize = 156;
-        static const int kSecondaryBridgeSourceMethodOffset =
-                kSecondaryBridgeSize - sizeof(std::size_t) * 5;
-        static const int kSecondaryBridgeBridgeMethodOffset =
+        static const int kSecondaryBridgeSize = 320;
+        static const int kSecondaryBridgeThreadSelfOffsetOffset =
                 kSecondaryBridgeSize - sizeof(std::size_t) * 4;
-        static const int kSecondaryBridgeBridgeEntranceOffset =
+        static const int kSecondaryBridgeDispatchTableOffset =
                 kSecondaryBridgeSize - sizeof(std::size_t) * 3;
         static const int kSecondaryBridgeBoxPointerOffset =
                 kSecondaryBridgeSize - sizeof(std::size_t) * 2;
         static const int kSecondaryBridgeOriginBridgeOffset =
                 kSecondaryBridgeSize - sizeof(std::size_t) * 1;
 
+        /**
+         * Size and reach of branch instruction jmp rel32.
+         */
+        static const int kBranchSize = 5;
+        static const std::size_t kBranchRange = 0x7fffffff;
+
+        static const int kOriginBridgeCodeSize =
+                X86_64Relocator::GetMaxRelocatedSize(kMainBridgeSize) + X86_64Relocator::kJumpSize;
+
+        /**
+         * Offset of thread native peer in gs segment, see Initialize().
+         */
+        static std::size_t thread_self_offset_;
+
+        /**
+         * Max offset searched for thread native peer in gs segment.
+         */
+        static const std::size_t kThreadSelfOffsetLimit = 0x1000;
+
+#else
+#error "Bridge code is not implemented on current architecture."
 #endif
+
+        // Veneer is aligned as code, and patch size is aligned as data.
+        static const int kOriginBridgeBackupOffset = kOriginBridgeCodeSize;
+        static const int kOriginBridgeVeneerOffset =
+                (kOriginBridgeBackupOffset + kMainBridgeSize + 15) / 16 * 16;
+        static const int kOriginBridgeVeneerTargetOffset =
+                kOriginBridgeVeneerOffset + kMainBridgeTargetOffset;
+        static const int kOriginBridgePatchSizeOffset =
+                (kOriginBridgeVeneerOffset + kMainBridgeSize + 7) / 8 * 8;
+        static const int kOriginBridgeSize = kOriginBridgePatchSizeOffset + sizeof(std::size_t);
+
+        /**
+         * Check whether a branch at the entrance can reach the target and be written by an
+         * atomic store of an aligned 8 bytes word.
+         */
+        static bool CanBranch(void *entrance, void *target);
+
+        /**
+         * Write the first bytes of code by an atomic store of the aligned 8 bytes word
+         * containing them.
+         */
+        static void StoreAtomically(void *code, const void *bytes, std::size_t size);
     };
 }
 
@@ -32,6 +32,8 @@ namespace moe::aoramd::kaleidoscope {
 
         class Memory;
 
+        class CodeArena;
+
         class Jni;
     }
 
@@ -50,6 +52,8 @@ namespace moe::aoramd::kaleidoscope {
 
         class Box;
 
+        class InsertBridgeResult;
+
         enum AndroidVersion {
             kLollipop = 21,
             kLollipopPlus = 22,
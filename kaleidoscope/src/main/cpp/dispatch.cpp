@@ -0,0 +1,138 @@
+/*
+ * MIT License
+ *
+ * Copyright (C) 2021 M.D.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <cstdlib>
+
+#include "dispatch.h"
+
+namespace moe::aoramd::kaleidoscope::bridge {
+
+    // Secondary bridge locates entries and records by offsets, see bridge/arm64.S.
+    static_assert(sizeof(DispatchTable::Entry) == 16, "Size of entry must be matched with bridge code.");
+    static_assert(offsetof(HookRecord, bridge_method_) == 0 &&
+                  offsetof(HookRecord, bridge_entrance_) == sizeof(void *),
+                  "Layout of hook record must be matched with bridge code.");
+    static_assert((DispatchTable::kInitialCapacity & (DispatchTable::kInitialCapacity - 1)) == 0,
+                  "Capacity of dispatch table must be a power of 2.");
+
+    DispatchTable::DispatchTable() : slots_(nullptr) {
+        static_assert(offsetof(DispatchTable, slots_) == 0 && sizeof(Slots) == 16,
+                      "Layout of dispatch table must be matched with bridge code.");
+    }
+
+    DispatchTable::~DispatchTable() {
+        Reclaim();
+        free(slots_.load(std::memory_order_relaxed));
+    }
+
+    HookRecord *DispatchTable::Find(mirror::Method *method) const {
+        Slots *slots = slots_.load(std::memory_order_acquire);
+        if (slots == nullptr || method == nullptr) return nullptr;
+        Entry *entries = slots->Entries();
+        for (std::size_t index = Hash(method);; index++) {
+            Entry &entry = entries[index & slots->mask_];
+            mirror::Method *current = entry.method_.load(std::memory_order_acquire);
+            if (current == method) return entry.record_;
+            if (current == nullptr) return nullptr;
+        }
+    }
+
+    bool DispatchTable::Insert(mirror::Method *method, HookRecord *record) {
+        if (method == nullptr || method == RemovedMethod() || Find(method) != nullptr) return false;
+
+        Slots *slots = slots_.load(std::memory_order_relaxed);
+        std::size_t capacity = slots == nullptr ? 0 : slots->mask_ + 1;
+        if ((used_ + 1) * 2 > capacity) {
+            // Removed entries are dropped by rebuilding, so grow only if live entries need.
+            std::size_t new_capacity = kInitialCapacity;
+            while ((size_ + 1) * 2 > new_capacity) new_capacity *= 2;
+            if (!Rebuild(new_capacity)) return false;
+            slots = slots_.load(std::memory_order_relaxed);
+        }
+
+        Entry *entries = slots->Entries();
+        for (std::size_t index = Hash(method);; index++) {
+            Entry &entry = entries[index & slots->mask_];
+            if (entry.method_.load(std::memory_order_relaxed) != nullptr) continue;
+            entry.record_ = record;
+            entry.method_.store(method, std::memory_order_release);
+            break;
+        }
+        size_++;
+        used_++;
+        return true;
+    }
+
+    bool DispatchTable::Remove(mirror::Method *method) {
+        Slots *slots = slots_.load(std::memory_order_relaxed);
+        if (slots == nullptr || method == nullptr) return false;
+        Entry *entries = slots->Entries();
+        for (std::size_t index = Hash(method);; index++) {
+            Entry &entry = entries[index & slots->mask_];
+            mirror::Method *current = entry.method_.load(std::memory_order_relaxed);
+            if (current == nullptr) return false;
+            if (current != method) continue;
+            entry.method_.store(RemovedMethod(), std::memory_order_release);
+            size_--;
+            return true;
+        }
+    }
+
+    void DispatchTable::Reclaim() {
+        for (Slots *slots : retired_) free(slots);
+        retired_.clear();
+    }
+
+    DispatchTable::Slots *DispatchTable::AllocateSlots(std::size_t capacity) {
+        auto *slots = static_cast<Slots *>(calloc(1, sizeof(Slots) + sizeof(Entry) * capacity));
+        if (slots != nullptr) slots->mask_ = capacity - 1;
+        return slots;
+    }
+
+    bool DispatchTable::Rebuild(std::size_t capacity) {
+        Slots *slots = AllocateSlots(capacity);
+        if (slots == nullptr) return false;
+
+        Slots *old_slots = slots_.load(std::memory_order_relaxed);
+        if (old_slots != nullptr) {
+            Entry *old_entries = old_slots->Entries();
+            for (std::size_t i = 0; i <= old_slots->mask_; i++) {
+                mirror::Method *method = old_entries[i].method_.load(std::memory_order_relaxed);
+                if (method == nullptr || method == RemovedMethod()) continue;
+                for (std::size_t index = Hash(method);; index++) {
+                    Entry &entry = slots->Entries()[index & slots->mask_];
+                    if (entry.method_.load(std::memory_order_relaxed) != nullptr) continue;
+                    entry.method_.store(method, std::memory_order_relaxed);
+                    entry.record_ = old_entries[i].record_;
+                    break;
+                }
+            }
+            retired_.push_back(old_slots);
+        }
+
+        slots_.store(slots, std::memory_order_release);
+        used_ = size_;
+        return true;
+    }
+}
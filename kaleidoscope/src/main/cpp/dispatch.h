@@ -0,0 +1,257 @@
+/*
+ * MIT License
+ *
+ * Copyright (C) 2021 M.D.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef KALEIDOSCOPE_DISPATCH_H
+#define KALEIDOSCOPE_DISPATCH_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "declare.h"
+#include "kaleidoscope/hook.h"
+
+namespace moe::aoramd::kaleidoscope::bridge {
+
+    /**
+     * A class for describing where secondary bridge jumps to for a hooked runtime method.
+     *
+     * The layout of the class is used by the bridge code directly, so it must be kept in sync
+     * with it.
+     */
+    class HookRecord final {
+    public:
+
+        /**
+         * Runtime method of bridge method.
+         */
+        mirror::Method *bridge_method_ = nullptr;
+
+        /**
+         * Entrance of runtime method of bridge method.
+         */
+        void *bridge_entrance_ = nullptr;
+
+        /**
+         * Secondary bridge jumps to bridge method for one in every sample_interval_ invocations,
+         * and jumps to origin bridge for others without claiming a box. Every invocation is
+         * sampled if it is 0 or 1.
+         */
+        std::uint64_t sample_interval_ = 0;
+
+        /**
+         * Invocations left before the next sampled one. It is updated by secondary bridge
+         * without atomic operations, so concurrent invocations may skew the sampling slightly.
+         */
+        std::uint64_t sample_countdown_ = 0;
+
+        /**
+         * Handle of the scope of hooked runtime method registered at the Java level, or -1 if
+         * it is not registered. It is not read by bridge code.
+         */
+        std::atomic<std::int32_t> scope_handle_ = -1;
+
+        /**
+         * Secondary bridge jumps to origin bridge directly if it is not 0, so that a paused
+         * hook costs a single load and branch, and it is toggled by a single store without
+         * patching code.
+         */
+        std::atomic<std::uint32_t> paused_ = 0;
+
+        /**
+         * Insert bridge code result owning the record, which is read by bridge method for
+         * capturing parameters by its layout. It is not read by bridge code.
+         */
+        runtime::InsertBridgeResult *result_ = nullptr;
+    };
+
+    /**
+     * A native listener of hooked runtime method, see NativeBridge().
+     *
+     * Its pointer is used as the bridge method in hook record, and its layout is used by the
+     * bridge code directly, so it must be kept in sync with it.
+     */
+    class NativeListener final {
+    public:
+
+        /**
+         * Listener called before origin code.
+         */
+        kaleidoscope_callback before_ = nullptr;
+
+        /**
+         * User data passed to the listener.
+         */
+        void *user_ = nullptr;
+
+        /**
+         * Origin bridge code of the hooked runtime method, which native bridge jumps to after
+         * calling the listener.
+         */
+        void *origin_bridge_ = nullptr;
+    };
+
+    /**
+     * An open-addressed hash table from runtime method to hook record, probed by secondary
+     * bridge for dispatching the runtime methods sharing one entrance.
+     *
+     * Entries are probed linearly from the hash of runtime method until the method or an empty
+     * entry is found, and the load factor including removed entries is kept at most 1/2, so a
+     * probe is short whether the method is hooked or not.
+     *
+     * Lookups never lock and can run concurrently with one writer. An entry is published by
+     * storing its method after its record, and a removed entry is only marked and never reused,
+     * so a lookup never sees a record of another method. When the table is full, entries are
+     * copied into new slots which are published at once, and the old slots are retired until
+     * Reclaim() is invoked.
+     *
+     * The layout of the class is used by the bridge code directly, so it must be kept in sync
+     * with it.
+     */
+    class DispatchTable final {
+    public:
+        class Entry final {
+        public:
+
+            /**
+             * Runtime method of entry, or null if the entry is empty, or kRemovedMethod if the
+             * entry is removed.
+             */
+            std::atomic<mirror::Method *> method_;
+
+            /**
+             * Hook record of runtime method.
+             */
+            HookRecord *record_;
+        };
+
+        DispatchTable();
+
+        ~DispatchTable();
+
+        DispatchTable(const DispatchTable &) = delete;
+
+        DispatchTable &operator=(const DispatchTable &) = delete;
+
+        /**
+         * Find hook record of runtime method in the same way as secondary bridge.
+         *
+         * @param method runtime method.
+         * @return hook record or null if the method is not found.
+         */
+        HookRecord *Find(mirror::Method *method) const;
+
+        /**
+         * Insert hook record of runtime method.
+         *
+         * @param method runtime method.
+         * @param record hook record, it must be alive until the method is removed and retired
+         *        slots are reclaimed.
+         * @return false if the method exists or slots are unable to be allocated.
+         */
+        bool Insert(mirror::Method *method, HookRecord *record);
+
+        /**
+         * Remove runtime method.
+         *
+         * @param method runtime method.
+         * @return false if the method is not found.
+         */
+        bool Remove(mirror::Method *method);
+
+        /**
+         * Free slots retired by Insert(). It must be invoked when no lookup is running, such as
+         * when all threads are suspended.
+         */
+        void Reclaim();
+
+        /**
+         * @return count of runtime methods in the table.
+         */
+        std::size_t Size() const {
+            return size_;
+        }
+
+        /**
+         * Capacity of slots of a new table. It must be a power of 2.
+         */
+        static constexpr std::size_t kInitialCapacity = 8;
+
+        /**
+         * Hash of runtime method, which must be matched with bridge code.
+         */
+        static std::size_t Hash(mirror::Method *method) {
+            auto value = reinterpret_cast<std::size_t>(method);
+            return (value >> 4) ^ (value >> 12);
+        }
+
+        /**
+         * Value of method of removed entries.
+         */
+        static mirror::Method *RemovedMethod() {
+            return reinterpret_cast<mirror::Method *>(1);
+        }
+
+    private:
+        /**
+         * Header of slots, followed by entries of the count of mask_ + 1.
+         */
+        class Slots final {
+        public:
+            std::size_t mask_;
+            std::size_t reserved_;
+
+            Entry *Entries() {
+                return reinterpret_cast<Entry *>(this + 1);
+            }
+        };
+
+        static Slots *AllocateSlots(std::size_t capacity);
+
+        /**
+         * Copy entries into new slots of the specified capacity and publish them.
+         */
+        bool Rebuild(std::size_t capacity);
+
+        /**
+         * Slots probed by secondary bridge.
+         */
+        std::atomic<Slots *> slots_;
+
+        /**
+         * Count of runtime methods.
+         */
+        std::size_t size_ = 0;
+
+        /**
+         * Count of entries which are not empty, including removed entries.
+         */
+        std::size_t used_ = 0;
+
+        std::vector<Slots *> retired_;
+    };
+}
+
+#endif
@@ -0,0 +1,113 @@
+/*
+ * MIT License
+ *
+ * Copyright (C) 2021 M.D.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "epoch.h"
+
+namespace moe::aoramd::kaleidoscope::runtime {
+
+    /**
+     * Slot of a thread. The epoch is only written by the thread, and 0 means the thread is not
+     * in any invocation.
+     */
+    class Epoch::Slot final {
+    public:
+        std::atomic<std::uint64_t> epoch_{0};
+
+        /**
+         * Depth of nested invocations, which is only accessed by the thread.
+         */
+        std::uint32_t depth_ = 0;
+
+        /**
+         * Set when the thread exits, and the slot is freed by IsQuiescent().
+         */
+        std::atomic<bool> closed_{false};
+    };
+
+    /**
+     * Owner of the slot of a thread, which closes the slot when the thread exits.
+     */
+    class Epoch::SlotOwner final {
+    public:
+        Slot *slot_ = nullptr;
+
+        ~SlotOwner();
+    };
+
+    std::atomic<std::uint64_t> Epoch::epoch_{1};
+
+    std::mutex Epoch::slots_mutex_;
+    std::vector<Epoch::Slot *> Epoch::slots_;
+    thread_local Epoch::SlotOwner Epoch::slot_owner_;
+
+    Epoch::SlotOwner::~SlotOwner() {
+        if (slot_ != nullptr) slot_->closed_.store(true, std::memory_order_release);
+        slot_ = nullptr;
+    }
+
+    Epoch::Slot *Epoch::GetSlot() {
+        Slot *slot = slot_owner_.slot_;
+        if (slot != nullptr) return slot;
+
+        slot = new Slot();
+        std::lock_guard<std::mutex> lock(slots_mutex_);
+        slots_.push_back(slot);
+        slot_owner_.slot_ = slot;
+        return slot;
+    }
+
+    void Epoch::Enter() {
+        Slot *slot = GetSlot();
+        if (slot->depth_++ > 0) return;
+        // Announcing must be visible before data of the hook is read, so it is sequentially
+        // consistent with the scan in IsQuiescent().
+        slot->epoch_.store(epoch_.load(std::memory_order_seq_cst), std::memory_order_seq_cst);
+    }
+
+    void Epoch::Exit() {
+        Slot *slot = slot_owner_.slot_;
+        if (slot == nullptr || slot->depth_ == 0) return;
+        if (--slot->depth_ > 0) return;
+        slot->epoch_.store(0, std::memory_order_release);
+    }
+
+    bool Epoch::IsQuiescent(std::uint64_t epoch) {
+        std::lock_guard<std::mutex> lock(slots_mutex_);
+        bool quiescent = true;
+        for (auto slot = slots_.begin(); slot != slots_.end();) {
+            // A closed thread never enters again, so its slot is freed once it is cleared.
+            bool closed = (*slot)->closed_.load(std::memory_order_acquire);
+            std::uint64_t announced = (*slot)->epoch_.load(std::memory_order_seq_cst);
+            if (announced != 0 && announced <= epoch) quiescent = false;
+
+            if (closed && announced == 0) {
+                delete *slot;
+                slot = slots_.erase(slot);
+            } else {
+                ++slot;
+            }
+        }
+        return quiescent;
+    }
+}
@@ -0,0 +1,98 @@
+/*
+ * MIT License
+ *
+ * Copyright (C) 2021 M.D.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef KALEIDOSCOPE_EPOCH_H
+#define KALEIDOSCOPE_EPOCH_H
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+namespace moe::aoramd::kaleidoscope::runtime {
+
+    /**
+     * A tool class for tracking invocations running in bridge methods, so that native data of
+     * a restored hook is reclaimed only after all invocations which may use it have exited.
+     *
+     * A thread entering an invocation announces the current epoch in its own slot, and clears
+     * it when the outermost invocation exits, so entering and exiting take neither locks nor
+     * allocation after the first invocation of the thread. Data retired at an epoch is safe
+     * to free once the epoch is advanced and no thread announces an epoch not after it.
+     */
+    class Epoch final {
+    public:
+
+        /**
+         * Enter an invocation on current thread. Nested invocations keep the epoch announced
+         * by the outermost one.
+         */
+        static void Enter();
+
+        /**
+         * Exit an invocation entered by Enter() on current thread.
+         */
+        static void Exit();
+
+        /**
+         * @return current epoch, which starts from 1.
+         */
+        static std::uint64_t Current() {
+            return epoch_.load(std::memory_order_seq_cst);
+        }
+
+        /**
+         * Advance current epoch, so that invocations entered later are distinguished from
+         * those entered before.
+         *
+         * @return advanced epoch.
+         */
+        static std::uint64_t Advance() {
+            return epoch_.fetch_add(1, std::memory_order_seq_cst) + 1;
+        }
+
+        /**
+         * Check whether all invocations entered at or before an epoch have exited.
+         *
+         * @param epoch epoch to check.
+         * @return true if no thread is in an invocation entered at or before the epoch.
+         */
+        static bool IsQuiescent(std::uint64_t epoch);
+
+    private:
+        class Slot;
+
+        class SlotOwner;
+
+        static Slot *GetSlot();
+
+        static std::atomic<std::uint64_t> epoch_;
+
+        static std::mutex slots_mutex_;
+        static std::vector<Slot *> slots_;
+        static thread_local SlotOwner slot_owner_;
+    };
+}
+
+#endif
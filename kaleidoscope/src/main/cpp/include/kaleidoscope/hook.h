@@ -0,0 +1,86 @@
+/*
+ * MIT License
+ *
+ * Copyright (C) 2021 M.D.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef KALEIDOSCOPE_HOOK_H
+#define KALEIDOSCOPE_HOOK_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Data of a hooked method invocation captured by bridge code, passed to native listeners.
+ *
+ * Parameters are the same as they are passed by the managed calling convention of Android
+ * Runtime, so integral and reference parameters are in registers first, floating parameters
+ * are in floating registers, and the others are on the stack.
+ */
+typedef struct kaleidoscope_hook_context {
+    /**
+     * Runtime method invoked, which is art::ArtMethod.
+     */
+    void *method;
+
+    /**
+     * Native peer of current thread, which is art::Thread.
+     */
+    void *thread;
+
+    /**
+     * Integral registers following the runtime method: x1 ~ x7 in arm64, or rsi, rdx, rcx,
+     * r8 and r9 in x86_64, where the last two are always 0.
+     */
+    uint64_t registers[7];
+
+    /**
+     * Raw bits of floating registers: d0 ~ d7 in arm64, or xmm0 ~ xmm7 in x86_64.
+     */
+    uint64_t floating_registers[8];
+
+    /**
+     * Stack pointer of caller, which points to the slot of runtime method followed by
+     * parameters passed on the stack.
+     */
+    const void *stack;
+} kaleidoscope_hook_context;
+
+/**
+ * Native listener called before a hooked method is invoked.
+ *
+ * It is called by bridge code of the hooked method, on the thread invoking it and before
+ * origin code runs, so it must be short: it must not call JNI functions, block or use much
+ * stack, because current thread keeps running managed code.
+ *
+ * @param context data of the invocation, which is only valid during the call.
+ * @param user user data passed when the listener is added.
+ */
+typedef void (*kaleidoscope_callback)(const kaleidoscope_hook_context *context, void *user);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,87 @@
+/*
+ * MIT License
+ *
+ * Copyright (C) 2021 M.D.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef KALEIDOSCOPE_KALEIDOSCOPE_H
+#define KALEIDOSCOPE_KALEIDOSCOPE_H
+
+#include <jni.h>
+
+#include "hook.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * A native listener added to a method, see kaleidoscope_listen().
+ */
+typedef struct kaleidoscope_listener kaleidoscope_listener;
+
+/**
+ * Listen invocations of a method with a native listener, which is called by bridge code
+ * directly and never enters managed code.
+ *
+ * Kaleidoscope must be initialized in Java before, and a method can only be listened or
+ * replaced once, no matter in Java or natively.
+ *
+ * @param env JNI environment of current thread.
+ * @param method object of java.lang.reflect.Method.
+ * @param before listener called before the method is invoked.
+ * @param user user data passed to the listener.
+ * @return the added listener, or NULL on failure.
+ */
+kaleidoscope_listener *
+kaleidoscope_listen(JNIEnv *env, jobject method, kaleidoscope_callback before, void *user);
+
+/**
+ * Pause a native listener without restoring the method, so that invocations run origin code
+ * directly in bridge code until it is resumed. Pausing and resuming are single stores and
+ * can be invoked on any thread.
+ *
+ * @param listener listener returned by kaleidoscope_listen().
+ */
+void kaleidoscope_pause(kaleidoscope_listener *listener);
+
+/**
+ * Resume a native listener paused by kaleidoscope_pause().
+ *
+ * @param listener listener returned by kaleidoscope_listen().
+ */
+void kaleidoscope_resume(kaleidoscope_listener *listener);
+
+/**
+ * Remove a native listener and restore the method.
+ *
+ * The listener may be still running on other threads when it returns, so user data should
+ * be kept alive.
+ *
+ * @param listener listener returned by kaleidoscope_listen().
+ */
+void kaleidoscope_restore(kaleidoscope_listener *listener);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -22,9 +22,9 @@
  * SOFTWARE.
  */
 
+#include <climits>
 #include <dlfcn.h>
-#include <unistd.h>
-#include <sys/mman.h>
+#include <vector>
 
 #include "internal.h"
 
@@ -37,17 +37,19 @@
 
 namespace moe::aoramd::kaleidoscope::internal {
 
-    void *Library::art_library_handle_ = nullptr;
-    void *Library::jit_library_handle_ = nullptr;
+    Library::Module Library::art_library_;
+    Library::Module Library::jit_library_;
 
-    bool Library::Initialize() {
-        art_library_handle_ = Open(LIBRARY_ART_NAME);
-        if (art_library_handle_ == nullptr) {
+    std::string Library::cache_directory_;
+    std::mutex Library::mutex_;
+
+    bool Library::Initialize(const char *cache_directory) {
+        cache_directory_ = cache_directory;
+        if (!Open(LIBRARY_ART_NAME, &art_library_)) {
             errorLog("Unable to load dynamic library %s.", LIBRARY_ART_NAME)
             return false;
         }
-        jit_library_handle_ = Open(LIBRARY_JIT_NAME);
-        if (jit_library_handle_ == nullptr) {
+        if (!Open(LIBRARY_JIT_NAME, &jit_library_)) {
             errorLog("Unable to load dynamic library %s.", LIBRARY_JIT_NAME)
             return false;
         }
@@ -55,46 +57,119 @@ namespace moe::aoramd::kaleidoscope::internal {
     }
 
     void *Library::SymbolInArtLibrary(const char *symbol) {
-        return Symbol(art_library_handle_, symbol);
+        return Symbol(&art_library_, symbol);
     }
 
     void *Library::SymbolInJitLibrary(const char *symbol) {
-        return Symbol(jit_library_handle_, symbol);
+        return Symbol(&jit_library_, symbol);
     }
 
-    void *Library::Open(const char *filename) {
-        void *library;
-        if (LIKELY(runtime::Runtime::AndroidVersionAtLeast(runtime::AndroidVersion::kNougat))) {
-            library = fake_dlopen(filename, RTLD_NOW);
-        } else {
-            library = dlopen(filename, RTLD_NOW);
+    bool Library::SymbolsInArtLibrary(const char *const *symbols, void **results, int count) {
+        return Symbols(&art_library_, symbols, results, count);
+    }
+
+    void Library::SaveCache() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (art_library_.cache_ != nullptr) art_library_.cache_->Save();
+        if (jit_library_.cache_ != nullptr) jit_library_.cache_->Save();
+    }
+
+    bool Library::Open(const char *filename, Module *module) {
+        if (UNLIKELY(!runtime::Runtime::AndroidVersionAtLeast(runtime::AndroidVersion::kNougat))) {
+            module->handle_ = dlopen(filename, RTLD_NOW);
+            return module->handle_ != nullptr;
         }
-        return library;
+
+        // Library file is parsed lazily, see OpenHandle().
+        char path[PATH_MAX];
+        if (!fake_dlmodule(filename, path, sizeof(path), &module->base_)) return false;
+        module->path_ = path;
+
+        SymbolCache::Key key;
+        if (cache_directory_.empty() || !SymbolCache::ReadKey(path, &key))
+            return OpenHandle(module);
+        module->cache_ = std::make_unique<SymbolCache>(
+                cache_directory_ + "/" + filename + kCacheFileSuffix, std::move(key));
+        module->cache_->Load();
+        return true;
     }
 
-    void *Library::Symbol(void *handle, const char *symbol) {
-        if (LIKELY(runtime::Runtime::AndroidVersionAtLeast(runtime::AndroidVersion::kNougat)))
-            return fake_dlsym(handle, symbol);
-        else return dlsym(handle, symbol);
+    bool Library::OpenHandle(Module *module) {
+        if (module->handle_ == nullptr)
+            module->handle_ = fake_dlopen(module->path_.c_str(), RTLD_NOW);
+        return module->handle_ != nullptr;
     }
 
-    bool Memory::Unprotect(void *start, std::size_t size) {
-        std::size_t page_size = sysconf(_SC_PAGESIZE);
-        std::size_t alignment = reinterpret_cast<std::size_t>(start) % page_size;
-        return mprotect(
-                reinterpret_cast<void *>(reinterpret_cast<std::size_t>(start) - alignment),
-                size + alignment, PROT_READ | PROT_WRITE | PROT_EXEC) == 0;
+    void *Library::Symbol(Module *module, const char *symbol) {
+        if (UNLIKELY(!runtime::Runtime::AndroidVersionAtLeast(runtime::AndroidVersion::kNougat)))
+            return dlsym(module->handle_, symbol);
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto base = reinterpret_cast<std::uint64_t>(module->base_);
+        std::uint64_t offset;
+        if (module->cache_ != nullptr && module->cache_->Find(symbol, &offset))
+            return reinterpret_cast<void *>(base + offset);
+
+        if (!OpenHandle(module)) return nullptr;
+        void *result = fake_dlsym(module->handle_, symbol);
+        if (result != nullptr && module->cache_ != nullptr)
+            module->cache_->Put(symbol, reinterpret_cast<std::uint64_t>(result) - base);
+        return result;
     }
 
-    void Memory::Copy(void *destination, void *source, std::size_t size) {
-        memcpy(destination, source, size);
+    bool Library::Symbols(Module *module, const char *const *symbols, void **results, int count) {
+        if (UNLIKELY(!runtime::Runtime::AndroidVersionAtLeast(runtime::AndroidVersion::kNougat))) {
+            bool found = true;
+            for (int i = 0; i < count; i++) {
+                results[i] = dlsym(module->handle_, symbols[i]);
+                if (results[i] == nullptr) found = false;
+            }
+            return found;
+        }
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto base = reinterpret_cast<std::uint64_t>(module->base_);
+        std::vector<const char *> missing_symbols;
+        std::vector<int> missing_indexes;
+        for (int i = 0; i < count; i++) {
+            std::uint64_t offset;
+            if (module->cache_ != nullptr && module->cache_->Find(symbols[i], &offset)) {
+                results[i] = reinterpret_cast<void *>(base + offset);
+            } else {
+                results[i] = nullptr;
+                missing_symbols.push_back(symbols[i]);
+                missing_indexes.push_back(i);
+            }
+        }
+        if (missing_symbols.empty()) return true;
+
+        if (!OpenHandle(module)) return false;
+        auto missing_count = static_cast<int>(missing_symbols.size());
+        std::vector<void *> missing_results(missing_count);
+        int found = fake_dlsym_many(module->handle_, missing_symbols.data(),
+                                    missing_results.data(), missing_count);
+        for (int i = 0; i < missing_count; i++) {
+            results[missing_indexes[i]] = missing_results[i];
+            if (missing_results[i] != nullptr && module->cache_ != nullptr)
+                module->cache_->Put(missing_symbols[i],
+                                    reinterpret_cast<std::uint64_t>(missing_results[i]) - base);
+        }
+        return found == missing_count;
     }
 
     jclass Jni::jvm_executable_class_ = nullptr;
 
+    jclass Jni::jvm_object_class_ = nullptr;
+
     void *Jni::function_add_weak_global_reference_ = nullptr;
 
     bool Jni::Initialize(JNIEnv *env) {
+        jvm_object_class_ = internal::Jni::GetClassGlobalReference(env, kJvmObjectClassName);
+        if (jvm_object_class_ == nullptr) {
+            errorLog("Cannot find class java.lang.Object in runtime.")
+            return false;
+        }
+
         // Initialize Java class references for Android 11.
         if (runtime::Runtime::AndroidVersionAtLeast(runtime::AndroidVersion::kR, true)) {
             jvm_executable_class_ =
@@ -148,6 +223,101 @@ namespace moe::aoramd::kaleidoscope::internal {
                 function_add_weak_global_reference_)(java_vm, thread, object);
     }
 
+    mirror::Thread *Jni::GetThread(JNIEnv *env) {
+        // JNI environment is art::JNIEnvExt, whose first field following JNIEnv is the thread.
+        return *reinterpret_cast<mirror::Thread **>(reinterpret_cast<std::size_t>(env) +
+                                                    sizeof(JNIEnv));
+    }
+
+    /**
+     * Invoke a method by the JNI function of its invoke type and return type.
+     */
+    template<typename T>
+    static T InvokeTyped(JNIEnv *env, jmethodID method, Jni::InvokeType type, jclass clazz,
+                         jobject thiz, const jvalue *arguments,
+                         T (JNIEnv::*call_static)(jclass, jmethodID, const jvalue *),
+                         T (JNIEnv::*call_direct)(jobject, jclass, jmethodID, const jvalue *),
+                         T (JNIEnv::*call_virtual)(jobject, jmethodID, const jvalue *)) {
+        switch (type) {
+            case Jni::kStatic:
+                return (env->*call_static)(clazz, method, arguments);
+            case Jni::kDirect:
+                return (env->*call_direct)(thiz, clazz, method, arguments);
+            case Jni::kVirtual:
+            default:
+                return (env->*call_virtual)(thiz, method, arguments);
+        }
+    }
+
+    jvalue Jni::Invoke(JNIEnv *env, jmethodID method, InvokeType type, jclass clazz,
+                       jobject thiz, const jvalue *arguments, char return_type) {
+        jvalue result;
+        result.j = 0;
+        switch (return_type) {
+            case 'V':
+                InvokeTyped<void>(env, method, type, clazz, thiz, arguments,
+                                  &JNIEnv::CallStaticVoidMethodA,
+                                  &JNIEnv::CallNonvirtualVoidMethodA,
+                                  &JNIEnv::CallVoidMethodA);
+                break;
+            case 'Z':
+                result.z = InvokeTyped(env, method, type, clazz, thiz, arguments,
+                                       &JNIEnv::CallStaticBooleanMethodA,
+                                       &JNIEnv::CallNonvirtualBooleanMethodA,
+                                       &JNIEnv::CallBooleanMethodA);
+                break;
+            case 'B':
+                result.b = InvokeTyped(env, method, type, clazz, thiz, arguments,
+                                       &JNIEnv::CallStaticByteMethodA,
+                                       &JNIEnv::CallNonvirtualByteMethodA,
+                                       &JNIEnv::CallByteMethodA);
+                break;
+            case 'C':
+                result.c = InvokeTyped(env, method, type, clazz, thiz, arguments,
+                                       &JNIEnv::CallStaticCharMethodA,
+                                       &JNIEnv::CallNonvirtualCharMethodA,
+                                       &JNIEnv::CallCharMethodA);
+                break;
+            case 'S':
+                result.s = InvokeTyped(env, method, type, clazz, thiz, arguments,
+                                       &JNIEnv::CallStaticShortMethodA,
+                                       &JNIEnv::CallNonvirtualShortMethodA,
+                                       &JNIEnv::CallShortMethodA);
+                break;
+            case 'I':
+                result.i = InvokeTyped(env, method, type, clazz, thiz, arguments,
+                                       &JNIEnv::CallStaticIntMethodA,
+                                       &JNIEnv::CallNonvirtualIntMethodA,
+                                       &JNIEnv::CallIntMethodA);
+                break;
+            case 'J':
+                result.j = InvokeTyped(env, method, type, clazz, thiz, arguments,
+                                       &JNIEnv::CallStaticLongMethodA,
+                                       &JNIEnv::CallNonvirtualLongMethodA,
+                                       &JNIEnv::CallLongMethodA);
+                break;
+            case 'F':
+                result.f = InvokeTyped(env, method, type, clazz, thiz, arguments,
+                                       &JNIEnv::CallStaticFloatMethodA,
+                                       &JNIEnv::CallNonvirtualFloatMethodA,
+                                       &JNIEnv::CallFloatMethodA);
+                break;
+            case 'D':
+                result.d = InvokeTyped(env, method, type, clazz, thiz, arguments,
+                                       &JNIEnv::CallStaticDoubleMethodA,
+                                       &JNIEnv::CallNonvirtualDoubleMethodA,
+                                       &JNIEnv::CallDoubleMethodA);
+                break;
+            default:
+                result.l = InvokeTyped(env, method, type, clazz, thiz, arguments,
+                                       &JNIEnv::CallStaticObjectMethodA,
+                                       &JNIEnv::CallNonvirtualObjectMethodA,
+                                       &JNIEnv::CallObjectMethodA);
+                break;
+        }
+        return result;
+    }
+
     mirror::Method *Jni::GetRuntimeMethodFromReflectMethodOnR(JNIEnv *env, jobject reflect_method) {
         if (jvm_executable_class_ == nullptr) {
             errorLog("Cannot find class java.lang.reflect.Executable.")
@@ -27,8 +27,12 @@
 
 #include <jni.h>
 #include <map>
+#include <memory>
+#include <mutex>
+#include <string>
 
 #include "declare.h"
+#include "symbol_cache.h"
 
 namespace moe::aoramd::kaleidoscope::internal {
 
@@ -43,9 +47,13 @@ namespace moe::aoramd::kaleidoscope::internal {
         /**
          * Initialize dynamic library related functions.
          *
+         * Since Android 7.0, offsets of found symbols are cached in a file of cache directory for
+         * each library, and the library file is only parsed if a symbol is not in the cache.
+         *
+         * @param cache_directory directory of symbol cache files, or empty for disabling cache.
          * @return true if initialize successfully.
          */
-        static bool Initialize();
+        static bool Initialize(const char *cache_directory);
 
         /**
          * Find function symbol in dynamic library libart.so.
@@ -63,40 +71,52 @@ namespace moe::aoramd::kaleidoscope::internal {
          */
         static void *SymbolInJitLibrary(const char *symbol);
 
+        /**
+         * Find function symbols in dynamic library libart.so in batch.
+         *
+         * @param symbols function symbols.
+         * @param results function pointers, or nullptr for symbols not found.
+         * @param count count of symbols.
+         * @return true if all symbols are found.
+         */
+        static bool SymbolsInArtLibrary(const char *const *symbols, void **results, int count);
+
+        /**
+         * Save symbols found since initialization into symbol cache files.
+         */
+        static void SaveCache();
+
     private:
-        static void *Open(const char *filename);
+        /**
+         * A loaded dynamic library. Since Android 7.0, handle is opened by fake_dlopen() when a
+         * symbol is not found in cache.
+         */
+        class Module final {
+        public:
+            void *handle_ = nullptr;
+            void *base_ = nullptr;
+            std::string path_;
+            std::unique_ptr<SymbolCache> cache_;
+        };
+
+        static bool Open(const char *filename, Module *module);
 
-        static void *Symbol(void *handle, const char *symbol);
+        static bool OpenHandle(Module *module);
 
-        static void *art_library_handle_;
-        static void *jit_library_handle_;
+        static void *Symbol(Module *module, const char *symbol);
+
+        static bool Symbols(Module *module, const char *const *symbols, void **results, int count);
+
+        static Module art_library_;
+        static Module jit_library_;
+
+        static std::string cache_directory_;
+        static std::mutex mutex_;
 
         static constexpr const char *LIBRARY_ART_NAME = "libart.so";
         static constexpr const char *LIBRARY_JIT_NAME = "libart-compiler.so";
-    };
-
-    class Memory final {
-    public:
-        /**
-         * Disable all access restrictions for the specified memory in units of memory pages.
-         *
-         * @param start memory start address. The starting address of affected space may be
-         *        smaller than this due to memory page alignment.
-         * @param size memory size. The size of affected space may be larger than this due to
-         *        memory page alignment.
-         * @return 0 on success or -1 on failure.
-         */
-        static bool Unprotect(void *start, std::size_t size);
 
-        /**
-         * Copies the values of num bytes from the location pointed to by source directly
-         * to the memory block pointed to by destination.
-         *
-         * @param destination pointer to the destination array where the content is to be copied.
-         * @param source pointer to the source of data to be copied.
-         * @param size number of bytes to copy.
-         */
-        static void Copy(void *destination, void *source, std::size_t size);
+        static constexpr const char *kCacheFileSuffix = ".symbols";
     };
 
     class Jni final {
@@ -136,14 +156,61 @@ namespace moe::aoramd::kaleidoscope::internal {
          */
         static jobject GetObject(JNIEnv *env, mirror::Thread *thread, mirror::Object *object);
 
+        /**
+         * Create an array of java.lang.Object.
+         *
+         * @param env JNI environment.
+         * @param length length of array.
+         * @return created array, or null if an exception is thrown.
+         */
+        static jobjectArray NewObjectArray(JNIEnv *env, jsize length) {
+            return env->NewObjectArray(length, jvm_object_class_, nullptr);
+        }
+
+        /**
+         * Get native peer of the thread which JNI environment belongs to.
+         *
+         * @param env JNI environment.
+         * @return thread native peer.
+         */
+        static mirror::Thread *GetThread(JNIEnv *env);
+
+        /**
+         * How a method is invoked by Invoke().
+         */
+        enum InvokeType {
+            kStatic = 0,
+            kDirect = 1,
+            kVirtual = 2
+        };
+
+        /**
+         * Invoke a method by JNI with unboxed arguments, which skips reflection, access checks
+         * and boxing. Exceptions thrown by the method are left pending.
+         *
+         * @param env JNI environment.
+         * @param method JNI method id, or runtime method pointer which is accepted as well.
+         * @param type how the method is invoked, kDirect invokes the method itself and never
+         *        dispatches it, which is required for copies of runtime methods.
+         * @param clazz declaring class of the method.
+         * @param thiz "this" of the invocation, ignored if type is kStatic.
+         * @param arguments arguments of the method.
+         * @param return_type return type of the method in shorty.
+         * @return result of the method.
+         */
+        static jvalue Invoke(JNIEnv *env, jmethodID method, InvokeType type, jclass clazz,
+                             jobject thiz, const jvalue *arguments, char return_type);
+
     private:
         static mirror::Method *GetRuntimeMethodFromReflectMethodOnR(JNIEnv *env, jobject reflect_method);
 
         static jclass jvm_executable_class_;
+        static jclass jvm_object_class_;
 
         static void *function_add_weak_global_reference_;
 
         static constexpr const char *kJvmExecutableClassName = "java/lang/reflect/Executable";
+        static constexpr const char *kJvmObjectClassName = "java/lang/Object";
 
         static constexpr const char *kFunctionAddWeakGlobalReferenceOnL =
                 "_ZN3art9JavaVMExt22AddWeakGlobalReferenceEPNS_6ThreadEPNS_6mirror6ObjectE";
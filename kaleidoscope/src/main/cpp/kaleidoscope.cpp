@@ -22,23 +22,38 @@
  * SOFTWARE.
  */
 
+#include <algorithm>
+#include <atomic>
 #include <jni.h>
+#include <vector>
+
+#include "kaleidoscope/kaleidoscope.h"
 
 #include "log.h"
 #include "internal.h"
 
+#include "bridge.h"
 #include "mirror.h"
 #include "runtime.h"
+#include "trace.h"
 
 using namespace moe::aoramd::kaleidoscope;
 
+/**
+ * Whether Kaleidoscope native runtime is initialized, which is checked by native API.
+ */
+static std::atomic<bool> initialized = false;
+
 extern "C"
 JNIEXPORT jboolean JNICALL
 Java_moe_aoramd_kaleidoscope_internal_RuntimeKt_initializeNativeInternal(JNIEnv *env, jclass,
                                                                          jint log_level,
                                                                          jlong current_thread,
                                                                          jobject standard_method,
-                                                                         jobject relative_method) {
+                                                                         jobject relative_method,
+                                                                         jobject static_method,
+                                                                         jobject native_method,
+                                                                         jstring cache_directory) {
     // Initialize log.
     Log::Initialize(log_level);
 
@@ -49,7 +64,10 @@ Java_moe_aoramd_kaleidoscope_internal_RuntimeKt_initializeNativeInternal(JNIEnv
     }
 
     // Initialize dynamic library related.
-    if (!internal::Library::Initialize()) {
+    const char *cache_directory_chars = env->GetStringUTFChars(cache_directory, nullptr);
+    bool library_initialized = internal::Library::Initialize(cache_directory_chars);
+    env->ReleaseStringUTFChars(cache_directory, cache_directory_chars);
+    if (!library_initialized) {
         errorLog("Initialize dynamic library tool failed.")
         return false;
     }
@@ -66,17 +84,32 @@ Java_moe_aoramd_kaleidoscope_internal_RuntimeKt_initializeNativeInternal(JNIEnv
         return false;
     }
 
+    // Initialize bridge related.
+    if (!bridge::Bridge::Initialize(reinterpret_cast<mirror::Thread *>(current_thread))) {
+        errorLog("Initialize bridge tool failed.")
+        return false;
+    }
+
     // Initialize runtime method related.
     mirror::Method *standard_runtime_method =
             internal::Jni::GetRuntimeMethodFromReflectMethod(env, standard_method);
     mirror::Method *relative_runtime_method =
             internal::Jni::GetRuntimeMethodFromReflectMethod(env, relative_method);
+    mirror::Method *static_runtime_method =
+            internal::Jni::GetRuntimeMethodFromReflectMethod(env, static_method);
+    mirror::Method *native_runtime_method =
+            internal::Jni::GetRuntimeMethodFromReflectMethod(env, native_method);
     if (!mirror::Method::Initialize(env, reinterpret_cast<mirror::Thread *>(current_thread),
-                                    standard_runtime_method, relative_runtime_method)) {
+                                    standard_runtime_method, relative_runtime_method,
+                                    static_runtime_method, native_runtime_method)) {
         errorLog("Initialize runtime method failed.")
         return false;
     }
 
+    // Save symbols found in initialization for next launch.
+    internal::Library::SaveCache();
+
+    initialized = true;
     return true;
 }
 
@@ -96,12 +129,17 @@ JNIEXPORT jlong JNICALL
 Java_moe_aoramd_kaleidoscope_internal_RuntimeKt_listenBridgeNative(JNIEnv *env, jclass,
                                                                    jobject method,
                                                                    jlong current_thread,
-                                                                   jint bridge_type_key) {
+                                                                   jint bridge_type_key,
+                                                                   jstring shorty,
+                                                                   jlong sample_interval) {
     mirror::Method *runtime_method = internal::Jni::GetRuntimeMethodFromReflectMethod(env, method);
+    const char *shorty_chars = env->GetStringUTFChars(shorty, nullptr);
     runtime::ListenResult *result =
             runtime::Runtime::ListenBridge(runtime_method,
                                            reinterpret_cast<mirror::Thread *>(current_thread),
-                                           bridge_type_key);
+                                           bridge_type_key, shorty_chars,
+                                           static_cast<std::uint64_t>(sample_interval));
+    env->ReleaseStringUTFChars(shorty, shorty_chars);
     if (result == nullptr) return 0;
     return reinterpret_cast<jlong>(result);
 }
@@ -111,16 +149,67 @@ JNIEXPORT jlong JNICALL
 Java_moe_aoramd_kaleidoscope_internal_RuntimeKt_replaceBridgeNative(JNIEnv *env, jclass,
                                                                     jobject method,
                                                                     jlong current_thread,
-                                                                    jint bridge_type_key) {
+                                                                    jint bridge_type_key,
+                                                                    jstring shorty) {
     mirror::Method *runtime_method = internal::Jni::GetRuntimeMethodFromReflectMethod(env, method);
+    const char *shorty_chars = env->GetStringUTFChars(shorty, nullptr);
     runtime::ReplaceResult *result =
             runtime::Runtime::ReplaceBridge(runtime_method,
                                             reinterpret_cast<mirror::Thread *>(current_thread),
-                                            bridge_type_key);
+                                            bridge_type_key, shorty_chars);
+    env->ReleaseStringUTFChars(shorty, shorty_chars);
     if (result == nullptr) return 0;
     return reinterpret_cast<jlong>(result);
 }
 
+extern "C"
+JNIEXPORT jlongArray JNICALL
+Java_moe_aoramd_kaleidoscope_internal_RuntimeKt_batchBridgeNative(JNIEnv *env, jclass,
+                                                                  jobjectArray methods,
+                                                                  jbooleanArray replaces,
+                                                                  jintArray bridge_type_keys,
+                                                                  jobjectArray shorties,
+                                                                  jlongArray sample_intervals,
+                                                                  jlong current_thread,
+                                                                  jlongArray timings) {
+    jsize size = env->GetArrayLength(methods);
+    std::vector<jboolean> replace_data(size);
+    std::vector<jint> bridge_type_key_data(size);
+    std::vector<jlong> sample_interval_data(size);
+    env->GetBooleanArrayRegion(replaces, 0, size, replace_data.data());
+    env->GetIntArrayRegion(bridge_type_keys, 0, size, bridge_type_key_data.data());
+    env->GetLongArrayRegion(sample_intervals, 0, size, sample_interval_data.data());
+
+    std::vector<runtime::BatchBridgeItem> items(size);
+    for (jsize i = 0; i < size; i++) {
+        jobject method = env->GetObjectArrayElement(methods, i);
+        items[i].method_ = internal::Jni::GetRuntimeMethodFromReflectMethod(env, method);
+        items[i].replace_ = replace_data[i];
+        items[i].bridge_type_key_ = bridge_type_key_data[i];
+        items[i].sample_interval_ = static_cast<std::uint64_t>(sample_interval_data[i]);
+        env->DeleteLocalRef(method);
+
+        auto shorty = static_cast<jstring>(env->GetObjectArrayElement(shorties, i));
+        const char *shorty_chars = env->GetStringUTFChars(shorty, nullptr);
+        items[i].shorty_ = shorty_chars;
+        env->ReleaseStringUTFChars(shorty, shorty_chars);
+        env->DeleteLocalRef(shorty);
+    }
+
+    jlong timing_data[2];
+    runtime::Runtime::BatchBridge(items, reinterpret_cast<mirror::Thread *>(current_thread),
+                                  &timing_data[0], &timing_data[1]);
+    env->SetLongArrayRegion(timings, 0, 2, timing_data);
+
+    std::vector<jlong> result_data(size);
+    for (jsize i = 0; i < size; i++) {
+        result_data[i] = reinterpret_cast<jlong>(items[i].result_);
+    }
+    jlongArray results = env->NewLongArray(size);
+    env->SetLongArrayRegion(results, 0, size, result_data.data());
+    return results;
+}
+
 extern "C"
 JNIEXPORT void JNICALL
 Java_moe_aoramd_kaleidoscope_internal_RuntimeKt_restoreBridgeNativeInternal(JNIEnv *, jclass,
@@ -130,160 +219,310 @@ Java_moe_aoramd_kaleidoscope_internal_RuntimeKt_restoreBridgeNativeInternal(JNIE
 }
 
 extern "C"
-JNIEXPORT jboolean JNICALL
-Java_moe_aoramd_kaleidoscope_internal_RuntimeKt_convertBoolean(JNIEnv *, jclass, jlong data) {
-    return internal::free_reinterpret_cast<jboolean>(data);
+JNIEXPORT void JNICALL
+Java_moe_aoramd_kaleidoscope_internal_RuntimeKt_exitInvocation(JNIEnv *, jclass,
+                                                               jlong result_pointer,
+                                                               jlong start) {
+    runtime::Runtime::ExitInvocation(
+            reinterpret_cast<runtime::InsertBridgeResult *>(result_pointer),
+            static_cast<std::uint64_t>(start));
+}
+
+/**
+ * Count of values appended to raw data of parameters by enterInternal, which are the scope
+ * handle of the hook and the callee runtime method.
+ */
+static constexpr std::size_t kInvocationTailCount = 2;
+
+extern "C"
+JNIEXPORT jobjectArray JNICALL
+Java_moe_aoramd_kaleidoscope_internal_Box_00024Companion_enterInternal(JNIEnv *env,
+                                                                       jobject,
+                                                                       jlong native_peer,
+                                                                       jlong x3, jlong x4,
+                                                                       jlong x5, jlong x6,
+                                                                       jlong x7,
+                                                                       jlong current_thread) {
+    auto *box = reinterpret_cast<runtime::Box *>(native_peer);
+    runtime::InsertBridgeResult *result = runtime::Runtime::EnterInvocation(box);
+    const runtime::ArgumentLayout &layout = result->layout_;
+    std::int64_t registers[runtime::ArgumentLayout::kExtraRegisterCount] = {x3, x4, x5, x6, x7};
+    std::int64_t slots[runtime::ArgumentLayout::kMaxSlotCount + kInvocationTailCount];
+    layout.Fill(box, registers, slots);
+    std::size_t count = layout.GetSlotCount();
+    slots[count] = result->GetScopeHandle();
+    slots[count + 1] = reinterpret_cast<std::int64_t>(box->callee_runtime_method_pointer_);
+
+    // Objects are obtained before anything is allocated, because raw references are only
+    // valid until garbage collection may move them.
+    auto *thread = reinterpret_cast<mirror::Thread *>(current_thread);
+    jobject objects[runtime::ArgumentLayout::kMaxSlotCount];
+    for (std::size_t slot = 0; slot < count; slot++) {
+        objects[slot] = layout.GetSlotType(slot) != 'L' ? nullptr : internal::Jni::GetObject(
+                env, thread, reinterpret_cast<mirror::Object *>(slots[slot]));
+    }
+
+    // Box is released once all data is obtained, so that it can be claimed by other invocations.
+    runtime::Runtime::ReleaseBox(box);
+
+    auto data_length = static_cast<jsize>(count + kInvocationTailCount);
+    jlongArray data = env->NewLongArray(data_length);
+    jobjectArray frame = data == nullptr ? nullptr :
+                         internal::Jni::NewObjectArray(env, static_cast<jsize>(count + 1));
+    if (frame != nullptr) {
+        env->SetLongArrayRegion(data, 0, data_length, reinterpret_cast<jlong *>(slots));
+        env->SetObjectArrayElement(frame, static_cast<jsize>(count), data);
+    }
+    for (std::size_t slot = 0; slot < count; slot++) {
+        if (objects[slot] == nullptr) continue;
+        if (frame != nullptr) {
+            env->SetObjectArrayElement(frame, static_cast<jsize>(slot), objects[slot]);
+        }
+        env->DeleteWeakGlobalRef(objects[slot]);
+    }
+    return frame;
 }
 
 extern "C"
-JNIEXPORT jbyte JNICALL
-Java_moe_aoramd_kaleidoscope_internal_RuntimeKt_convertByte(JNIEnv *, jclass, jlong data) {
-    return internal::free_reinterpret_cast<jbyte>(data);
+JNIEXPORT jint JNICALL
+Java_moe_aoramd_kaleidoscope_internal_InsertBridgeResult_00024Companion_scopeHandleNative(
+        JNIEnv *, jobject,
+        jlong native_peer) {
+    return reinterpret_cast<runtime::InsertBridgeResult *>(native_peer)->GetScopeHandle();
 }
 
 extern "C"
-JNIEXPORT jchar JNICALL
-Java_moe_aoramd_kaleidoscope_internal_RuntimeKt_convertChar(JNIEnv *, jclass, jlong data) {
-    return internal::free_reinterpret_cast<jchar>(data);
+JNIEXPORT void JNICALL
+Java_moe_aoramd_kaleidoscope_internal_InsertBridgeResult_00024Companion_setScopeHandleNative(
+        JNIEnv *, jobject,
+        jlong native_peer, jint handle) {
+    reinterpret_cast<runtime::InsertBridgeResult *>(native_peer)->SetScopeHandle(handle);
 }
 
 extern "C"
-JNIEXPORT jshort JNICALL
-Java_moe_aoramd_kaleidoscope_internal_RuntimeKt_convertShort(JNIEnv *, jclass, jlong data) {
-    return internal::free_reinterpret_cast<jshort>(data);
+JNIEXPORT jintArray JNICALL
+Java_moe_aoramd_kaleidoscope_internal_InsertBridgeResult_00024Companion_reclaimedHandlesNative(
+        JNIEnv *env, jobject) {
+    std::vector<std::int32_t> handles;
+    runtime::Runtime::TakeReclaimedHandles(&handles);
+    jintArray array = env->NewIntArray(static_cast<jsize>(handles.size()));
+    env->SetIntArrayRegion(array, 0, static_cast<jsize>(handles.size()), handles.data());
+    return array;
 }
 
 extern "C"
-JNIEXPORT jint JNICALL
-Java_moe_aoramd_kaleidoscope_internal_RuntimeKt_convertInt(JNIEnv *, jclass, jlong data) {
-    return internal::free_reinterpret_cast<jint>(data);
+JNIEXPORT void JNICALL
+Java_moe_aoramd_kaleidoscope_internal_InsertBridgeResult_00024Companion_setPausedNative(
+        JNIEnv *, jobject,
+        jlong native_peer, jboolean paused) {
+    reinterpret_cast<runtime::InsertBridgeResult *>(native_peer)->SetPaused(paused);
 }
 
 extern "C"
 JNIEXPORT jlong JNICALL
-Java_moe_aoramd_kaleidoscope_internal_RuntimeKt_convertLong(JNIEnv *, jclass, jlong data) {
-    return internal::free_reinterpret_cast<jlong>(data);
+Java_moe_aoramd_kaleidoscope_internal_InsertBridgeResult_00024Companion_originPointerNative(
+        JNIEnv *, jobject,
+        jlong native_peer) {
+    return reinterpret_cast<jlong>(reinterpret_cast<runtime::InsertBridgeResult *>(native_peer)->origin_);
 }
 
-extern "C"
-JNIEXPORT jfloat JNICALL
-Java_moe_aoramd_kaleidoscope_internal_RuntimeKt_convertFloat(JNIEnv *, jclass, jlong data) {
-    return internal::free_reinterpret_cast<jfloat>(data);
+/**
+ * Invoke a method with raw data of arguments captured by the layout of insert result, and
+ * objects obtained for reference arguments, see internal::Jni::Invoke().
+ */
+static jvalue InvokeWithLayout(JNIEnv *env, jlong native_peer, jlong method, jclass clazz,
+                               jint type, jlongArray data, jobjectArray objects) {
+    const runtime::ArgumentLayout &layout =
+            reinterpret_cast<runtime::InsertBridgeResult *>(native_peer)->layout_;
+    std::size_t count = layout.GetSlotCount();
+    jlong slots[runtime::ArgumentLayout::kMaxSlotCount];
+    env->GetLongArrayRegion(data, 0, static_cast<jsize>(count), slots);
+
+    // Raw data of primitive is kept in low bits, which is where jvalue saves it.
+    std::size_t first = layout.IsStatic() ? 0 : 1;
+    jobject thiz = first == 0 ? nullptr : env->GetObjectArrayElement(objects, 0);
+    jvalue arguments[runtime::ArgumentLayout::kMaxSlotCount];
+    for (std::size_t i = first; i < count; i++) {
+        jvalue &argument = arguments[i - first];
+        if (layout.GetSlotType(i) == 'L') {
+            argument.l = env->GetObjectArrayElement(objects, static_cast<jsize>(i));
+        } else {
+            argument.j = slots[i];
+        }
+    }
+
+    jvalue result = internal::Jni::Invoke(env, reinterpret_cast<jmethodID>(method),
+                                          static_cast<internal::Jni::InvokeType>(type), clazz,
+                                          thiz, arguments, layout.GetReturnType());
+
+    if (thiz != nullptr) env->DeleteLocalRef(thiz);
+    for (std::size_t i = first; i < count; i++) {
+        if (layout.GetSlotType(i) == 'L' && arguments[i - first].l != nullptr)
+            env->DeleteLocalRef(arguments[i - first].l);
+    }
+    return result;
 }
 
 extern "C"
-JNIEXPORT jdouble JNICALL
-Java_moe_aoramd_kaleidoscope_internal_RuntimeKt_convertDouble(JNIEnv *, jclass, jlong data) {
-    return internal::free_reinterpret_cast<jdouble>(data);
+JNIEXPORT jlong JNICALL
+Java_moe_aoramd_kaleidoscope_internal_InsertBridgeResult_00024Companion_invokeNative(
+        JNIEnv *env, jobject,
+        jlong native_peer,
+        jlong method,
+        jclass clazz,
+        jint type,
+        jlongArray data,
+        jobjectArray objects) {
+    return InvokeWithLayout(env, native_peer, method, clazz, type, data, objects).j;
 }
 
 extern "C"
 JNIEXPORT jobject JNICALL
-Java_moe_aoramd_kaleidoscope_internal_RuntimeKt_convertAny(JNIEnv *env, jclass, jlong data,
-                                                           jlong current_thread) {
-    return internal::Jni::GetObject(env,
-                                    reinterpret_cast<mirror::Thread *>(current_thread),
-                                    reinterpret_cast<mirror::Object *>(data));
+Java_moe_aoramd_kaleidoscope_internal_InsertBridgeResult_00024Companion_invokeObjectNative(
+        JNIEnv *env, jobject,
+        jlong native_peer,
+        jlong method,
+        jclass clazz,
+        jint type,
+        jlongArray data,
+        jobjectArray objects) {
+    return InvokeWithLayout(env, native_peer, method, clazz, type, data, objects).l;
 }
 
 extern "C"
 JNIEXPORT jlong JNICALL
-Java_moe_aoramd_kaleidoscope_internal_Box_00024Companion_unlockAndCopyInternal(JNIEnv *,
-                                                                               jobject,
-                                                                               jlong main) {
-    return reinterpret_cast<jlong>(runtime::Runtime::UnlockAndCopyBox(
-            reinterpret_cast<runtime::Box *>(main)));
+Java_moe_aoramd_kaleidoscope_internal_InvokerKt_methodIdNative(JNIEnv *env, jclass,
+                                                                jobject method) {
+    return reinterpret_cast<jlong>(env->FromReflectedMethod(method));
+}
+
+extern "C"
+JNIEXPORT jlong JNICALL
+Java_moe_aoramd_kaleidoscope_internal_ListenResult_00024Companion_clonePointerNative(JNIEnv *,
+                                                                                     jobject,
+                                                                                     jlong native_peer) {
+    return reinterpret_cast<jlong>(reinterpret_cast<runtime::ListenResult *>(native_peer)->clone_);
 }
 
 extern "C"
 JNIEXPORT void JNICALL
-Java_moe_aoramd_kaleidoscope_internal_Box_00024Companion_releaseInternal(JNIEnv *,
-                                                                         jobject,
-                                                                         jlong native_peer) {
-    free(reinterpret_cast<runtime::Box *>(native_peer));
+Java_moe_aoramd_kaleidoscope_Trace_setEnabledNative(JNIEnv *, jclass, jboolean enabled) {
+    runtime::Trace::SetEnabled(enabled);
 }
 
 extern "C"
-JNIEXPORT jlong JNICALL
-Java_moe_aoramd_kaleidoscope_internal_Box_00024Companion_calleeRuntimeMethod(JNIEnv *,
-                                                                             jobject,
-                                                                             jlong native_peer) {
-    return reinterpret_cast<jlong>(
-            reinterpret_cast<runtime::Box *>(native_peer)->callee_runtime_method_pointer_);
+JNIEXPORT jint JNICALL
+Java_moe_aoramd_kaleidoscope_Trace_drainNative(JNIEnv *env, jclass, jlongArray data) {
+    // Each record is drained into 4 longs: timestamp, method, thread id and event, duration.
+    static const std::size_t kBatchSize = 256;
+    runtime::TraceRecord records[kBatchSize];
+    jlong record_data[kBatchSize * 4];
+    std::size_t capacity = std::min<std::size_t>(kBatchSize, env->GetArrayLength(data) / 4);
+    std::size_t count = runtime::Trace::Drain(records, capacity);
+    for (std::size_t i = 0; i < count; i++) {
+        record_data[i * 4] = static_cast<jlong>(records[i].timestamp_);
+        record_data[i * 4 + 1] = static_cast<jlong>(records[i].method_);
+        record_data[i * 4 + 2] = static_cast<jlong>(records[i].thread_id_) << 16 |
+                                 static_cast<jlong>(records[i].event_);
+        record_data[i * 4 + 3] = static_cast<jlong>(records[i].duration_);
+    }
+    env->SetLongArrayRegion(data, 0, static_cast<jsize>(count * 4), record_data);
+    return static_cast<jint>(count);
 }
 
 extern "C"
-JNIEXPORT jlong JNICALL
-Java_moe_aoramd_kaleidoscope_internal_Box_00024Companion_register1(JNIEnv *, jobject,
-                                                                   jlong native_peer) {
-    return internal::free_reinterpret_cast<jlong>(
-            reinterpret_cast<runtime::Box *>(native_peer)->register_1_);
+JNIEXPORT jint JNICALL
+Java_moe_aoramd_kaleidoscope_Trace_exportNative(JNIEnv *env, jclass, jstring path) {
+    const char *path_chars = env->GetStringUTFChars(path, nullptr);
+    std::size_t count;
+    bool exported = runtime::Trace::Export(path_chars, &count);
+    env->ReleaseStringUTFChars(path, path_chars);
+    return exported ? static_cast<jint>(count) : -1;
 }
 
 extern "C"
 JNIEXPORT jlong JNICALL
-Java_moe_aoramd_kaleidoscope_internal_Box_00024Companion_register2(JNIEnv *, jobject,
-                                                                   jlong native_peer) {
-    return internal::free_reinterpret_cast<jlong>(
-            reinterpret_cast<runtime::Box *>(native_peer)->register_2_);
+Java_moe_aoramd_kaleidoscope_Trace_droppedCountNative(JNIEnv *, jclass) {
+    return static_cast<jlong>(runtime::Trace::GetDroppedCount());
 }
 
 extern "C"
-JNIEXPORT jfloat JNICALL
-Java_moe_aoramd_kaleidoscope_internal_Box_00024Companion_parameterFromFloatRegister(JNIEnv *,
-                                                                                    jobject,
-                                                                                    jlong native_peer,
-                                                                                    jint index) {
-    return internal::free_reinterpret_cast<jfloat>(
-            reinterpret_cast<runtime::Box *>(native_peer)->floating_registers_[index]
-    );
+JNIEXPORT void JNICALL
+Java_moe_aoramd_kaleidoscope_Profiler_setEnabledNative(JNIEnv *, jclass, jboolean enabled) {
+    runtime::HookStatistics::SetEnabled(enabled);
 }
 
 extern "C"
-JNIEXPORT jdouble JNICALL
-Java_moe_aoramd_kaleidoscope_internal_Box_00024Companion_parameterFromDoubleRegister(JNIEnv *,
-                                                                                     jobject,
-                                                                                     jlong native_peer,
-                                                                                     jint index) {
-    return internal::free_reinterpret_cast<jdouble>(
-            reinterpret_cast<runtime::Box *>(native_peer)->floating_registers_[index]
-    );
+JNIEXPORT jlongArray JNICALL
+Java_moe_aoramd_kaleidoscope_Profiler_snapshotNative(JNIEnv *env, jclass) {
+    // Each snapshot is flattened into method, call count, total latency and buckets.
+    static const std::size_t kSnapshotLength = 3 + runtime::HookStatistics::kBucketCount;
+    std::vector<runtime::StatisticsSnapshot> snapshots;
+    runtime::Runtime::SnapshotStatistics(&snapshots);
+    std::vector<jlong> data(snapshots.size() * kSnapshotLength);
+    for (std::size_t i = 0; i < snapshots.size(); i++) {
+        jlong *snapshot_data = &data[i * kSnapshotLength];
+        snapshot_data[0] = reinterpret_cast<jlong>(snapshots[i].method_);
+        snapshot_data[1] = static_cast<jlong>(snapshots[i].call_count_);
+        snapshot_data[2] = static_cast<jlong>(snapshots[i].total_latency_);
+        std::copy(std::begin(snapshots[i].buckets_), std::end(snapshots[i].buckets_),
+                  snapshot_data + 3);
+    }
+    jlongArray result = env->NewLongArray(static_cast<jsize>(data.size()));
+    env->SetLongArrayRegion(result, 0, static_cast<jsize>(data.size()), data.data());
+    return result;
 }
 
 extern "C"
-#pragma clang diagnostic push
-#pragma ide diagnostic ignored "hicpp-signed-bitwise"
-JNIEXPORT jlong JNICALL
-Java_moe_aoramd_kaleidoscope_internal_Box_00024Companion_parameterFromStack(JNIEnv *,
-                                                                            jobject,
-                                                                            jlong native_peer,
-                                                                            jint byte_offset,
-                                                                            jint byte_size) {
-    std::size_t base =
-            reinterpret_cast<runtime::Box *>(native_peer)->sp_pointer_ + sizeof(std::size_t);
-    std::uint64_t value = *reinterpret_cast<std::uint64_t *>(base + byte_offset);
-    std::uint64_t mask = 0;
-
-    // Delete the extra bits obtained.
-    for (int i = 0; i < byte_size; i++) mask = (mask << 8) + 0xff;
-    value = value & mask;
-
-    return internal::free_reinterpret_cast<jlong>(value);
+JNIEXPORT void JNICALL
+Java_moe_aoramd_kaleidoscope_Profiler_resetNative(JNIEnv *, jclass) {
+    runtime::Runtime::ResetStatistics();
 }
-#pragma clang diagnostic pop
 
 extern "C"
-JNIEXPORT jlong JNICALL
-Java_moe_aoramd_kaleidoscope_internal_InsertBridgeResult_00024Companion_originPointerNative(
-        JNIEnv *, jobject,
-        jlong native_peer) {
-    return reinterpret_cast<jlong>(reinterpret_cast<runtime::InsertBridgeResult *>(native_peer)->origin_);
+JNIEXPORT jlongArray JNICALL
+Java_moe_aoramd_kaleidoscope_Profiler_bucketLowerBoundsNative(JNIEnv *env, jclass) {
+    jlong bounds[runtime::HookStatistics::kBucketCount];
+    for (std::size_t i = 0; i < runtime::HookStatistics::kBucketCount; i++) {
+        bounds[i] = static_cast<jlong>(runtime::HookStatistics::GetBucketLowerBound(i));
+    }
+    jlongArray result = env->NewLongArray(runtime::HookStatistics::kBucketCount);
+    env->SetLongArrayRegion(result, 0, runtime::HookStatistics::kBucketCount, bounds);
+    return result;
 }
 
 extern "C"
-JNIEXPORT jlong JNICALL
-Java_moe_aoramd_kaleidoscope_internal_ListenResult_00024Companion_clonePointerNative(JNIEnv *,
-                                                                                     jobject,
-                                                                                     jlong native_peer) {
-    return reinterpret_cast<jlong>(reinterpret_cast<runtime::ListenResult *>(native_peer)->clone_);
-}
\ No newline at end of file
+JNIEXPORT kaleidoscope_listener *
+kaleidoscope_listen(JNIEnv *env, jobject method, kaleidoscope_callback before, void *user) {
+    if (!initialized) {
+        errorLog("Kaleidoscope must be initialized before listening methods natively.")
+        return nullptr;
+    }
+    if (before == nullptr) {
+        errorLog("Native listener must not be null.")
+        return nullptr;
+    }
+    mirror::Method *runtime_method = internal::Jni::GetRuntimeMethodFromReflectMethod(env, method);
+    runtime::NativeResult *result =
+            runtime::Runtime::ListenNative(runtime_method, internal::Jni::GetThread(env),
+                                           before, user);
+    return reinterpret_cast<kaleidoscope_listener *>(result);
+}
+
+extern "C"
+JNIEXPORT void kaleidoscope_pause(kaleidoscope_listener *listener) {
+    if (listener == nullptr) return;
+    reinterpret_cast<runtime::NativeResult *>(listener)->SetPaused(true);
+}
+
+extern "C"
+JNIEXPORT void kaleidoscope_resume(kaleidoscope_listener *listener) {
+    if (listener == nullptr) return;
+    reinterpret_cast<runtime::NativeResult *>(listener)->SetPaused(false);
+}
+
+extern "C"
+JNIEXPORT void kaleidoscope_restore(kaleidoscope_listener *listener) {
+    if (listener == nullptr) return;
+    runtime::Runtime::RestoreBridge(reinterpret_cast<runtime::NativeResult *>(listener));
+}
@@ -0,0 +1,105 @@
+/*
+ * MIT License
+ *
+ * Copyright (C) 2021 M.D.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <cstring>
+
+#include "layout.h"
+
+#include "log.h"
+#include "runtime.h"
+
+namespace moe::aoramd::kaleidoscope::runtime {
+
+    bool ArgumentLayout::Initialize(const char *shorty, bool is_static) {
+        slots_.clear();
+        return_type_ = '\0';
+        if (shorty == nullptr || shorty[0] == '\0') {
+            errorLog("Shorty of runtime method is empty.")
+            return false;
+        }
+
+        int general_index = 0;
+        int floating_index = 0;
+        std::size_t offset = 0;
+        auto add = [&](char type) {
+            bool floating = type == 'F' || type == 'D';
+            // Object pointer is 32-bit in Android Runtime.
+            std::uint8_t size = type == 'J' || type == 'D' ? 8 : 4;
+            Slot slot{kStack, size, static_cast<std::uint16_t>(offset), type};
+            if (floating && floating_index < kFloatingRegisterCount) {
+                slot.source_ = kFloatingRegister;
+                slot.index_ = floating_index++;
+            } else if (!floating && general_index < kGeneralRegisterCount) {
+                slot.source_ = kGeneralRegister;
+                slot.index_ = general_index++;
+            }
+            slots_.push_back(slot);
+            offset += size;
+        };
+
+        if (!is_static) add('L');
+        for (const char *type = shorty + 1; *type != '\0'; type++) {
+            if (strchr("ZBCSIJFDL", *type) == nullptr) {
+                errorLog("Invalid parameter type '%c' in shorty %s.", *type, shorty)
+                slots_.clear();
+                return false;
+            }
+            add(*type);
+        }
+        if (slots_.size() > kMaxSlotCount) {
+            errorLog("Too many parameters in shorty %s.", shorty)
+            slots_.clear();
+            return false;
+        }
+        return_type_ = shorty[0];
+        is_static_ = is_static;
+        return true;
+    }
+
+    void ArgumentLayout::Fill(const Box *box, const std::int64_t *registers,
+                              std::int64_t *data) const {
+        // Parameters on stack follow the runtime method of callee.
+        std::size_t stack = box->sp_pointer_ + sizeof(std::size_t);
+        for (std::size_t i = 0; i < slots_.size(); i++) {
+            const Slot &slot = slots_[i];
+            switch (slot.source_) {
+                case kGeneralRegister:
+                    if (slot.index_ == 0) data[i] = static_cast<std::int64_t>(box->register_1_);
+                    else if (slot.index_ == 1) data[i] = static_cast<std::int64_t>(box->register_2_);
+                    else data[i] = registers[slot.index_ - 2];
+                    break;
+                case kFloatingRegister:
+                    data[i] = static_cast<std::int64_t>(box->floating_registers_[slot.index_]);
+                    if (slot.size_ == 4) data[i] &= 0xffffffff;
+                    break;
+                case kStack: {
+                    std::uint64_t value = 0;
+                    memcpy(&value, reinterpret_cast<void *>(stack + slot.index_), slot.size_);
+                    data[i] = static_cast<std::int64_t>(value);
+                    break;
+                }
+            }
+        }
+    }
+}
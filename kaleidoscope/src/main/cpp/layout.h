@@ -0,0 +1,176 @@
+/*
+ * MIT License
+ *
+ * Copyright (C) 2021 M.D.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef KALEIDOSCOPE_LAYOUT_H
+#define KALEIDOSCOPE_LAYOUT_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "declare.h"
+
+namespace moe::aoramd::kaleidoscope::runtime {
+
+    /**
+     * A class for describing where parameters of a runtime method are passed in 64-bit Android
+     * Runtime, which is computed once when bridge code is inserted.
+     *
+     * Slots of the layout are "this" if runtime method is not static, followed by parameters.
+     * Integer and floating point parameters are assigned to registers separately in order, and
+     * every parameter takes its place on stack even if it is passed in register.
+     */
+    class ArgumentLayout final {
+    public:
+
+        /**
+         * Count of general purpose registers passed to bridge method as parameters x3 ~ x7,
+         * see Fill().
+         */
+        static const int kExtraRegisterCount = 5;
+
+        /**
+         * Max count of slots. Parameters of a method take at most 255 registers in dex
+         * format, including "this".
+         */
+        static const std::size_t kMaxSlotCount = 255;
+
+        /**
+         * Compute the layout from shorty of runtime method.
+         *
+         * @param shorty shorty descriptor of runtime method, the return type followed by
+         *        parameter types, which are 'Z', 'B', 'C', 'S', 'I', 'J', 'F', 'D' or 'L'.
+         * @param is_static true if runtime method is static.
+         * @return true if shorty is valid and slots are not more than kMaxSlotCount.
+         */
+        bool Initialize(const char *shorty, bool is_static);
+
+        /**
+         * Get count of slots, including "this" if runtime method is not static.
+         *
+         * @return count of slots.
+         */
+        std::size_t GetSlotCount() const {
+            return slots_.size();
+        }
+
+        /**
+         * Fill raw data of all slots from the box claimed by secondary bridge and registers
+         * passed to bridge method. Floating point data is saved as its bits, and data narrower
+         * than 64 bits on stack is zero extended.
+         *
+         * @param box box claimed by secondary bridge.
+         * @param registers parameters x3 ~ x7 of bridge method, see kExtraRegisterCount.
+         * @param data array for saving raw data, whose length is at least GetSlotCount().
+         */
+        void Fill(const Box *box, const std::int64_t *registers, std::int64_t *data) const;
+
+        /**
+         * Get type of a slot in shorty, which is 'L' for "this".
+         *
+         * @param slot index of slot.
+         * @return type of slot.
+         */
+        char GetSlotType(std::size_t slot) const {
+            return slots_[slot].type_;
+        }
+
+        /**
+         * Get return type of runtime method in shorty.
+         *
+         * @return return type, or '\0' if layout is not initialized.
+         */
+        char GetReturnType() const {
+            return return_type_;
+        }
+
+        /**
+         * Check whether runtime method is static, so that the first slot is not "this".
+         *
+         * @return true if runtime method is static.
+         */
+        bool IsStatic() const {
+            return is_static_;
+        }
+
+    private:
+        enum Source : std::uint8_t {
+            kGeneralRegister,
+            kFloatingRegister,
+            kStack
+        };
+
+        class Slot final {
+        public:
+
+            Source source_;
+
+            /**
+             * Size in bytes of data.
+             */
+            std::uint8_t size_;
+
+            /**
+             * Register index, or byte offset on stack if it is passed on stack.
+             */
+            std::uint16_t index_;
+
+            /**
+             * Type of data in shorty.
+             */
+            char type_;
+        };
+
+#if defined(__aarch64__)
+
+        /**
+         * General purpose registers are x1 ~ x7, excluding x0 for runtime method.
+         */
+        static const int kGeneralRegisterCount = 7;
+
+#else
+
+        /**
+         * General purpose registers are rsi, rdx, rcx, r8 and r9, excluding rdi for runtime
+         * method. Parameters x6 and x7 of bridge method are passed on stack rather than
+         * registers, so they are not used.
+         */
+        static const int kGeneralRegisterCount = 5;
+
+#endif
+
+        /**
+         * Floating point registers are d0 ~ d7 in arm64, and xmm0 ~ xmm7 in x86_64.
+         */
+        static const int kFloatingRegisterCount = 8;
+
+        std::vector<Slot> slots_;
+
+        char return_type_ = '\0';
+
+        bool is_static_ = false;
+    };
+}
+
+#endif
@@ -30,8 +30,14 @@
 #include <sys/mman.h>
 #include <elf.h>
 #include <dlfcn.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdint.h>
+#ifdef __ANDROID__
 #include <sys/system_properties.h>
 #include <android/log.h>
+#endif
 
 #include "fake_dlfcn.h"
 
@@ -51,10 +57,18 @@
 #define Elf_Ehdr Elf64_Ehdr
 #define Elf_Shdr Elf64_Shdr
 #define Elf_Sym  Elf64_Sym
+#define Elf_Addr Elf64_Addr
+#define Elf_Phdr Elf64_Phdr
+#define Elf_Dyn  Elf64_Dyn
+#define ELF_CLASS ELFCLASS64
 #else
 #define Elf_Ehdr Elf32_Ehdr
 #define Elf_Shdr Elf32_Shdr
 #define Elf_Sym  Elf32_Sym
+#define Elf_Addr Elf32_Addr
+#define Elf_Phdr Elf32_Phdr
+#define Elf_Dyn  Elf32_Dyn
+#define ELF_CLASS ELFCLASS32
 #endif
 
 struct ctx {
@@ -63,48 +77,455 @@ struct ctx {
     void *dynsym;
     int nsyms;
     off_t bias;
+    void *gnu_hash;    /* .gnu.hash, or null if not found */
+    void *hash;        /* .hash, or null if not found, only used without .gnu.hash */
+    void *map;         /* mapping of file holding all tables above, or null if they are copied */
+    size_t map_size;
+};
+
+/*
+ * Layout of .gnu.hash: header, bloom filter words, buckets, and then chain values of symbols
+ * from symoffset, in which the lowest bit marks the end of a chain.
+ */
+struct gnu_hash_header {
+    uint32_t nbuckets;
+    uint32_t symoffset;
+    uint32_t bloom_size;
+    uint32_t bloom_shift;
+};
+
+static uint32_t gnu_hash(const char *name) {
+    uint32_t h = 5381;
+    for (const unsigned char *c = (const unsigned char *) name; *c; c++) h = h * 33 + *c;
+    return h;
+}
+
+static uint32_t elf_hash(const char *name) {
+    uint32_t h = 0, g;
+    for (const unsigned char *c = (const unsigned char *) name; *c; c++) {
+        h = (h << 4) + *c;
+        g = h & 0xf0000000;
+        if (g) h ^= g >> 24;
+        h &= ~g;
+    }
+    return h;
+}
+
+/* check that buckets and chains are inside the section before keeping it */
+static int gnu_hash_valid(const void *section, size_t size, int nsyms) {
+    const struct gnu_hash_header *header = (const struct gnu_hash_header *) section;
+    if (size < sizeof(*header) || header->nbuckets == 0 || header->bloom_size == 0 ||
+        (header->bloom_size & (header->bloom_size - 1)) != 0 ||
+        header->symoffset > (uint32_t) nsyms)
+        return 0;
+    size_t chain_size = (size_t) (nsyms - header->symoffset) * sizeof(uint32_t);
+    return sizeof(*header) + header->bloom_size * sizeof(Elf_Addr) +
+           header->nbuckets * sizeof(uint32_t) + chain_size <= size;
+}
+
+static int hash_valid(const void *section, size_t size, int nsyms) {
+    const uint32_t *words = (const uint32_t *) section;
+    if (size < 2 * sizeof(uint32_t) || words[0] == 0 || words[1] != (uint32_t) nsyms) return 0;
+    return (2 + (size_t) words[0] + words[1]) * sizeof(uint32_t) <= size;
+}
+
+static Elf_Sym *gnu_hash_lookup(struct ctx *ctx, const char *name) {
+    const struct gnu_hash_header *header = (const struct gnu_hash_header *) ctx->gnu_hash;
+    const Elf_Addr *bloom = (const Elf_Addr *) (header + 1);
+    const uint32_t *buckets = (const uint32_t *) (bloom + header->bloom_size);
+    const uint32_t *chain = buckets + header->nbuckets;
+    const uint32_t bits = sizeof(Elf_Addr) * 8;
+    Elf_Sym *syms = (Elf_Sym *) ctx->dynsym;
+    char *strings = (char *) ctx->dynstr;
+
+    uint32_t h = gnu_hash(name);
+
+    /* the bloom filter rejects most absent names without touching buckets */
+    Elf_Addr word = bloom[(h / bits) & (header->bloom_size - 1)];
+    Elf_Addr mask = ((Elf_Addr) 1 << (h % bits)) |
+                    ((Elf_Addr) 1 << ((h >> header->bloom_shift) % bits));
+    if ((word & mask) != mask) return 0;
+
+    uint32_t k = buckets[h % header->nbuckets];
+    if (k < header->symoffset) return 0;
+    for (; k < (uint32_t) ctx->nsyms; k++) {
+        uint32_t value = chain[k - header->symoffset];
+        if ((value | 1) == (h | 1) && strcmp(strings + syms[k].st_name, name) == 0)
+            return syms + k;
+        if (value & 1) break;
+    }
+    return 0;
+}
+
+static Elf_Sym *hash_lookup(struct ctx *ctx, const char *name) {
+    const uint32_t *words = (const uint32_t *) ctx->hash;
+    uint32_t nbuckets = words[0];
+    const uint32_t *buckets = words + 2;
+    const uint32_t *chain = buckets + nbuckets;
+    Elf_Sym *syms = (Elf_Sym *) ctx->dynsym;
+    char *strings = (char *) ctx->dynstr;
+
+    /* bound the walk, so that a broken chain cannot loop forever */
+    int steps = 0;
+    for (uint32_t k = buckets[elf_hash(name) % nbuckets];
+         k != STN_UNDEF && k < (uint32_t) ctx->nsyms && steps < ctx->nsyms; k = chain[k], steps++) {
+        if (syms[k].st_shndx != SHN_UNDEF && strcmp(strings + syms[k].st_name, name) == 0)
+            return syms + k;
+    }
+    return 0;
+}
+
+/*  NB: sym->st_value is an offset into the section for relocatables,
+    but a VMA for shared libs or exe files, so we have to subtract the bias */
+static void *symbol_address(struct ctx *ctx, Elf_Sym *sym) {
+    return (char *) ctx->load_addr + sym->st_value - ctx->bias;
+}
+
+/* translate a virtual address into file offset, and the end of its segment in file */
+static int vaddr_to_offset(const Elf_Phdr *phdrs, int phnum, Elf_Addr vaddr,
+                           off_t *offset, off_t *segment_end) {
+    for (int i = 0; i < phnum; i++) {
+        const Elf_Phdr *phdr = phdrs + i;
+        if (phdr->p_type != PT_LOAD || vaddr < phdr->p_vaddr ||
+            vaddr >= phdr->p_vaddr + phdr->p_filesz)
+            continue;
+        *offset = (off_t) (vaddr - phdr->p_vaddr + phdr->p_offset);
+        *segment_end = (off_t) (phdr->p_offset + phdr->p_filesz);
+        return 1;
+    }
+    return 0;
+}
+
+/* count symbols by the last symbol in chains, because PT_DYNAMIC has no size of DT_SYMTAB */
+static int gnu_hash_nsyms(const void *section, const char *end) {
+    const struct gnu_hash_header *header = (const struct gnu_hash_header *) section;
+    const Elf_Addr *bloom = (const Elf_Addr *) (header + 1);
+    const uint32_t *buckets = (const uint32_t *) (bloom + header->bloom_size);
+    const uint32_t *chain = buckets + header->nbuckets;
+    if ((const char *) chain > end) return -1;
+
+    uint32_t last = 0;
+    for (uint32_t i = 0; i < header->nbuckets; i++) if (buckets[i] > last) last = buckets[i];
+    if (last < header->symoffset) return (int) header->symoffset;
+    for (;; last++) {
+        const uint32_t *value = chain + (last - header->symoffset);
+        if ((const char *) (value + 1) > end) return -1;
+        if (*value & 1) break;
+    }
+    return (int) last + 1;
+}
+
+/*
+ * Find symbol tables through PT_DYNAMIC, and keep a private read-only mapping from the first of
+ * them to the end of their segments instead of copying them, so that only pages touched by
+ * lookups become resident and they are backed by page cache. Returns 0 if it is not possible,
+ * such as no hash tables in the library.
+ */
+static int load_dynamic(struct ctx *ctx, int fd, off_t size) {
+    Elf_Ehdr ehdr;
+    Elf_Phdr *phdrs = 0;
+    Elf_Dyn *dyns = 0;
+    int k, ndyns = 0, ok = 0;
+    Elf_Addr symtab = 0, strtab = 0, gnu_hash = 0, hash = 0, min_vaddr = (Elf_Addr) -1;
+    size_t strsz = 0, syment = sizeof(Elf_Sym);
+    off_t symtab_offset, strtab_offset, hash_offset = 0, start, end = 0, segment_end;
+    long page_size = sysconf(_SC_PAGESIZE);
+    char *map, *map_end;
+    const Elf_Phdr *dynamic = 0;
+
+    if (pread(fd, &ehdr, sizeof(ehdr), 0) != sizeof(ehdr) ||
+        memcmp(ehdr.e_ident, ELFMAG, SELFMAG) != 0 || ehdr.e_ident[EI_CLASS] != ELF_CLASS ||
+        ehdr.e_phentsize != sizeof(Elf_Phdr) || ehdr.e_phnum == 0)
+        return 0;
+
+    phdrs = (Elf_Phdr *) malloc(ehdr.e_phnum * sizeof(Elf_Phdr));
+    if (!phdrs) goto exit;
+    if (pread(fd, phdrs, ehdr.e_phnum * sizeof(Elf_Phdr), ehdr.e_phoff) !=
+        (ssize_t) (ehdr.e_phnum * sizeof(Elf_Phdr)))
+        goto exit;
+    for (k = 0; k < ehdr.e_phnum; k++) {
+        if (phdrs[k].p_type == PT_DYNAMIC) dynamic = phdrs + k;
+        if (phdrs[k].p_type == PT_LOAD && phdrs[k].p_vaddr < min_vaddr)
+            min_vaddr = phdrs[k].p_vaddr;
+    }
+    if (!dynamic || dynamic->p_filesz == 0) goto exit;
+
+    dyns = (Elf_Dyn *) malloc(dynamic->p_filesz);
+    if (!dyns) goto exit;
+    if (pread(fd, dyns, dynamic->p_filesz, dynamic->p_offset) != (ssize_t) dynamic->p_filesz)
+        goto exit;
+    ndyns = (int) (dynamic->p_filesz / sizeof(Elf_Dyn));
+    for (k = 0; k < ndyns && dyns[k].d_tag != DT_NULL; k++) {
+        switch (dyns[k].d_tag) {
+            case DT_SYMTAB: symtab = dyns[k].d_un.d_ptr; break;
+            case DT_STRTAB: strtab = dyns[k].d_un.d_ptr; break;
+            case DT_STRSZ: strsz = dyns[k].d_un.d_val; break;
+            case DT_SYMENT: syment = dyns[k].d_un.d_val; break;
+            case DT_GNU_HASH: gnu_hash = dyns[k].d_un.d_ptr; break;
+            case DT_HASH: hash = dyns[k].d_un.d_ptr; break;
+        }
+    }
+    if (!symtab || !strtab || !strsz || syment != sizeof(Elf_Sym) || (!gnu_hash && !hash))
+        goto exit;
+
+    if (!vaddr_to_offset(phdrs, ehdr.e_phnum, symtab, &symtab_offset, &segment_end)) goto exit;
+    start = symtab_offset;
+    if (segment_end > end) end = segment_end;
+    if (!vaddr_to_offset(phdrs, ehdr.e_phnum, strtab, &strtab_offset, &segment_end)) goto exit;
+    if (strtab_offset < start) start = strtab_offset;
+    if (segment_end > end) end = segment_end;
+    if (!vaddr_to_offset(phdrs, ehdr.e_phnum, gnu_hash ? gnu_hash : hash,
+                         &hash_offset, &segment_end))
+        goto exit;
+    if (hash_offset < start) start = hash_offset;
+    if (segment_end > end) end = segment_end;
+    if (end > size || strtab_offset + (off_t) strsz > end) goto exit;
+
+    start = start / page_size * page_size;
+    map = (char *) mmap(0, end - start, PROT_READ, MAP_PRIVATE, fd, start);
+    if (map == MAP_FAILED) goto exit;
+    map_end = map + (end - start);
+
+    ctx->map = map;
+    ctx->map_size = end - start;
+    ctx->dynsym = map + (symtab_offset - start);
+    ctx->dynstr = map + (strtab_offset - start);
+    if (gnu_hash) {
+        ctx->gnu_hash = map + (hash_offset - start);
+        ctx->nsyms = gnu_hash_nsyms(ctx->gnu_hash, map_end);
+    } else {
+        ctx->hash = map + (hash_offset - start);
+        ctx->nsyms = map_end - (char *) ctx->hash >= 2 * (long) sizeof(uint32_t) ?
+                     (int) ((uint32_t *) ctx->hash)[1] : -1;
+    }
+    ok = ctx->nsyms > 0 &&
+         (char *) ctx->dynsym + (size_t) ctx->nsyms * sizeof(Elf_Sym) <= map_end &&
+         (gnu_hash ? gnu_hash_valid(ctx->gnu_hash, map_end - (char *) ctx->gnu_hash, ctx->nsyms)
+                   : hash_valid(ctx->hash, map_end - (char *) ctx->hash, ctx->nsyms));
+    if (!ok) {
+        munmap(map, ctx->map_size);
+        ctx->map = ctx->dynsym = ctx->dynstr = ctx->gnu_hash = ctx->hash = 0;
+        ctx->map_size = 0;
+        ctx->nsyms = 0;
+        goto exit;
+    }
+    ctx->bias = (off_t) (min_vaddr / page_size * page_size);
+
+    exit:
+    free(phdrs);
+    free(dyns);
+    return ok;
+}
+
+#if defined(__LP64__)
+static const char *const kSystemLibDir = "/system/lib64/";
+static const char *const kOdmLibDir = "/odm/lib64/";
+static const char *const kVendorLibDir = "/vendor/lib64/";
+static const char *const kApexLibDir = "/apex/com.android.runtime/lib64/";
+static const char *const kApexArtNsLibDir = "/apex/com.android.art/lib64/";
+#else
+static const char *const kSystemLibDir = "/system/lib/";
+static const char *const kOdmLibDir = "/odm/lib/";
+static const char *const kVendorLibDir = "/vendor/lib/";
+static const char *const kApexLibDir = "/apex/com.android.runtime/lib/";
+static const char *const kApexArtNsLibDir = "/apex/com.android.art/lib/";
+#endif
+
+/* directories preferred in order when a library is opened by basename */
+static const char *const kSearchDirs[] = {
+        kSystemLibDir,      /* system */
+        kApexLibDir,        /* apex in ns com.android.runtime */
+        kApexArtNsLibDir,   /* apex in ns com.android.art */
+        kOdmLibDir,         /* odm */
+        kVendorLibDir,      /* vendor */
 };
 
+/*
+ * Snapshot of /proc/self/maps with the load base of every mapped file, sorted by basename and
+ * then path, so that libraries are found by binary search instead of scanning maps again for
+ * every search path. It is loaded once and refreshed only when a library is not found.
+ */
+struct module {
+    char *path;
+    const char *name;    /* basename in path */
+    uintptr_t base;
+};
+
+/* max count of modules tried for a basename */
+static const int kMaxCandidateCount = 8;
+
+static struct module *modules = 0;
+static int nmodules = 0;
+static pthread_mutex_t modules_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static int module_compare(const void *a, const void *b) {
+    const struct module *x = (const struct module *) a, *y = (const struct module *) b;
+    int result = strcmp(x->name, y->name);
+    if (result == 0) result = strcmp(x->path, y->path);
+    if (result == 0) result = x->base < y->base ? -1 : x->base > y->base;
+    return result;
+}
+
+/* lines are read by getline(), so that long paths are never split */
+static int load_modules() {
+    FILE *maps = fopen("/proc/self/maps", "r");
+    if (!maps) return 0;
+
+    char *line = 0;
+    size_t line_size = 0;
+    ssize_t length;
+    struct module *table = 0;
+    int count = 0, capacity = 0, k, unique;
+
+    while ((length = getline(&line, &line_size, maps)) > 0) {
+        uintptr_t start, end;
+        unsigned long offset;
+        int path_index = 0;
+        if (line[length - 1] == '\n') line[length - 1] = '\0';
+        if (sscanf(line, "%" SCNxPTR "-%" SCNxPTR " %*s %lx %*s %*s %n",
+                   &start, &end, &offset, &path_index) != 3 || line[path_index] != '/')
+            continue;
+        if (count == capacity) {
+            capacity = capacity ? capacity * 2 : 256;
+            struct module *grown =
+                    (struct module *) realloc(table, capacity * sizeof(struct module));
+            if (!grown) break;
+            table = grown;
+        }
+        table[count].path = strdup(line + path_index);
+        if (!table[count].path) break;
+        table[count].name = strrchr(table[count].path, '/') + 1;
+        /* segments are mapped contiguously, so the base is where offset 0 is mapped */
+        table[count].base = start - offset;
+        count++;
+    }
+    free(line);
+    fclose(maps);
+
+    /* keep the lowest base of each path */
+    if (count > 0) qsort(table, count, sizeof(struct module), module_compare);
+    for (k = 0, unique = 0; k < count; k++) {
+        if (unique > 0 && strcmp(table[unique - 1].path, table[k].path) == 0) {
+            free(table[k].path);
+            continue;
+        }
+        table[unique++] = table[k];
+    }
+
+    for (k = 0; k < nmodules; k++) free(modules[k].path);
+    free(modules);
+    modules = table;
+    nmodules = unique;
+    return 1;
+}
+
+/* index of the first module whose basename is not less than name */
+static int module_lower_bound(const char *name) {
+    int low = 0, high = nmodules;
+    while (low < high) {
+        int middle = (low + high) / 2;
+        if (strcmp(modules[middle].name, name) < 0) low = middle + 1;
+        else high = middle;
+    }
+    return low;
+}
+
+/*
+ * Find loaded modules by absolute path, or by basename in the order of search directories
+ * followed by other directories. At most count (not more than kMaxCandidateCount) modules are
+ * saved into paths and bases, and the
+ * snapshot is refreshed once if none is found. Returns the count of modules found.
+ */
+static int find_modules(const char *filename, char (*paths)[PATH_MAX], uintptr_t *bases,
+                        int count) {
+    const char *slash = strrchr(filename, '/');
+    const char *name = slash ? slash + 1 : filename;
+    const struct module *found[kMaxCandidateCount];
+    int result = 0, refreshed = 0, k, d, first, last;
+
+    pthread_mutex_lock(&modules_lock);
+    if (!modules) load_modules();
+    for (;;) {
+        first = module_lower_bound(name);
+        for (last = first; last < nmodules && strcmp(modules[last].name, name) == 0;) last++;
+
+        if (filename[0] == '/') {
+            for (k = first; k < last && result < count; k++)
+                if (strcmp(modules[k].path, filename) == 0) found[result++] = modules + k;
+        } else {
+            for (d = 0; d < (int) (sizeof(kSearchDirs) / sizeof(kSearchDirs[0])); d++) {
+                size_t dir_length = strlen(kSearchDirs[d]);
+                for (k = first; k < last && result < count; k++)
+                    if (strncmp(modules[k].path, kSearchDirs[d], dir_length) == 0 &&
+                        strcmp(modules[k].path + dir_length, name) == 0)
+                        found[result++] = modules + k;
+            }
+            for (k = first; k < last && result < count; k++) {
+                int duplicate = 0;
+                for (d = 0; d < result; d++) if (found[d] == modules + k) duplicate = 1;
+                if (!duplicate) found[result++] = modules + k;
+            }
+        }
+
+        if (result > 0 || refreshed || !load_modules()) break;
+        refreshed = 1;
+    }
+    /* copy results, because the snapshot may be refreshed by others later */
+    for (k = 0; k < result; k++) {
+        strncpy(paths[k], found[k]->path, PATH_MAX - 1);
+        paths[k][PATH_MAX - 1] = '\0';
+        bases[k] = found[k]->base;
+    }
+    pthread_mutex_unlock(&modules_lock);
+    return result;
+}
+
+static void *fake_dlopen_at(const char *libpath, off_t load_addr, int flags);
+
 extern "C" {
 
 int fake_dlclose(void *handle) {
     if (handle) {
         struct ctx *ctx = (struct ctx *) handle;
-        if (ctx->dynsym) free(ctx->dynsym);    /* we're saving dynsym and dynstr */
-        if (ctx->dynstr) free(ctx->dynstr);    /* from library file just in case */
+        if (ctx->map) {
+            munmap(ctx->map, ctx->map_size);  /* tables point into the mapping */
+        } else {
+            if (ctx->dynsym) free(ctx->dynsym);    /* we're saving dynsym and dynstr */
+            if (ctx->dynstr) free(ctx->dynstr);    /* from library file just in case */
+            if (ctx->gnu_hash) free(ctx->gnu_hash);
+            if (ctx->hash) free(ctx->hash);
+        }
         free(ctx);
     }
     return 0;
 }
 
-/* flags are ignored */
+/* flags other than FAKE_DLOPEN_COPY_SECTIONS are ignored */
 void *fake_dlopen_with_path(const char *libpath, int flags) {
-    FILE *maps;
-    char buff[256];
+    char path[1][PATH_MAX];
+    uintptr_t base;
+    if (libpath[0] != '/' || !find_modules(libpath, path, &base, 1)) {
+        log_err("%s not found in my userspace", libpath);
+        return 0;
+    }
+    return fake_dlopen_at(libpath, (off_t) base, flags);
+}
+
+}
+
+static void *fake_dlopen_at(const char *libpath, off_t load_addr, int flags) {
     struct ctx *ctx = 0;
-    off_t load_addr, size;
-    int k, fd = -1, found = 0;
+    off_t size;
+    int k, fd = -1, biased = 0;
+    size_t gnu_hash_size = 0, hash_size = 0;
     char *shoff;
     Elf_Ehdr *elf = (Elf_Ehdr *) MAP_FAILED;
 
 #define fatal(fmt, args...) do { log_err(fmt,##args); goto err_exit; } while(0)
 
-    maps = fopen("/proc/self/maps", "r");
-    if (!maps) fatal("failed to open maps");
-
-    while (!found && fgets(buff, sizeof(buff), maps)) {
-        if (strstr(buff, libpath) && (strstr(buff, "r-xp") || strstr(buff, "r--p"))) found = 1;
-    }
-    fclose(maps);
-
-    if (!found) fatal("%s not found in my userspace", libpath);
-
-    if (sscanf(buff, "%lx", &load_addr) != 1)
-        fatal("failed to read load address for %s", libpath);
-
     log_info("%s loaded in Android at 0x%016lx", libpath, load_addr);
 
-    /* Now, mmap the same library once again */
+    /* Now, open the same library once again */
 
     fd = open(libpath, O_RDONLY);
     if (fd < 0) fatal("failed to open %s", libpath);
@@ -112,16 +533,24 @@ void *fake_dlopen_with_path(const char *libpath, int flags) {
     size = lseek(fd, 0, SEEK_END);
     if (size <= 0) fatal("lseek() failed for %s", libpath);
 
+    ctx = (struct ctx *) calloc(1, sizeof(struct ctx));
+    if (!ctx) fatal("no memory for %s", libpath);
+
+    ctx->load_addr = (void *) load_addr;
+
+    if (!(flags & FAKE_DLOPEN_COPY_SECTIONS) && load_dynamic(ctx, fd, size)) {
+        close(fd);
+        log_dbg("%s: ok, mapped dynsym = %p, dynstr = %p", libpath, ctx->dynsym, ctx->dynstr);
+        return ctx;
+    }
+
+    /* Otherwise, mmap the whole library and copy sections found by section headers */
+
     elf = (Elf_Ehdr *) mmap(0, size, PROT_READ, MAP_SHARED, fd, 0);
     close(fd);
     fd = -1;
 
     if (elf == MAP_FAILED) fatal("mmap() failed for %s", libpath);
-
-    ctx = (struct ctx *) calloc(1, sizeof(struct ctx));
-    if (!ctx) fatal("no memory for %s", libpath);
-
-    ctx->load_addr = (void *) load_addr;
     shoff = ((char *) elf) + elf->e_shoff;
 
     for (k = 0; k < elf->e_shnum; k++, shoff += elf->e_shentsize) {
@@ -146,11 +575,28 @@ void *fake_dlopen_with_path(const char *libpath, int flags) {
                 memcpy(ctx->dynstr, ((char *) elf) + sh->sh_offset, sh->sh_size);
                 break;
 
+            case SHT_GNU_HASH:
+                if (ctx->gnu_hash) break;
+                ctx->gnu_hash = malloc(sh->sh_size);
+                if (!ctx->gnu_hash) fatal("%s: no memory for .gnu.hash", libpath);
+                memcpy(ctx->gnu_hash, ((char *) elf) + sh->sh_offset, sh->sh_size);
+                gnu_hash_size = sh->sh_size;
+                break;
+
+            case SHT_HASH:
+                if (ctx->hash) break;
+                ctx->hash = malloc(sh->sh_size);
+                if (!ctx->hash) fatal("%s: no memory for .hash", libpath);
+                memcpy(ctx->hash, ((char *) elf) + sh->sh_offset, sh->sh_size);
+                hash_size = sh->sh_size;
+                break;
+
             case SHT_PROGBITS:
-                if (!ctx->dynstr || !ctx->dynsym) break;
+                if (!ctx->dynstr || !ctx->dynsym || biased) break;
                 /* won't even bother checking against the section name */
                 ctx->bias = (off_t) sh->sh_addr - (off_t) sh->sh_offset;
-                k = elf->e_shnum;  /* exit for */
+                /* keep walking, hash sections may follow */
+                biased = 1;
                 break;
         }
     }
@@ -160,6 +606,17 @@ void *fake_dlopen_with_path(const char *libpath, int flags) {
 
     if (!ctx->dynstr || !ctx->dynsym) fatal("dynamic sections not found in %s", libpath);
 
+    /* prefer .gnu.hash, fall back to .hash, or scan .dynsym linearly without both */
+    if (ctx->gnu_hash && !gnu_hash_valid(ctx->gnu_hash, gnu_hash_size, ctx->nsyms)) {
+        log_err("%s: invalid .gnu.hash", libpath);
+        free(ctx->gnu_hash);
+        ctx->gnu_hash = 0;
+    }
+    if (ctx->hash && (ctx->gnu_hash || !hash_valid(ctx->hash, hash_size, ctx->nsyms))) {
+        free(ctx->hash);
+        ctx->hash = 0;
+    }
+
 #undef fatal
 
     log_dbg("%s: ok, dynsym = %p, dynstr = %p", libpath, ctx->dynsym, ctx->dynstr);
@@ -173,73 +630,34 @@ void *fake_dlopen_with_path(const char *libpath, int flags) {
     return 0;
 }
 
-
-#if defined(__LP64__)
-static const char *const kSystemLibDir = "/system/lib64/";
-static const char *const kOdmLibDir = "/odm/lib64/";
-static const char *const kVendorLibDir = "/vendor/lib64/";
-static const char *const kApexLibDir = "/apex/com.android.runtime/lib64/";
-static const char *const kApexArtNsLibDir = "/apex/com.android.art/lib64/";
-#else
-static const char *const kSystemLibDir = "/system/lib/";
-static const char *const kOdmLibDir = "/odm/lib/";
-static const char *const kVendorLibDir = "/vendor/lib/";
-static const char *const kApexLibDir = "/apex/com.android.runtime/lib/";
-static const char *const kApexArtNsLibDir = "/apex/com.android.art/lib/";
-#endif
+extern "C" {
 
 void *fake_dlopen(const char *filename, int flags) {
-    if (strlen(filename) > 0 && filename[0] == '/') {
-        return fake_dlopen_with_path(filename, flags);
-    } else {
-        char buf[512] = {0};
-        void *handle = NULL;
-        //sysmtem
-        strcpy(buf, kSystemLibDir);
-        strcat(buf, filename);
-        handle = fake_dlopen_with_path(buf, flags);
-        if (handle) {
-            return handle;
-        }
-
-        // apex in ns com.android.runtime
-        memset(buf, 0, sizeof(buf));
-        strcpy(buf, kApexLibDir);
-        strcat(buf, filename);
-        handle = fake_dlopen_with_path(buf, flags);
-        if (handle) {
-            return handle;
-        }
-
-        // apex in ns com.android.art
-        memset(buf, 0, sizeof(buf));
-        strcpy(buf, kApexArtNsLibDir);
-        strcat(buf, filename);
-        handle = fake_dlopen_with_path(buf, flags);
-        if (handle) {
-            return handle;
-        }
-
-        //odm
-        memset(buf, 0, sizeof(buf));
-        strcpy(buf, kOdmLibDir);
-        strcat(buf, filename);
-        handle = fake_dlopen_with_path(buf, flags);
-        if (handle) {
-            return handle;
-        }
+    char paths[kMaxCandidateCount][PATH_MAX];
+    uintptr_t bases[kMaxCandidateCount];
+    int count, k;
+    void *handle;
+
+    if (strlen(filename) == 0) return 0;
+    count = find_modules(filename, paths, bases, kMaxCandidateCount);
+    for (k = 0; k < count; k++) {
+        handle = fake_dlopen_at(paths[k], (off_t) bases[k], flags);
+        if (handle) return handle;
+    }
+    if (count == 0) log_err("%s not found in my userspace", filename);
+    return 0;
+}
 
-        //vendor
-        memset(buf, 0, sizeof(buf));
-        strcpy(buf, kVendorLibDir);
-        strcat(buf, filename);
-        handle = fake_dlopen_with_path(buf, flags);
-        if (handle) {
-            return handle;
-        }
+int fake_dlmodule(const char *filename, char *path, size_t path_size, void **base) {
+    char paths[1][PATH_MAX];
+    uintptr_t bases[1];
 
-        return fake_dlopen_with_path(filename, flags);
-    }
+    if (strlen(filename) == 0 || path_size == 0) return 0;
+    if (!find_modules(filename, paths, bases, 1)) return 0;
+    strncpy(path, paths[0], path_size - 1);
+    path[path_size - 1] = '\0';
+    *base = (void *) bases[0];
+    return 1;
 }
 
 void *fake_dlsym(void *handle, const char *name) {
@@ -248,17 +666,51 @@ void *fake_dlsym(void *handle, const char *name) {
     Elf_Sym *sym = (Elf_Sym *) ctx->dynsym;
     char *strings = (char *) ctx->dynstr;
 
+    if (ctx->gnu_hash || ctx->hash) {
+        sym = ctx->gnu_hash ? gnu_hash_lookup(ctx, name) : hash_lookup(ctx, name);
+        if (!sym) return 0;
+        void *ret = symbol_address(ctx, sym);
+        log_info("%s found at %p", name, ret);
+        return ret;
+    }
+
     for (k = 0; k < ctx->nsyms; k++, sym++)
-        if (strcmp(strings + sym->st_name, name) == 0) {
-            /*  NB: sym->st_value is an offset into the section for relocatables,
-            but a VMA for shared libs or exe files, so we have to subtract the bias */
-            void *ret = (char *) ctx->load_addr + sym->st_value - ctx->bias;
+        if (sym->st_shndx != SHN_UNDEF && strcmp(strings + sym->st_name, name) == 0) {
+            void *ret = symbol_address(ctx, sym);
             log_info("%s found at %p", name, ret);
             return ret;
         }
     return 0;
 }
 
+int fake_dlsym_many(void *handle, const char *const *names, void **symbols, int count) {
+    int i, k, found = 0;
+    struct ctx *ctx = (struct ctx *) handle;
+    Elf_Sym *sym = (Elf_Sym *) ctx->dynsym;
+    char *strings = (char *) ctx->dynstr;
+
+    if (ctx->gnu_hash || ctx->hash) {
+        for (i = 0; i < count; i++) {
+            symbols[i] = fake_dlsym(handle, names[i]);
+            if (symbols[i]) found++;
+        }
+        return found;
+    }
+
+    /* without hash tables, resolve all names in a single walk of .dynsym */
+    for (i = 0; i < count; i++) symbols[i] = 0;
+    for (k = 0; k < ctx->nsyms && found < count; k++, sym++) {
+        if (sym->st_shndx == SHN_UNDEF) continue;
+        const char *sym_name = strings + sym->st_name;
+        for (i = 0; i < count; i++) {
+            if (symbols[i] || strcmp(sym_name, names[i]) != 0) continue;
+            symbols[i] = symbol_address(ctx, sym);
+            found++;
+        }
+    }
+    return found;
+}
+
 static const char *fake_dlerror() {
     return NULL;
 }
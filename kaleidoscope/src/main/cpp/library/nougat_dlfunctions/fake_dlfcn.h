@@ -25,14 +25,36 @@
 #ifndef NOUGAT_DLFUNCTIONS_FAKE_DLFCN_H
 #define NOUGAT_DLFUNCTIONS_FAKE_DLFCN_H
 
+#include <stddef.h>
+
+/*
+ * Flag of fake_dlopen() for copying symbol tables found by section headers into heap, instead
+ * of mapping them from the file through PT_DYNAMIC. It is the fallback if the library has no
+ * hash tables.
+ */
+#define FAKE_DLOPEN_COPY_SECTIONS 0x40000000
+
 extern "C" {
 
 int fake_dlclose(void *handle);
 
 void *fake_dlopen(const char *libpath, int flags);
 
+/*
+ * Find the loaded module which fake_dlopen() opens first for filename, without reading the
+ * library file. Its path is copied into path and its load base is saved into base.
+ * Returns 1 if the module is found, otherwise 0.
+ */
+int fake_dlmodule(const char *filename, char *path, size_t path_size, void **base);
+
 void *fake_dlsym(void *handle, const char *name);
 
+/*
+ * Resolve count symbols in names into symbols, null for those not found.
+ * Returns the count of symbols found.
+ */
+int fake_dlsym_many(void *handle, const char *const *names, void **symbols, int count);
+
 };
 
 #endif
@@ -22,21 +22,19 @@
  * SOFTWARE.
  */
 
+#include <string_view>
+
 #include "log.h"
 
 namespace moe::aoramd::kaleidoscope {
 
     int Log::log_level_ = Level::kError;
 
-    std::string convert_file_name(const char *file_path) {
-        return std::regex_replace(file_path, std::regex("(.*)(/|\\\\)(.*)"), "$3");
-    }
+    static_assert(std::string_view(file_name("src/main/cpp/log.cpp")) == "log.cpp");
+    static_assert(std::string_view(file_name("src\\main\\cpp\\log.cpp")) == "log.cpp");
+    static_assert(std::string_view(file_name("log.cpp")) == "log.cpp");
 
     void Log::Initialize(int level) {
         log_level_ = level;
     }
-
-    int Log::GetLogLevel() {
-        return log_level_;
-    }
 }
\ No newline at end of file
@@ -25,34 +25,49 @@
 #ifndef KALEIDOSCOPE_LOG_H
 #define KALEIDOSCOPE_LOG_H
 
-#include <android/log.h>
-#include <string>
-#include <regex>
-
 #define __default_log_tag__ "Kaleidoscope"
 
-#define debugLog(message, ...) if (Log::Level::kDebug >= Log::GetLogLevel())\
-    __android_log_print(ANDROID_LOG_DEBUG, __default_log_tag__, "C++ %s %s() line %d - " message,\
-        convert_file_name(__FILE__).c_str(), __FUNCTION__, __LINE__, ##__VA_ARGS__);
+/*
+ * Minimum log level compiled into the library, see Log::Level. Logs of lower levels are removed
+ * at compile time together with their arguments. It is set by CMake option
+ * KALEIDOSCOPE_MIN_LOG_LEVEL.
+ */
+#if !defined(KALEIDOSCOPE_MIN_LOG_LEVEL)
+#define KALEIDOSCOPE_MIN_LOG_LEVEL 0
+#endif
 
-#define warnLog(message, ...) if (Log::Level::kWarn >= Log::GetLogLevel()) {\
-        if (Log::Level::kDebug >= Log::GetLogLevel()) {\
-            __android_log_print(ANDROID_LOG_WARN, __default_log_tag__, "C++ %s %s() line %d - " message,\
-                convert_file_name(__FILE__).c_str(), __FUNCTION__, __LINE__, ##__VA_ARGS__);\
-        } else {\
-            __android_log_print(ANDROID_LOG_WARN, __default_log_tag__, "C++ - " message, ##__VA_ARGS__);\
-        }\
-    }
+// Logs are written to standard error in host builds, which have no Android log library.
+#if defined(__ANDROID__)
+#include <android/log.h>
+#define __log_print__(priority, message, ...) \
+    __android_log_print(ANDROID_LOG_##priority, __default_log_tag__, message, ##__VA_ARGS__)
+#else
+#include <cstdio>
+#define __log_print__(priority, message, ...) \
+    fprintf(stderr, #priority " " __default_log_tag__ " " message "\n", ##__VA_ARGS__)
+#endif
 
-#define errorLog(message, ...) if (Log::Level::kError >= Log::GetLogLevel()) {\
-        if (Log::Level::kDebug >= Log::GetLogLevel()) {\
-            __android_log_print(ANDROID_LOG_ERROR, __default_log_tag__, "C++ %s %s() line %d - " message,\
-                convert_file_name(__FILE__).c_str(), __FUNCTION__, __LINE__, ##__VA_ARGS__);\
+/*
+ * Arguments are only evaluated if the level is enabled, so they can be expensive, such as a
+ * dump of runtime method data.
+ */
+#define __log__(level, priority, message, ...) if (Log::IsEnabled(Log::Level::level)) {\
+        if (Log::IsEnabled(Log::Level::kDebug)) {\
+            constexpr const char *__log_file_name__ =\
+                    moe::aoramd::kaleidoscope::file_name(__FILE__);\
+            __log_print__(priority, "C++ %s %s() line %d - " message,\
+                __log_file_name__, __FUNCTION__, __LINE__, ##__VA_ARGS__);\
         } else {\
-            __android_log_print(ANDROID_LOG_ERROR, __default_log_tag__, "C++ - " message, ##__VA_ARGS__);\
+            __log_print__(priority, "C++ - " message, ##__VA_ARGS__);\
         }\
     }
 
+#define debugLog(message, ...) __log__(kDebug, DEBUG, message, ##__VA_ARGS__)
+
+#define warnLog(message, ...) __log__(kWarn, WARN, message, ##__VA_ARGS__)
+
+#define errorLog(message, ...) __log__(kError, ERROR, message, ##__VA_ARGS__)
+
 #if defined(__aarch64__) || defined(__x86_64__)
 #define __log_memory_specifier__ "0x%016lx"
 #elif defined(__arm__) || defined(__i386__)
@@ -61,14 +76,28 @@
 
 namespace moe::aoramd::kaleidoscope {
 
-    std::string convert_file_name(const char *file_path);
+    /**
+     * Get file name from a file path at compile time.
+     *
+     * @param file_path file path separated by slashes or backslashes.
+     * @return pointer to the file name in file path.
+     */
+    constexpr const char *file_name(const char *file_path) {
+        const char *result = file_path;
+        for (const char *pointer = file_path; *pointer != '\0'; pointer++) {
+            if (*pointer == '/' || *pointer == '\\') result = pointer + 1;
+        }
+        return result;
+    }
 
     class Log final {
     public:
 
         static void Initialize(int level);
 
-        static int GetLogLevel();
+        static int GetLogLevel() {
+            return log_level_;
+        }
 
         enum Level {
             kDebug = 0,
@@ -78,6 +107,17 @@ namespace moe::aoramd::kaleidoscope {
             kUnknown [[maybe_unused]] = 100
         };
 
+        /**
+         * Check whether logs of a level are compiled and enabled. Levels lower than
+         * KALEIDOSCOPE_MIN_LOG_LEVEL are always disabled without reading log level.
+         *
+         * @param level log level.
+         * @return true if logs of the level are printed.
+         */
+        static bool IsEnabled(Level level) {
+            return level >= KALEIDOSCOPE_MIN_LOG_LEVEL && level >= log_level_;
+        }
+
     private:
 
         static int log_level_;
@@ -0,0 +1,44 @@
+/*
+ * MIT License
+ *
+ * Copyright (C) 2021 M.D.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <cstring>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "memory.h"
+
+namespace moe::aoramd::kaleidoscope::internal {
+
+    bool Memory::Unprotect(void *start, std::size_t size) {
+        std::size_t page_size = sysconf(_SC_PAGESIZE);
+        std::size_t alignment = reinterpret_cast<std::size_t>(start) % page_size;
+        return mprotect(
+                reinterpret_cast<void *>(reinterpret_cast<std::size_t>(start) - alignment),
+                size + alignment, PROT_READ | PROT_WRITE | PROT_EXEC) == 0;
+    }
+
+    void Memory::Copy(void *destination, void *source, std::size_t size) {
+        memcpy(destination, source, size);
+    }
+}
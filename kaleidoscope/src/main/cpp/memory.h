@@ -0,0 +1,57 @@
+/*
+ * MIT License
+ *
+ * Copyright (C) 2021 M.D.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef KALEIDOSCOPE_MEMORY_H
+#define KALEIDOSCOPE_MEMORY_H
+
+#include <cstddef>
+
+namespace moe::aoramd::kaleidoscope::internal {
+
+    class Memory final {
+    public:
+        /**
+         * Disable all access restrictions for the specified memory in units of memory pages.
+         *
+         * @param start memory start address. The starting address of affected space may be
+         *        smaller than this due to memory page alignment.
+         * @param size memory size. The size of affected space may be larger than this due to
+         *        memory page alignment.
+         * @return 0 on success or -1 on failure.
+         */
+        static bool Unprotect(void *start, std::size_t size);
+
+        /**
+         * Copies the values of num bytes from the location pointed to by source directly
+         * to the memory block pointed to by destination.
+         *
+         * @param destination pointer to the destination array where the content is to be copied.
+         * @param source pointer to the source of data to be copied.
+         * @param size number of bytes to copy.
+         */
+        static void Copy(void *destination, void *source, std::size_t size);
+    };
+}
+
+#endif
@@ -22,6 +22,9 @@
  * SOFTWARE.
  */
 
+#include <algorithm>
+#include <cstdio>
+#include <iterator>
 #include <string>
 
 #include "mirror.h"
@@ -39,6 +42,10 @@ namespace moe::aoramd::kaleidoscope::mirror {
     std::size_t Method::entry_point_for_quick_compiled_code_offset_ = 0;
     std::size_t Method::access_flag_offset_ = 0;
     void *Method::entry_point_for_jit_compile_ = nullptr;
+    void *Method::uncompiled_entry_points_[kUncompiledEntryPointCount] = {};
+    bool Method::compiled_check_enabled_ = false;
+    std::unordered_map<Method *, Method::Compilation> Method::compiled_methods_;
+    std::mutex Method::compiled_methods_mutex_;
 
     template<typename T>
     ALWAYS_INLINE int find_offset(void *start, T target, int range) {
@@ -82,13 +89,17 @@ namespace moe::aoramd::kaleidoscope::mirror {
 
         friend bool Method::Initialize(JNIEnv *env, Thread *current_thread,
                                        Method *standard_method,
-                                       Method *relative_method);
+                                       Method *relative_method,
+                                       Method *static_method,
+                                       Method *native_method);
     };
 
     bool Method::Initialize(JNIEnv *env,
                             Thread *current_thread,
                             Method *standard_method,
-                            Method *relative_method) {
+                            Method *relative_method,
+                            Method *static_method,
+                            Method *native_method) {
 
         // Initialize method compile entrances.
         if (runtime::Runtime::AndroidVersionAtLeast(runtime::AndroidVersion::kR, true)) {
@@ -177,11 +188,22 @@ namespace moe::aoramd::kaleidoscope::mirror {
             // Below Android 7, Android Runtime only uses AOT-compile mode.
             entry_point_for_jit_compile_ = nullptr;
         } else {
+            // Stubs are read before the standard method is compiled, and methods are always
+            // compiled if any of them is not found.
+            uncompiled_entry_points_[0] = relative_method->GetEntryPointFromQuickCompiledCode();
+            uncompiled_entry_points_[1] = static_method->GetEntryPointFromQuickCompiledCode();
+            uncompiled_entry_points_[2] = native_method->GetEntryPointFromQuickCompiledCode();
+            compiled_check_enabled_ = std::none_of(
+                    std::begin(uncompiled_entry_points_), std::end(uncompiled_entry_points_),
+                    [](void *entry_point) { return entry_point == nullptr; });
+            if (!compiled_check_enabled_) {
+                warnLog("Unable to find entry points of methods without compiled code, so methods are always compiled.")
+            }
             void *entry_point_before_compile =
                     standard_method->GetEntryPointFromQuickCompiledCode();
             // Use CompileInternal() instead of Compile() to skip the compilation check,
             // because the data related to the compilation check has not been initialized.
-            standard_method->Compile(current_thread);
+            standard_method->CompileInternal(current_thread);
             void *entry_point_after_compile =
                     standard_method->GetEntryPointFromQuickCompiledCode();
             if (entry_point_before_compile != entry_point_after_compile) {
@@ -203,16 +225,25 @@ namespace moe::aoramd::kaleidoscope::mirror {
         *pointer = *pointer & ~kAccessFlagPublicMask | kAccessFlagPrivateMask;
     }
 
+    bool Method::IsStatic() {
+        auto *pointer = reinterpret_cast<std::uint32_t *>(this + access_flag_offset_);
+        return (*pointer & kAccessFlagStaticMask) != 0;
+    }
+
     std::string Method::GetDataHexString() {
+        // Each word is printed as "0x%08x" and separated by ", ", so data is formatted in place.
+        static const std::size_t kWordLength = 12;
         auto base = reinterpret_cast<std::size_t>(this);
-        std::string data = "[";
-        char buffer[11];
-        for (std::size_t i = 0; i < runtime_method_size_; i += sizeof(std::uint32_t)) {
-            sprintf(buffer, "0x%08x", *reinterpret_cast<std::uint32_t *>(base + i));
-            if (i != 0) data += ", ";
-            data += buffer;
+        std::size_t count = runtime_method_size_ / sizeof(std::uint32_t);
+        std::string data(count * kWordLength + 2, '\0');
+        char *cursor = data.data();
+        *cursor++ = '[';
+        for (std::size_t i = 0; i < count; i++) {
+            auto word = *reinterpret_cast<std::uint32_t *>(base + i * sizeof(std::uint32_t));
+            cursor += snprintf(cursor, kWordLength + 1, i == 0 ? "0x%08x" : ", 0x%08x", word);
         }
-        data += "]";
+        *cursor++ = ']';
+        data.resize(cursor - data.data());
         return data;
     }
 
@@ -223,9 +254,42 @@ namespace moe::aoramd::kaleidoscope::mirror {
                 entry_point_for_quick_compiled_code_offset_);
     }
 
+    bool Method::IsCompiled() {
+        if (!compiled_check_enabled_) return false;
+        void *entry_point = GetEntryPointFromQuickCompiledCode();
+        if (entry_point == nullptr || entry_point == entry_point_for_jit_compile_) return false;
+        for (void *uncompiled_entry_point : uncompiled_entry_points_) {
+            if (entry_point == uncompiled_entry_point) return false;
+        }
+        return true;
+    }
+
     bool Method::Compile(Thread *current_thread) {
         if (!runtime::Runtime::AndroidVersionAtLeast(runtime::AndroidVersion::kNougat)) return true;
-        // TODO: Check whether is compiled.
+        if (IsCompiled()) {
+            debugLog("Runtime method " __log_memory_specifier__ " is already compiled.",
+                     reinterpret_cast<std::size_t>(this))
+            return true;
+        }
+        std::lock_guard<std::mutex> lock(compiled_methods_mutex_);
+        auto iterator = compiled_methods_.find(this);
+        if (iterator != compiled_methods_.end() &&
+            iterator->second.entry_point_ == GetEntryPointFromQuickCompiledCode()) {
+            // Entry point is not changed since the last compilation, whose result still holds.
+            return iterator->second.compiled_;
+        }
+        bool result = CompileInternal(current_thread);
+        if (compiled_methods_.size() >= kMaxCompiledMethodCount) compiled_methods_.clear();
+        compiled_methods_[this] = {GetEntryPointFromQuickCompiledCode(), result};
+        return result;
+    }
+
+    void Method::ForgetCompilation() {
+        std::lock_guard<std::mutex> lock(compiled_methods_mutex_);
+        compiled_methods_.erase(this);
+    }
+
+    bool Method::CompileInternal(Thread *current_thread) {
         auto *state_and_flags = reinterpret_cast<int32_t *>(current_thread);
         std::int32_t state_and_flags_backup = *state_and_flags;
         bool result = compiler_->Compile(this, current_thread);
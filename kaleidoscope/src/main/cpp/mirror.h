@@ -26,7 +26,9 @@
 #define KALEIDOSCOPE_MIRROR_H
 
 #include <jni.h>
+#include <mutex>
 #include <string>
+#include <unordered_map>
 
 #include "declare.h"
 
@@ -60,18 +62,31 @@ namespace moe::aoramd::kaleidoscope::mirror {
          * @param current_thread current thread native peer for compile standard method.
          * @param standard_method standard method. It is used for calculate runtime method size.
          * @param relative_method relative method. It is used for calculate runtime method size.
+         * @param static_method static method of a class never initialized. It is used for
+         *        finding the entry point of runtime methods to be resolved.
+         * @param native_method native method never registered. It is used for finding the entry
+         *        point of native runtime methods without compiled code.
          * @return
          */
         static bool Initialize(JNIEnv *env,
                                Thread *current_thread,
                                Method *standard_method,
-                               Method *relative_method);
+                               Method *relative_method,
+                               Method *static_method,
+                               Method *native_method);
 
         /**
          * Set access flag private.
          */
         void SetPrivate();
 
+        /**
+         * Check whether access flag static is set.
+         *
+         * @return true if runtime method is static.
+         */
+        bool IsStatic();
+
         /**
          * Get size of runtime method object.
          *
@@ -85,7 +100,9 @@ namespace moe::aoramd::kaleidoscope::mirror {
         }
 
         /**
-         * Returns data of the object saved as a string. It is used for debugging.
+         * Returns data of the object saved as a string. It is used for debugging, and it should
+         * only be called in arguments of debugLog(), which are not evaluated if debug logs are
+         * disabled.
          *
          * @return string used to print the log.
          */
@@ -96,24 +113,94 @@ namespace moe::aoramd::kaleidoscope::mirror {
         void *GetEntryPointFromQuickCompiledCode();
 
         /**
-         * Force runtime method to be compiled in JIT mode.
+         * Check whether runtime method has compiled code. Runtime method is not compiled if its
+         * entry point is the JIT compile entrance or one of interpreter, resolution and generic
+         * JNI stubs. Runtime method is always regarded as not compiled if any stub is not found,
+         * because its entry point may be a stub shared with other runtime methods.
+         *
+         * @return true if the runtime method is compiled.
+         */
+        bool IsCompiled();
+
+        /**
+         * Remove runtime method from compiled methods, so that it is checked and compiled again
+         * when it is inserted next time. It is invoked when bridge code of it is restored.
+         */
+        void ForgetCompilation();
+
+        /**
+         * Force runtime method to be compiled in JIT mode. Compilation is skipped if the runtime
+         * method is already compiled.
          *
          * @param current_thread current thread native peer.
          * @return true if the runtime method is compiled.
          */
         bool Compile(Thread *current_thread);
 
+        /**
+         * Force runtime method to be compiled in JIT mode without the compilation check.
+         *
+         * @param current_thread current thread native peer.
+         * @return true if the runtime method is compiled.
+         */
+        bool CompileInternal(Thread *current_thread);
+
         static Compiler *compiler_;
         static std::size_t runtime_method_size_;
         static std::size_t entry_point_for_quick_compiled_code_offset_;
         static std::size_t access_flag_offset_;
         static void *entry_point_for_jit_compile_;
 
+        /**
+         * Compilation of a runtime method by Kaleidoscope.
+         */
+        struct Compilation {
+            /**
+             * Entry point of runtime method after compiling.
+             */
+            void *entry_point_;
+
+            /**
+             * Whether JIT compiled runtime method.
+             */
+            bool compiled_;
+        };
+
+        /**
+         * Compilations of runtime methods by Kaleidoscope. A method is not compiled again until
+         * its entry point is changed, and the result of its last compilation is returned
+         * instead. It is cleared once it holds kMaxCompiledMethodCount methods.
+         */
+        static std::unordered_map<Method *, Compilation> compiled_methods_;
+        static std::mutex compiled_methods_mutex_;
+
+        static constexpr std::size_t kMaxCompiledMethodCount = 4096;
+
+        /**
+         * Stubs are local symbols of libart which cannot be looked up, so their addresses are
+         * read from entry points of runtime methods known to use them: the interpreter bridge
+         * from a method never invoked, the resolution stub from a static method of a class never
+         * initialized, and the generic JNI stub from a native method never registered.
+         */
+        static constexpr int kUncompiledEntryPointCount = 3;
+
+        /**
+         * Entry points of runtime methods without compiled code.
+         */
+        static void *uncompiled_entry_points_[kUncompiledEntryPointCount];
+
+        /**
+         * Whether all entry points of runtime methods without compiled code are found, so that
+         * IsCompiled() can be trusted.
+         */
+        static bool compiled_check_enabled_;
+
         /**
          * Type of access flags in art::ArtMethod is std::atomic<std::uint32_t>.
          */
         static const std::uint32_t kAccessFlagPublicMask = 0b01;
         static const std::uint32_t kAccessFlagPrivateMask = 0b10;
+        static const std::uint32_t kAccessFlagStaticMask = 0b1000;
     };
 
     /**
@@ -0,0 +1,525 @@
+/*
+ * MIT License
+ *
+ * Copyright (C) 2021 M.D.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <cstring>
+
+#include "relocator.h"
+
+namespace moe::aoramd::kaleidoscope::bridge {
+
+    /**
+     * Sign extend the lowest bits of value.
+     */
+    static std::int64_t sign_extend(std::uint64_t value, int bits) {
+        std::uint64_t sign = 1ull << (bits - 1);
+        value &= (1ull << bits) - 1;
+        return static_cast<std::int64_t>((value ^ sign) - sign);
+    }
+
+    static std::uint32_t encode_ldr_literal_x(std::uint32_t rt, std::int32_t offset) {
+        return 0x58000000u | ((static_cast<std::uint32_t>(offset / 4) & 0x7ffff) << 5) | rt;
+    }
+
+    static std::uint32_t encode_b(std::int32_t offset) {
+        return 0x14000000u | (static_cast<std::uint32_t>(offset / 4) & 0x3ffffff);
+    }
+
+    static std::uint32_t encode_br(std::uint32_t rn) {
+        return 0xd61f0000u | (rn << 5);
+    }
+
+    static std::uint32_t encode_blr(std::uint32_t rn) {
+        return 0xd63f0000u | (rn << 5);
+    }
+
+    /**
+     * Write instructions loading 64-bit value into register, and return count of words.
+     *
+     * ldr xN, #8
+     * b #12
+     * .quad value
+     */
+    static std::size_t write_load(std::uint32_t *destination, std::uint32_t rt,
+                                  std::uint64_t value) {
+        destination[0] = encode_ldr_literal_x(rt, 8);
+        destination[1] = encode_b(12);
+        destination[2] = static_cast<std::uint32_t>(value);
+        destination[3] = static_cast<std::uint32_t>(value >> 32);
+        return 4;
+    }
+
+    std::size_t Arm64Relocator::WriteJump(std::uint32_t *destination, std::uint64_t target) {
+        // ldr x17, #8
+        // br x17
+        // .quad target
+        destination[0] = encode_ldr_literal_x(kScratchRegister, 8);
+        destination[1] = encode_br(kScratchRegister);
+        destination[2] = static_cast<std::uint32_t>(target);
+        destination[3] = static_cast<std::uint32_t>(target >> 32);
+        return kJumpSize;
+    }
+
+    std::size_t Arm64Relocator::Relocate(const std::uint32_t *source, std::size_t count,
+                                         std::uint64_t source_address,
+                                         std::uint32_t *destination) {
+        const std::uint64_t source_end = source_address + count * sizeof(std::uint32_t);
+        std::uint32_t *cursor = destination;
+
+        for (std::size_t i = 0; i < count; i++) {
+            const std::uint32_t instruction = source[i];
+            const std::uint64_t pc = source_address + i * sizeof(std::uint32_t);
+
+            if ((instruction & 0x1f000000u) == 0x10000000u) {
+                // ADR / ADRP.
+                std::uint32_t rd = instruction & 0x1f;
+                std::uint64_t immediate = ((instruction >> 5) & 0x7ffff) << 2 |
+                                          ((instruction >> 29) & 0x3);
+                std::uint64_t target;
+                if (instruction & 0x80000000u) {
+                    target = (pc & ~0xfffull) + sign_extend(immediate, 21) * 0x1000;
+                } else {
+                    target = pc + sign_extend(immediate, 21);
+                }
+                cursor += write_load(cursor, rd, target);
+
+            } else if ((instruction & 0x3b000000u) == 0x18000000u) {
+                // LDR (literal), LDRSW (literal) and PRFM (literal).
+                std::uint32_t rt = instruction & 0x1f;
+                std::uint32_t opc = instruction >> 30;
+                bool simd = instruction & 0x04000000u;
+                std::uint64_t target = pc + sign_extend(instruction >> 5, 19) * 4;
+                if (!simd) {
+                    if (opc == 3) {
+                        // Prefetch is only a hint, so it is dropped.
+                        *cursor++ = 0xd503201fu;
+                        continue;
+                    }
+                    cursor += write_load(cursor, rt, target);
+                    static constexpr std::uint32_t kLoadGeneral[] = {
+                            0xb9400000u, // ldr wN, [xN]
+                            0xf9400000u, // ldr xN, [xN]
+                            0xb9800000u, // ldrsw xN, [xN]
+                    };
+                    *cursor++ = kLoadGeneral[opc] | (rt << 5) | rt;
+                } else {
+                    if (opc == 3) return 0;
+                    cursor += write_load(cursor, kScratchRegister, target);
+                    static constexpr std::uint32_t kLoadFloating[] = {
+                            0xbd400000u, // ldr sN, [x17]
+                            0xfd400000u, // ldr dN, [x17]
+                            0x3dc00000u, // ldr qN, [x17]
+                    };
+                    *cursor++ = kLoadFloating[opc] | (kScratchRegister << 5) | rt;
+                }
+
+            } else if ((instruction & 0x7c000000u) == 0x14000000u) {
+                // B / BL.
+                std::uint64_t target = pc + sign_extend(instruction, 26) * 4;
+                if (target >= source_address && target < source_end) return 0;
+                if (instruction & 0x80000000u) {
+                    // ldr x17, #8
+                    // b #12
+                    // .quad target
+                    // blr x17
+                    cursor += write_load(cursor, kScratchRegister, target);
+                    *cursor++ = encode_blr(kScratchRegister);
+                } else {
+                    cursor += WriteJump(cursor, target) / sizeof(std::uint32_t);
+                }
+
+            } else if ((instruction & 0xff000010u) == 0x54000000u ||
+                       (instruction & 0x7c000000u) == 0x34000000u) {
+                // B.cond, CBZ / CBNZ and TBZ / TBNZ.
+                std::uint64_t target;
+                std::uint32_t inverse;
+                if ((instruction & 0xff000010u) == 0x54000000u) {
+                    target = pc + sign_extend(instruction >> 5, 19) * 4;
+                    std::uint32_t condition = instruction & 0xf;
+                    if (condition >= 0xe) {
+                        // Condition AL and NV mean always.
+                        if (target >= source_address && target < source_end) return 0;
+                        cursor += WriteJump(cursor, target) / sizeof(std::uint32_t);
+                        continue;
+                    }
+                    inverse = (instruction & ~0x00ffffefu) | (condition ^ 1);
+                } else if (instruction & 0x02000000u) {
+                    target = pc + sign_extend(instruction >> 5, 14) * 4;
+                    inverse = (instruction & ~0x0007ffe0u) ^ 0x01000000u;
+                } else {
+                    target = pc + sign_extend(instruction >> 5, 19) * 4;
+                    inverse = (instruction & ~0x00ffffe0u) ^ 0x01000000u;
+                }
+                if (target >= source_address && target < source_end) return 0;
+
+                // Branch over the jump if the condition is not satisfied.
+                //
+                // b.!cond #20
+                // ldr x17, #8
+                // br x17
+                // .quad target
+                constexpr std::uint32_t kSkip = 5;
+                *cursor++ = inverse | (kSkip << 5);
+                cursor += WriteJump(cursor, target) / sizeof(std::uint32_t);
+
+            } else {
+                *cursor++ = instruction;
+            }
+        }
+        return (cursor - destination) * sizeof(std::uint32_t);
+    }
+
+    /**
+     * Decoded x86_64 instruction.
+     */
+    struct X86_64Instruction {
+        std::size_t length = 0;
+
+        /**
+         * Size of legacy prefixes.
+         */
+        std::size_t prefix_size = 0;
+
+        std::uint8_t rex = 0;
+
+        /**
+         * Whether opcode is escaped by 0x0f.
+         */
+        bool two_byte = false;
+
+        std::uint8_t opcode = 0;
+
+        std::uint8_t modrm = 0;
+
+        /**
+         * Offset of RIP-relative displacement in instruction, or 0 if there is none.
+         */
+        std::size_t displacement_offset = 0;
+
+        /**
+         * Size of relative branch offset at the end of instruction, or 0 if there is none.
+         */
+        std::size_t branch_size = 0;
+    };
+
+    static bool decode_x86_64(const std::uint8_t *code, X86_64Instruction *instruction) {
+        std::size_t i = 0;
+        bool operand_size_prefix = false;
+        bool address_size_prefix = false;
+        for (; i < 15; i++) {
+            std::uint8_t byte = code[i];
+            if (byte == 0x66) {
+                operand_size_prefix = true;
+            } else if (byte == 0x67) {
+                address_size_prefix = true;
+            } else if (byte != 0xf0 && byte != 0xf2 && byte != 0xf3 && byte != 0x2e &&
+                       byte != 0x36 && byte != 0x3e && byte != 0x26 && byte != 0x64 &&
+                       byte != 0x65) {
+                break;
+            }
+        }
+        instruction->prefix_size = i;
+        if ((code[i] & 0xf0) == 0x40) instruction->rex = code[i++];
+        bool rex_w = instruction->rex & 0x08;
+
+        // Size of immediate whose operand size is 16 or 32 bits.
+        std::size_t immediate_z = operand_size_prefix ? 2 : 4;
+        std::size_t immediate_size = 0;
+        bool has_modrm = false;
+        bool group_test = false;
+
+        std::uint8_t opcode = code[i++];
+        if (opcode == 0x0f) {
+            instruction->two_byte = true;
+            opcode = code[i++];
+            if (opcode == 0x0f || opcode == 0x24 || opcode == 0x26 || opcode == 0x36 ||
+                opcode == 0x39 || (opcode >= 0x3b && opcode <= 0x3f)) {
+                return false;
+            } else if (opcode == 0x38) {
+                i++;
+                has_modrm = true;
+            } else if (opcode == 0x3a) {
+                i++;
+                has_modrm = true;
+                immediate_size = 1;
+            } else if ((opcode & 0xf0) == 0x80) {
+                instruction->branch_size = 4;
+            } else if ((opcode >= 0x05 && opcode <= 0x09) || opcode == 0x0b || opcode == 0x0e ||
+                       (opcode >= 0x30 && opcode <= 0x37) || opcode == 0x77 ||
+                       opcode == 0xa0 || opcode == 0xa1 || opcode == 0xa2 || opcode == 0xa8 ||
+                       opcode == 0xa9 || opcode == 0xaa || (opcode >= 0xc8 && opcode <= 0xcf)) {
+                // Instructions without ModR/M.
+            } else {
+                has_modrm = true;
+                if ((opcode >= 0x70 && opcode <= 0x73) || opcode == 0xa4 || opcode == 0xac ||
+                    opcode == 0xba || (opcode >= 0xc2 && opcode <= 0xc6)) {
+                    immediate_size = 1;
+                }
+            }
+        } else if (opcode < 0x40) {
+            // Arithmetic instructions. Pushing or popping segment registers and BCD
+            // instructions are invalid in 64-bit mode.
+            std::uint8_t low = opcode & 0x07;
+            if (low >= 6) return false;
+            if (low < 4) has_modrm = true;
+            else immediate_size = low == 4 ? 1 : immediate_z;
+        } else if (opcode < 0x50) {
+            // Redundant REX prefix.
+            return false;
+        } else if (opcode < 0x60) {
+            // push / pop.
+        } else if (opcode == 0x63) {
+            has_modrm = true;
+        } else if (opcode == 0x68) {
+            immediate_size = immediate_z;
+        } else if (opcode == 0x69) {
+            has_modrm = true;
+            immediate_size = immediate_z;
+        } else if (opcode == 0x6a) {
+            immediate_size = 1;
+        } else if (opcode == 0x6b) {
+            has_modrm = true;
+            immediate_size = 1;
+        } else if (opcode >= 0x6c && opcode <= 0x6f) {
+            // ins / outs.
+        } else if (opcode >= 0x70 && opcode <= 0x7f) {
+            instruction->branch_size = 1;
+        } else if (opcode == 0x80 || opcode == 0x83) {
+            has_modrm = true;
+            immediate_size = 1;
+        } else if (opcode == 0x81) {
+            has_modrm = true;
+            immediate_size = immediate_z;
+        } else if (opcode >= 0x84 && opcode <= 0x8f) {
+            has_modrm = true;
+        } else if (opcode >= 0x90 && opcode <= 0x9f && opcode != 0x9a) {
+            // nop, xchg, cbw, cwd, pushf, popf, sahf and lahf.
+        } else if ((opcode >= 0xa4 && opcode <= 0xa7) || (opcode >= 0xaa && opcode <= 0xaf)) {
+            // String instructions.
+        } else if (opcode == 0xa8 || (opcode >= 0xb0 && opcode <= 0xb7)) {
+            immediate_size = 1;
+        } else if (opcode == 0xa9) {
+            immediate_size = immediate_z;
+        } else if (opcode >= 0xb8 && opcode <= 0xbf) {
+            immediate_size = rex_w ? 8 : immediate_z;
+        } else if (opcode == 0xc0 || opcode == 0xc1 || opcode == 0xc6) {
+            has_modrm = true;
+            immediate_size = 1;
+        } else if (opcode == 0xc7) {
+            has_modrm = true;
+            immediate_size = immediate_z;
+        } else if (opcode == 0xc2 || opcode == 0xca) {
+            immediate_size = 2;
+        } else if (opcode == 0xc8) {
+            immediate_size = 3;
+        } else if (opcode == 0xcd) {
+            immediate_size = 1;
+        } else if (opcode == 0xc3 || opcode == 0xc9 || opcode == 0xcb || opcode == 0xcc ||
+                   opcode == 0xcf) {
+            // ret, leave, int3 and iret.
+        } else if ((opcode >= 0xd0 && opcode <= 0xd3) || (opcode >= 0xd8 && opcode <= 0xdf)) {
+            has_modrm = true;
+        } else if (opcode == 0xd7 || (opcode >= 0xec && opcode <= 0xef)) {
+            // xlat, in and out.
+        } else if (opcode >= 0xe4 && opcode <= 0xe7) {
+            immediate_size = 1;
+        } else if (opcode == 0xe8 || opcode == 0xe9) {
+            instruction->branch_size = 4;
+        } else if (opcode == 0xeb) {
+            instruction->branch_size = 1;
+        } else if (opcode == 0xf1 || opcode == 0xf4 || opcode == 0xf5 ||
+                   (opcode >= 0xf8 && opcode <= 0xfd)) {
+            // int1, hlt, cmc and flag instructions.
+        } else if (opcode == 0xf6 || opcode == 0xf7) {
+            has_modrm = true;
+            group_test = true;
+        } else if (opcode == 0xfe || opcode == 0xff) {
+            has_modrm = true;
+        } else {
+            // VEX and EVEX prefixes, moffs, loop and other unsupported instructions.
+            return false;
+        }
+        instruction->opcode = opcode;
+
+        if (has_modrm) {
+            std::uint8_t modrm = code[i++];
+            std::uint8_t mod = modrm >> 6;
+            std::uint8_t rm = modrm & 0x07;
+            instruction->modrm = modrm;
+            if (mod != 3) {
+                if (rm == 4) {
+                    std::uint8_t sib = code[i++];
+                    if (mod == 0 && (sib & 0x07) == 5) i += 4;
+                } else if (mod == 0 && rm == 5) {
+                    // EIP-relative addressing is not supported.
+                    if (address_size_prefix) return false;
+                    instruction->displacement_offset = i;
+                    i += 4;
+                }
+                if (mod == 1) i += 1;
+                else if (mod == 2) i += 4;
+            }
+            if (group_test && ((modrm >> 3) & 0x07) < 2) {
+                // test r/m, imm.
+                immediate_size = opcode == 0xf6 ? 1 : immediate_z;
+            }
+        }
+        i += immediate_size + instruction->branch_size;
+
+        if (i > 15) return false;
+        instruction->length = i;
+        return true;
+    }
+
+    std::size_t X86_64Relocator::GetInstructionLength(const std::uint8_t *instruction) {
+        X86_64Instruction decoded;
+        return decode_x86_64(instruction, &decoded) ? decoded.length : 0;
+    }
+
+    std::size_t X86_64Relocator::WriteJump(std::uint8_t *destination, std::uint64_t target) {
+        // jmp *0(%rip)
+        // .quad target
+        static constexpr std::uint8_t kJump[] = {0xff, 0x25, 0x00, 0x00, 0x00, 0x00};
+        memcpy(destination, kJump, sizeof(kJump));
+        memcpy(destination + sizeof(kJump), &target, sizeof(target));
+        return kJumpSize;
+    }
+
+    /**
+     * Write instruction moving 64-bit value into register, and return its size.
+     *
+     * movabs $value, %reg
+     */
+    static std::size_t write_move(std::uint8_t *destination, std::uint8_t reg,
+                                  std::uint64_t value) {
+        destination[0] = 0x48 | (reg >> 3);
+        destination[1] = 0xb8 | (reg & 0x07);
+        memcpy(destination + 2, &value, sizeof(value));
+        return 2 + sizeof(value);
+    }
+
+    std::size_t X86_64Relocator::Relocate(const std::uint8_t *source, std::size_t size,
+                                          std::uint64_t source_address,
+                                          std::uint8_t *destination,
+                                          std::size_t *relocated_size) {
+        // Find out the range of relocated instructions first, for checking branch targets.
+        std::size_t source_size = 0;
+        while (source_size < size) {
+            std::size_t length = GetInstructionLength(source + source_size);
+            if (length == 0) return 0;
+            source_size += length;
+        }
+        const std::uint64_t source_end = source_address + source_size;
+        std::uint8_t *cursor = destination;
+
+        for (std::size_t offset = 0; offset < source_size;) {
+            const std::uint8_t *code = source + offset;
+            X86_64Instruction instruction;
+            decode_x86_64(code, &instruction);
+            const std::size_t length = instruction.length;
+            const std::uint64_t next = source_address + offset + length;
+            offset += length;
+
+            if (instruction.branch_size != 0) {
+                std::int64_t displacement;
+                if (instruction.branch_size == 1) {
+                    displacement = static_cast<std::int8_t>(code[length - 1]);
+                } else {
+                    std::int32_t value;
+                    memcpy(&value, code + length - 4, sizeof(value));
+                    displacement = value;
+                }
+                std::uint64_t target = next + displacement;
+                if (target >= source_address && target < source_end) return 0;
+
+                if (!instruction.two_byte && instruction.opcode == 0xe8) {
+                    // call *2(%rip)
+                    // jmp +8
+                    // .quad target
+                    static constexpr std::uint8_t kCall[] = {
+                            0xff, 0x15, 0x02, 0x00, 0x00, 0x00, 0xeb, 0x08};
+                    memcpy(cursor, kCall, sizeof(kCall));
+                    memcpy(cursor + sizeof(kCall), &target, sizeof(target));
+                    cursor += sizeof(kCall) + sizeof(target);
+                } else if (!instruction.two_byte &&
+                           (instruction.opcode == 0xe9 || instruction.opcode == 0xeb)) {
+                    cursor += WriteJump(cursor, target);
+                } else {
+                    // Jump over the absolute jump if the condition is not satisfied.
+                    //
+                    // j!cc +14
+                    // jmp *0(%rip)
+                    // .quad target
+                    *cursor++ = 0x70 | ((instruction.opcode & 0x0f) ^ 1);
+                    *cursor++ = kJumpSize;
+                    cursor += WriteJump(cursor, target);
+                }
+
+            } else if (instruction.displacement_offset != 0) {
+                std::int32_t displacement;
+                memcpy(&displacement, code + instruction.displacement_offset,
+                       sizeof(displacement));
+                std::uint64_t target = next + displacement;
+                std::uint8_t reg = ((instruction.modrm >> 3) & 0x07) |
+                                   ((instruction.rex & 0x04) ? 0x08 : 0);
+
+                if (!instruction.two_byte && instruction.opcode == 0x8d &&
+                    (instruction.rex & 0x08) && instruction.prefix_size == 0) {
+                    // lea target(%rip), %reg -> movabs $target, %reg
+                    cursor += write_move(cursor, reg, target);
+                } else if (!instruction.two_byte && instruction.opcode == 0x8b &&
+                           instruction.prefix_size == 0) {
+                    // mov target(%rip), %reg -> movabs $target, %reg; mov (%reg), %reg
+                    cursor += write_move(cursor, reg, target);
+                    std::uint8_t low = reg & 0x07;
+                    *cursor++ = 0x40 | (instruction.rex & 0x08) | ((reg >> 3) ? 0x05 : 0);
+                    *cursor++ = 0x8b;
+                    if (low == 4) {
+                        *cursor++ = low << 3 | 0x04;
+                        *cursor++ = 0x24;
+                    } else if (low == 5) {
+                        *cursor++ = 0x40 | low << 3 | low;
+                        *cursor++ = 0x00;
+                    } else {
+                        *cursor++ = low << 3 | low;
+                    }
+                } else {
+                    // Other instructions are kept, if target is still reachable.
+                    std::int64_t adjusted = static_cast<std::int64_t>(
+                            target - (reinterpret_cast<std::uint64_t>(cursor) + length));
+                    if (adjusted < INT32_MIN || adjusted > INT32_MAX) return 0;
+                    std::int32_t value = static_cast<std::int32_t>(adjusted);
+                    memcpy(cursor, code, length);
+                    memcpy(cursor + instruction.displacement_offset, &value, sizeof(value));
+                    cursor += length;
+                }
+
+            } else {
+                memcpy(cursor, code, length);
+                cursor += length;
+            }
+        }
+        *relocated_size = source_size;
+        return cursor - destination;
+    }
+}
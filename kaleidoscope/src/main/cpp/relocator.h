@@ -0,0 +1,147 @@
+/*
+ * MIT License
+ *
+ * Copyright (C) 2021 M.D.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef KALEIDOSCOPE_RELOCATOR_H
+#define KALEIDOSCOPE_RELOCATOR_H
+
+#include <cstddef>
+#include <cstdint>
+
+namespace moe::aoramd::kaleidoscope::bridge {
+
+    /**
+     * A tool class for relocating arm64 instructions to another address.
+     *
+     * PC-relative instructions (ADR, ADRP, LDR literal, B, BL, B.cond, CBZ, CBNZ, TBZ and TBNZ)
+     * are rewritten to use absolute addresses loaded from inline literals, and other instructions
+     * are copied as they are. Register x17 is used as scratch register.
+     */
+    class Arm64Relocator final {
+    public:
+        /**
+         * Relocate instructions.
+         *
+         * Relocation fails if an instruction is unallocated or branches into the relocated
+         * instructions themselves.
+         *
+         * @param source instructions to be relocated.
+         * @param count count of instructions.
+         * @param source_address address where instructions are executed originally.
+         * @param destination memory for relocated instructions, whose size must be at least
+         *        count * kMaxRelocatedInstructionSize.
+         * @return size of relocated instructions in bytes, or 0 on failure.
+         */
+        static std::size_t Relocate(const std::uint32_t *source, std::size_t count,
+                                    std::uint64_t source_address, std::uint32_t *destination);
+
+        /**
+         * Write instructions jumping to absolute address.
+         *
+         * @param destination memory for instructions, whose size must be at least kJumpSize.
+         * @param target target address.
+         * @return size of instructions in bytes.
+         */
+        static std::size_t WriteJump(std::uint32_t *destination, std::uint64_t target);
+
+        /**
+         * Max size of the instructions which a single instruction is relocated to.
+         */
+        static constexpr std::size_t kMaxRelocatedInstructionSize = 6 * sizeof(std::uint32_t);
+
+        /**
+         * Size of instructions written by WriteJump().
+         */
+        static constexpr std::size_t kJumpSize = 4 * sizeof(std::uint32_t);
+
+    private:
+        static constexpr std::uint32_t kScratchRegister = 17;
+    };
+
+    /**
+     * A tool class for relocating x86_64 instructions to another address.
+     *
+     * Whole instructions are relocated. Relative branches (JMP, CALL and Jcc) are rewritten to
+     * use absolute addresses loaded from inline literals, and RIP-relative memory operands are
+     * rewritten to absolute addresses or adjusted displacements. The decoder only accepts
+     * general purpose and SSE instructions, others such as VEX encoded ones fail relocation.
+     */
+    class X86_64Relocator final {
+    public:
+        /**
+         * Relocate whole instructions covering at least specified size of bytes.
+         *
+         * Relocation fails if an instruction cannot be decoded or branches into the relocated
+         * instructions themselves.
+         *
+         * @param source instructions to be relocated.
+         * @param size minimum size of instructions to be relocated in bytes.
+         * @param source_address address where instructions are executed originally.
+         * @param destination memory for relocated instructions, which is also the address where
+         *        they are executed. Its size must be at least GetMaxRelocatedSize(size).
+         * @param relocated_size size of origin instructions relocated in bytes.
+         * @return size of relocated instructions in bytes, or 0 on failure.
+         */
+        static std::size_t Relocate(const std::uint8_t *source, std::size_t size,
+                                    std::uint64_t source_address, std::uint8_t *destination,
+                                    std::size_t *relocated_size);
+
+        /**
+         * Write instructions jumping to absolute address.
+         *
+         * @param destination memory for instructions, whose size must be at least kJumpSize.
+         * @param target target address.
+         * @return size of instructions in bytes.
+         */
+        static std::size_t WriteJump(std::uint8_t *destination, std::uint64_t target);
+
+        /**
+         * Get length of instruction.
+         *
+         * @param instruction instruction to be decoded.
+         * @return length of instruction in bytes, or 0 if the instruction is not supported.
+         */
+        static std::size_t GetInstructionLength(const std::uint8_t *instruction);
+
+        /**
+         * Get max size of the instructions which instructions of specified size are relocated to.
+         *
+         * @param size minimum size of instructions to be relocated in bytes.
+         * @return max size of relocated instructions in bytes.
+         */
+        static constexpr std::size_t GetMaxRelocatedSize(std::size_t size) {
+            // The shortest conditional branch (2 bytes) expands most, to 16 bytes.
+            return (size + kMaxInstructionSize - 1) * 8;
+        }
+
+        /**
+         * Size of instructions written by WriteJump().
+         */
+        static constexpr std::size_t kJumpSize = 14;
+
+    private:
+        static constexpr std::size_t kMaxInstructionSize = 15;
+    };
+}
+
+#endif
@@ -22,13 +22,19 @@
  * SOFTWARE.
  */
 
+#include <algorithm>
+#include <chrono>
 #include <string>
 
 #include "runtime.h"
 
+#include "arena.h"
+#include "epoch.h"
 #include "log.h"
 #include "internal.h"
+#include "memory.h"
 #include "macro.h"
+#include "trace.h"
 
 #include "bridge.h"
 #include "mirror.h"
@@ -40,14 +46,25 @@ namespace moe::aoramd::kaleidoscope::runtime {
 
     std::map<int, mirror::Method *> Runtime::bridge_runtime_method_;
 
-    InsertBridgeResult::InsertBridgeResult(mirror::Method *origin) :
-            origin_(origin) {
-        bridge_box_ = new Box;
-    }
+    std::map<void *, EntranceBridge *> Runtime::entrance_bridges_;
 
-    InsertBridgeResult::~InsertBridgeResult() {
-        delete bridge_box_;
-    }
+    std::vector<EntranceBridge *> Runtime::retired_entrance_bridges_;
+
+    std::vector<InsertBridgeResult *> Runtime::retired_results_;
+    std::size_t Runtime::retired_result_threshold_ = kMaxRetiredResultCount;
+
+    std::vector<std::int32_t> Runtime::reclaimed_handles_;
+    std::mutex Runtime::reclaimed_handles_mutex_;
+
+    std::set<InsertBridgeResult *> Runtime::active_results_;
+    std::mutex Runtime::active_results_mutex_;
+
+    // Bridge code locates a box by shifting the index, see bridge/arm64.S.
+    static_assert(sizeof(Box) == 128, "Size of box must be matched with bridge code.");
+    static_assert((Box::kTableSize & (Box::kTableSize - 1)) == 0,
+                  "Size of box table must be a power of 2.");
+
+    Box Runtime::box_table_[Box::kTableSize];
 
     ListenResult::ListenResult(mirror::Method *origin) : InsertBridgeResult(origin) {
         clone_ = reinterpret_cast<mirror::Method *>(malloc(mirror::Method::GetSize()));
@@ -57,6 +74,8 @@ namespace moe::aoramd::kaleidoscope::runtime {
         debugLog("Clone runtime method " __log_memory_specifier__ " data : %s.",
                  reinterpret_cast<std::size_t>(clone_), clone_->GetDataHexString().c_str())
         clone_->SetPrivate();
+        // Bridge method cannot find the scope until its handle is set, see SetScopeHandle().
+        SetPaused(true);
     }
 
     ListenResult::~ListenResult() {
@@ -64,6 +83,12 @@ namespace moe::aoramd::kaleidoscope::runtime {
         clone_ = nullptr;
     }
 
+    NativeResult::NativeResult(mirror::Method *origin, kaleidoscope_callback before, void *user)
+            : InsertBridgeResult(origin) {
+        listener_.before_ = before;
+        listener_.user_ = user;
+    }
+
     bool Runtime::InitializeConfiguration() {
         char api_level[5];
         if (__system_property_get("ro.build.version.sdk", api_level) < 1) {
@@ -93,35 +118,136 @@ namespace moe::aoramd::kaleidoscope::runtime {
 
     ListenResult *
     Runtime::ListenBridge(mirror::Method *method, mirror::Thread *current_thread,
-                          int bridge_type_key) {
+                          int bridge_type_key, const char *shorty,
+                          std::uint64_t sample_interval) {
+        std::uint64_t start = Trace::Now();
         method->Compile(current_thread);
         auto *result = new ListenResult(method);
-        if (Bridge(method, result, bridge_type_key)) return result;
+        result->record_.sample_interval_ = sample_interval;
+        if (result->layout_.Initialize(shorty, method->IsStatic()) &&
+            Bridge(method, result, bridge_type_key)) {
+            Trace::Record(TraceEvent::kInstall, method, start, Trace::Now() - start);
+            Activate(result);
+            return result;
+        }
         delete result;
         return nullptr;
     }
 
     ReplaceResult *
     Runtime::ReplaceBridge(mirror::Method *method, mirror::Thread *current_thread,
-                           int bridge_type_key) {
+                           int bridge_type_key, const char *shorty) {
+        std::uint64_t start = Trace::Now();
         method->Compile(current_thread);
         auto *result = new ReplaceResult(method);
-        if (Bridge(method, result, bridge_type_key)) return result;
+        if (result->layout_.Initialize(shorty, method->IsStatic()) &&
+            Bridge(method, result, bridge_type_key)) {
+            Trace::Record(TraceEvent::kInstall, method, start, Trace::Now() - start);
+            Activate(result);
+            return result;
+        }
+        delete result;
+        return nullptr;
+    }
+
+    NativeResult *
+    Runtime::ListenNative(mirror::Method *method, mirror::Thread *current_thread,
+                          kaleidoscope_callback before, void *user) {
+        std::uint64_t start = Trace::Now();
+        method->Compile(current_thread);
+        auto *result = new NativeResult(method, before, user);
+        result->record_.bridge_method_ = reinterpret_cast<mirror::Method *>(&result->listener_);
+        result->record_.bridge_entrance_ = reinterpret_cast<void *>(NativeBridge);
+        internal::CodeArena::ScopedWrite write(bridge::Bridge::GetArena());
+        if (PrepareBridge(method, result)) {
+            // Native bridge jumps to origin bridge directly, which is known after preparing.
+            result->listener_.origin_bridge_ = result->entrance_bridge_->origin_bridge_;
+            if (SuspendAndPatchBridge(result)) {
+                // Statistics are not activated, because native listeners are not timed.
+                Trace::Record(TraceEvent::kInstall, method, start, Trace::Now() - start);
+                return result;
+            }
+        }
         delete result;
         return nullptr;
     }
 
     void Runtime::RestoreBridge(InsertBridgeResult *result) {
-        if (result->secondary_bridge_ != nullptr) {
-            free(result->secondary_bridge_);
+        std::uint64_t start = Trace::Now();
+        {
+            std::lock_guard<std::mutex> lock(active_results_mutex_);
+            active_results_.erase(result);
         }
-        if (result->origin_bridge_ != nullptr) {
-            bridge::Bridge::RecoverMain(
-                    result->origin_->GetEntryPointFromQuickCompiledCode(),
-                    result->origin_bridge_);
-            free(result->origin_bridge_);
+        result->origin_->ForgetCompilation();
+        if (result->entrance_bridge_ == nullptr) {
+            Trace::Record(TraceEvent::kRestore, result->origin_, start, Trace::Now() - start);
+            delete result;
+            return;
         }
-        delete result;
+
+        internal::CodeArena::ScopedWrite write(bridge::Bridge::GetArena());
+
+        // Removing from dispatch table is atomic for secondary bridge.
+        result->entrance_bridge_->dispatch_table_.Remove(result->origin_);
+        ReleaseEntranceBridge(result->entrance_bridge_);
+        Trace::Record(TraceEvent::kRestore, result->origin_, start, Trace::Now() - start);
+
+        result->retire_epoch_ = Epoch::Current();
+        retired_results_.push_back(result);
+        if (retired_results_.size() > retired_result_threshold_) {
+            // Threads are only suspended if any result can be freed.
+            if (HasReclaimableResult()) {
+                ScopedSuspendAll suspendAll;
+                ReclaimRetired();
+            }
+            retired_result_threshold_ =
+                    std::max(kMaxRetiredResultCount, retired_results_.size() * 2);
+        }
+    }
+
+    InsertBridgeResult *Runtime::EnterInvocation(Box *box) {
+        Epoch::Enter();
+        return box->hook_record_->result_;
+    }
+
+    void Runtime::ExitInvocation(InsertBridgeResult *result, std::uint64_t start) {
+        if (result != nullptr && start != 0) FinishInvocation(result, start);
+        Epoch::Exit();
+    }
+
+    void Runtime::TakeReclaimedHandles(std::vector<std::int32_t> *handles) {
+        std::lock_guard<std::mutex> lock(reclaimed_handles_mutex_);
+        handles->swap(reclaimed_handles_);
+        reclaimed_handles_.clear();
+    }
+
+    void Runtime::FinishInvocation(InsertBridgeResult *result, std::uint64_t start) {
+        std::uint64_t now = Trace::Now();
+        Trace::Record(TraceEvent::kEnter, result->origin_, start);
+        Trace::Record(TraceEvent::kExit, result->origin_, now, now - start);
+        if (HookStatistics::IsEnabled()) result->statistics_.Record(now - start);
+    }
+
+    void Runtime::SnapshotStatistics(std::vector<StatisticsSnapshot> *snapshots) {
+        std::lock_guard<std::mutex> lock(active_results_mutex_);
+        snapshots->resize(active_results_.size());
+        std::size_t i = 0;
+        for (InsertBridgeResult *result : active_results_) {
+            StatisticsSnapshot &snapshot = (*snapshots)[i++];
+            snapshot.method_ = result->origin_;
+            result->statistics_.Snapshot(&snapshot.call_count_, &snapshot.total_latency_,
+                                         snapshot.buckets_);
+        }
+    }
+
+    void Runtime::ResetStatistics() {
+        std::lock_guard<std::mutex> lock(active_results_mutex_);
+        for (InsertBridgeResult *result : active_results_) result->statistics_.Reset();
+    }
+
+    void Runtime::Activate(InsertBridgeResult *result) {
+        std::lock_guard<std::mutex> lock(active_results_mutex_);
+        active_results_.insert(result);
     }
 
     void Runtime::RegisterBridgeMethod(int key, mirror::Thread *current_thread,
@@ -130,12 +256,8 @@ namespace moe::aoramd::kaleidoscope::runtime {
         bridge_runtime_method_[key] = bridge_method;
     }
 
-    Box *Runtime::UnlockAndCopyBox(Box *origin) {
-        auto *clone = reinterpret_cast<Box *>(malloc(sizeof(Box)));
-        internal::Memory::Copy(clone, origin, sizeof(Box));
-        // Unlock.
-        origin->lock_ = 0;
-        return clone;
+    void Runtime::ReleaseBox(Box *box) {
+        box->Release();
     }
 
     bool Runtime::AndroidVersionAtLeast(AndroidVersion version, bool warnDevelopment) {
@@ -149,51 +271,275 @@ namespace moe::aoramd::kaleidoscope::runtime {
         return android_version_ >= version;
     }
 
+    void Runtime::BatchBridge(std::vector<BatchBridgeItem> &items, mirror::Thread *current_thread,
+                              std::int64_t *prepare_time, std::int64_t *patch_time) {
+        // Write scope is kept until patching, because entrance bridges are prepared and
+        // patched under it.
+        internal::CodeArena::ScopedWrite write(bridge::Bridge::GetArena());
+
+        auto prepare_start = std::chrono::steady_clock::now();
+        for (auto &item : items) {
+            item.method_->Compile(current_thread);
+            InsertBridgeResult *result;
+            if (item.replace_) {
+                result = new ReplaceResult(item.method_);
+            } else {
+                result = new ListenResult(item.method_);
+                result->record_.sample_interval_ = item.sample_interval_;
+            }
+            if (result->layout_.Initialize(item.shorty_.c_str(), item.method_->IsStatic()) &&
+                SetBridgeMethod(item.method_, result, item.bridge_type_key_) &&
+                PrepareBridge(item.method_, result)) {
+                item.result_ = result;
+            } else {
+                delete result;
+            }
+        }
+
+        auto patch_start = std::chrono::steady_clock::now();
+        auto patch = [&items]() {
+            for (auto &item : items) {
+                if (item.result_ == nullptr) continue;
+                if (!PatchBridge(item.result_)) {
+                    delete item.result_;
+                    item.result_ = nullptr;
+                }
+            }
+        };
+        bool suspend = std::any_of(items.begin(), items.end(), [](BatchBridgeItem &item) {
+            return item.result_ != nullptr && NeedSuspension(item.result_);
+        });
+        if (suspend) {
+            ScopedSuspendAll suspendAll;
+            patch();
+            ReclaimRetired();
+        } else {
+            patch();
+        }
+        auto patch_end = std::chrono::steady_clock::now();
+
+        *prepare_time = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                patch_start - prepare_start).count();
+        *patch_time = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                patch_end - patch_start).count();
+
+        // Methods of a batch are inserted together, so each takes the time of the whole batch.
+        std::uint64_t end = Trace::Now();
+        auto duration = static_cast<std::uint64_t>(*prepare_time + *patch_time);
+        for (auto &item : items) {
+            if (item.result_ == nullptr) continue;
+            Trace::Record(TraceEvent::kInstall, item.method_, end - duration, duration);
+            Activate(item.result_);
+        }
+        debugLog("Insert bridge code into %zu runtime methods, prepare %lld ns, patch %lld ns.",
+                 items.size(), static_cast<long long>(*prepare_time),
+                 static_cast<long long>(*patch_time))
+    }
+
     bool
     Runtime::Bridge(mirror::Method *method, InsertBridgeResult *result, int bridge_type_key) {
+        internal::CodeArena::ScopedWrite write(bridge::Bridge::GetArena());
 
-        void *entrance = method->GetEntryPointFromQuickCompiledCode();
+        if (!SetBridgeMethod(method, result, bridge_type_key)) return false;
+        if (!PrepareBridge(method, result)) return false;
+        return SuspendAndPatchBridge(result);
+    }
 
-        // Create origin bridge.
-        result->origin_bridge_ = bridge::Bridge::CreateOrigin(entrance);
-        if (result->origin_bridge_ == nullptr) {
-            errorLog("Unable to create origin bridge for runtime method " __log_memory_specifier__ ".",
-                     reinterpret_cast<std::size_t>(method))
-            return false;
-        }
+    bool Runtime::SuspendAndPatchBridge(InsertBridgeResult *result) {
+        if (!NeedSuspension(result)) return PatchBridge(result);
+
+        ScopedSuspendAll suspendAll;
 
+        bool success = PatchBridge(result);
+        ReclaimRetired();
+        return success;
+    }
+
+    bool
+    Runtime::SetBridgeMethod(mirror::Method *method, InsertBridgeResult *result,
+                             int bridge_type_key) {
         mirror::Method *bridge_runtime_method = bridge_runtime_method_[bridge_type_key];
         if (bridge_runtime_method == nullptr) {
             errorLog("Unable to find bridge method for runtime method " __log_memory_specifier__ ".",
                      reinterpret_cast<std::size_t>(method))
             return false;
         }
+        result->record_.bridge_method_ = bridge_runtime_method;
+        result->record_.bridge_entrance_ = bridge_runtime_method->GetEntryPointFromQuickCompiledCode();
+        return true;
+    }
+
+    bool Runtime::PrepareBridge(mirror::Method *method, InsertBridgeResult *result) {
+
+        void *entrance = method->GetEntryPointFromQuickCompiledCode();
+
+        internal::CodeArena::ScopedWrite write(bridge::Bridge::GetArena());
+
+        // Reuse bridge code if the entrance is shared with runtime methods inserted before.
+        auto existing = entrance_bridges_.find(entrance);
+        if (existing != entrance_bridges_.end()) {
+            existing->second->references_++;
+            result->entrance_ = entrance;
+            result->entrance_bridge_ = existing->second;
+            return true;
+        }
+
+        auto *entrance_bridge = new EntranceBridge(entrance);
+
+        // Create origin bridge.
+        entrance_bridge->origin_bridge_ = bridge::Bridge::CreateOrigin(entrance);
+        if (entrance_bridge->origin_bridge_ == nullptr) {
+            errorLog("Unable to create origin bridge for runtime method " __log_memory_specifier__ ".",
+                     reinterpret_cast<std::size_t>(method))
+            delete entrance_bridge;
+            return false;
+        }
 
         // Create secondary bridge.
-        result->secondary_bridge_ = bridge::Bridge::CreateSecondary(
-                method,
-                bridge_runtime_method,
-                bridge_runtime_method->GetEntryPointFromQuickCompiledCode(),
-                result->bridge_box_,
-                result->origin_bridge_
+        entrance_bridge->secondary_bridge_ = bridge::Bridge::CreateSecondary(
+                &entrance_bridge->dispatch_table_,
+                box_table_,
+                entrance_bridge->origin_bridge_
         );
-        if (result->secondary_bridge_ == nullptr) {
+        if (entrance_bridge->secondary_bridge_ == nullptr) {
             errorLog("Unable to create secondary bridge for runtime method "  __log_memory_specifier__ ".",
                      reinterpret_cast<std::size_t>(method))
+            bridge::Bridge::FreeOrigin(entrance_bridge->origin_bridge_);
+            delete entrance_bridge;
             return false;
         }
 
-        {
-            ScopedSuspendAll suspendAll;
+        entrance_bridge->references_ = 1;
+        entrance_bridges_[entrance] = entrance_bridge;
+        result->entrance_ = entrance;
+        result->entrance_bridge_ = entrance_bridge;
+        return true;
+    }
 
-            // Insert main bridge.
-            if (!bridge::Bridge::SetMain(entrance, result->secondary_bridge_)) {
+    bool Runtime::PatchBridge(InsertBridgeResult *result) {
+        mirror::Method *method = result->origin_;
+        EntranceBridge *entrance_bridge = result->entrance_bridge_;
+
+        // Entrance may be changed by JIT after bridge code is created.
+        bool success = method->GetEntryPointFromQuickCompiledCode() == result->entrance_;
+        if (!success) {
+            errorLog("Entrance of runtime method " __log_memory_specifier__ " is changed after creating bridge code.",
+                     reinterpret_cast<std::size_t>(method))
+        }
+
+        // Bridge code must be executable and visible to instruction fetch before it is reached.
+        if (success) bridge::Bridge::GetArena()->Seal();
+
+        // Insert runtime method into dispatch table before secondary bridge can be reached.
+        if (success && !entrance_bridge->dispatch_table_.Insert(method, &result->record_)) {
+            errorLog("Unable to insert runtime method " __log_memory_specifier__ " into dispatch table.",
+                     reinterpret_cast<std::size_t>(method))
+            success = false;
+        }
+        // Insert main bridge.
+        if (success && !entrance_bridge->patched_) {
+            if (bridge::Bridge::SetMain(result->entrance_, entrance_bridge->secondary_bridge_,
+                                        entrance_bridge->origin_bridge_)) {
+                entrance_bridge->patched_ = true;
+            } else {
                 errorLog("Unable to set main bridge for runtime method " __log_memory_specifier__ ".",
                          reinterpret_cast<std::size_t>(method))
-                return false;
+                entrance_bridge->dispatch_table_.Remove(method);
+                success = false;
             }
         }
-        return true;
+
+        if (!success) {
+            ReleaseEntranceBridge(entrance_bridge);
+            result->entrance_bridge_ = nullptr;
+        }
+        return success;
+    }
+
+    bool Runtime::NeedSuspension(InsertBridgeResult *result) {
+        EntranceBridge *entrance_bridge = result->entrance_bridge_;
+        return !entrance_bridge->patched_ &&
+               !bridge::Bridge::IsAtomicMain(entrance_bridge->origin_bridge_);
+    }
+
+    void Runtime::ReleaseEntranceBridge(EntranceBridge *entrance_bridge) {
+        if (--entrance_bridge->references_ > 0) return;
+        entrance_bridges_.erase(entrance_bridge->entrance_);
+
+        if (!entrance_bridge->patched_) {
+            FreeEntranceBridge(entrance_bridge);
+            return;
+        }
+
+        if (bridge::Bridge::IsAtomicMain(entrance_bridge->origin_bridge_)) {
+            // Other threads may be still running bridge code, so it is freed later.
+            bridge::Bridge::RecoverMain(entrance_bridge->entrance_, entrance_bridge->origin_bridge_);
+            retired_entrance_bridges_.push_back(entrance_bridge);
+            if (retired_entrance_bridges_.size() > kMaxRetiredEntranceBridgeCount) {
+                ScopedSuspendAll suspendAll;
+                ReclaimRetired();
+            }
+            return;
+        }
+
+        ScopedSuspendAll suspendAll;
+        bridge::Bridge::RecoverMain(entrance_bridge->entrance_, entrance_bridge->origin_bridge_);
+        FreeEntranceBridge(entrance_bridge);
+        ReclaimRetired();
+    }
+
+    void Runtime::ReclaimRetired() {
+        for (EntranceBridge *entrance_bridge : retired_entrance_bridges_) {
+            FreeEntranceBridge(entrance_bridge);
+        }
+        retired_entrance_bridges_.clear();
+        for (auto &[entrance, entrance_bridge] : entrance_bridges_) {
+            entrance_bridge->dispatch_table_.Reclaim();
+        }
+
+        std::uint64_t epoch = Epoch::Advance();
+        auto kept = retired_results_.begin();
+        for (InsertBridgeResult *result : retired_results_) {
+            if (IsBoxed(result)) {
+                result->retire_epoch_ = epoch;
+                *kept++ = result;
+            } else if (!Epoch::IsQuiescent(result->retire_epoch_ + 1)) {
+                *kept++ = result;
+            } else {
+                std::int32_t handle = result->GetScopeHandle();
+                if (handle >= 0) {
+                    std::lock_guard<std::mutex> lock(reclaimed_handles_mutex_);
+                    reclaimed_handles_.push_back(handle);
+                }
+                delete result;
+            }
+        }
+        retired_results_.erase(kept, retired_results_.end());
+    }
+
+    bool Runtime::HasReclaimableResult() {
+        Epoch::Advance();
+        return std::any_of(retired_results_.begin(), retired_results_.end(),
+                           [](InsertBridgeResult *result) {
+                               return !IsBoxed(result) &&
+                                      Epoch::IsQuiescent(result->retire_epoch_ + 1);
+                           });
+    }
+
+    bool Runtime::IsBoxed(InsertBridgeResult *result) {
+        for (Box &box : box_table_) {
+            if (box.owner_.load(std::memory_order_acquire) != 0 &&
+                box.hook_record_ == &result->record_) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void Runtime::FreeEntranceBridge(EntranceBridge *entrance_bridge) {
+        bridge::Bridge::FreeSecondary(entrance_bridge->secondary_bridge_);
+        bridge::Bridge::FreeOrigin(entrance_bridge->origin_bridge_);
+        delete entrance_bridge;
     }
 
     void
@@ -202,10 +548,12 @@ namespace moe::aoramd::kaleidoscope::runtime {
     void (*Runtime::ScopedSuspendAll::resume_function_)(ScopedSuspendAll *) = nullptr;
 
     bool Runtime::ScopedSuspendAll::Initialize() {
-        suspend_function_ = reinterpret_cast<void (*)(ScopedSuspendAll *, const char *)>(
-                internal::Library::SymbolInArtLibrary(kFunctionSuspendAllSymbol));
-        resume_function_ = reinterpret_cast<void (*)(ScopedSuspendAll *)>(
-                internal::Library::SymbolInArtLibrary(kFunctionResumeAllSymbol));
+        const char *symbols[] = {kFunctionSuspendAllSymbol, kFunctionResumeAllSymbol};
+        void *functions[2];
+        internal::Library::SymbolsInArtLibrary(symbols, functions, 2);
+        suspend_function_ =
+                reinterpret_cast<void (*)(ScopedSuspendAll *, const char *)>(functions[0]);
+        resume_function_ = reinterpret_cast<void (*)(ScopedSuspendAll *)>(functions[1]);
         return true;
     }
 
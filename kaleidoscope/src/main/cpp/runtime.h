@@ -25,29 +25,59 @@
 #ifndef KALEIDOSCOPE_RUNTIME_H
 #define KALEIDOSCOPE_RUNTIME_H
 
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
 #include <map>
+#include <mutex>
+#include <set>
+#include <string>
+#include <vector>
 
 #include "declare.h"
+#include "dispatch.h"
+#include "layout.h"
+#include "statistics.h"
 
 namespace moe::aoramd::kaleidoscope::runtime {
 
     /**
-     * A class whose object is bound to bridge is used to capture registers data.
+     * A class whose object is claimed by secondary bridge is used to capture registers data.
+     *
+     * Boxes are stored in a table shared by all bridges. Secondary bridge claims a free box by
+     * hashing the native peer of current thread and probing linearly, so invocations on
+     * different threads never wait for each other. If all boxes are occupied after probing
+     * kTableSize of them, the invocation runs origin code without being hooked. The layout and
+     * size of the class are used by the bridge code directly, so they must be kept in sync
+     * with it.
      */
-    class Box final {
+    class alignas(128) Box final {
         friend class Runtime;
 
-        friend class InsertBridgeResult;
+    public:
+        /**
+         * Count of boxes in the box table. It must be a power of 2.
+         */
+        static constexpr std::size_t kTableSize = 256;
+
+        /**
+         * Release the box, so that it can be claimed by other invocations.
+         * Data of the box must not be read after releasing.
+         */
+        void Release() {
+            owner_.store(0, std::memory_order_release);
+        }
 
     private:
         /**
-         * A spin lock used to ensure concurrency safety.
+         * Native peer of the thread which occupies the box, or 0 if the box is free.
          */
-        [[maybe_unused]] std::size_t lock_ = 0;
+        std::atomic<std::size_t> owner_ = 0;
 
     public:
         /**
-         * sp register data.
+         * sp register data of caller, which points to the runtime method of callee and
+         * parameters on stack.
          */
         std::size_t sp_pointer_;
 
@@ -58,12 +88,12 @@ namespace moe::aoramd::kaleidoscope::runtime {
         mirror::Method *callee_runtime_method_pointer_;
 
         /**
-         * x2 register data.
+         * x1 register data in arm64, or rsi register data in x86_64.
          */
         std::size_t register_1_;
 
         /**
-         * x3 register data.
+         * x2 register data in arm64, or rdx register data in x86_64.
          */
         std::size_t register_2_;
 
@@ -72,7 +102,7 @@ namespace moe::aoramd::kaleidoscope::runtime {
         /**
          * floating registers data.
          *
-         * In arm64, floating registers is d0 ~ d7.
+         * In arm64, floating registers is d0 ~ d7, and in x86_64, they are xmm0 ~ xmm7.
          */
         std::size_t floating_registers_[8];
 
@@ -86,6 +116,57 @@ namespace moe::aoramd::kaleidoscope::runtime {
         std::size_t floating_registers_[4];
 
 #endif
+
+        /**
+         * Hook record of callee runtime method found by secondary bridge, so that the scope
+         * of the invocation is obtained without searching callee runtime method again.
+         */
+        bridge::HookRecord *hook_record_;
+    };
+
+    /**
+     * Class for saving bridge code inserted into an entrance of runtime methods.
+     *
+     * Android Runtime may share one entrance among several runtime methods, such as methods
+     * whose compiled code is deduplicated. Bridge code is inserted into such an entrance only
+     * once, and hooked runtime methods are dispatched by the dispatch table of secondary bridge.
+     */
+    class EntranceBridge final {
+        friend class Runtime;
+
+    private:
+        explicit EntranceBridge(void *entrance) :
+                entrance_(entrance) {}
+
+        /**
+         * Runtime method entrance.
+         */
+        void *entrance_;
+
+        /**
+         * Secondary bridge code entrance.
+         */
+        void *secondary_bridge_ = nullptr;
+
+        /**
+         * Origin bridge code entrance.
+         */
+        void *origin_bridge_ = nullptr;
+
+        /**
+         * Dispatch table from hooked runtime methods to their hook records.
+         */
+        bridge::DispatchTable dispatch_table_;
+
+        /**
+         * Count of insert bridge code results referring to the entrance bridge.
+         */
+        std::size_t references_ = 0;
+
+        /**
+         * True if main bridge is inserted into the entrance.
+         */
+        bool patched_ = false;
     };
 
     /**
@@ -101,27 +182,75 @@ namespace moe::aoramd::kaleidoscope::runtime {
          */
         mirror::Method *origin_;
 
+        /**
+         * Where parameters of runtime method are passed, which is used by bridge method for
+         * obtaining them in a single call.
+         */
+        ArgumentLayout layout_;
+
+        /**
+         * Call count and latency histogram of runtime method, which are updated by bridge
+         * method if statistics are enabled, see Runtime::FinishInvocation().
+         */
+        HookStatistics statistics_;
+
+        /**
+         * Set handle of the scope of runtime method, which is read by bridge method from the
+         * hook record captured in box, see bridge::HookRecord::scope_handle_.
+         *
+         * @param handle handle of scope, or -1 if the scope is released.
+         */
+        void SetScopeHandle(std::int32_t handle) {
+            record_.scope_handle_.store(handle, std::memory_order_release);
+        }
+
+        /**
+         * Pause or resume the hook of runtime method without restoring bridge code, see
+         * bridge::HookRecord::paused_. Invocations already dispatched are not affected.
+         *
+         * @param paused true if paused.
+         */
+        void SetPaused(bool paused) {
+            record_.paused_.store(paused ? 1 : 0, std::memory_order_release);
+        }
+
+        /**
+         * @return handle of the scope of runtime method, or -1 if no scope is registered.
+         */
+        std::int32_t GetScopeHandle() const {
+            return record_.scope_handle_.load(std::memory_order_acquire);
+        }
+
     protected:
-        InsertBridgeResult(mirror::Method *origin);
+        InsertBridgeResult(mirror::Method *origin) :
+                origin_(origin) {
+            record_.result_ = this;
+        }
 
-        ~InsertBridgeResult();
+        virtual ~InsertBridgeResult() = default;
 
     private:
 
         /**
-         * Secondary bridge code entrance.
+         * Entrance of runtime method when bridge code is created.
          */
-        void *secondary_bridge_ = nullptr;
+        void *entrance_ = nullptr;
 
         /**
-         * Origin bridge code entrance.
+         * Bridge code of the entrance, which may be shared with other results.
          */
-        void *origin_bridge_ = nullptr;
+        EntranceBridge *entrance_bridge_ = nullptr;
+
+        /**
+         * Hook record of runtime method in dispatch table.
+         */
+        bridge::HookRecord record_;
 
         /**
-         * Box for capture data.
+         * Epoch when the result is restored, or when it is found still in use by reclaiming,
+         * see Runtime::ReclaimRetired().
          */
-        Box *bridge_box_;
+        std::uint64_t retire_epoch_ = 0;
     };
 
     /**
@@ -140,7 +269,7 @@ namespace moe::aoramd::kaleidoscope::runtime {
     private:
         ListenResult(mirror::Method *origin);
 
-        ~ListenResult();
+        ~ListenResult() override;
     };
 
     /**
@@ -151,7 +280,74 @@ namespace moe::aoramd::kaleidoscope::runtime {
 
     private:
         ReplaceResult(mirror::Method *origin) :
-                InsertBridgeResult(origin) {}
+                InsertBridgeResult(origin) {
+            // Bridge method cannot find the scope until its handle is set, see SetScopeHandle().
+            SetPaused(true);
+        }
+    };
+
+    /**
+     * Class for saving results of inserting bridge code for native listeners, whose bridge
+     * method is native bridge, see NativeBridge().
+     */
+    class NativeResult : public InsertBridgeResult {
+        friend class Runtime;
+
+    private:
+        NativeResult(mirror::Method *origin, kaleidoscope_callback before, void *user);
+
+        /**
+         * Native listener passed to native bridge as bridge method.
+         */
+        bridge::NativeListener listener_;
+    };
+
+    /**
+     * Class for describing runtime method inserted into bridge code in batch and saving its result.
+     */
+    class BatchBridgeItem final {
+    public:
+
+        /**
+         * Runtime method inserted into bridge code.
+         */
+        mirror::Method *method_;
+
+        /**
+         * True for replacing method invocation, false for listening.
+         */
+        bool replace_;
+
+        /**
+         * Bridge method key.
+         */
+        int bridge_type_key_;
+
+        /**
+         * Shorty descriptor of runtime method, see ArgumentLayout::Initialize().
+         */
+        std::string shorty_;
+
+        /**
+         * Sample interval of listening, see Runtime::ListenBridge().
+         */
+        std::uint64_t sample_interval_ = 0;
+
+        /**
+         * Result of insert or null on failure.
+         */
+        InsertBridgeResult *result_ = nullptr;
+    };
+
+    /**
+     * Statistics of a runtime method inserted into bridge code, see HookStatistics.
+     */
+    class StatisticsSnapshot final {
+    public:
+        mirror::Method *method_;
+        std::uint64_t call_count_;
+        std::uint64_t total_latency_;
+        std::uint64_t buckets_[HookStatistics::kBucketCount];
     };
 
     /**
@@ -175,33 +371,113 @@ namespace moe::aoramd::kaleidoscope::runtime {
 
         /**
          * Insert bridge code into entrance of runtime method for listening method invocation.
+         * The hook is inserted paused, and it must be resumed after its scope handle is set.
          * 
          * @param method runtime method inserted into bridge code.
          * @param current_thread current thread native peer.
          * @param bridge_type_key bridge method key.
+         * @param shorty shorty descriptor of runtime method, see ArgumentLayout::Initialize().
+         * @param sample_interval bridge method is only invoked for one in every sample_interval
+         *        invocations, see bridge::HookRecord::sample_interval_.
          * @return result of insert or null on failure.
          */
         static ListenResult *
-        ListenBridge(mirror::Method *method, mirror::Thread *current_thread, int bridge_type_key);
+        ListenBridge(mirror::Method *method, mirror::Thread *current_thread, int bridge_type_key,
+                     const char *shorty, std::uint64_t sample_interval);
 
         /**
          * Insert bridge code into entrance of runtime method for replacing method invocation.
+         * The hook is inserted paused, and it must be resumed after its scope handle is set.
          * 
          * @param method runtime method inserted into bridge code.
          * @param current_thread current thread native peer.
          * @param bridge_type_key bridge method key.
+         * @param shorty shorty descriptor of runtime method, see ArgumentLayout::Initialize().
          * @return result of insert or null on failure.
          */
         static ReplaceResult *
-        ReplaceBridge(mirror::Method *method, mirror::Thread *current_thread, int bridge_type_key);
+        ReplaceBridge(mirror::Method *method, mirror::Thread *current_thread, int bridge_type_key,
+                      const char *shorty);
+
+        /**
+         * Insert bridge code into entrance of runtime method for listening method invocation
+         * with a native listener, which is called by native bridge without entering managed
+         * code, see NativeBridge().
+         *
+         * @param method runtime method inserted into bridge code.
+         * @param current_thread current thread native peer.
+         * @param before listener called before origin code.
+         * @param user user data passed to the listener.
+         * @return result of insert or null on failure.
+         */
+        static NativeResult *
+        ListenNative(mirror::Method *method, mirror::Thread *current_thread,
+                     kaleidoscope_callback before, void *user);
+
+        /**
+         * Insert bridge code into entrances of runtime methods in batch.
+         *
+         * Bridge code of all runtime methods is created before suspending threads, and then
+         * main bridges are inserted in a single suspension, which is skipped if all of them can
+         * be inserted atomically.
+         *
+         * @param items runtime methods inserted into bridge code, results are saved in them.
+         * @param current_thread current thread native peer.
+         * @param prepare_time time of creating bridge code in nanoseconds.
+         * @param patch_time time of inserting main bridges in nanoseconds.
+         */
+        static void BatchBridge(std::vector<BatchBridgeItem> &items, mirror::Thread *current_thread,
+                                std::int64_t *prepare_time, std::int64_t *patch_time);
 
         /**
-         * Recover runtime method entrance and free related resources.
+         * Recover runtime method entrance and release related resources.
+         *
+         * The result is retired rather than freed, because other threads may be still running
+         * bridge method with it. It is freed by ReclaimRetired() once no invocation may use it.
          *
-         * @param result result will be free.
+         * @param result result will be released.
          */
         static void RestoreBridge(InsertBridgeResult *result);
 
+        /**
+         * Enter an invocation of hooked runtime method in bridge method, before reading any
+         * data of the hook from the box. It is paired with ExitInvocation().
+         *
+         * @param box box claimed by secondary bridge.
+         * @return result owning the hook record captured in the box.
+         */
+        static InsertBridgeResult *EnterInvocation(Box *box);
+
+        /**
+         * Exit an invocation entered by EnterInvocation() when bridge method returns or throws,
+         * and record it into trace and statistics if they are enabled.
+         *
+         * @param result result of inserting bridge code into the runtime method, or null if it
+         *        is not found.
+         * @param start time when bridge method is invoked, see Trace::Now(), or 0 if trace and
+         *        statistics are disabled.
+         */
+        static void ExitInvocation(InsertBridgeResult *result, std::uint64_t start);
+
+        /**
+         * Take scope handles of results freed by reclaiming, so that they can be reused.
+         *
+         * @param handles destination of handles.
+         */
+        static void TakeReclaimedHandles(std::vector<std::int32_t> *handles);
+
+        /**
+         * Copy statistics of all runtime methods inserted into bridge code at once.
+         *
+         * @param snapshots statistics of each runtime method.
+         */
+        static void SnapshotStatistics(std::vector<StatisticsSnapshot> *snapshots);
+
+        /**
+         * Clear statistics of all runtime methods inserted into bridge code.
+         */
+        static void ResetStatistics();
+
         /**
          * Register bridge method into runtime.
          *
@@ -213,15 +489,12 @@ namespace moe::aoramd::kaleidoscope::runtime {
                                          mirror::Method *bridge_runtime_method);
 
         /**
-         * Unlock spin lock of box and return a copy of box. In order to ensure that spin lock is
-         * not occupied while reading data to improve performance, the copy should be used for
-         * reading data instead of the origin one. The spin lock will be released immediately after
-         * completing copy.
+         * Release box claimed by secondary bridge, so that it can be claimed by other invocations.
+         * Data of the box must not be read after releasing.
          *
-         * @param origin the origin box.
-         * @return copy of origin box.
+         * @param box box claimed by secondary bridge.
          */
-        static Box *UnlockAndCopyBox(Box *origin);
+        static void ReleaseBox(Box *box);
 
         /**
          * Check whether current Android version is equal to or higher than the specified.
@@ -235,11 +508,134 @@ namespace moe::aoramd::kaleidoscope::runtime {
         static bool
         Bridge(mirror::Method *method, InsertBridgeResult *result, int bridge_type_key);
 
+        /**
+         * Set the bridge method of bridge method key into hook record of result.
+         */
+        static bool
+        SetBridgeMethod(mirror::Method *method, InsertBridgeResult *result, int bridge_type_key);
+
+        /**
+         * Create origin bridge and secondary bridge of runtime method, whose hook record must
+         * be set before.
+         */
+        static bool PrepareBridge(mirror::Method *method, InsertBridgeResult *result);
+
+        /**
+         * Insert prepared bridge code by PatchBridge(), and suspend threads if it is required.
+         */
+        static bool SuspendAndPatchBridge(InsertBridgeResult *result);
+
+        /**
+         * Insert runtime method into dispatch table and main bridge into runtime method entrance.
+         * Threads must be suspended if NeedSuspension() returns true. Bridge code is released
+         * on failure.
+         */
+        static bool PatchBridge(InsertBridgeResult *result);
+
+        /**
+         * Check whether threads must be suspended for PatchBridge(), which is only required if
+         * main bridge is not inserted yet and it cannot be inserted atomically.
+         */
+        static bool NeedSuspension(InsertBridgeResult *result);
+
+        /**
+         * Release an entrance bridge referred by a result. If it is not referred any more, the
+         * entrance is recovered, and bridge code is freed, or retired until threads are
+         * suspended next time if the entrance is recovered without suspending threads.
+         */
+        static void ReleaseEntranceBridge(EntranceBridge *entrance_bridge);
+
+        /**
+         * Record an invocation of hooked runtime method into trace and statistics.
+         */
+        static void FinishInvocation(InsertBridgeResult *result, std::uint64_t start);
+
+        /**
+         * Free bridge code, dispatch table slots and results which are not used any more, but
+         * may have been used by other threads. Threads must be suspended.
+         *
+         * Suspended threads are never running bridge code, so bridge code and dispatch table
+         * slots are freed at once. A retired result is kept while a claimed box refers to it,
+         * or an invocation entered at or before the epoch after its retire epoch has not
+         * exited, see Epoch. The extra epoch covers invocations which claimed the box before
+         * the result is retired and enter after the epoch is advanced.
+         */
+        static void ReclaimRetired();
+
+        /**
+         * Check whether a retired result may be freed by ReclaimRetired(), without suspending
+         * threads. Epoch is advanced, so that results retired before are not kept by invocations
+         * entered later. The check is a hint, because boxes may be claimed at the same time.
+         */
+        static bool HasReclaimableResult();
+
+        /**
+         * Check whether a claimed box refers to the hook record of result.
+         */
+        static bool IsBoxed(InsertBridgeResult *result);
+
+        static void FreeEntranceBridge(EntranceBridge *entrance_bridge);
+
         static int android_version_;
         static int preview_android_version_;
 
         static std::map<int, mirror::Method *> bridge_runtime_method_;
 
+        /**
+         * Entrance bridges indexed by entrance. It is only accessed in write scope of bridge code
+         * arena, see bridge::Bridge::GetArena().
+         */
+        static std::map<void *, EntranceBridge *> entrance_bridges_;
+
+        /**
+         * Entrance bridges whose entrance is recovered without suspending threads. It is only
+         * accessed in write scope of bridge code arena.
+         */
+        static std::vector<EntranceBridge *> retired_entrance_bridges_;
+
+        /**
+         * Results restored but may be still used by bridge method. It is only accessed in write
+         * scope of bridge code arena.
+         */
+        static std::vector<InsertBridgeResult *> retired_results_;
+
+        /**
+         * Count of retired results for trying to reclaim them. It is doubled while they cannot be
+         * reclaimed, for example, a long-running invocation keeps its epoch, so that restoring
+         * does not check them every time, and reset once they are reclaimed.
+         */
+        static std::size_t retired_result_threshold_;
+
+        /**
+         * Scope handles of freed results, see TakeReclaimedHandles().
+         */
+        static std::vector<std::int32_t> reclaimed_handles_;
+        static std::mutex reclaimed_handles_mutex_;
+
+        /**
+         * Results of runtime methods inserted into bridge code, for taking snapshot of their
+         * statistics. It is guarded by active_results_mutex_, because snapshots may be taken on
+         * any thread.
+         */
+        static std::set<InsertBridgeResult *> active_results_;
+        static std::mutex active_results_mutex_;
+
+        static void Activate(InsertBridgeResult *result);
+
+        /**
+         * Max count of retired entrance bridges, threads are suspended for reclaiming them when
+         * it is exceeded.
+         */
+        static constexpr std::size_t kMaxRetiredEntranceBridgeCount = 64;
+
+        /**
+         * Initial count of retired results for trying to reclaim them, see
+         * retired_result_threshold_.
+         */
+        static constexpr std::size_t kMaxRetiredResultCount = 64;
+
+        static Box box_table_[Box::kTableSize];
+
         /**
          * A tool class for scoped suspending all thread.
          */
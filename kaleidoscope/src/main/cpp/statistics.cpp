@@ -0,0 +1,45 @@
+/*
+ * MIT License
+ *
+ * Copyright (C) 2021 M.D.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "statistics.h"
+
+namespace moe::aoramd::kaleidoscope::runtime {
+
+    std::atomic<bool> HookStatistics::enabled_{false};
+
+    void HookStatistics::Snapshot(std::uint64_t *call_count, std::uint64_t *total_latency,
+                                  std::uint64_t *buckets) const {
+        *call_count = call_count_.load(std::memory_order_relaxed);
+        *total_latency = total_latency_.load(std::memory_order_relaxed);
+        for (std::size_t i = 0; i < kBucketCount; i++) {
+            buckets[i] = buckets_[i].load(std::memory_order_relaxed);
+        }
+    }
+
+    void HookStatistics::Reset() {
+        call_count_.store(0, std::memory_order_relaxed);
+        total_latency_.store(0, std::memory_order_relaxed);
+        for (auto &bucket : buckets_) bucket.store(0, std::memory_order_relaxed);
+    }
+}
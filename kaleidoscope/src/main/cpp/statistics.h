@@ -0,0 +1,128 @@
+/*
+ * MIT License
+ *
+ * Copyright (C) 2021 M.D.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef KALEIDOSCOPE_STATISTICS_H
+#define KALEIDOSCOPE_STATISTICS_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+namespace moe::aoramd::kaleidoscope::runtime {
+
+    /**
+     * Call count and latency histogram of a hooked runtime method, which are updated by bridge
+     * method with relaxed atomic operations and without allocation.
+     *
+     * The histogram is log-bucketed like HdrHistogram: latencies are grouped by their highest
+     * set bit, and every group is split into kSubBucketCount buckets linearly, so the relative
+     * error of a bucket is at most 1 / kSubBucketCount. Latencies not less than
+     * 2 ^ kMaxLatencyBits nanoseconds are counted in the last bucket.
+     */
+    class HookStatistics final {
+    public:
+        static constexpr int kSubBucketBits = 2;
+        static constexpr std::uint64_t kSubBucketCount = 1 << kSubBucketBits;
+        static constexpr int kMaxLatencyBits = 40;
+        static constexpr std::size_t kBucketCount =
+                (kMaxLatencyBits - kSubBucketBits + 1) << kSubBucketBits;
+
+        /**
+         * Start or stop updating statistics of all hooked runtime methods.
+         *
+         * @param enabled true for starting.
+         */
+        static void SetEnabled(bool enabled) {
+            enabled_.store(enabled, std::memory_order_relaxed);
+        }
+
+        static bool IsEnabled() {
+            return enabled_.load(std::memory_order_relaxed);
+        }
+
+        /**
+         * Get the bucket of a latency.
+         *
+         * @param latency latency in nanoseconds.
+         * @return index of bucket.
+         */
+        static std::size_t GetBucket(std::uint64_t latency) {
+            if (latency < kSubBucketCount) return latency;
+            int bit = 63 - __builtin_clzll(latency);
+            if (bit >= kMaxLatencyBits) return kBucketCount - 1;
+            std::uint64_t sub_bucket = latency >> (bit - kSubBucketBits) & (kSubBucketCount - 1);
+            return (static_cast<std::size_t>(bit - kSubBucketBits + 1) << kSubBucketBits) +
+                   sub_bucket;
+        }
+
+        /**
+         * Get the least latency counted in a bucket.
+         *
+         * @param bucket index of bucket.
+         * @return least latency in nanoseconds.
+         */
+        static std::uint64_t GetBucketLowerBound(std::size_t bucket) {
+            if (bucket < kSubBucketCount) return bucket;
+            std::size_t group = bucket >> kSubBucketBits;
+            std::uint64_t sub_bucket = bucket & (kSubBucketCount - 1);
+            return (kSubBucketCount + sub_bucket) << (group - 1);
+        }
+
+        /**
+         * Count an invocation.
+         *
+         * @param latency latency of invocation in nanoseconds.
+         */
+        void Record(std::uint64_t latency) {
+            call_count_.fetch_add(1, std::memory_order_relaxed);
+            total_latency_.fetch_add(latency, std::memory_order_relaxed);
+            buckets_[GetBucket(latency)].fetch_add(1, std::memory_order_relaxed);
+        }
+
+        /**
+         * Copy statistics. Fields are read separately, so they may be slightly inconsistent
+         * if invocations are being counted.
+         *
+         * @param call_count count of invocations.
+         * @param total_latency sum of latencies in nanoseconds.
+         * @param buckets counts of buckets, kBucketCount in total.
+         */
+        void Snapshot(std::uint64_t *call_count, std::uint64_t *total_latency,
+                      std::uint64_t *buckets) const;
+
+        /**
+         * Clear statistics.
+         */
+        void Reset();
+
+    private:
+        static std::atomic<bool> enabled_;
+
+        std::atomic<std::uint64_t> call_count_{0};
+        std::atomic<std::uint64_t> total_latency_{0};
+        std::atomic<std::uint64_t> buckets_[kBucketCount] = {};
+    };
+}
+
+#endif
@@ -0,0 +1,243 @@
+/*
+ * MIT License
+ *
+ * Copyright (C) 2021 M.D.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <cstdio>
+#include <cstring>
+#include <elf.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "symbol_cache.h"
+
+#include "log.h"
+
+namespace moe::aoramd::kaleidoscope::internal {
+
+#if defined(__LP64__)
+    using ElfHeader = Elf64_Ehdr;
+    using ProgramHeader = Elf64_Phdr;
+    using NoteHeader = Elf64_Nhdr;
+#else
+    using ElfHeader = Elf32_Ehdr;
+    using ProgramHeader = Elf32_Phdr;
+    using NoteHeader = Elf32_Nhdr;
+#endif
+
+    static std::size_t align_note(std::size_t size) {
+        return (size + 3) / 4 * 4;
+    }
+
+    /**
+     * Find GNU build id in notes of a note segment.
+     */
+    static bool find_build_id(const std::vector<std::uint8_t> &notes,
+                              std::vector<std::uint8_t> *build_id) {
+        std::size_t offset = 0;
+        while (offset + sizeof(NoteHeader) <= notes.size()) {
+            NoteHeader header;
+            memcpy(&header, notes.data() + offset, sizeof(header));
+            std::size_t name_offset = offset + sizeof(header);
+            std::size_t descriptor_offset = name_offset + align_note(header.n_namesz);
+            std::size_t next = descriptor_offset + align_note(header.n_descsz);
+            if (next > notes.size() || next <= offset) return false;
+            if (header.n_type == NT_GNU_BUILD_ID && header.n_namesz == sizeof("GNU") &&
+                memcmp(notes.data() + name_offset, "GNU", sizeof("GNU")) == 0) {
+                build_id->assign(notes.data() + descriptor_offset,
+                                 notes.data() + descriptor_offset + header.n_descsz);
+                return !build_id->empty();
+            }
+            offset = next;
+        }
+        return false;
+    }
+
+    bool SymbolCache::ReadKey(const char *path, Key *key) {
+        int fd = open(path, O_RDONLY | O_CLOEXEC);
+        if (fd < 0) return false;
+
+        bool found = false;
+        struct stat status{};
+        ElfHeader elf_header;
+        if (fstat(fd, &status) == 0 &&
+            pread(fd, &elf_header, sizeof(elf_header), 0) == sizeof(elf_header) &&
+            memcmp(elf_header.e_ident, ELFMAG, SELFMAG) == 0 &&
+            elf_header.e_phentsize == sizeof(ProgramHeader)) {
+            std::vector<ProgramHeader> program_headers(elf_header.e_phnum);
+            auto size = static_cast<ssize_t>(program_headers.size() * sizeof(ProgramHeader));
+            if (pread(fd, program_headers.data(), size, elf_header.e_phoff) == size) {
+                for (const auto &program_header : program_headers) {
+                    // Notes are small, and limited in case the file is broken.
+                    if (program_header.p_type != PT_NOTE || program_header.p_filesz > 0x10000)
+                        continue;
+                    std::vector<std::uint8_t> notes(program_header.p_filesz);
+                    if (pread(fd, notes.data(), notes.size(), program_header.p_offset) !=
+                        static_cast<ssize_t>(notes.size()))
+                        continue;
+                    if (find_build_id(notes, &key->build_id_)) {
+                        found = true;
+                        break;
+                    }
+                }
+            }
+        }
+        close(fd);
+        if (!found) return false;
+
+        key->size_ = status.st_size;
+        key->modification_time_ =
+                static_cast<std::int64_t>(status.st_mtim.tv_sec) * 1000000000 +
+                status.st_mtim.tv_nsec;
+        return true;
+    }
+
+    SymbolCache::SymbolCache(std::string path, Key key) :
+            path_(std::move(path)), key_(std::move(key)) {}
+
+    /**
+     * Reader of cache file data with bounds checking.
+     */
+    class CacheReader final {
+    public:
+        explicit CacheReader(const std::vector<std::uint8_t> &data) : data_(data) {}
+
+        template<typename T>
+        bool Read(T *value) {
+            return ReadBytes(value, sizeof(T));
+        }
+
+        bool ReadBytes(void *destination, std::size_t size) {
+            if (size > data_.size() - offset_) return false;
+            memcpy(destination, data_.data() + offset_, size);
+            offset_ += size;
+            return true;
+        }
+
+    private:
+        const std::vector<std::uint8_t> &data_;
+        std::size_t offset_ = 0;
+    };
+
+    bool SymbolCache::Load() {
+        FILE *file = fopen(path_.c_str(), "rbe");
+        if (file == nullptr) return false;
+        std::vector<std::uint8_t> data;
+        std::uint8_t buffer[4096];
+        std::size_t size;
+        while ((size = fread(buffer, 1, sizeof(buffer), file)) > 0) {
+            data.insert(data.end(), buffer, buffer + size);
+        }
+        fclose(file);
+
+        /*
+            Layout of cache file:
+            magic, version, build id size, build id, file size, modification time,
+            symbol count, and then offset, name size and name of each symbol.
+         */
+        CacheReader reader(data);
+        std::uint32_t magic, version, build_id_size, count;
+        Key key;
+        if (!reader.Read(&magic) || magic != kMagic ||
+            !reader.Read(&version) || version != kVersion ||
+            !reader.Read(&build_id_size) || build_id_size > data.size())
+            return false;
+        key.build_id_.resize(build_id_size);
+        if (!reader.ReadBytes(key.build_id_.data(), build_id_size) ||
+            !reader.Read(&key.size_) || !reader.Read(&key.modification_time_) ||
+            !(key == key_) || !reader.Read(&count))
+            return false;
+
+        std::unordered_map<std::string, std::uint64_t> offsets;
+        for (std::uint32_t i = 0; i < count; i++) {
+            std::uint64_t offset;
+            std::uint16_t name_size;
+            if (!reader.Read(&offset) || !reader.Read(&name_size)) return false;
+            std::string name(name_size, '\0');
+            if (!reader.ReadBytes(name.data(), name_size)) return false;
+            offsets.emplace(std::move(name), offset);
+        }
+        offsets_ = std::move(offsets);
+        dirty_ = false;
+        debugLog("Load %zu symbols from cache %s.", offsets_.size(), path_.c_str())
+        return true;
+    }
+
+    bool SymbolCache::Find(const char *symbol, std::uint64_t *offset) const {
+        auto found = offsets_.find(symbol);
+        if (found == offsets_.end()) return false;
+        *offset = found->second;
+        return true;
+    }
+
+    void SymbolCache::Put(const char *symbol, std::uint64_t offset) {
+        std::size_t length = strlen(symbol);
+        if (length > UINT16_MAX) return;
+        auto [position, inserted] = offsets_.emplace(std::string(symbol, length), offset);
+        if (!inserted && position->second == offset) return;
+        position->second = offset;
+        dirty_ = true;
+    }
+
+    bool SymbolCache::Save() {
+        if (!dirty_) return true;
+
+        std::vector<std::uint8_t> data;
+        auto append = [&data](const void *value, std::size_t size) {
+            auto *bytes = static_cast<const std::uint8_t *>(value);
+            data.insert(data.end(), bytes, bytes + size);
+        };
+        auto build_id_size = static_cast<std::uint32_t>(key_.build_id_.size());
+        auto count = static_cast<std::uint32_t>(offsets_.size());
+        append(&kMagic, sizeof(kMagic));
+        append(&kVersion, sizeof(kVersion));
+        append(&build_id_size, sizeof(build_id_size));
+        append(key_.build_id_.data(), build_id_size);
+        append(&key_.size_, sizeof(key_.size_));
+        append(&key_.modification_time_, sizeof(key_.modification_time_));
+        append(&count, sizeof(count));
+        for (const auto &[name, offset] : offsets_) {
+            auto name_size = static_cast<std::uint16_t>(name.size());
+            append(&offset, sizeof(offset));
+            append(&name_size, sizeof(name_size));
+            append(name.data(), name_size);
+        }
+
+        std::string temporary_path = path_ + "." + std::to_string(getpid());
+        FILE *file = fopen(temporary_path.c_str(), "wbe");
+        if (file == nullptr) {
+            errorLog("Unable to create symbol cache %s.", temporary_path.c_str())
+            return false;
+        }
+        bool written = fwrite(data.data(), 1, data.size(), file) == data.size();
+        written = fclose(file) == 0 && written;
+        if (!written || rename(temporary_path.c_str(), path_.c_str()) != 0) {
+            errorLog("Unable to save symbol cache %s.", path_.c_str())
+            unlink(temporary_path.c_str());
+            return false;
+        }
+        dirty_ = false;
+        debugLog("Save %zu symbols into cache %s.", offsets_.size(), path_.c_str())
+        return true;
+    }
+}
@@ -0,0 +1,120 @@
+/*
+ * MIT License
+ *
+ * Copyright (C) 2021 M.D.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef KALEIDOSCOPE_SYMBOL_CACHE_H
+#define KALEIDOSCOPE_SYMBOL_CACHE_H
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace moe::aoramd::kaleidoscope::internal {
+
+    /**
+     * A persistent cache of symbol offsets from the load base of a dynamic library.
+     *
+     * Symbols of the same library file are found at the same offsets in every process, so they
+     * are saved into a cache file once and loaded by later processes without parsing the
+     * library. The cache file is only used if the library file matches its key, see Key.
+     */
+    class SymbolCache final {
+    public:
+
+        /**
+         * Identity of a library file, which consists of its GNU build id and the size and
+         * modification time of the file.
+         */
+        class Key final {
+        public:
+            std::vector<std::uint8_t> build_id_;
+            std::uint64_t size_ = 0;
+            std::int64_t modification_time_ = 0;
+
+            bool operator==(const Key &other) const {
+                return build_id_ == other.build_id_ && size_ == other.size_ &&
+                       modification_time_ == other.modification_time_;
+            }
+        };
+
+        /**
+         * Read key of a library file. Only the ELF header, program headers and notes are read.
+         *
+         * @param path path of library file.
+         * @param key key of library file.
+         * @return true if the file has a GNU build id note.
+         */
+        static bool ReadKey(const char *path, Key *key);
+
+        /**
+         * @param path path of cache file.
+         * @param key key of library file which symbols are found in.
+         */
+        SymbolCache(std::string path, Key key);
+
+        /**
+         * Load symbols from cache file. Symbols are not loaded if the key of cache file is not
+         * equal to the key of library file.
+         *
+         * @return true if symbols are loaded.
+         */
+        bool Load();
+
+        /**
+         * Find offset of a symbol from the load base of library.
+         *
+         * @param symbol symbol name.
+         * @param offset offset of symbol.
+         * @return true if symbol is in the cache.
+         */
+        bool Find(const char *symbol, std::uint64_t *offset) const;
+
+        /**
+         * Put offset of a symbol found in library into the cache.
+         *
+         * @param symbol symbol name.
+         * @param offset offset of symbol from the load base of library.
+         */
+        void Put(const char *symbol, std::uint64_t offset);
+
+        /**
+         * Save symbols into cache file if any symbol is put after loading. The file is replaced
+         * by renaming, so that other processes never read a partially written file.
+         *
+         * @return true if symbols are saved or nothing needs to be saved.
+         */
+        bool Save();
+
+    private:
+        static constexpr std::uint32_t kMagic = 0x4353594b;
+        static constexpr std::uint32_t kVersion = 1;
+
+        std::string path_;
+        Key key_;
+        std::unordered_map<std::string, std::uint64_t> offsets_;
+        bool dirty_ = false;
+    };
+}
+
+#endif
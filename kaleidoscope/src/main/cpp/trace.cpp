@@ -0,0 +1,167 @@
+/*
+ * MIT License
+ *
+ * Copyright (C) 2021 M.D.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <cstdio>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "trace.h"
+
+#include "log.h"
+
+namespace moe::aoramd::kaleidoscope::runtime {
+
+    static_assert((Trace::kRingCapacity & (Trace::kRingCapacity - 1)) == 0,
+                  "Capacity of trace ring must be a power of 2.");
+
+    /**
+     * Ring buffer of a thread. Head is only written by the thread, and tail is only written
+     * by Drain(), so they are kept in different cache lines.
+     */
+    class Trace::Ring final {
+    public:
+        TraceRecord records_[kRingCapacity];
+
+        alignas(64) std::atomic<std::uint64_t> head_{0};
+        std::atomic<std::uint64_t> dropped_{0};
+        std::uint32_t thread_id_ = 0;
+
+        alignas(64) std::atomic<std::uint64_t> tail_{0};
+
+        /**
+         * Set when the thread exits, and the ring is freed by Drain() once it is empty.
+         */
+        std::atomic<bool> closed_{false};
+    };
+
+    /**
+     * Owner of the ring of a thread, which closes the ring when the thread exits.
+     */
+    class Trace::RingOwner final {
+    public:
+        Ring *ring_ = nullptr;
+
+        ~RingOwner();
+    };
+
+    std::atomic<bool> Trace::enabled_{false};
+
+    std::mutex Trace::rings_mutex_;
+    std::vector<Trace::Ring *> Trace::rings_;
+    std::uint64_t Trace::freed_dropped_count_ = 0;
+    thread_local Trace::RingOwner Trace::ring_owner_;
+
+    Trace::RingOwner::~RingOwner() {
+        if (ring_ != nullptr) ring_->closed_.store(true, std::memory_order_release);
+        ring_ = nullptr;
+    }
+
+    Trace::Ring *Trace::GetRing() {
+        Ring *ring = ring_owner_.ring_;
+        if (ring != nullptr) return ring;
+
+        ring = new Ring();
+        ring->thread_id_ = static_cast<std::uint32_t>(syscall(SYS_gettid));
+        std::lock_guard<std::mutex> lock(rings_mutex_);
+        rings_.push_back(ring);
+        ring_owner_.ring_ = ring;
+        return ring;
+    }
+
+    void Trace::Push(TraceEvent event, const void *method, std::uint64_t timestamp,
+                     std::uint64_t duration) {
+        Ring *ring = GetRing();
+        std::uint64_t head = ring->head_.load(std::memory_order_relaxed);
+        if (head - ring->tail_.load(std::memory_order_acquire) == kRingCapacity) {
+            ring->dropped_.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        TraceRecord &record = ring->records_[head & (kRingCapacity - 1)];
+        record.timestamp_ = timestamp;
+        record.method_ = reinterpret_cast<std::uint64_t>(method);
+        record.thread_id_ = ring->thread_id_;
+        record.event_ = event;
+        record.reserved_ = 0;
+        record.duration_ = duration;
+        ring->head_.store(head + 1, std::memory_order_release);
+    }
+
+    std::size_t Trace::Drain(TraceRecord *records, std::size_t count) {
+        std::lock_guard<std::mutex> lock(rings_mutex_);
+        std::size_t drained = 0;
+        for (auto ring = rings_.begin(); ring != rings_.end();) {
+            // Nothing is recorded after closing, so head read later is final.
+            bool closed = (*ring)->closed_.load(std::memory_order_acquire);
+            std::uint64_t tail = (*ring)->tail_.load(std::memory_order_relaxed);
+            std::uint64_t head = (*ring)->head_.load(std::memory_order_acquire);
+            while (tail != head && drained < count) {
+                records[drained++] = (*ring)->records_[tail & (kRingCapacity - 1)];
+                tail++;
+            }
+            (*ring)->tail_.store(tail, std::memory_order_release);
+
+            if (closed && tail == head) {
+                freed_dropped_count_ += (*ring)->dropped_.load(std::memory_order_relaxed);
+                delete *ring;
+                ring = rings_.erase(ring);
+            } else {
+                ++ring;
+            }
+        }
+        return drained;
+    }
+
+    bool Trace::Export(const char *path, std::size_t *count) {
+        *count = 0;
+        FILE *file = fopen(path, "wbe");
+        if (file == nullptr) {
+            errorLog("Unable to create trace file %s.", path)
+            return false;
+        }
+
+        std::uint16_t record_size = sizeof(TraceRecord);
+        std::uint64_t dropped_count = GetDroppedCount();
+        bool written = fwrite(&kExportMagic, sizeof(kExportMagic), 1, file) == 1 &&
+                       fwrite(&kExportVersion, sizeof(kExportVersion), 1, file) == 1 &&
+                       fwrite(&record_size, sizeof(record_size), 1, file) == 1 &&
+                       fwrite(&dropped_count, sizeof(dropped_count), 1, file) == 1;
+
+        TraceRecord records[256];
+        std::size_t drained;
+        while (written && (drained = Drain(records, sizeof(records) / sizeof(records[0]))) > 0) {
+            written = fwrite(records, sizeof(TraceRecord), drained, file) == drained;
+            *count += drained;
+        }
+        written = fclose(file) == 0 && written;
+        if (!written) errorLog("Unable to write trace file %s.", path)
+        return written;
+    }
+
+    std::uint64_t Trace::GetDroppedCount() {
+        std::lock_guard<std::mutex> lock(rings_mutex_);
+        std::uint64_t count = freed_dropped_count_;
+        for (Ring *ring : rings_) count += ring->dropped_.load(std::memory_order_relaxed);
+        return count;
+    }
+}
@@ -0,0 +1,190 @@
+/*
+ * MIT License
+ *
+ * Copyright (C) 2021 M.D.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef KALEIDOSCOPE_TRACE_H
+#define KALEIDOSCOPE_TRACE_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <ctime>
+#include <mutex>
+#include <vector>
+
+namespace moe::aoramd::kaleidoscope::runtime {
+
+    /**
+     * Events of hooked runtime methods recorded by Trace.
+     */
+    enum class TraceEvent : std::uint16_t {
+        kInstall = 0,
+        kEnter = 1,
+        kExit = 2,
+        kRestore = 3
+    };
+
+    /**
+     * A fixed-size binary trace record. Records are exported as they are, so the layout must
+     * not be changed without changing Trace::kExportVersion.
+     */
+    class TraceRecord final {
+    public:
+
+        /**
+         * Time of the event from CLOCK_MONOTONIC in nanoseconds, the same clock as
+         * System.nanoTime() in Android.
+         */
+        std::uint64_t timestamp_;
+
+        /**
+         * Runtime method of the event.
+         */
+        std::uint64_t method_;
+
+        /**
+         * Kernel thread id of the thread recording the event.
+         */
+        std::uint32_t thread_id_;
+
+        TraceEvent event_;
+
+        std::uint16_t reserved_;
+
+        /**
+         * Duration of the event in nanoseconds: time of inserting or restoring bridge code,
+         * or time of the invocation for exit events. It is 0 for enter events.
+         */
+        std::uint64_t duration_;
+    };
+
+    static_assert(sizeof(TraceRecord) == 32, "Size of trace record must be 32 bytes.");
+
+    /**
+     * A tool class for tracing events of hooked runtime methods with little overhead.
+     *
+     * Every thread records into its own single-producer single-consumer ring buffer of fixed
+     * capacity, so recording takes neither locks nor allocation after the first record of the
+     * thread. Records are dropped and counted if the ring is full. Drain() is the only consumer
+     * of all rings, and it is serialized by a lock.
+     */
+    class Trace final {
+    public:
+
+        /**
+         * Count of records in the ring buffer of each thread.
+         */
+        static constexpr std::size_t kRingCapacity = 1024;
+
+        /**
+         * Magic and version in the header of exported files, see Export().
+         */
+        static constexpr std::uint32_t kExportMagic = 0x5254434b;
+        static constexpr std::uint16_t kExportVersion = 1;
+
+        /**
+         * Start or stop recording. Records saved before stopping are kept until drained.
+         *
+         * @param enabled true for starting recording.
+         */
+        static void SetEnabled(bool enabled) {
+            enabled_.store(enabled, std::memory_order_relaxed);
+        }
+
+        static bool IsEnabled() {
+            return enabled_.load(std::memory_order_relaxed);
+        }
+
+        /**
+         * Get current time of trace records.
+         *
+         * @return time from CLOCK_MONOTONIC in nanoseconds.
+         */
+        static std::uint64_t Now() {
+            timespec time{};
+            clock_gettime(CLOCK_MONOTONIC, &time);
+            return static_cast<std::uint64_t>(time.tv_sec) * 1000000000 + time.tv_nsec;
+        }
+
+        /**
+         * Record an event into the ring buffer of current thread if recording is started.
+         *
+         * @param event event type.
+         * @param method runtime method of the event.
+         * @param timestamp time of the event, see Now().
+         * @param duration duration of the event in nanoseconds.
+         */
+        static void Record(TraceEvent event, const void *method, std::uint64_t timestamp,
+                           std::uint64_t duration = 0) {
+            if (!IsEnabled()) return;
+            Push(event, method, timestamp, duration);
+        }
+
+        /**
+         * Move records out of ring buffers. Records of a thread are in order, and records of
+         * different threads can be ordered by timestamp.
+         *
+         * @param records destination of records.
+         * @param count max count of records.
+         * @return count of records moved.
+         */
+        static std::size_t Drain(TraceRecord *records, std::size_t count);
+
+        /**
+         * Drain all records into a file, which is a header followed by records as they are.
+         * The header is magic and version in 32 bits and 16 bits, size of a record in 16 bits
+         * and count of dropped records in 64 bits, all in native byte order.
+         *
+         * @param path path of exported file, which is replaced.
+         * @param count count of records exported.
+         * @return true if exported successfully.
+         */
+        static bool Export(const char *path, std::size_t *count);
+
+        /**
+         * Get count of records dropped because ring buffers are full.
+         *
+         * @return count of dropped records.
+         */
+        static std::uint64_t GetDroppedCount();
+
+    private:
+        class Ring;
+
+        class RingOwner;
+
+        static void Push(TraceEvent event, const void *method, std::uint64_t timestamp,
+                         std::uint64_t duration);
+
+        static Ring *GetRing();
+
+        static std::atomic<bool> enabled_;
+
+        static std::mutex rings_mutex_;
+        static std::vector<Ring *> rings_;
+        static std::uint64_t freed_dropped_count_;
+        static thread_local RingOwner ring_owner_;
+    };
+}
+
+#endif
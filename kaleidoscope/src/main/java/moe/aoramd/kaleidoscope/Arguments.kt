@@ -0,0 +1,113 @@
+/*
+ * MIT License
+ *
+ * Copyright (C) 2021 M.D.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+package moe.aoramd.kaleidoscope
+
+import moe.aoramd.kaleidoscope.internal.ArgumentLayout
+import moe.aoramd.kaleidoscope.internal.ArgumentLayout.Kind
+
+/**
+ * A view of parameters of a method invocation, excluding "this".
+ *
+ * Raw data of all parameters is captured and object parameters are obtained when the method
+ * is invoked, because the box of the invocation is released before listeners are called and
+ * objects may be moved by garbage collection later. Primitive parameters are kept as raw data
+ * and boxed only when they are read by [get] or [toArray], so getters such as [getInt] never
+ * allocate.
+ *
+ * A getter of a primitive type must match the parameter type, and [get] or [toArray] boxes
+ * parameters of any type.
+ */
+class Arguments internal constructor(
+    private val layout: ArgumentLayout,
+    internal val data: LongArray,
+    internal val objects: Array<Any?>?
+) {
+    private var array: Array<Any?>? = null
+
+    /**
+     * Count of parameters.
+     */
+    val size: Int
+        get() = layout.parameterCount
+
+    fun getBoolean(index: Int): Boolean = (raw(index, Kind.BOOLEAN) and 0xffL) != 0L
+
+    fun getByte(index: Int): Byte = raw(index, Kind.BYTE).toByte()
+
+    fun getChar(index: Int): Char = raw(index, Kind.CHAR).toInt().toChar()
+
+    fun getShort(index: Int): Short = raw(index, Kind.SHORT).toShort()
+
+    fun getInt(index: Int): Int = raw(index, Kind.INT).toInt()
+
+    fun getLong(index: Int): Long = raw(index, Kind.LONG)
+
+    fun getFloat(index: Int): Float = Float.fromBits(raw(index, Kind.FLOAT).toInt())
+
+    fun getDouble(index: Int): Double = Double.fromBits(raw(index, Kind.DOUBLE))
+
+    fun getObject(index: Int): Any? {
+        checkKind(index, Kind.OBJECT)
+        return objects!![layout.slotOf(index)]
+    }
+
+    /**
+     * Get parameter of any type, primitive parameters are boxed.
+     */
+    operator fun get(index: Int): Any? = when (layout.kindOf(index)) {
+        Kind.BOOLEAN -> getBoolean(index)
+        Kind.BYTE -> getByte(index)
+        Kind.CHAR -> getChar(index)
+        Kind.SHORT -> getShort(index)
+        Kind.INT -> getInt(index)
+        Kind.LONG -> getLong(index)
+        Kind.FLOAT -> getFloat(index)
+        Kind.DOUBLE -> getDouble(index)
+        Kind.OBJECT -> getObject(index)
+    }
+
+    /**
+     * Get all parameters with primitive parameters boxed. The array is created once for the
+     * invocation, and the same array is returned to its before and after listeners, so it must
+     * not be modified by callers.
+     */
+    fun toArray(): Array<Any?> = array ?: Array(size) { get(it) }.also { array = it }
+
+    /**
+     * "this" of the invocation, or null if method is static.
+     */
+    internal val thiz: Any?
+        get() = if (layout.isStatic) null else objects!![0]
+
+    private fun raw(index: Int, kind: Kind): Long {
+        checkKind(index, kind)
+        return data[layout.slotOf(index)]
+    }
+
+    private fun checkKind(index: Int, kind: Kind) {
+        if (index !in 0 until size) throw IndexOutOfBoundsException("Index $index, size $size.")
+        if (layout.kindOf(index) != kind) throw ArgumentTypeNotMatchException(index, kind.name)
+    }
+}
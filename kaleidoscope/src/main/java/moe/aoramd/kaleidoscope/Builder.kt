@@ -27,18 +27,134 @@ package moe.aoramd.kaleidoscope
 import moe.aoramd.kaleidoscope.internal.*
 import java.lang.reflect.Method
 
-sealed class Builder(protected val source: Method) {
+sealed class Builder(internal val source: Method) {
     /**
      * Commit and enable settings.
      * An exception will be thrown if method was set repeatedly.
      */
     abstract fun commit(): Scope
+
+    /**
+     * Whether the builder replaces method invocation. It is used for committing in batch.
+     */
+    internal abstract val replacing: Boolean
+
+    /**
+     * Sample interval of listening method invocation. It is used for committing in batch.
+     */
+    internal open val sampleInterval: Long = 0
+
+    /**
+     * Create scope attached to the hook of source method if bridge code has been inserted
+     * into it and can be shared, or return null if bridge code must be inserted.
+     */
+    internal open fun attach(): Scope? = null
+
+    /**
+     * Check settings and mark source method before bridge code is inserted.
+     */
+    internal abstract fun prepare()
+
+    /**
+     * Create scope with native peer of insert result, or [ErrorScope] if [nativePeer] is 0.
+     */
+    internal abstract fun complete(nativePeer: Long): Scope
+}
+
+/**
+ * Result of committing builders in batch. See [commitAll].
+ */
+class BatchResult internal constructor(
+    /**
+     * Scopes in the same order as builders, [ErrorScope] for failed ones.
+     */
+    val scopes: List<Scope>,
+
+    /**
+     * Time of creating bridge code for all methods in nanoseconds.
+     */
+    val prepareTime: Long,
+
+    /**
+     * Time of inserting bridge code while all threads are suspended in nanoseconds.
+     */
+    val patchTime: Long
+) {
+    val succeeded: List<Scope>
+        get() = scopes.filter { it != ErrorScope }
+
+    val failed: List<Int>
+        get() = scopes.indices.filter { scopes[it] == ErrorScope }
+}
+
+/**
+ * Commit and enable settings of builders in batch.
+ *
+ * Bridge code of all methods is created before suspending threads, and then inserted in a
+ * single suspension, which is much faster than invoking [Builder.commit] one by one.
+ * Listeners of methods already listened, or listened by an earlier builder of the batch, are
+ * attached to their bridge code without inserting it again.
+ * An exception will be thrown if any method was set repeatedly, and none of builders is committed.
+ */
+fun Iterable<Builder>.commitAll(): BatchResult {
+    val builders = toList()
+    val scopes = Array(builders.size) { builders[it].attach() }
+
+    // Listeners of one method share the bridge code inserted for the first of them.
+    val inserting = mutableListOf<Int>()
+    val sharing = mutableMapOf<Int, Int>()
+    val firstListeners = mutableMapOf<Method, Int>()
+    builders.indices.filter { scopes[it] == null }.forEach {
+        val builder = builders[it]
+        if (!builder.replacing) {
+            val first = firstListeners[builder.source]
+            if (first != null) {
+                sharing[it] = first
+                return@forEach
+            }
+            firstListeners[builder.source] = it
+        }
+        inserting.add(it)
+    }
+
+    val prepared = mutableListOf<Builder>()
+    try {
+        inserting.forEach {
+            builders[it].prepare()
+            prepared.add(builders[it])
+        }
+    } catch (exception: RuntimeException) {
+        prepared.forEach { it.source.unmark() }
+        scopes.forEach { it?.restore() }
+        throw exception
+    }
+
+    val timings = LongArray(2)
+    val nativePeers = batchBridge(
+        Array(inserting.size) { builders[inserting[it]].source },
+        BooleanArray(inserting.size) { builders[inserting[it]].replacing },
+        LongArray(inserting.size) { builders[inserting[it]].sampleInterval },
+        timings
+    )
+    inserting.forEachIndexed { index, builder ->
+        scopes[builder] = builders[builder].complete(nativePeers[index])
+    }
+    sharing.forEach { (index, first) ->
+        scopes[index] =
+            if (scopes[first] == ErrorScope) ErrorScope else builders[index].attach() ?: ErrorScope
+    }
+    return BatchResult(scopes.map { it!! }, timings[0], timings[1])
 }
 
 class ListenBuilder internal constructor(method: Method) : Builder(method) {
 
-    private var beforeListener: (Any?, Array<Any?>) -> Any? = { _, _ -> }
-    private var afterListener: (Any?, Array<Any?>, Any?) -> Unit = { _, _, _ -> }
+    private var beforeListener: (Any?, Arguments) -> Any? = { _, _ -> }
+    private var afterListener: (Any?, Arguments, Any?) -> Unit = { _, _, _ -> }
+
+    override var sampleInterval: Long = 0
+        private set
+
+    private var priority: Int = 0
 
     /**
      * Add a listener which is called before the method is invoked.
@@ -50,9 +166,18 @@ class ListenBuilder internal constructor(method: Method) : Builder(method) {
      * after the method is invoked. See [after].
      */
     fun before(listener: (thiz: Any?, parameters: Array<Any?>) -> Any?): ListenBuilder = apply {
-        beforeListener = listener
+        beforeListener = { thiz, arguments -> listener(thiz, arguments.toArray()) }
     }
 
+    /**
+     * Add a listener which is called before the method is invoked, the same as [before] but
+     * parameters are passed as [Arguments], which boxes parameters only when they are read.
+     */
+    fun beforeArguments(listener: (thiz: Any?, arguments: Arguments) -> Any?): ListenBuilder =
+        apply {
+            beforeListener = listener
+        }
+
     /**
      * Add a listener which is called after the method is invoked.
      *
@@ -63,20 +188,92 @@ class ListenBuilder internal constructor(method: Method) : Builder(method) {
      * before the method is invoked. See [before].
      */
     fun after(listener: (thiz: Any?, parameters: Array<Any?>, store: Any?) -> Unit): ListenBuilder = apply {
-        afterListener = listener
+        afterListener = { thiz, arguments, store -> listener(thiz, arguments.toArray(), store) }
+    }
+
+    /**
+     * Add a listener which is called after the method is invoked, the same as [after] but
+     * parameters are passed as [Arguments], which boxes parameters only when they are read.
+     */
+    fun afterArguments(listener: (thiz: Any?, arguments: Arguments, store: Any?) -> Unit): ListenBuilder =
+        apply {
+            afterListener = listener
+        }
+
+    /**
+     * Only listen one in every [n] invocations of the method, the others run origin code
+     * without calling listeners. All invocations are listened by default.
+     *
+     * Unsampled invocations are skipped in bridge code, so that they cost only a few
+     * instructions, which is useful for listening methods invoked very frequently.
+     */
+    fun sampleEvery(n: Int): ListenBuilder = apply {
+        if (n <= 0) throw SampleIntervalException(n)
+        sampleInterval = n.toLong()
+    }
+
+    /**
+     * Only listen invocations of the method at [rate], which is in (0, 1].
+     * The rate is rounded to an interval, see [sampleEvery].
+     */
+    fun sample(rate: Double): ListenBuilder = apply {
+        if (!(rate > 0.0 && rate <= 1.0)) throw SampleRateException(rate)
+        sampleInterval = Math.round(1.0 / rate).coerceIn(1L, Int.MAX_VALUE.toLong())
+    }
+
+    /**
+     * Set priority of listeners, which is 0 by default.
+     *
+     * A method can be listened by several scopes, which share one bridge code and decode
+     * parameters once. Before listeners of higher priority are called earlier and their after
+     * listeners are called later, and listeners of the same priority are called in the order
+     * they are committed.
+     *
+     * Sampling applies to the method rather than the scope, so the sample interval of the
+     * scope committed first is kept until all scopes of the method are restored.
+     */
+    fun priority(priority: Int): ListenBuilder = apply {
+        this.priority = priority
     }
 
     override fun commit(): Scope {
+        attach()?.let { return it }
+        prepare()
+        return complete(source.listenBridge(sampleInterval))
+    }
+
+    override val replacing: Boolean = false
+
+    override fun attach(): Scope? {
+        val hook = source.findListenHook() ?: return null
+        synchronized(hook) {
+            // Hook is being restored with its last scope, so bridge code must be inserted again.
+            if (hook.isEmpty) return null
+            return ListenScope(beforeListener, afterListener, priority, hook).also { hook.attach(it) }
+        }
+    }
+
+    override fun prepare() {
         source.mark()
         source.isAccessible = true
         source.forceLoad()
-        val (result, target) = source.listenBridge() ?: run {
+    }
+
+    override fun complete(nativePeer: Long): Scope = complete(source.listenResult(nativePeer))
+
+    private fun complete(bridge: Pair<ListenResult, Method>?): Scope {
+        val (result, clone) = bridge ?: run {
             source.unmark()
             return ErrorScope
         }
-        return ListenScope(beforeListener, afterListener, target, source, result).also {
-            result.originPointer.registerRecord(it)
+        val hook = ListenHook(source, clone, result)
+        val scope = ListenScope(beforeListener, afterListener, priority, hook)
+        synchronized(hook) {
+            // Bridge code is inserted paused, and attaching resumes it after registering.
+            result.registerRecord(hook)
+            hook.attach(scope)
         }
+        return scope
     }
 }
 
@@ -95,6 +292,13 @@ class ReplaceBuilder internal constructor(method: Method) : Builder(method) {
     }
 
     override fun commit(): Scope {
+        prepare()
+        return complete(source.replaceBridge())
+    }
+
+    override val replacing: Boolean = true
+
+    override fun prepare() {
         if (target == null) throw NullTargetMethodException()
         val actualTarget = target!!
 
@@ -110,12 +314,20 @@ class ReplaceBuilder internal constructor(method: Method) : Builder(method) {
         source.isAccessible = true
         source.forceLoad()
         actualTarget.isAccessible = true
-        val result = source.replaceBridge() ?: run {
+    }
+
+    override fun complete(nativePeer: Long): Scope = complete(replaceResult(nativePeer))
+
+    private fun complete(bridge: InsertBridgeResult?): Scope {
+        val result = bridge ?: run {
             source.unmark()
             return ErrorScope
         }
-        return ReplaceScope(actualTarget, source, result).also {
-            result.originPointer.registerRecord(it)
+        val hook = ReplaceHook(target!!, source, result)
+        return ReplaceScope(hook).also {
+            // Bridge code is inserted paused, and it is resumed after registering.
+            result.registerRecord(hook)
+            result.setPaused(false)
         }
     }
 }
\ No newline at end of file
@@ -47,6 +47,12 @@ internal class ParameterTypeNotMatchException(
     parameterIndex: Int
 ) : RuntimeException("Parameter type of source method [$source] index of $parameterIndex and target method [$target]'s are not the same.")
 
+internal class SampleIntervalException(interval: Int) :
+    RuntimeException("Sample interval $interval is not positive.")
+
+internal class SampleRateException(rate: Double) :
+    RuntimeException("Sample rate $rate is not in (0, 1].")
+
 // Runtime
 
 internal class MethodCloneException(method: Method) :
@@ -69,6 +75,11 @@ internal class DuplicateMarkException(method: Method) :
 internal class RepeatInvokeRestoreException(scope: Scope) :
     RuntimeException("Function restore() of scope $scope can only be invoked once.")
 
+// Arguments
+
+internal class ArgumentTypeNotMatchException(index: Int, type: String) :
+    RuntimeException("Parameter index of $index is not of type ${type.toLowerCase()}.")
+
 // Bridge
 
 internal class UnsupportedArchitectureException(architecture: String) :
@@ -45,6 +45,9 @@ private enum class State {
 @Volatile
 private var currentState = State.NOT_INITIALIZED
 
+internal val isInitialized: Boolean
+    get() = currentState == State.SUCCESS
+
 @Synchronized
 @JvmName("initialize")
 fun Context.initializeKaleidoscope(logLevel: LogLevel = LogLevel.ERROR): Boolean {
@@ -77,6 +80,9 @@ fun Context.initializeKaleidoscope(logLevel: LogLevel = LogLevel.ERROR): Boolean
         currentThread = currentThreadNativePeer,
         standardMethod = Holder::class.java.getDeclaredMethod("functionStandard"),
         relativeMethod = Holder::class.java.getDeclaredMethod("functionRelative"),
+        staticMethod = UninitializedHolder::class.java.getDeclaredMethod("functionStatic"),
+        nativeMethod = Holder::class.java.getDeclaredMethod("functionNative"),
+        cacheDirectory = codeCacheDir.absolutePath,
     )
     if (!initialized) {
         currentState = State.NATIVE_ERROR
@@ -98,4 +104,10 @@ fun Method.listen(): ListenBuilder {
 fun Method.replace(): ReplaceBuilder {
     if (currentState != State.SUCCESS) throw NotInitializeException()
     return ReplaceBuilder(this)
-}
\ No newline at end of file
+}
+
+/**
+ * Listen invocations of all methods with the same settings in batch. See [commitAll].
+ */
+fun Iterable<Method>.listenAll(settings: ListenBuilder.() -> Unit = {}): BatchResult =
+    map { it.listen().apply(settings) }.commitAll()
@@ -0,0 +1,145 @@
+/*
+ * MIT License
+ *
+ * Copyright (C) 2021 M.D.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+package moe.aoramd.kaleidoscope
+
+import moe.aoramd.kaleidoscope.internal.RuntimeMethod
+import moe.aoramd.kaleidoscope.internal.findRecord
+import java.lang.reflect.Method
+
+/**
+ * A low-overhead method profiler of hooked methods.
+ *
+ * When started, every invocation of a hooked method is counted natively with its latency,
+ * without allocation, so the measurement is not distorted like measuring in listeners.
+ * Statistics of all hooked methods are taken at once by [snapshot].
+ */
+object Profiler {
+
+    /**
+     * Statistics of a hooked method. Latencies are in nanoseconds, and they include the time
+     * of bridge code and listeners.
+     *
+     * The latency histogram is log-bucketed, so percentiles are accurate to within 25%.
+     */
+    class HookProfile internal constructor(
+        val method: Method?,
+        val methodPointer: Long,
+        val callCount: Long,
+        val totalLatency: Long,
+        private val buckets: LongArray
+    ) {
+        val meanLatency: Double
+            get() = if (callCount == 0L) 0.0 else totalLatency.toDouble() / callCount
+
+        /**
+         * The least latency of the bucket in which the latency at [percentile] (0 ~ 100) is.
+         */
+        fun percentile(percentile: Double): Long {
+            val total = buckets.sum()
+            if (total == 0L) return 0L
+            val rank = (percentile / 100 * total).toLong().coerceIn(1L, total)
+            var count = 0L
+            for (bucket in buckets.indices) {
+                count += buckets[bucket]
+                if (count >= rank) return bucketLowerBounds[bucket]
+            }
+            return bucketLowerBounds.last()
+        }
+
+        /**
+         * Pairs of the least latency and the count of each bucket which is not empty.
+         */
+        val histogram: List<Pair<Long, Long>>
+            get() = buckets.indices.filter { buckets[it] != 0L }
+                .map { Pair(bucketLowerBounds[it], buckets[it]) }
+    }
+
+    @Volatile
+    internal var enabled = false
+        private set
+
+    /**
+     * Start counting invocations of hooked methods.
+     */
+    fun start() {
+        if (!isInitialized) throw NotInitializeException()
+        setEnabledNative(true)
+        enabled = true
+    }
+
+    /**
+     * Stop counting invocations. Statistics are kept until [reset].
+     */
+    fun stop() {
+        if (!isInitialized) throw NotInitializeException()
+        enabled = false
+        setEnabledNative(false)
+    }
+
+    /**
+     * Take statistics of all hooked methods at once.
+     */
+    fun snapshot(): List<HookProfile> {
+        if (!isInitialized) throw NotInitializeException()
+        val data = snapshotNative()
+        val length = 3 + bucketLowerBounds.size
+        return (0 until data.size / length).map {
+            val offset = it * length
+            HookProfile(
+                method = RuntimeMethod(data[offset]).findRecord()?.source,
+                methodPointer = data[offset],
+                callCount = data[offset + 1],
+                totalLatency = data[offset + 2],
+                buckets = data.copyOfRange(offset + 3, offset + length)
+            )
+        }
+    }
+
+    /**
+     * Clear statistics of all hooked methods.
+     */
+    fun reset() {
+        if (!isInitialized) throw NotInitializeException()
+        resetNative()
+    }
+
+    private val bucketLowerBounds: LongArray by lazy { bucketLowerBoundsNative() }
+
+    @JvmStatic
+    private external fun setEnabledNative(enabled: Boolean)
+
+    /**
+     * Statistics of each hooked method are flattened into method pointer, call count, total
+     * latency and counts of buckets.
+     */
+    @JvmStatic
+    private external fun snapshotNative(): LongArray
+
+    @JvmStatic
+    private external fun resetNative()
+
+    @JvmStatic
+    private external fun bucketLowerBoundsNative(): LongArray
+}
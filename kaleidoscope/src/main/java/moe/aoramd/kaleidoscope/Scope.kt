@@ -25,29 +25,40 @@
 package moe.aoramd.kaleidoscope
 
 import moe.aoramd.kaleidoscope.internal.InsertBridgeResult
-import moe.aoramd.kaleidoscope.internal.releaseRecord
-import moe.aoramd.kaleidoscope.internal.unmark
+import moe.aoramd.kaleidoscope.internal.ListenHook
+import moe.aoramd.kaleidoscope.internal.ReplaceHook
 import java.lang.reflect.Method
 
 interface Scope {
     fun restore()
+
+    /**
+     * Stop calling listeners or the replacing method without restoring the method, until
+     * [resume] is invoked. Invocations of a paused method run origin code directly in bridge
+     * code, and pausing or resuming never patches code or suspends threads.
+     *
+     * It has no effect after the scope is restored.
+     */
+    fun pause()
+
+    /**
+     * Resume the scope paused by [pause].
+     */
+    fun resume()
 }
 
 object ErrorScope : Scope {
     override fun restore() {}
+
+    override fun pause() {}
+
+    override fun resume() {}
 }
 
 sealed class ValidScope(
     internal val source: Method,
-    private val result: InsertBridgeResult
+    internal val result: InsertBridgeResult
 ) : Scope {
-    internal abstract fun invoke(thiz: Any?, parameters: Array<Any?>): Any?
-    override fun restore() {
-        result.restoreBridge()
-        if (!source.unmark()) throw RepeatInvokeRestoreException(this)
-        result.originPointer.releaseRecord()
-    }
-
     override fun equals(other: Any?): Boolean {
         if (other == null || other !is ValidScope) return false
         return source == other.source && result == other.result
@@ -60,52 +71,94 @@ sealed class ValidScope(
     }
 }
 
+/**
+ * Scope of listeners attached to a listened method. Several scopes can be attached to one
+ * method, and they share the bridge code inserted for the first one, see [ListenBuilder.priority].
+ *
+ * Restoring a scope detaches its listeners, and bridge code is restored with the last one.
+ */
 class ListenScope internal constructor(
-    private val before: (Any?, Array<Any?>) -> Any?,
-    private val after: (Any?, Array<Any?>, Any?) -> Unit,
-    private val target: Method,
-    source: Method,
-    result: InsertBridgeResult
-) : ValidScope(source, result) {
-    override fun invoke(thiz: Any?, parameters: Array<Any?>): Any? {
-        val store = before.invoke(thiz, parameters)
-        val result = target.invoke(thiz, *parameters)
-        after.invoke(thiz, parameters, store)
-        return result
+    internal val before: (Any?, Arguments) -> Any?,
+    internal val after: (Any?, Arguments, Any?) -> Unit,
+    internal val priority: Int,
+    private val hook: ListenHook
+) : ValidScope(hook.source, hook.result) {
+    /**
+     * Whether listeners are skipped, see [pause].
+     */
+    @Volatile
+    internal var paused = false
+        private set
+
+    override fun restore() {
+        synchronized(hook) {
+            if (!hook.detach(this)) throw RepeatInvokeRestoreException(this)
+            if (hook.isEmpty) hook.restore()
+        }
+    }
+
+    /**
+     * Skip listeners of this scope. Bridge code stops dispatching the method only when all
+     * scopes of the method are paused, and the others keep being called.
+     */
+    override fun pause() = setPaused(true)
+
+    override fun resume() = setPaused(false)
+
+    private fun setPaused(paused: Boolean) {
+        synchronized(hook) {
+            if (!hook.contains(this)) return
+            this.paused = paused
+            hook.updatePaused()
+        }
     }
 
     override fun equals(other: Any?): Boolean {
         if (other == null || other !is ListenScope) return false
         return before == other.before && after == other.after &&
-                target == other.target && super.equals(other)
+                priority == other.priority && super.equals(other)
     }
 
     override fun hashCode(): Int {
         var result = super.hashCode()
         result = 31 * result + before.hashCode()
         result = 31 * result + after.hashCode()
-        result = 31 * result + target.hashCode()
+        result = 31 * result + priority
         return result
     }
 }
 
 class ReplaceScope internal constructor(
-    private val target: Method,
-    source: Method,
-    result: InsertBridgeResult
-) : ValidScope(source, result) {
-    override fun invoke(thiz: Any?, parameters: Array<Any?>): Any? {
-        return target.invoke(thiz, *parameters)
+    private val hook: ReplaceHook
+) : ValidScope(hook.source, hook.result) {
+    private var restored = false
+
+    override fun restore() {
+        synchronized(hook) {
+            if (restored) throw RepeatInvokeRestoreException(this)
+            restored = true
+            hook.restore()
+        }
+    }
+
+    override fun pause() = setPaused(true)
+
+    override fun resume() = setPaused(false)
+
+    private fun setPaused(paused: Boolean) {
+        synchronized(hook) {
+            if (!restored) hook.result.setPaused(paused)
+        }
     }
 
     override fun equals(other: Any?): Boolean {
         if (other == null || other !is ReplaceScope) return false
-        return target == other.target && super.equals(other)
+        return hook.target == other.hook.target && super.equals(other)
     }
 
     override fun hashCode(): Int {
         var result = super.hashCode()
-        result = 31 * result + target.hashCode()
+        result = 31 * result + hook.target.hashCode()
         return result
     }
-}
\ No newline at end of file
+}
@@ -0,0 +1,137 @@
+/*
+ * MIT License
+ *
+ * Copyright (C) 2021 M.D.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+package moe.aoramd.kaleidoscope
+
+import java.io.File
+
+/**
+ * A binary trace of hooked methods, which is cheap enough to be left on in production.
+ *
+ * Events are recorded natively into a fixed-size ring buffer of each thread, and events
+ * recorded when the buffer is full are dropped and counted in [droppedCount]. Events are
+ * moved out of buffers by [drain] or [export].
+ */
+object Trace {
+
+    enum class Event { INSTALL, ENTER, EXIT, RESTORE }
+
+    /**
+     * A trace record. [timestamp] is in nanoseconds of the same clock as [System.nanoTime], and
+     * [duration] is the time of inserting or restoring bridge code, or the time of invocation
+     * for [Event.EXIT].
+     */
+    class Record(
+        val timestamp: Long,
+        val methodPointer: Long,
+        val threadId: Int,
+        val event: Event,
+        val duration: Long
+    )
+
+    @Volatile
+    internal var enabled = false
+        private set
+
+    /**
+     * Start recording events.
+     */
+    fun start() {
+        if (!isInitialized) throw NotInitializeException()
+        setEnabledNative(true)
+        enabled = true
+    }
+
+    /**
+     * Stop recording events. Events recorded before are kept until drained.
+     */
+    fun stop() {
+        if (!isInitialized) throw NotInitializeException()
+        enabled = false
+        setEnabledNative(false)
+    }
+
+    /**
+     * Move all recorded events out of buffers. Events of a thread are in order, and events of
+     * different threads can be ordered by [Record.timestamp].
+     */
+    fun drain(): List<Record> {
+        if (!isInitialized) throw NotInitializeException()
+        val records = mutableListOf<Record>()
+        val data = LongArray(DRAIN_BATCH_SIZE * RECORD_LONG_COUNT)
+        do {
+            val count = drainNative(data)
+            for (i in 0 until count) {
+                val offset = i * RECORD_LONG_COUNT
+                records.add(
+                    Record(
+                        timestamp = data[offset],
+                        methodPointer = data[offset + 1],
+                        threadId = (data[offset + 2] ushr 16).toInt(),
+                        event = Event.values()[(data[offset + 2] and 0xffff).toInt()],
+                        duration = data[offset + 3]
+                    )
+                )
+            }
+        } while (count == DRAIN_BATCH_SIZE)
+        return records
+    }
+
+    /**
+     * Move all recorded events into [file] in the compact binary format of native records,
+     * and return the count of exported events, or -1 on failure.
+     */
+    fun export(file: File): Int {
+        if (!isInitialized) throw NotInitializeException()
+        return exportNative(file.absolutePath)
+    }
+
+    /**
+     * Count of events dropped because buffers are full.
+     */
+    val droppedCount: Long
+        get() {
+            if (!isInitialized) throw NotInitializeException()
+            return droppedCountNative()
+        }
+
+    private const val DRAIN_BATCH_SIZE = 256
+
+    /**
+     * Each record is drained as timestamp, method, thread id and event, and duration.
+     */
+    private const val RECORD_LONG_COUNT = 4
+
+    @JvmStatic
+    private external fun setEnabledNative(enabled: Boolean)
+
+    @JvmStatic
+    private external fun drainNative(data: LongArray): Int
+
+    @JvmStatic
+    private external fun exportNative(path: String): Int
+
+    @JvmStatic
+    private external fun droppedCountNative(): Long
+}
@@ -0,0 +1,94 @@
+/*
+ * MIT License
+ *
+ * Copyright (C) 2021 M.D.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+package moe.aoramd.kaleidoscope.internal
+
+import java.lang.reflect.Method
+
+/**
+ * Kinds of parameters of a method set to Kaleidoscope, which are computed once when the scope
+ * of the method is created.
+ *
+ * Slots of the layout are "this" if method is not static, followed by parameters. Where each
+ * slot is passed is computed once by native runtime when bridge code is inserted, see
+ * [Method.shorty], and all slots of an invocation are captured by a single native call, see
+ * [Box.enter].
+ */
+internal class ArgumentLayout(method: Method) {
+
+    enum class Kind { BOOLEAN, BYTE, CHAR, SHORT, INT, LONG, FLOAT, DOUBLE, OBJECT }
+
+    val isStatic: Boolean = method.isStatic
+
+    val parameterCount: Int = method.parameterTypes.size
+
+    private val kinds: Array<Kind> = mutableListOf<Kind>().apply {
+        if (!isStatic) add(Kind.OBJECT)
+        method.parameterTypes.forEach { add(it.kind) }
+    }.toTypedArray()
+
+    fun kindOf(index: Int): Kind = kinds[slotOf(index)]
+
+    fun slotOf(index: Int): Int = if (isStatic) index else index + 1
+
+    private companion object {
+        val Class<*>.kind: Kind
+            get() = when (this) {
+                Boolean::class.javaPrimitiveType -> Kind.BOOLEAN
+                Byte::class.javaPrimitiveType -> Kind.BYTE
+                Char::class.javaPrimitiveType -> Kind.CHAR
+                Short::class.javaPrimitiveType -> Kind.SHORT
+                Int::class.javaPrimitiveType -> Kind.INT
+                Long::class.javaPrimitiveType -> Kind.LONG
+                Float::class.javaPrimitiveType -> Kind.FLOAT
+                Double::class.javaPrimitiveType -> Kind.DOUBLE
+                else -> Kind.OBJECT
+            }
+    }
+}
+
+/**
+ * Shorty descriptor of method, the return type followed by parameter types, in which all
+ * reference types are 'L'. It is passed to native runtime for computing where parameters are
+ * passed.
+ */
+internal val Method.shorty: String
+    get() = buildString {
+        append(returnType.shortyChar)
+        parameterTypes.forEach { append(it.shortyChar) }
+    }
+
+private val Class<*>.shortyChar: Char
+    get() = when (this) {
+        Void.TYPE -> 'V'
+        Boolean::class.javaPrimitiveType -> 'Z'
+        Byte::class.javaPrimitiveType -> 'B'
+        Char::class.javaPrimitiveType -> 'C'
+        Short::class.javaPrimitiveType -> 'S'
+        Int::class.javaPrimitiveType -> 'I'
+        Long::class.javaPrimitiveType -> 'J'
+        Float::class.javaPrimitiveType -> 'F'
+        Double::class.javaPrimitiveType -> 'D'
+        else -> 'L'
+    }
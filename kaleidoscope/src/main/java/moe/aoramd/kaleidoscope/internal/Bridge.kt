@@ -90,55 +90,55 @@ private object Bridge64 : Bridge() {
     private fun booleanBridge(
         currentThread: Long, box: Long, x3: Long,
         x4: Long, x5: Long, x6: Long, x7: Long
-    ): Boolean = invokeBridge64(currentThread, box, x3, x4, x5, x6, x7) as Boolean
+    ): Boolean = invokeBridge64(currentThread, box, x3, x4, x5, x6, x7) != 0L
 
     @JvmStatic
     private fun byteBridge(
         currentThread: Long, box: Long, x3: Long,
         x4: Long, x5: Long, x6: Long, x7: Long
-    ): Byte = invokeBridge64(currentThread, box, x3, x4, x5, x6, x7) as Byte
+    ): Byte = invokeBridge64(currentThread, box, x3, x4, x5, x6, x7).toByte()
 
     @JvmStatic
     private fun charBridge(
         currentThread: Long, box: Long, x3: Long,
         x4: Long, x5: Long, x6: Long, x7: Long
-    ): Char = invokeBridge64(currentThread, box, x3, x4, x5, x6, x7) as Char
+    ): Char = invokeBridge64(currentThread, box, x3, x4, x5, x6, x7).toInt().toChar()
 
     @JvmStatic
     private fun shortBridge(
         currentThread: Long, box: Long, x3: Long,
         x4: Long, x5: Long, x6: Long, x7: Long
-    ): Short = invokeBridge64(currentThread, box, x3, x4, x5, x6, x7) as Short
+    ): Short = invokeBridge64(currentThread, box, x3, x4, x5, x6, x7).toShort()
 
     @JvmStatic
     private fun intBridge(
         currentThread: Long, box: Long, x3: Long,
         x4: Long, x5: Long, x6: Long, x7: Long
-    ): Int = invokeBridge64(currentThread, box, x3, x4, x5, x6, x7) as Int
+    ): Int = invokeBridge64(currentThread, box, x3, x4, x5, x6, x7).toInt()
 
     @JvmStatic
     private fun longBridge(
         currentThread: Long, box: Long, x3: Long,
         x4: Long, x5: Long, x6: Long, x7: Long
-    ): Long = invokeBridge64(currentThread, box, x3, x4, x5, x6, x7) as Long
+    ): Long = invokeBridge64(currentThread, box, x3, x4, x5, x6, x7)
 
     @JvmStatic
     private fun floatBridge(
         currentThread: Long, box: Long, x3: Long,
         x4: Long, x5: Long, x6: Long, x7: Long
-    ): Float = invokeBridge64(currentThread, box, x3, x4, x5, x6, x7) as Float
+    ): Float = invokeBridge64(currentThread, box, x3, x4, x5, x6, x7).let { Float.fromBits(it.toInt()) }
 
     @JvmStatic
     private fun doubleBridge(
         currentThread: Long, box: Long, x3: Long,
         x4: Long, x5: Long, x6: Long, x7: Long
-    ): Double = invokeBridge64(currentThread, box, x3, x4, x5, x6, x7) as Double
+    ): Double = invokeBridge64(currentThread, box, x3, x4, x5, x6, x7).let { Double.fromBits(it) }
 
     @JvmStatic
     private fun anyBridge(
         currentThread: Long, box: Long, x3: Long,
         x4: Long, x5: Long, x6: Long, x7: Long
-    ): Any? = invokeBridge64(currentThread, box, x3, x4, x5, x6, x7)
+    ): Any? = invokeBridge64Object(currentThread, box, x3, x4, x5, x6, x7)
 
     override fun bridgeMethod(type: Type): Method =
         Bridge64::class.java.getDeclaredMethod(
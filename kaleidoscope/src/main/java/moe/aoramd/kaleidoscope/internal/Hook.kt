@@ -0,0 +1,196 @@
+/*
+ * MIT License
+ *
+ * Copyright (C) 2021 M.D.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+package moe.aoramd.kaleidoscope.internal
+
+import moe.aoramd.kaleidoscope.Arguments
+import moe.aoramd.kaleidoscope.ListenScope
+import java.lang.reflect.Method
+
+/**
+ * A method inserted into bridge code, which is registered in record and invoked by bridge
+ * method for each captured invocation. Parameters of an invocation are decoded once by its
+ * [layout], however many scopes are attached to the hook.
+ */
+internal sealed class Hook(val source: Method, val result: InsertBridgeResult) {
+
+    /**
+     * Layout of parameters of source method, which is used to decode parameters of each
+     * invocation.
+     */
+    val layout = ArgumentLayout(source)
+
+    /**
+     * Runtime method of source method, which is kept after the native result is reclaimed.
+     */
+    val originPointer = result.originPointer
+
+    /**
+     * Invoke the hook for an invocation of source method returning primitive or void, and
+     * return raw data of the result, see [Invoker.invoke].
+     */
+    abstract fun invoke(arguments: Arguments): Long
+
+    /**
+     * Invoke the hook for an invocation of source method returning an object.
+     */
+    abstract fun invokeObject(arguments: Arguments): Any?
+
+    /**
+     * Restore bridge code of source method and release the hook.
+     */
+    fun restore() {
+        releaseRecord()
+        result.restoreBridge()
+        source.unmark()
+    }
+}
+
+/**
+ * Hook of a listened method, which calls listeners of all attached [ListenScope]s around the
+ * origin code.
+ *
+ * Scopes are kept in a flat array sorted by descending priority, so an invocation iterates
+ * them contiguously. Attaching or detaching a scope replaces the array as a whole and never
+ * touches bridge code, and invocations running concurrently keep the array they have read.
+ */
+internal class ListenHook(source: Method, clone: Method, result: ListenResult) :
+    Hook(source, result) {
+
+    private val invoker = Invoker.origin(clone, result)
+
+    @Volatile
+    private var scopes: Array<ListenScope> = emptyArray()
+
+    /**
+     * Attach [scope] behind the scopes with the same or higher priority.
+     */
+    @Synchronized
+    fun attach(scope: ListenScope) {
+        val scopes = scopes
+        val index = scopes.indexOfFirst { it.priority < scope.priority }
+            .let { if (it == -1) scopes.size else it }
+        this.scopes = Array(scopes.size + 1) {
+            when {
+                it < index -> scopes[it]
+                it == index -> scope
+                else -> scopes[it - 1]
+            }
+        }
+        updatePaused()
+    }
+
+    /**
+     * Detach [scope], and return false if it is not attached.
+     */
+    @Synchronized
+    fun detach(scope: ListenScope): Boolean {
+        val scopes = scopes
+        val index = scopes.indexOfFirst { it === scope }
+        if (index == -1) return false
+        this.scopes = Array(scopes.size - 1) { if (it < index) scopes[it] else scopes[it + 1] }
+        if (this.scopes.isNotEmpty()) updatePaused()
+        return true
+    }
+
+    /**
+     * Whether [scope] is attached.
+     */
+    @Synchronized
+    fun contains(scope: ListenScope): Boolean = scopes.any { it === scope }
+
+    /**
+     * Pause the hook in bridge code if all scopes are paused, or resume it otherwise.
+     */
+    @Synchronized
+    fun updatePaused() = result.setPaused(scopes.all { it.paused })
+
+    /**
+     * Whether no scope is attached, in which case the hook should be restored.
+     */
+    val isEmpty: Boolean
+        get() = scopes.isEmpty()
+
+    override fun invoke(arguments: Arguments): Long =
+        listen(arguments) { invoker.invoke(arguments) }
+
+    override fun invokeObject(arguments: Arguments): Any? =
+        listen(arguments) { invoker.invokeObject(arguments) }
+
+    /**
+     * Call before listeners in order of priority and after listeners in reverse order, so that
+     * listeners of higher priority wrap the others. Listeners of paused scopes are skipped, and
+     * after listeners are only called if their before listeners are called.
+     */
+    private inline fun <T> listen(arguments: Arguments, origin: () -> T): T {
+        val scopes = scopes
+        val thiz = arguments.thiz
+        when (scopes.size) {
+            0 -> return origin()
+            1 -> {
+                // A single scope is the common case, which needs no array for stores.
+                val scope = scopes[0]
+                if (scope.paused) return origin()
+                val store = scope.before(thiz, arguments)
+                val result = origin()
+                scope.after(thiz, arguments, store)
+                return result
+            }
+            else -> {
+                val stores = arrayOfNulls<Any?>(scopes.size)
+                for (index in scopes.indices) {
+                    val scope = scopes[index]
+                    stores[index] = if (scope.paused) Skipped else scope.before(thiz, arguments)
+                }
+                val result = origin()
+                for (index in scopes.size - 1 downTo 0) {
+                    val store = stores[index]
+                    if (store !== Skipped) scopes[index].after(thiz, arguments, store)
+                }
+                return result
+            }
+        }
+    }
+}
+
+/**
+ * Store of a scope whose listeners are skipped in an invocation, see [ListenHook.listen].
+ */
+private object Skipped
+
+/**
+ * Hook of a replaced method, which invokes the target method instead of origin code.
+ */
+internal class ReplaceHook(
+    val target: Method,
+    source: Method,
+    result: InsertBridgeResult
+) : Hook(source, result) {
+
+    private val invoker = Invoker.target(target, result)
+
+    override fun invoke(arguments: Arguments): Long = invoker.invoke(arguments)
+
+    override fun invokeObject(arguments: Arguments): Any? = invoker.invokeObject(arguments)
+}
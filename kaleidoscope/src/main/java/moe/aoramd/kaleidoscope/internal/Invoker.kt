@@ -0,0 +1,92 @@
+/*
+ * MIT License
+ *
+ * Copyright (C) 2021 M.D.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+package moe.aoramd.kaleidoscope.internal
+
+import moe.aoramd.kaleidoscope.Arguments
+import java.lang.reflect.Method
+
+/**
+ * Invoke a method with arguments captured by bridge code in native code, which passes raw data
+ * of primitive arguments unboxed and skips reflection and access checks.
+ *
+ * Results of primitive types are returned as raw data by [invoke], in which data narrower than
+ * 64 bits is kept in low bits, and results of objects are returned by [invokeObject].
+ * Exceptions thrown by the method are thrown as they are, rather than wrapped.
+ */
+internal class Invoker private constructor(
+    private val result: InsertBridgeResult,
+    private val method: Long,
+    private val clazz: Class<*>,
+    private val type: Int
+) {
+    fun invoke(arguments: Arguments): Long {
+        checkReceiver(arguments)
+        return InsertBridgeResult.invokeNative(
+            result.nativePeer, method, clazz, type, arguments.data, arguments.objects
+        )
+    }
+
+    fun invokeObject(arguments: Arguments): Any? {
+        checkReceiver(arguments)
+        return InsertBridgeResult.invokeObjectNative(
+            result.nativePeer, method, clazz, type, arguments.data, arguments.objects
+        )
+    }
+
+    private fun checkReceiver(arguments: Arguments) {
+        if (type != TYPE_STATIC && arguments.thiz == null)
+            throw NullPointerException("Invoke instance method with null receiver.")
+    }
+
+    companion object {
+        private const val TYPE_STATIC = 0
+        private const val TYPE_DIRECT = 1
+        private const val TYPE_VIRTUAL = 2
+
+        /**
+         * Invoker of the origin code kept in [clone], the method object whose runtime method is
+         * copied in [result]. The copy is invoked itself, because it is unknown to dispatching.
+         *
+         * Method id is got from [clone] by JNI rather than the runtime method pointer, because
+         * method ids are indexes rather than pointers if Android Runtime enables JNI id
+         * indirection, for example, in debuggable apps on Android 11 and above.
+         */
+        fun origin(clone: Method, result: ListenResult): Invoker = Invoker(
+            result, methodIdNative(clone), clone.declaringClass,
+            if (clone.isStatic) TYPE_STATIC else TYPE_DIRECT
+        )
+
+        /**
+         * Invoker of [target] with arguments captured by bridge code of [result], which is
+         * dispatched as invoked by reflection.
+         */
+        fun target(target: Method, result: InsertBridgeResult): Invoker = Invoker(
+            result, methodIdNative(target), target.declaringClass,
+            if (target.isStatic) TYPE_STATIC else TYPE_VIRTUAL
+        )
+    }
+}
+
+private external fun methodIdNative(method: Method): Long
@@ -37,49 +37,59 @@ internal class RuntimeMethod(val nativePeer: Long)
 
 /**
  * The mirror class used to obtain data of native class [runtime::Box] objects.
+ *
+ * The box is claimed by the current thread in bridge code, and it is released by [enter] once
+ * all data is obtained.
  */
-internal class Box(private val nativePeer: Long) {
-//internal inline class Box(private val nativePeer: Long) {
-
-    fun release() = releaseInternal(nativePeer)
-
-    val calleeRuntimeMethod: RuntimeMethod
-        get() = RuntimeMethod(calleeRuntimeMethod(nativePeer))
-
-    val x1: Long
-        get() = register1(nativePeer)
+internal class Box(val nativePeer: Long) {
+//internal inline class Box(val nativePeer: Long) {
+
+    /**
+     * Enter the invocation captured in the box, capture all its parameters from the box and
+     * registers passed to bridge method by the layout of its hook, and release the box, all in
+     * a single native call.
+     *
+     * Objects of reference parameters are returned at the indexes of their slots, followed by
+     * raw data of all slots, which is followed by the handle of the hook read from the hook
+     * record captured by secondary bridge, or -1 if the hook is not registered, and the callee
+     * runtime method, see [Invocation].
+     *
+     * Objects are obtained eagerly rather than when they are read, because raw references in
+     * the box are unknown to garbage collection, and they are stale once a moving collector
+     * relocates the objects. Raw data of primitive parameters is captured eagerly as well,
+     * because the box is released before listeners are called.
+     *
+     * Native data of the hook is not reclaimed until the invocation exits, even if the hook
+     * is restored meanwhile, so it must be paired with [exitInvocation] whether bridge method
+     * returns or throws.
+     */
+    fun enter(
+        x3: Long, x4: Long, x5: Long, x6: Long, x7: Long, currentThread: Long
+    ): Invocation = Invocation(enterInternal(nativePeer, x3, x4, x5, x6, x7, currentThread))
 
-    val x2: Long
-        get() = register2(nativePeer)
+    companion object {
+        private external fun enterInternal(
+            nativePeer: Long, x3: Long, x4: Long, x5: Long, x6: Long, x7: Long,
+            currentThread: Long
+        ): Array<Any?>
+    }
+}
 
-    fun parameterFromFloatRegister(index: Int): Float =
-        Companion.parameterFromFloatRegister(nativePeer, index)
+/**
+ * An invocation captured by [Box.enter], which wraps the array returned by native runtime.
+ */
+internal class Invocation(val objects: Array<Any?>) {
 
-    fun parameterFromDoubleRegister(index: Int): Double =
-        Companion.parameterFromDoubleRegister(nativePeer, index)
+    /**
+     * Raw data of all slots, followed by the handle and the callee runtime method.
+     */
+    val data = objects[objects.size - 1] as LongArray
 
-    fun parameterFromStack(byteOffset: Int, byteSize: Int): Long =
-        parameterFromStack(nativePeer, byteOffset, byteSize)
+    val handle: Int
+        get() = data[data.size - 2].toInt()
 
-    companion object {
-        fun unlockAndCopy(main: Long): Box = Box(unlockAndCopyInternal(main))
-        private external fun unlockAndCopyInternal(main: Long): Long
-        private external fun releaseInternal(nativePeer: Long)
-        private external fun calleeRuntimeMethod(nativePeer: Long): Long
-        private external fun register1(nativePeer: Long): Long
-        private external fun register2(nativePeer: Long): Long
-        private external fun parameterFromFloatRegister(
-            nativePeer: Long, index: Int
-        ): Float
-
-        private external fun parameterFromDoubleRegister(
-            nativePeer: Long, index: Int
-        ): Double
-
-        private external fun parameterFromStack(
-            nativePeer: Long, byteOffset: Int, byteSize: Int
-        ): Long
-    }
+    val calleeRuntimeMethod: RuntimeMethod
+        get() = RuntimeMethod(data[data.size - 1])
 }
 
 /**
@@ -93,8 +103,35 @@ internal interface InsertBridgeResult {
 
     fun restoreBridge() = restoreBridgeNative(nativePeer)
 
+    /**
+     * Pause or resume the hook in bridge code without restoring it.
+     */
+    fun setPaused(paused: Boolean) = setPausedNative(nativePeer, paused)
+
+    /**
+     * Handle of the scope registered with the result in its hook record, or -1 if no scope is
+     * registered.
+     */
+    var scopeHandle: Int
+        get() = scopeHandleNative(nativePeer)
+        set(value) = setScopeHandleNative(nativePeer, value)
+
     companion object {
         external fun originPointerNative(nativePeer: Long): Long
+        external fun setPausedNative(nativePeer: Long, paused: Boolean)
+        external fun reclaimedHandlesNative(): IntArray
+        external fun scopeHandleNative(nativePeer: Long): Int
+        external fun setScopeHandleNative(nativePeer: Long, handle: Int)
+
+        external fun invokeNative(
+            nativePeer: Long, method: Long, clazz: Class<*>, type: Int,
+            data: LongArray, objects: Array<Any?>?
+        ): Long
+
+        external fun invokeObjectNative(
+            nativePeer: Long, method: Long, clazz: Class<*>, type: Int,
+            data: LongArray, objects: Array<Any?>?
+        ): Any?
     }
 }
 
@@ -26,34 +26,108 @@ package moe.aoramd.kaleidoscope.internal
 
 import moe.aoramd.kaleidoscope.*
 import java.lang.reflect.Method
-
-private val records = mutableMapOf<Long, ValidScope>()
+import java.util.concurrent.atomic.AtomicReferenceArray
 
 /**
- * Register [scope] into record when the scope is created.
+ * Hooks indexed by their handles. Bridge method reads the handle from the hook record captured
+ * by secondary bridge, so a lookup is a single array read without locking or boxing. The array
+ * is replaced by a larger copy when it is full, and writers are serialized by [recordLock].
  *
- * [this] is the source runtime method pointer which will be captured from bridge function.
+ * A restored hook is kept in the array until native runtime reclaims its result, so that
+ * invocations still running it find it, see [reclaimRecords].
+ */
+@Volatile
+private var records = AtomicReferenceArray<Hook?>(16)
+
+private val recordLock = Any()
+
+/**
+ * Hooks of listened methods, which new listeners of the same method are attached to.
+ */
+private val listenHooks = mutableMapOf<Method, ListenHook>()
+
+/**
+ * Handles of hooks whose results are reclaimed, which are reused before the array grows.
+ */
+private val freeHandles = ArrayDeque<Int>()
+
+private var nextHandle = 0
+
+/**
+ * Register [hook] into record when bridge code is inserted, and set its handle into the hook
+ * record of [this] in native runtime. Bridge code is inserted paused, and it must be resumed
+ * after registering, so that bridge method never reads the handle before it is set.
  *
  * This function is paired with [releaseRecord].
  */
-internal fun RuntimeMethod.registerRecord(scope: ValidScope) {
-    if (records.containsKey(this.nativePeer)) throw DuplicateRegisterException(this)
-    records[this.nativePeer] = scope
+internal fun InsertBridgeResult.registerRecord(hook: Hook) {
+    if (scopeHandle != -1) throw DuplicateRegisterException(originPointer)
+    synchronized(recordLock) {
+        reclaimRecords()
+        val handle = freeHandles.removeFirstOrNull() ?: nextHandle++
+        if (handle >= records.length()) {
+            val grown = AtomicReferenceArray<Hook?>(records.length() * 2)
+            for (index in 0 until records.length()) grown.set(index, records.get(index))
+            records = grown
+        }
+        records.set(handle, hook)
+        if (hook is ListenHook) listenHooks[hook.source] = hook
+        scopeHandle = handle
+    }
+}
+
+/**
+ * Search the hook of [this] by its handle, see [Box.enter].
+ */
+internal fun Invocation.searchRecord(): Hook {
+    val records = records
+    val handle = handle
+    if (handle < 0 || handle >= records.length()) throw UnexpectedTokenException(calleeRuntimeMethod)
+    return records.get(handle) ?: throw UnexpectedTokenException(calleeRuntimeMethod)
 }
 
-internal fun RuntimeMethod.searchRecord(): ValidScope {
-    if (!records.containsKey(this.nativePeer)) throw UnexpectedTokenException(this)
-    return records[this.nativePeer]!!
+/**
+ * Find the hook registered with [this], or null if it is not registered.
+ *
+ * It scans all hooks, so it must not be used in bridge method.
+ */
+internal fun RuntimeMethod.findRecord(): Hook? {
+    val records = records
+    for (index in 0 until records.length()) {
+        val hook = records.get(index) ?: continue
+        if (hook.originPointer.nativePeer == nativePeer) return hook
+    }
+    return null
 }
 
 /**
- * Release scope using [this] when [Scope.restore] is invoked.
+ * Find the hook of [this] if it is listened, so that new listeners can be attached to it
+ * without inserting bridge code again.
+ */
+internal fun Method.findListenHook(): ListenHook? = synchronized(recordLock) { listenHooks[this] }
+
+/**
+ * Release [this] when it is restored, so that no listener is attached to it any more.
+ * It must be invoked before its bridge code is restored, and its handle is released when
+ * native runtime reclaims its result.
  *
  * This function is paired with [registerRecord].
  */
-internal fun RuntimeMethod.releaseRecord() {
-    if (!records.containsKey(this.nativePeer)) throw UnexpectedTokenException(this)
-    records.remove(this.nativePeer)
+internal fun Hook.releaseRecord() {
+    synchronized(recordLock) {
+        if (this is ListenHook && listenHooks[source] === this) listenHooks.remove(source)
+    }
+}
+
+/**
+ * Remove hooks whose results are reclaimed by native runtime, and reuse their handles.
+ * It must be invoked with [recordLock] held.
+ */
+private fun reclaimRecords() {
+    InsertBridgeResult.reclaimedHandlesNative().forEach {
+        records.set(it, null)
+        freeHandles.addLast(it)
+    }
 }
 
 private val marks = mutableSetOf<Method>()
@@ -24,6 +24,9 @@
 
 package moe.aoramd.kaleidoscope.internal
 
+import moe.aoramd.kaleidoscope.Arguments
+import moe.aoramd.kaleidoscope.Profiler
+import moe.aoramd.kaleidoscope.Trace
 import moe.aoramd.kaleidoscope.internal.Bridge.Type.Companion.toBridgeType
 import java.lang.reflect.Method
 
@@ -34,19 +37,28 @@ internal fun initializeNative(
     logLevel: Int,
     currentThread: Long,
     standardMethod: Method,
-    relativeMethod: Method
+    relativeMethod: Method,
+    staticMethod: Method,
+    nativeMethod: Method,
+    cacheDirectory: String
 ): Boolean = initializeNativeInternal(
     logLevel,
     currentThread,
     standardMethod,
-    relativeMethod
+    relativeMethod,
+    staticMethod,
+    nativeMethod,
+    cacheDirectory
 )
 
 private external fun initializeNativeInternal(
     logLevel: Int,
     currentThread: Long,
     standardMethod: Method,
-    relativeMethod: Method
+    relativeMethod: Method,
+    staticMethod: Method,
+    nativeMethod: Method,
+    cacheDirectory: String
 ): Boolean
 
 private val threadNativePeerField by lazy {
@@ -73,12 +85,22 @@ private external fun registerBridgeMethod(key: Int, currentThread: Long, bridgeM
 
 /**
  * Insert bridge code into entrance of runtime method of method for listening method invocation.
+ *
+ * Only one in every [sampleInterval] invocations is listened, and the others run origin code
+ * directly in bridge code. All invocations are listened if [sampleInterval] is 0 or 1.
  */
-internal fun Method.listenBridge(): Pair<InsertBridgeResult, Method>? {
-    val nativePeer =
+internal fun Method.listenBridge(sampleInterval: Long): Pair<ListenResult, Method>? =
+    listenResult(
         listenBridgeNative(
-            this, currentThreadNativePeer, returnType.toBridgeType.key
+            this, currentThreadNativePeer, returnType.toBridgeType.key, shorty, sampleInterval
         )
+    )
+
+/**
+ * Wrap the native peer of listen insert result with the clone of method,
+ * or return null if [nativePeer] is 0.
+ */
+internal fun Method.listenResult(nativePeer: Long): Pair<ListenResult, Method>? {
     if (nativePeer == 0L) return null
     val result = ListenResult(nativePeer)
     val clone = runtimeClone(result.clonePointer)
@@ -88,160 +110,122 @@ internal fun Method.listenBridge(): Pair<InsertBridgeResult, Method>? {
 private external fun listenBridgeNative(
     method: Method,
     currentThread: Long,
-    bridgeTypeKey: Int
+    bridgeTypeKey: Int,
+    shorty: String,
+    sampleInterval: Long
 ): Long
 
 /**
  * Insert bridge code into entrance of runtime method of method for replacing method invocation.
  */
-internal fun Method.replaceBridge(): InsertBridgeResult? {
-    val nativePeer =
+internal fun Method.replaceBridge(): InsertBridgeResult? =
+    replaceResult(
         replaceBridgeNative(
-            this, currentThreadNativePeer, returnType.toBridgeType.key
+            this, currentThreadNativePeer, returnType.toBridgeType.key, shorty
         )
-    return if (nativePeer == 0L) null else ReplaceResult(nativePeer)
-}
+    )
+
+/**
+ * Wrap the native peer of replace insert result, or return null if [nativePeer] is 0.
+ */
+internal fun replaceResult(nativePeer: Long): InsertBridgeResult? =
+    if (nativePeer == 0L) null else ReplaceResult(nativePeer)
 
 private external fun replaceBridgeNative(
     method: Method,
     currentThread: Long,
-    bridgeTypeKey: Int
+    bridgeTypeKey: Int,
+    shorty: String
 ): Long
 
+/**
+ * Insert bridge code into entrances of runtime methods of [methods] in batch. All main bridges
+ * are inserted in a single suspension of threads.
+ *
+ * [replaces] marks whether each method is for replacing or listening method invocation, and
+ * [sampleIntervals] are sample intervals of listening methods, see [listenBridge]. Native
+ * peers of insert results are returned in the same order as [methods], 0 for failure, and time
+ * of preparing bridge code and inserting main bridges in nanoseconds are saved in [timings].
+ */
+internal fun batchBridge(
+    methods: Array<Method>,
+    replaces: BooleanArray,
+    sampleIntervals: LongArray,
+    timings: LongArray
+): LongArray = batchBridgeNative(
+    methods,
+    replaces,
+    IntArray(methods.size) { methods[it].returnType.toBridgeType.key },
+    Array(methods.size) { methods[it].shorty },
+    sampleIntervals,
+    currentThreadNativePeer,
+    timings
+)
+
+private external fun batchBridgeNative(
+    methods: Array<Method>,
+    replaces: BooleanArray,
+    bridgeTypeKeys: IntArray,
+    shorties: Array<String>,
+    sampleIntervals: LongArray,
+    currentThread: Long,
+    timings: LongArray
+): LongArray
+
 internal fun restoreBridgeNative(resultPointer: Long) = restoreBridgeNativeInternal(resultPointer)
 
 private external fun restoreBridgeNativeInternal(resultPointer: Long)
 
 internal fun invokeBridge32(
-    currentThread: Long, mainBox: Long, x3: Long
+    currentThread: Long, boxPointer: Long, x3: Long
 ): Any? = TODO("Not yet implement.")
 
+/**
+ * Invoke the hook of the method inserted into bridge code for an invocation captured in the
+ * box, and return raw data of its primitive result, see [Hook.invoke].
+ */
 internal fun invokeBridge64(
-    currentThread: Long, mainBox: Long, x3: Long,
+    currentThread: Long, boxPointer: Long, x3: Long,
     x4: Long, x5: Long, x6: Long, x7: Long
-): Any? {
-    val box = Box.unlockAndCopy(mainBox)
-    val scope = box.calleeRuntimeMethod.searchRecord()
-    val types = mutableListOf<Class<*>>().apply {
-        if (!scope.source.isStatic) add(Any::class.java)
-        addAll(scope.source.parameterTypes)
-    }
-    val data = mutableListOf<Any?>()
-
-    val size = types.size
-    var offset = 0
-
-    val generalPurposeRegisters = longArrayOf(box.x1, box.x2, x3, x4, x5, x6, x7)
-
-    /*
-        Index used to get the general purpose register data.
-
-        Index for getting integer data is not equal to the index of parameters, but the
-        index of integer parameters, so the variable is calculated separately from the
-        parameter index.
-     */
-    var integerIndex = 0
-
-    /*
-        Index used to get the floating point register data.
-
-        In ARM 64, because of the particularity of floating point numbers, they are stored in
-        floating point number registers (float, or named single, is stored in registers s0 ~ s7,
-        and double is stored in registers d0 ~ d7. sX is dX low 32-bit.). In order to ensure the
-        precision of floating point, we need to get data from floating point registers instead of
-        general purpose registers.
-
-        Index for getting floating point data is not equal to the index of parameters, but the
-        index of floating point parameters, so the variable is calculated separately from the
-        parameter index.
-     */
-    var floatingIndex = 0
-
-    for (i in 0 until size) {
-        types[i].apply {
-            data.add(
-                when (this) {
-                    Float::class.java ->
-                        if (floatingIndex < 8)
-                            box.parameterFromFloatRegister(floatingIndex++)
-                        else
-                            convert(box.parameterFromStack(offset, stackSize), currentThread)
-                    Double::class.java ->
-                        if (floatingIndex < 8)
-                            box.parameterFromDoubleRegister(floatingIndex++)
-                        else
-                            convert(box.parameterFromStack(offset, stackSize), currentThread)
-                    else ->
-                        if (integerIndex < 7)
-                            convert(generalPurposeRegisters[integerIndex++], currentThread)
-                        else
-                            convert(box.parameterFromStack(offset, stackSize), currentThread)
-                }
-            )
-            offset += stackSize
-        }
-    }
-
-    // data.size == types.size == size.
-
-    // Release box object to prevent memory leaks after obtaining all data.
-    box.release()
+): Long = bridge64(currentThread, boxPointer, x3, x4, x5, x6, x7) { hook, arguments ->
+    hook.invoke(arguments)
+}
 
-    val thiz: Any?
-    val parameters: Array<Any?>
-    if (scope.source.isStatic) {
-        thiz = null
-        parameters = data.toTypedArray()
-    } else {
-        thiz = data[0]
-        parameters = data.subList(1, size).toTypedArray()
-    }
-    return scope.invoke(thiz, parameters)
+/**
+ * Invoke the hook of the method inserted into bridge code for an invocation captured in the
+ * box, and return its object result, see [Hook.invokeObject].
+ */
+internal fun invokeBridge64Object(
+    currentThread: Long, boxPointer: Long, x3: Long,
+    x4: Long, x5: Long, x6: Long, x7: Long
+): Any? = bridge64(currentThread, boxPointer, x3, x4, x5, x6, x7) { hook, arguments ->
+    hook.invokeObject(arguments)
 }
 
-private fun Class<*>.convert(data: Long, currentThread: Long): Any? =
-    when (this) {
-        Boolean::class.java -> convertBoolean(data)
-        Byte::class.java -> convertByte(data)
-        Char::class.java -> convertChar(data)
-        Short::class.java -> convertShort(data)
-        Int::class.java -> convertInt(data)
-        Long::class.java -> convertLong(data)
-        Float::class.java -> convertFloat(data)
-        Double::class.java -> convertDouble(data)
-        else -> convertAny(data, currentThread)
+private inline fun <T> bridge64(
+    currentThread: Long, boxPointer: Long, x3: Long,
+    x4: Long, x5: Long, x6: Long, x7: Long,
+    invoke: (Hook, Arguments) -> T
+): T {
+    val start = if (Trace.enabled || Profiler.enabled) System.nanoTime() else 0L
+    var resultPointer = 0L
+    try {
+        // Box is released by entering, which is the only native call before invoking hook.
+        val invocation = Box(boxPointer).enter(x3, x4, x5, x6, x7, currentThread)
+        val hook = invocation.searchRecord()
+        resultPointer = hook.result.nativePeer
+        return invoke(hook, Arguments(hook.layout, invocation.data, invocation.objects))
+    } finally {
+        exitInvocation(resultPointer, start)
     }
+}
 
 /**
- * Get the size in bytes of data type on stack.
+ * Exit an invocation entered by [Box.enter], and record it into [Trace] and [Profiler] if
+ * [start] from [System.nanoTime] is not 0. [resultPointer] is the result of the method inserted
+ * into bridge code, or 0 if it is not found.
  */
-private val Class<*>.stackSize: Int
-    get() = when (this) {
-        Boolean::class.javaPrimitiveType, Byte::class.javaPrimitiveType,
-        Char::class.javaPrimitiveType, Short::class.javaPrimitiveType,
-        Int::class.javaPrimitiveType, Float::class.javaPrimitiveType -> 4
-        Long::class.javaPrimitiveType, Double::class.javaPrimitiveType -> 8
-        // Object pointer is 32-bit in Android Runtime.
-        else -> 4
-    }
-
-private external fun convertBoolean(data: Long): Boolean
-
-private external fun convertByte(data: Long): Byte
-
-private external fun convertChar(data: Long): Char
-
-private external fun convertShort(data: Long): Short
-
-private external fun convertInt(data: Long): Int
-
-private external fun convertLong(data: Long): Long
-
-private external fun convertFloat(data: Long): Float
-
-private external fun convertDouble(data: Long): Double
-
-private external fun convertAny(data: Long, currentThread: Long): Any?
+private external fun exitInvocation(resultPointer: Long, start: Long)
 
 /**
  * An unused class with two adjacent methods for calculating runtime method object size.
@@ -250,4 +234,21 @@ private external fun convertAny(data: Long, currentThread: Long): Any?
 internal class Holder {
     private fun functionStandard() {}
     private fun functionRelative() {}
+
+    /**
+     * A native method never registered, whose entry point is the generic JNI stub.
+     */
+    private external fun functionNative()
+}
+
+/**
+ * An unused class never initialized, whose static method keeps the resolution stub as its
+ * entry point. It is used for finding entry points of methods without compiled code.
+ */
+@Suppress("unused")
+internal class UninitializedHolder {
+    companion object {
+        @JvmStatic
+        fun functionStatic() {}
+    }
 }
\ No newline at end of file
@@ -0,0 +1,93 @@
+/*
+ * MIT License
+ *
+ * Copyright (C) 2021 M.D.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <cstdlib>
+#include <cstring>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+#include "arena.h"
+
+using namespace moe::aoramd::kaleidoscope;
+
+/**
+ * Size of secondary bridge code in arm64.
+ */
+static constexpr std::size_t kBridgeSize = 184;
+
+static unsigned char bridge_template[kBridgeSize];
+
+/**
+ * Install bridges in the way before code arena is introduced: every bridge is allocated from
+ * heap and the pages around it are made writable and executable one by one.
+ */
+static void BM_InstallWithHeap(benchmark::State &state) {
+    const auto count = static_cast<std::size_t>(state.range(0));
+    const std::size_t page_size = sysconf(_SC_PAGESIZE);
+    std::vector<void *> bridges(count);
+    for (auto _ : state) {
+        for (std::size_t i = 0; i < count; i++) {
+            void *bridge = malloc(kBridgeSize);
+            memcpy(bridge, bridge_template, kBridgeSize);
+            std::size_t alignment = reinterpret_cast<std::size_t>(bridge) % page_size;
+            mprotect(static_cast<char *>(bridge) - alignment, kBridgeSize + alignment,
+                     PROT_READ | PROT_WRITE | PROT_EXEC);
+            bridges[i] = bridge;
+        }
+        state.PauseTiming();
+        for (void *bridge : bridges) free(bridge);
+        state.ResumeTiming();
+    }
+    state.SetItemsProcessed(static_cast<std::int64_t>(state.iterations() * count));
+}
+
+BENCHMARK(BM_InstallWithHeap)->Arg(1)->Arg(100)->Arg(2000);
+
+/**
+ * Install bridges from code arena in a single write scope.
+ */
+static void BM_InstallWithArena(benchmark::State &state) {
+    const auto count = static_cast<std::size_t>(state.range(0));
+    internal::CodeArena arena(kBridgeSize);
+    std::vector<void *> bridges(count);
+    for (auto _ : state) {
+        {
+            internal::CodeArena::ScopedWrite write(&arena);
+            for (std::size_t i = 0; i < count; i++) {
+                void *bridge = arena.AllocateSlot();
+                memcpy(bridge, bridge_template, kBridgeSize);
+                bridges[i] = bridge;
+            }
+        }
+        state.PauseTiming();
+        for (void *bridge : bridges) arena.FreeSlot(bridge);
+        state.ResumeTiming();
+    }
+    state.SetItemsProcessed(static_cast<std::int64_t>(state.iterations() * count));
+}
+
+BENCHMARK(BM_InstallWithArena)->Arg(1)->Arg(100)->Arg(2000);
@@ -0,0 +1,232 @@
+/*
+ * MIT License
+ *
+ * Copyright (C) 2021 M.D.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <cstdio>
+#include <cstring>
+#include <set>
+#include <string>
+#include <vector>
+#include <unistd.h>
+
+#include <gtest/gtest.h>
+
+#include "arena.h"
+
+using namespace moe::aoramd::kaleidoscope;
+
+/**
+ * Get permissions of the memory mapping containing address from /proc/self/maps.
+ */
+static std::string permissions_of(void *address) {
+    auto target = reinterpret_cast<std::size_t>(address);
+    std::string result;
+    FILE *maps = fopen("/proc/self/maps", "r");
+    if (maps == nullptr) return result;
+    char line[4096];
+    while (fgets(line, sizeof(line), maps)) {
+        std::size_t start, end;
+        char permissions[5];
+        if (sscanf(line, "%zx-%zx %4s", &start, &end, permissions) != 3) continue;
+        if (start <= target && target < end) {
+            result = permissions;
+            break;
+        }
+    }
+    fclose(maps);
+    return result;
+}
+
+TEST(CodeArenaTest, AllocateOutsideWriteScope) {
+    internal::CodeArena arena(184);
+    EXPECT_EQ(nullptr, arena.AllocateSlot());
+    EXPECT_EQ(nullptr, arena.Allocate(64));
+}
+
+TEST(CodeArenaTest, AllocateAndFreeSlots) {
+    constexpr int kCount = 100000;
+    constexpr std::size_t kSlotSize = 184;
+    internal::CodeArena arena(kSlotSize);
+
+    std::vector<void *> slots;
+    {
+        internal::CodeArena::ScopedWrite write(&arena);
+        for (int i = 0; i < kCount; i++) {
+            void *slot = arena.AllocateSlot();
+            ASSERT_NE(nullptr, slot);
+            ASSERT_EQ(0u, reinterpret_cast<std::size_t>(slot) % internal::CodeArena::kAlignment);
+            memset(slot, i & 0xff, kSlotSize);
+            slots.push_back(slot);
+        }
+    }
+    std::set<void *> unique(slots.begin(), slots.end());
+    ASSERT_EQ(slots.size(), unique.size());
+    for (int i = 0; i < kCount; i++) {
+        ASSERT_EQ(i & 0xff, *static_cast<unsigned char *>(slots[i]));
+        ASSERT_EQ(i & 0xff, static_cast<unsigned char *>(slots[i])[kSlotSize - 1]);
+    }
+
+    for (void *slot : slots) arena.FreeSlot(slot);
+
+    // Freed slots are reused before new slabs are mapped.
+    {
+        internal::CodeArena::ScopedWrite write(&arena);
+        for (int i = 0; i < kCount; i++) {
+            void *slot = arena.AllocateSlot();
+            ASSERT_EQ(1u, unique.count(slot));
+            unique.erase(slot);
+        }
+    }
+    EXPECT_TRUE(unique.empty());
+}
+
+TEST(CodeArenaTest, AllocateAndFreeBlocks) {
+    internal::CodeArena arena(184);
+    internal::CodeArena::ScopedWrite write(&arena);
+
+    void *small = arena.Allocate(100);
+    void *large = arena.Allocate(internal::CodeArena::kSlabSize * 2 + 1);
+    ASSERT_NE(nullptr, small);
+    ASSERT_NE(nullptr, large);
+    memset(large, 0xff, internal::CodeArena::kSlabSize * 2 + 1);
+
+    arena.Free(small);
+    // The smallest free block which is large enough is reused.
+    EXPECT_EQ(small, arena.Allocate(64));
+    EXPECT_NE(small, arena.Allocate(64));
+
+    arena.Free(large);
+    EXPECT_EQ(large, arena.Allocate(internal::CodeArena::kSlabSize + 1));
+}
+
+TEST(CodeArenaTest, AllocateNearAddress) {
+    constexpr std::size_t kRange = 128 * 1024 * 1024;
+    internal::CodeArena arena(184);
+    void *address = reinterpret_cast<void *>(permissions_of);
+    EXPECT_EQ(nullptr, arena.AllocateNear(64, address, kRange));
+
+    internal::CodeArena::ScopedWrite write(&arena);
+    auto distance = [address](void *block) {
+        auto start = reinterpret_cast<std::size_t>(block);
+        auto target = reinterpret_cast<std::size_t>(address);
+        return start > target ? start + 64 - target : target - start;
+    };
+    std::vector<void *> blocks;
+    for (int i = 0; i < 2000; i++) {
+        void *block = arena.AllocateNear(64, address, kRange);
+        ASSERT_NE(nullptr, block);
+        ASSERT_LE(distance(block), kRange);
+        blocks.push_back(block);
+    }
+    std::set<void *> unique(blocks.begin(), blocks.end());
+    EXPECT_EQ(blocks.size(), unique.size());
+
+    // Freed near blocks are reused, and blocks out of range are not.
+    arena.Free(blocks[0]);
+    EXPECT_EQ(blocks[0], arena.AllocateNear(64, address, kRange));
+    void *far = arena.Allocate(64);
+    ASSERT_NE(nullptr, far);
+    if (distance(far) > kRange) {
+        arena.Free(far);
+        EXPECT_NE(far, arena.AllocateNear(64, address, kRange));
+    }
+}
+
+TEST(CodeArenaTest, SealAfterWriteScope) {
+    internal::CodeArena arena(184);
+    void *slot;
+    {
+        internal::CodeArena::ScopedWrite outer(&arena);
+        {
+            internal::CodeArena::ScopedWrite inner(&arena);
+            slot = arena.AllocateSlot();
+            ASSERT_NE(nullptr, slot);
+        }
+        // Nested scope does not seal memory.
+        EXPECT_EQ("rw-p", permissions_of(slot));
+    }
+    EXPECT_EQ("r-xp", permissions_of(slot));
+
+    arena.FreeSlot(slot);
+    {
+        internal::CodeArena::ScopedWrite write(&arena);
+        EXPECT_EQ(slot, arena.AllocateSlot());
+        EXPECT_EQ("rw-p", permissions_of(slot));
+    }
+    EXPECT_EQ("r-xp", permissions_of(slot));
+}
+
+TEST(CodeArenaTest, KeepSealedCodeExecutable) {
+    internal::CodeArena arena(184);
+    void *sealed_slot;
+    void *sealed_block;
+    {
+        internal::CodeArena::ScopedWrite write(&arena);
+        sealed_slot = arena.AllocateSlot();
+        sealed_block = arena.Allocate(64);
+        ASSERT_NE(nullptr, sealed_slot);
+        ASSERT_NE(nullptr, sealed_block);
+    }
+
+    std::size_t page_size = sysconf(_SC_PAGESIZE);
+    auto page_of = [page_size](void *pointer) {
+        return reinterpret_cast<std::size_t>(pointer) / page_size;
+    };
+    internal::CodeArena::ScopedWrite write(&arena);
+    void *slot = arena.AllocateSlot();
+    void *block = arena.Allocate(64);
+    ASSERT_NE(nullptr, slot);
+    ASSERT_NE(nullptr, block);
+    // Memory in pages of sealed memory is not allocated until the sealed memory is freed.
+    EXPECT_NE(page_of(sealed_slot), page_of(slot));
+    EXPECT_NE(page_of(sealed_block), page_of(block));
+    EXPECT_EQ("r-xp", permissions_of(sealed_slot));
+    EXPECT_EQ("r-xp", permissions_of(sealed_block));
+    EXPECT_EQ("rw-p", permissions_of(slot));
+    EXPECT_EQ("rw-p", permissions_of(block));
+
+    // Seal in write scope makes memory executable before the scope exits.
+    arena.Seal();
+    EXPECT_EQ("r-xp", permissions_of(slot));
+    arena.FreeSlot(sealed_slot);
+    EXPECT_EQ(sealed_slot, arena.AllocateSlot());
+    EXPECT_EQ("rw-p", permissions_of(sealed_slot));
+}
+
+#if defined(__x86_64__)
+
+TEST(CodeArenaTest, ExecuteCode) {
+    internal::CodeArena arena(184);
+    void *slot;
+    {
+        internal::CodeArena::ScopedWrite write(&arena);
+        slot = arena.AllocateSlot();
+        ASSERT_NE(nullptr, slot);
+        // mov eax, 42; ret
+        const unsigned char code[] = {0xb8, 0x2a, 0x00, 0x00, 0x00, 0xc3};
+        memcpy(slot, code, sizeof(code));
+    }
+    EXPECT_EQ(42, reinterpret_cast<int (*)()>(slot)());
+}
+
+#endif
@@ -0,0 +1,225 @@
+/*
+ * MIT License
+ *
+ * Copyright (C) 2021 M.D.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <cstdint>
+#include <cstring>
+
+#include <benchmark/benchmark.h>
+
+#include "bridge_fixture.h"
+
+using namespace moe::aoramd::kaleidoscope;
+using namespace moe::aoramd::kaleidoscope::fixture;
+
+/**
+ * Entrance of the fake bridge method. It only does what a bridge method must do: reading
+ * parameters from the box, releasing it and invoking origin code through origin bridge.
+ */
+extern "C" std::int64_t BenchmarkBridgeEntrance(mirror::Method *, void *, runtime::Box *box) {
+    mirror::Method *callee = box->callee_runtime_method_pointer_;
+    auto a = static_cast<std::int64_t>(box->register_1_);
+    auto b = static_cast<std::int64_t>(box->register_2_);
+    double c;
+    memcpy(&c, &box->floating_registers_[0], sizeof(c));
+    box->Release();
+    return reinterpret_cast<decltype(&CompiledMethod)>(origin_bridge)(callee, a, b, c);
+}
+
+static ScopedHook *hook = nullptr;
+
+static void InstallHook(const benchmark::State &) {
+    hook = new ScopedHook(reinterpret_cast<void *>(CompiledMethod),
+                          reinterpret_cast<void *>(BenchmarkBridgeEntrance));
+}
+
+static void RecoverHook(const benchmark::State &) {
+    delete hook;
+    hook = nullptr;
+}
+
+/**
+ * Call a compiled method without bridge code.
+ */
+static void BM_CallUnhooked(benchmark::State &state) {
+    std::int64_t i = 0;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(CompiledPlainMethod(kSourceMethod, i++, 1, 1.0));
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+BENCHMARK(BM_CallUnhooked)->ThreadRange(1, 64)->UseRealTime();
+
+/**
+ * Call a hooked compiled method with another runtime method, so that secondary bridge falls
+ * through to origin bridge.
+ */
+static void BM_CallHookedUnmatched(benchmark::State &state) {
+    if (!hook->Installed()) state.SkipWithError("Unable to insert bridge code.");
+    std::int64_t i = 0;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(CompiledMethod(kOtherMethod, i++, 1, 1.0));
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+BENCHMARK(BM_CallHookedUnmatched)
+        ->Setup(InstallHook)->Teardown(RecoverHook)->ThreadRange(1, 64)->UseRealTime();
+
+/**
+ * Call a hooked compiled method with its own runtime method, so that secondary bridge captures
+ * registers into a box and jumps to bridge method.
+ */
+static void BM_CallHookedMatched(benchmark::State &state) {
+    if (!hook->Installed()) state.SkipWithError("Unable to insert bridge code.");
+    std::int64_t i = 0;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(CompiledMethod(kSourceMethod, i++, 1, 1.0));
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+BENCHMARK(BM_CallHookedMatched)
+        ->Setup(InstallHook)->Teardown(RecoverHook)->ThreadRange(1, 64)->UseRealTime();
+
+static void InstallSampledHook(const benchmark::State &state) {
+    InstallHook(state);
+    hook->Sample(state.range(0));
+}
+
+/**
+ * Call a hooked compiled method with its own runtime method which is sampled once in the
+ * specified count of invocations, so that most invocations are skipped by secondary bridge
+ * before claiming a box.
+ */
+static void BM_CallHookedSampled(benchmark::State &state) {
+    if (!hook->Installed()) state.SkipWithError("Unable to insert bridge code.");
+    std::int64_t i = 0;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(CompiledMethod(kSourceMethod, i++, 1, 1.0));
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+BENCHMARK(BM_CallHookedSampled)
+        ->Setup(InstallSampledHook)->Teardown(RecoverHook)->RangeMultiplier(16)
+        ->Range(16, 1 << 20)->UseRealTime();
+
+static void InstallPausedHook(const benchmark::State &state) {
+    InstallHook(state);
+    hook->Pause(true);
+}
+
+/**
+ * Call a hooked compiled method with its own runtime method whose hook is paused, so that
+ * secondary bridge jumps to origin bridge right after finding it in dispatch table.
+ */
+static void BM_CallHookedPaused(benchmark::State &state) {
+    if (!hook->Installed()) state.SkipWithError("Unable to insert bridge code.");
+    std::int64_t i = 0;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(CompiledMethod(kSourceMethod, i++, 1, 1.0));
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+BENCHMARK(BM_CallHookedPaused)
+        ->Setup(InstallPausedHook)->Teardown(RecoverHook)->ThreadRange(1, 64)->UseRealTime();
+
+static void EmptyNativeListener(const kaleidoscope_hook_context *, void *) {}
+
+static bridge::NativeListener native_listener = {EmptyNativeListener, nullptr, nullptr};
+
+static void InstallNativeHook(const benchmark::State &) {
+    hook = new ScopedHook(reinterpret_cast<void *>(CompiledMethod),
+                          reinterpret_cast<void *>(NativeBridge),
+                          reinterpret_cast<mirror::Method *>(&native_listener));
+    native_listener.origin_bridge_ = origin_bridge;
+}
+
+/**
+ * Call a hooked compiled method whose bridge method is an empty native listener, so that
+ * secondary bridge captures registers into a box and native bridge calls the listener before
+ * jumping to origin bridge.
+ */
+static void BM_CallHookedNative(benchmark::State &state) {
+    if (!hook->Installed()) state.SkipWithError("Unable to insert bridge code.");
+    std::int64_t i = 0;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(CompiledMethod(kSourceMethod, i++, 1, 1.0));
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+BENCHMARK(BM_CallHookedNative)
+        ->Setup(InstallNativeHook)->Teardown(RecoverHook)->ThreadRange(1, 64)->UseRealTime();
+
+/**
+ * Fake runtime methods laid out like an array of runtime methods of a class.
+ */
+static char shared_methods[1024][40];
+
+static void InstallSharedHook(const benchmark::State &state) {
+    InstallHook(state);
+    for (std::int64_t i = 0; i < state.range(0); i++) {
+        hook->Add(reinterpret_cast<mirror::Method *>(shared_methods[i]), kBridgeMethod,
+                  reinterpret_cast<void *>(BenchmarkBridgeEntrance));
+    }
+}
+
+/**
+ * Call a compiled method whose entrance is shared by the specified count of hooked runtime
+ * methods, with a runtime method which is not hooked, so that secondary bridge probes the
+ * dispatch table and falls through to origin bridge.
+ */
+static void BM_CallHookedSharedUnmatched(benchmark::State &state) {
+    if (!hook->Installed()) state.SkipWithError("Unable to insert bridge code.");
+    std::int64_t i = 0;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(CompiledMethod(kOtherMethod, i++, 1, 1.0));
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+BENCHMARK(BM_CallHookedSharedUnmatched)
+        ->Setup(InstallSharedHook)->Teardown(RecoverHook)->RangeMultiplier(8)->Range(1, 1024)
+        ->UseRealTime();
+
+/**
+ * Call every runtime method sharing a hooked entrance in turn, so that secondary bridge probes
+ * the dispatch table and jumps to bridge method of each.
+ */
+static void BM_CallHookedSharedMatched(benchmark::State &state) {
+    if (!hook->Installed()) state.SkipWithError("Unable to insert bridge code.");
+    std::int64_t i = 0;
+    for (auto _ : state) {
+        auto *method = reinterpret_cast<mirror::Method *>(shared_methods[i % state.range(0)]);
+        benchmark::DoNotOptimize(CompiledMethod(method, i++, 1, 1.0));
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+BENCHMARK(BM_CallHookedSharedMatched)
+        ->Setup(InstallSharedHook)->Teardown(RecoverHook)->RangeMultiplier(8)->Range(1, 1024)
+        ->UseRealTime();
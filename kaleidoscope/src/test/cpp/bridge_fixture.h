@@ -0,0 +1,186 @@
+/*
+ * MIT License
+ *
+ * Copyright (C) 2021 M.D.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef KALEIDOSCOPE_BRIDGE_FIXTURE_H
+#define KALEIDOSCOPE_BRIDGE_FIXTURE_H
+
+#include <cstdint>
+#include <cstring>
+
+#include "arena.h"
+#include "bridge.h"
+#include "runtime.h"
+
+/*
+ * Fixtures for testing and benchmarking bridge code on x86_64 hosts, see compiled_method.S.
+ */
+
+extern "C" std::int64_t CompiledMethod(moe::aoramd::kaleidoscope::mirror::Method *method,
+                                       std::int64_t a, std::int64_t b, double c);
+
+extern "C" std::int64_t CompiledPlainMethod(moe::aoramd::kaleidoscope::mirror::Method *method,
+                                            std::int64_t a, std::int64_t b, double c);
+
+extern "C" std::int64_t CompiledCallMethod(moe::aoramd::kaleidoscope::mirror::Method *method,
+                                           std::int64_t a, std::int64_t b);
+
+extern "C" std::int64_t CompiledLeafMethod(moe::aoramd::kaleidoscope::mirror::Method *method,
+                                           std::int64_t a, std::int64_t b);
+
+namespace moe::aoramd::kaleidoscope::fixture {
+
+    inline runtime::Box box_table[runtime::Box::kTableSize];
+
+    // Fake runtime methods, only their addresses are used.
+    inline char source_method_object;
+    inline char bridge_method_object;
+    inline char other_method_object;
+    inline char shared_method_object;
+    inline char shared_bridge_method_object;
+
+    inline auto *const kSourceMethod = reinterpret_cast<mirror::Method *>(&source_method_object);
+    inline auto *const kBridgeMethod = reinterpret_cast<mirror::Method *>(&bridge_method_object);
+    inline auto *const kOtherMethod = reinterpret_cast<mirror::Method *>(&other_method_object);
+    inline auto *const kSharedMethod = reinterpret_cast<mirror::Method *>(&shared_method_object);
+    inline auto *const kSharedBridgeMethod =
+            reinterpret_cast<mirror::Method *>(&shared_bridge_method_object);
+
+    /**
+     * Origin bridge of the latest hooked compiled method.
+     */
+    inline void *origin_bridge = nullptr;
+
+    /**
+     * Insert bridge code into the entrance of a compiled method, and recover it at the end.
+     * The secondary bridge dispatches kSourceMethod to bridge_method, kBridgeMethod by default,
+     * and bridge_entrance, and more runtime methods sharing the entrance can be added by Add().
+     */
+    class ScopedHook final {
+    public:
+        ScopedHook(void *entrance, void *bridge_entrance,
+                   mirror::Method *bridge_method = kBridgeMethod) : entrance_(entrance) {
+            memcpy(backup_, entrance, sizeof(backup_));
+            if (!Add(kSourceMethod, bridge_method, bridge_entrance)) return;
+            internal::CodeArena::ScopedWrite write(bridge::Bridge::GetArena());
+            origin_bridge = origin_ = bridge::Bridge::CreateOrigin(entrance);
+            if (origin_ == nullptr) return;
+            secondary_ = bridge::Bridge::CreateSecondary(&dispatch_table_, box_table, origin_);
+            if (secondary_ == nullptr) return;
+            Patch();
+        }
+
+        /**
+         * Insert main bridge again after Recover().
+         */
+        bool Patch() {
+            installed_ = bridge::Bridge::SetMain(entrance_, secondary_, origin_);
+            return installed_;
+        }
+
+        /**
+         * Recover the entrance and keep bridge code, so that it can be patched again.
+         */
+        void Recover() {
+            bridge::Bridge::RecoverMain(entrance_, origin_);
+            installed_ = false;
+        }
+
+        /**
+         * Dispatch another runtime method sharing the entrance. Records are never moved, so
+         * secondary bridge can keep using them while adding.
+         */
+        bool Add(mirror::Method *method, mirror::Method *bridge_method, void *bridge_entrance) {
+            if (record_count_ == kMaxRecordCount) return false;
+            bridge::HookRecord &record = records_[record_count_];
+            record.bridge_method_ = bridge_method;
+            record.bridge_entrance_ = bridge_entrance;
+            if (!dispatch_table_.Insert(method, &record)) return false;
+            record_count_++;
+            return true;
+        }
+
+        /**
+         * Set sample interval of kSourceMethod, see bridge::HookRecord::sample_interval_.
+         */
+        void Sample(std::uint64_t sample_interval) {
+            records_[0].sample_interval_ = sample_interval;
+            records_[0].sample_countdown_ = 0;
+        }
+
+        /**
+         * Pause or resume dispatching kSourceMethod, see bridge::HookRecord::paused_.
+         */
+        void Pause(bool paused) {
+            records_[0].paused_ = paused ? 1 : 0;
+        }
+
+        /**
+         * Set scope handles of hooked runtime methods in the order they are added, see
+         * bridge::HookRecord::scope_handle_.
+         */
+        void SetScopeHandle(std::size_t index, std::int32_t handle) {
+            records_[index].scope_handle_ = handle;
+        }
+
+        /**
+         * Stop dispatching a runtime method. The entrance is kept hooked.
+         */
+        bool Remove(mirror::Method *method) {
+            return dispatch_table_.Remove(method);
+        }
+
+        ~ScopedHook() {
+            if (installed_) bridge::Bridge::RecoverMain(entrance_, origin_);
+            internal::CodeArena::ScopedWrite write(bridge::Bridge::GetArena());
+            if (secondary_ != nullptr) bridge::Bridge::FreeSecondary(secondary_);
+            if (origin_ != nullptr) bridge::Bridge::FreeOrigin(origin_);
+        }
+
+        bool Installed() const {
+            return installed_;
+        }
+
+        bool Atomic() const {
+            return bridge::Bridge::IsAtomicMain(origin_);
+        }
+
+        bool Recovered() const {
+            return memcmp(backup_, entrance_, sizeof(backup_)) == 0;
+        }
+
+    private:
+        static constexpr std::size_t kMaxRecordCount = 1024;
+
+        void *entrance_;
+        std::uint8_t backup_[32];
+        bridge::DispatchTable dispatch_table_;
+        bridge::HookRecord records_[kMaxRecordCount];
+        std::size_t record_count_ = 0;
+        void *origin_ = nullptr;
+        void *secondary_ = nullptr;
+        bool installed_ = false;
+    };
+}
+
+#endif
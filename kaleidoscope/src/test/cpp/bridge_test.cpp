@@ -0,0 +1,389 @@
+/*
+ * MIT License
+ *
+ * Copyright (C) 2021 M.D.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <pthread.h>
+#include <thread>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "bridge_fixture.h"
+
+using namespace moe::aoramd::kaleidoscope;
+using namespace moe::aoramd::kaleidoscope::fixture;
+
+/**
+ * Data captured by bridge entrance on current thread.
+ */
+struct Capture {
+    int count = 0;
+    mirror::Method *bridge_method = nullptr;
+    void *thread = nullptr;
+    mirror::Method *callee = nullptr;
+    std::int64_t register_1 = 0;
+    std::int64_t register_2 = 0;
+    double floating_register_0 = 0;
+    std::size_t sp_pointer = 0;
+    std::int32_t scope_handle = -1;
+};
+
+static thread_local Capture capture;
+
+/**
+ * Entrance of the fake bridge method. Like bridge methods in Kotlin, it reads data from the box,
+ * releases the box, and then invokes origin code through origin bridge.
+ */
+extern "C" std::int64_t BridgeEntrance(mirror::Method *bridge_method, void *thread,
+                                       runtime::Box *box) {
+    capture.count++;
+    capture.bridge_method = bridge_method;
+    capture.thread = thread;
+    capture.callee = box->callee_runtime_method_pointer_;
+    capture.register_1 = static_cast<std::int64_t>(box->register_1_);
+    capture.register_2 = static_cast<std::int64_t>(box->register_2_);
+    memcpy(&capture.floating_register_0, &box->floating_registers_[0], sizeof(double));
+    capture.sp_pointer = box->sp_pointer_;
+    capture.scope_handle = box->hook_record_->scope_handle_;
+    mirror::Method *callee = box->callee_runtime_method_pointer_;
+    std::int64_t a = capture.register_1, b = capture.register_2;
+    double c = capture.floating_register_0;
+    box->Release();
+
+    auto origin = reinterpret_cast<decltype(&CompiledMethod)>(origin_bridge);
+    return origin(callee, a, b, c) + 1000;
+}
+
+TEST(BridgeTest, CaptureMatchedMethod) {
+    ASSERT_TRUE(bridge::Bridge::Initialize(nullptr));
+    ScopedHook hook(reinterpret_cast<void *>(CompiledMethod),
+                    reinterpret_cast<void *>(BridgeEntrance));
+    ASSERT_TRUE(hook.Installed());
+
+    capture = Capture();
+    EXPECT_EQ(1000 + 2 + 3 + 4, CompiledMethod(kSourceMethod, 2, 3, 4.5));
+    EXPECT_EQ(1, capture.count);
+    EXPECT_EQ(kBridgeMethod, capture.bridge_method);
+    EXPECT_EQ(reinterpret_cast<void *>(pthread_self()), capture.thread);
+    EXPECT_EQ(kSourceMethod, capture.callee);
+    EXPECT_EQ(2, capture.register_1);
+    EXPECT_EQ(3, capture.register_2);
+    EXPECT_EQ(4.5, capture.floating_register_0);
+    EXPECT_NE(0u, capture.sp_pointer);
+
+    // All boxes are released.
+    for (auto &box : box_table) {
+        EXPECT_EQ(0u, *reinterpret_cast<std::size_t *>(&box));
+    }
+}
+
+TEST(BridgeTest, PassUnmatchedMethod) {
+    ScopedHook hook(reinterpret_cast<void *>(CompiledMethod),
+                    reinterpret_cast<void *>(BridgeEntrance));
+    ASSERT_TRUE(hook.Installed());
+
+    capture = Capture();
+    EXPECT_EQ(2 + 3 + 4, CompiledMethod(kOtherMethod, 2, 3, 4.5));
+    EXPECT_EQ(0, capture.count);
+}
+
+TEST(BridgeTest, DispatchSharedEntrance) {
+    ScopedHook hook(reinterpret_cast<void *>(CompiledMethod),
+                    reinterpret_cast<void *>(BridgeEntrance));
+    ASSERT_TRUE(hook.Installed());
+    ASSERT_TRUE(hook.Add(kSharedMethod, kSharedBridgeMethod,
+                         reinterpret_cast<void *>(BridgeEntrance)));
+    hook.SetScopeHandle(0, 3);
+    hook.SetScopeHandle(1, 7);
+
+    // Hook record of the dispatched method is captured in the box.
+    capture = Capture();
+    EXPECT_EQ(1000 + 2 + 3 + 4, CompiledMethod(kSourceMethod, 2, 3, 4.5));
+    EXPECT_EQ(kBridgeMethod, capture.bridge_method);
+    EXPECT_EQ(3, capture.scope_handle);
+    EXPECT_EQ(1000 + 5 + 6 + 7, CompiledMethod(kSharedMethod, 5, 6, 7.5));
+    EXPECT_EQ(kSharedBridgeMethod, capture.bridge_method);
+    EXPECT_EQ(kSharedMethod, capture.callee);
+    EXPECT_EQ(7, capture.scope_handle);
+    EXPECT_EQ(2 + 3 + 4, CompiledMethod(kOtherMethod, 2, 3, 4.5));
+    EXPECT_EQ(2, capture.count);
+
+    // Removed runtime method falls through to origin code, and others are still dispatched.
+    ASSERT_TRUE(hook.Remove(kSharedMethod));
+    EXPECT_EQ(5 + 6 + 7, CompiledMethod(kSharedMethod, 5, 6, 7.5));
+    EXPECT_EQ(1000 + 2 + 3 + 4, CompiledMethod(kSourceMethod, 2, 3, 4.5));
+    EXPECT_EQ(3, capture.count);
+}
+
+TEST(BridgeTest, SampleMatchedMethod) {
+    ScopedHook hook(reinterpret_cast<void *>(CompiledMethod),
+                    reinterpret_cast<void *>(BridgeEntrance));
+    ASSERT_TRUE(hook.Installed());
+    hook.Sample(4);
+
+    // The first invocation is sampled, and then one in every 4 invocations.
+    capture = Capture();
+    for (int i = 0; i < 12; i++) {
+        std::int64_t expected = 2 + 3 + 4 + (i % 4 == 0 ? 1000 : 0);
+        EXPECT_EQ(expected, CompiledMethod(kSourceMethod, 2, 3, 4.5));
+        EXPECT_EQ(i / 4 + 1, capture.count);
+    }
+
+    // Unsampled invocations do not claim boxes.
+    for (auto &box : box_table) {
+        EXPECT_EQ(0u, *reinterpret_cast<std::size_t *>(&box));
+    }
+
+    // Interval 1 samples every invocation.
+    hook.Sample(1);
+    EXPECT_EQ(1000 + 2 + 3 + 4, CompiledMethod(kSourceMethod, 2, 3, 4.5));
+    EXPECT_EQ(1000 + 2 + 3 + 4, CompiledMethod(kSourceMethod, 2, 3, 4.5));
+    EXPECT_EQ(5, capture.count);
+}
+
+TEST(BridgeTest, PauseMatchedMethod) {
+    ScopedHook hook(reinterpret_cast<void *>(CompiledMethod),
+                    reinterpret_cast<void *>(BridgeEntrance));
+    ASSERT_TRUE(hook.Installed());
+    ASSERT_TRUE(hook.Add(kSharedMethod, kSharedBridgeMethod,
+                         reinterpret_cast<void *>(BridgeEntrance)));
+
+    // Paused method runs origin code without claiming boxes, and others are still dispatched.
+    capture = Capture();
+    hook.Pause(true);
+    EXPECT_EQ(2 + 3 + 4, CompiledMethod(kSourceMethod, 2, 3, 4.5));
+    EXPECT_EQ(0, capture.count);
+    for (auto &box : box_table) {
+        EXPECT_EQ(0u, *reinterpret_cast<std::size_t *>(&box));
+    }
+    EXPECT_EQ(1000 + 5 + 6 + 7, CompiledMethod(kSharedMethod, 5, 6, 7.5));
+    EXPECT_EQ(1, capture.count);
+
+    // Resumed method is dispatched again without inserting bridge code.
+    hook.Pause(false);
+    EXPECT_EQ(1000 + 2 + 3 + 4, CompiledMethod(kSourceMethod, 2, 3, 4.5));
+    EXPECT_EQ(2, capture.count);
+}
+
+TEST(BridgeTest, SkipWhenBoxesOccupied) {
+    ScopedHook hook(reinterpret_cast<void *>(CompiledMethod),
+                    reinterpret_cast<void *>(BridgeEntrance));
+    ASSERT_TRUE(hook.Installed());
+
+    // Matched method runs origin code instead of spinning when every box is claimed. Owner is
+    // the first field of boxes.
+    auto owner = [](std::size_t index) -> std::size_t & {
+        return *reinterpret_cast<std::size_t *>(&box_table[index]);
+    };
+    for (std::size_t i = 0; i < runtime::Box::kTableSize; i++) owner(i) = 1;
+    capture = Capture();
+    EXPECT_EQ(2 + 3 + 4, CompiledMethod(kSourceMethod, 2, 3, 4.5));
+    EXPECT_EQ(0, capture.count);
+
+    // The last free box is found wherever the probe starts.
+    owner(runtime::Box::kTableSize - 1) = 0;
+    EXPECT_EQ(1000 + 2 + 3 + 4, CompiledMethod(kSourceMethod, 2, 3, 4.5));
+    EXPECT_EQ(1, capture.count);
+    EXPECT_EQ(0u, owner(runtime::Box::kTableSize - 1));
+
+    for (std::size_t i = 0; i < runtime::Box::kTableSize; i++) owner(i) = 0;
+    EXPECT_EQ(1000 + 2 + 3 + 4, CompiledMethod(kSourceMethod, 2, 3, 4.5));
+    EXPECT_EQ(2, capture.count);
+}
+
+/**
+ * Data captured by native listener.
+ */
+struct NativeCapture {
+    int count = 0;
+    kaleidoscope_hook_context context = {};
+    void *user = nullptr;
+};
+
+static void NativeListener(const kaleidoscope_hook_context *context, void *user) {
+    auto *native_capture = static_cast<NativeCapture *>(user);
+    native_capture->count++;
+    native_capture->context = *context;
+    native_capture->user = user;
+}
+
+TEST(BridgeTest, CallNativeListener) {
+    NativeCapture native_capture;
+    bridge::NativeListener listener;
+    listener.before_ = NativeListener;
+    listener.user_ = &native_capture;
+    ScopedHook hook(reinterpret_cast<void *>(CompiledMethod),
+                    reinterpret_cast<void *>(NativeBridge),
+                    reinterpret_cast<mirror::Method *>(&listener));
+    ASSERT_TRUE(hook.Installed());
+    listener.origin_bridge_ = origin_bridge;
+
+    // Origin code runs with the same parameters after the listener.
+    EXPECT_EQ(2 + 3 + 4, CompiledMethod(kSourceMethod, 2, 3, 4.5));
+    EXPECT_EQ(1, native_capture.count);
+    EXPECT_EQ(&native_capture, native_capture.user);
+    EXPECT_EQ(kSourceMethod, native_capture.context.method);
+    EXPECT_EQ(reinterpret_cast<void *>(pthread_self()), native_capture.context.thread);
+    EXPECT_EQ(2u, native_capture.context.registers[0]);
+    EXPECT_EQ(3u, native_capture.context.registers[1]);
+    double c;
+    memcpy(&c, &native_capture.context.floating_registers[0], sizeof(c));
+    EXPECT_EQ(4.5, c);
+    EXPECT_NE(nullptr, native_capture.context.stack);
+
+    // Unmatched runtime method does not call the listener.
+    EXPECT_EQ(2 + 3 + 4, CompiledMethod(kOtherMethod, 2, 3, 4.5));
+    EXPECT_EQ(1, native_capture.count);
+
+    // All boxes are released.
+    for (auto &box : box_table) {
+        EXPECT_EQ(0u, *reinterpret_cast<std::size_t *>(&box));
+    }
+}
+
+TEST(BridgeTest, DispatchManyMethods) {
+    ScopedHook hook(reinterpret_cast<void *>(CompiledMethod),
+                    reinterpret_cast<void *>(BridgeEntrance));
+    ASSERT_TRUE(hook.Installed());
+
+    // Fake runtime methods laid out like an array of runtime methods of a class.
+    constexpr int kMethodCount = 100;
+    constexpr std::size_t kMethodSize = 40;
+    static char methods[kMethodCount][kMethodSize];
+    for (int i = 0; i < kMethodCount; i += 2) {
+        ASSERT_TRUE(hook.Add(reinterpret_cast<mirror::Method *>(methods[i]), kSharedBridgeMethod,
+                             reinterpret_cast<void *>(BridgeEntrance)));
+    }
+
+    capture = Capture();
+    for (int i = 0; i < kMethodCount; i++) {
+        auto *method = reinterpret_cast<mirror::Method *>(methods[i]);
+        std::int64_t expected = i % 2 == 0 ? 1000 + i : i;
+        EXPECT_EQ(expected, CompiledMethod(method, i, 0, 0.0));
+    }
+    EXPECT_EQ(kMethodCount / 2, capture.count);
+    EXPECT_EQ(1000, CompiledMethod(kSourceMethod, 0, 0, 0.0));
+}
+
+TEST(BridgeTest, RecoverMain) {
+    {
+        ScopedHook hook(reinterpret_cast<void *>(CompiledMethod),
+                        reinterpret_cast<void *>(BridgeEntrance));
+        ASSERT_TRUE(hook.Installed());
+        EXPECT_FALSE(hook.Recovered());
+    }
+    capture = Capture();
+    EXPECT_EQ(2 + 3 + 4, CompiledMethod(kSourceMethod, 2, 3, 4.5));
+    EXPECT_EQ(0, capture.count);
+}
+
+TEST(BridgeTest, PatchAtomically) {
+    auto *entrance = reinterpret_cast<std::uint8_t *>(CompiledMethod);
+    std::uint8_t backup[16];
+    memcpy(backup, entrance, sizeof(backup));
+    {
+        ScopedHook hook(entrance, reinterpret_cast<void *>(BridgeEntrance));
+        ASSERT_TRUE(hook.Installed());
+        ASSERT_TRUE(hook.Atomic());
+
+        // Only the first instruction is overwritten by a branch.
+        EXPECT_EQ(0xe9, entrance[0]);
+        EXPECT_EQ(0, memcmp(backup + 7, entrance + 7, sizeof(backup) - 7));
+    }
+    EXPECT_EQ(0, memcmp(backup, entrance, sizeof(backup)));
+}
+
+TEST(BridgeTest, PatchShortFirstInstruction) {
+    // A branch would overwrite instructions behind the first one, so threads must be suspended.
+    ScopedHook hook(reinterpret_cast<void *>(CompiledLeafMethod),
+                    reinterpret_cast<void *>(BridgeEntrance));
+    ASSERT_TRUE(hook.Installed());
+    EXPECT_FALSE(hook.Atomic());
+
+    capture = Capture();
+    EXPECT_EQ(2 + 3, CompiledLeafMethod(kOtherMethod, 2, 3));
+    EXPECT_EQ(0, capture.count);
+}
+
+TEST(BridgeTest, PatchWhileCalling) {
+    ScopedHook hook(reinterpret_cast<void *>(CompiledMethod),
+                    reinterpret_cast<void *>(BridgeEntrance));
+    ASSERT_TRUE(hook.Installed());
+    ASSERT_TRUE(hook.Atomic());
+
+    // Threads run either origin code or bridge code while main bridge is toggled.
+    constexpr int kThreadCount = 4;
+    std::atomic<bool> done = false;
+    std::atomic<int> failures = 0;
+    std::vector<std::thread> threads;
+    for (int t = 0; t < kThreadCount; t++) {
+        threads.emplace_back([t, &done, &failures]() {
+            for (std::int64_t i = 0; !done.load(std::memory_order_relaxed); i++) {
+                std::int64_t result = CompiledMethod(kSourceMethod, t, i, 0.0);
+                if (result != t + i && result != 1000 + t + i) failures++;
+                if (CompiledMethod(kOtherMethod, t, i, 0.0) != t + i) failures++;
+            }
+        });
+    }
+    for (int i = 0; i < 10000; i++) {
+        hook.Recover();
+        ASSERT_TRUE(hook.Patch());
+    }
+    done = true;
+    for (auto &thread : threads) thread.join();
+    EXPECT_EQ(0, failures.load());
+}
+
+TEST(BridgeTest, RelocatePcRelativePrologue) {
+    ScopedHook hook(reinterpret_cast<void *>(CompiledCallMethod),
+                    reinterpret_cast<void *>(BridgeEntrance));
+    ASSERT_TRUE(hook.Installed());
+
+    // Origin code is invoked through origin bridge with relocated prologue.
+    EXPECT_EQ(100 + 2 * 2 + 3, CompiledCallMethod(kOtherMethod, 2, 3));
+}
+
+TEST(BridgeTest, CaptureOnMultipleThreads) {
+    ScopedHook hook(reinterpret_cast<void *>(CompiledMethod),
+                    reinterpret_cast<void *>(BridgeEntrance));
+    ASSERT_TRUE(hook.Installed());
+
+    constexpr int kThreadCount = 8;
+    constexpr int kInvocationCount = 10000;
+    std::atomic<int> failures = 0;
+    std::vector<std::thread> threads;
+    for (int t = 0; t < kThreadCount; t++) {
+        threads.emplace_back([t, &failures]() {
+            for (int i = 0; i < kInvocationCount; i++) {
+                std::int64_t result = CompiledMethod(kSourceMethod, t, i, 0.0);
+                if (result != 1000 + t + i) failures++;
+            }
+            if (capture.count != kInvocationCount) failures++;
+        });
+    }
+    for (auto &thread : threads) thread.join();
+    EXPECT_EQ(0, failures.load());
+}
@@ -0,0 +1,130 @@
+/*
+ * MIT License
+ *
+ * Copyright (C) 2021 M.D.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <atomic>
+#include <cstdint>
+#include <thread>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "dispatch.h"
+
+using namespace moe::aoramd::kaleidoscope;
+
+/**
+ * Fake runtime methods laid out like an array of runtime methods of a class.
+ */
+static char methods[4096][40];
+
+static mirror::Method *method_at(std::size_t index) {
+    return reinterpret_cast<mirror::Method *>(methods[index]);
+}
+
+TEST(DispatchTableTest, FindInEmptyTable) {
+    bridge::DispatchTable table;
+    EXPECT_EQ(0u, table.Size());
+    EXPECT_EQ(nullptr, table.Find(method_at(0)));
+    EXPECT_FALSE(table.Remove(method_at(0)));
+}
+
+TEST(DispatchTableTest, InsertAndFind) {
+    bridge::DispatchTable table;
+    bridge::HookRecord first, second;
+    ASSERT_TRUE(table.Insert(method_at(0), &first));
+    ASSERT_TRUE(table.Insert(method_at(1), &second));
+    EXPECT_EQ(2u, table.Size());
+    EXPECT_EQ(&first, table.Find(method_at(0)));
+    EXPECT_EQ(&second, table.Find(method_at(1)));
+    EXPECT_EQ(nullptr, table.Find(method_at(2)));
+}
+
+TEST(DispatchTableTest, RejectInvalidMethods) {
+    bridge::DispatchTable table;
+    bridge::HookRecord record;
+    ASSERT_TRUE(table.Insert(method_at(0), &record));
+    EXPECT_FALSE(table.Insert(method_at(0), &record));
+    EXPECT_FALSE(table.Insert(nullptr, &record));
+    EXPECT_FALSE(table.Insert(bridge::DispatchTable::RemovedMethod(), &record));
+    EXPECT_EQ(1u, table.Size());
+}
+
+TEST(DispatchTableTest, RemoveKeepsOtherMethods) {
+    bridge::DispatchTable table;
+    std::vector<bridge::HookRecord> records(64);
+    for (std::size_t i = 0; i < records.size(); i++) {
+        ASSERT_TRUE(table.Insert(method_at(i), &records[i]));
+    }
+    for (std::size_t i = 0; i < records.size(); i += 2) {
+        ASSERT_TRUE(table.Remove(method_at(i)));
+    }
+    EXPECT_EQ(records.size() / 2, table.Size());
+    for (std::size_t i = 0; i < records.size(); i++) {
+        EXPECT_EQ(i % 2 == 0 ? nullptr : &records[i], table.Find(method_at(i)));
+    }
+
+    // Removed methods can be inserted again.
+    ASSERT_TRUE(table.Insert(method_at(0), &records[0]));
+    EXPECT_EQ(&records[0], table.Find(method_at(0)));
+}
+
+TEST(DispatchTableTest, InsertAndRemoveRepeatedly) {
+    // Removed entries are dropped when the table is rebuilt, so it does not fill up.
+    bridge::DispatchTable table;
+    bridge::HookRecord record;
+    for (std::size_t i = 0; i < 4096; i++) {
+        ASSERT_TRUE(table.Insert(method_at(i), &record));
+        ASSERT_EQ(&record, table.Find(method_at(i)));
+        ASSERT_TRUE(table.Remove(method_at(i)));
+        table.Reclaim();
+    }
+    EXPECT_EQ(0u, table.Size());
+}
+
+TEST(DispatchTableTest, FindWhileInserting) {
+    constexpr std::size_t kCount = 4096;
+    bridge::DispatchTable table;
+    std::vector<bridge::HookRecord> records(kCount);
+    ASSERT_TRUE(table.Insert(method_at(0), &records[0]));
+
+    // Lookups never see records of other methods, and inserted methods are never lost.
+    std::atomic<bool> done = false;
+    std::atomic<int> failures = 0;
+    std::thread reader([&]() {
+        while (!done.load(std::memory_order_acquire)) {
+            for (std::size_t i = 0; i < kCount; i += 7) {
+                bridge::HookRecord *record = table.Find(method_at(i));
+                if (record != nullptr && record != &records[i]) failures++;
+            }
+            if (table.Find(method_at(0)) != &records[0]) failures++;
+        }
+    });
+    for (std::size_t i = 1; i < kCount; i++) {
+        ASSERT_TRUE(table.Insert(method_at(i), &records[i]));
+    }
+    done.store(true, std::memory_order_release);
+    reader.join();
+    EXPECT_EQ(0, failures.load());
+    EXPECT_EQ(kCount, table.Size());
+}
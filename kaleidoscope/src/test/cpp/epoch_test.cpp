@@ -0,0 +1,86 @@
+/*
+ * MIT License
+ *
+ * Copyright (C) 2021 M.D.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <atomic>
+#include <thread>
+
+#include <gtest/gtest.h>
+
+#include "epoch.h"
+
+using namespace moe::aoramd::kaleidoscope::runtime;
+
+TEST(EpochTest, QuiescentWithoutInvocation) {
+    std::uint64_t epoch = Epoch::Current();
+    EXPECT_TRUE(Epoch::IsQuiescent(epoch));
+    EXPECT_EQ(epoch + 1, Epoch::Advance());
+}
+
+TEST(EpochTest, InvocationBlocksEarlierEpochs) {
+    std::uint64_t epoch = Epoch::Current();
+    Epoch::Enter();
+    EXPECT_FALSE(Epoch::IsQuiescent(epoch));
+    EXPECT_TRUE(Epoch::IsQuiescent(epoch - 1));
+
+    // Invocation entered before advancing still blocks later epochs.
+    Epoch::Advance();
+    EXPECT_FALSE(Epoch::IsQuiescent(epoch + 1));
+
+    Epoch::Exit();
+    EXPECT_TRUE(Epoch::IsQuiescent(epoch + 1));
+}
+
+TEST(EpochTest, NestedInvocationKeepsOuterEpoch) {
+    std::uint64_t epoch = Epoch::Current();
+    Epoch::Enter();
+    Epoch::Advance();
+    Epoch::Enter();
+    Epoch::Exit();
+    EXPECT_FALSE(Epoch::IsQuiescent(epoch));
+    Epoch::Exit();
+    EXPECT_TRUE(Epoch::IsQuiescent(epoch));
+
+    // Unpaired exit is ignored.
+    Epoch::Exit();
+    Epoch::Enter();
+    EXPECT_FALSE(Epoch::IsQuiescent(Epoch::Current()));
+    Epoch::Exit();
+}
+
+TEST(EpochTest, InvocationOnOtherThread) {
+    std::atomic<int> state = 0;
+    std::thread thread([&state] {
+        Epoch::Enter();
+        state = 1;
+        while (state != 2) std::this_thread::yield();
+        Epoch::Exit();
+    });
+    while (state != 1) std::this_thread::yield();
+
+    std::uint64_t epoch = Epoch::Current();
+    EXPECT_FALSE(Epoch::IsQuiescent(epoch));
+    state = 2;
+    thread.join();
+    EXPECT_TRUE(Epoch::IsQuiescent(epoch));
+}
@@ -0,0 +1,224 @@
+/*
+ * MIT License
+ *
+ * Copyright (C) 2021 M.D.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <dlfcn.h>
+#include <elf.h>
+#include <fcntl.h>
+#include <link.h>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+#include "library/nougat_dlfunctions/fake_dlfcn.h"
+
+/**
+ * Symbol tables of a library mapped from its file, which are scanned linearly in the way before
+ * hash tables are used.
+ */
+class SymbolFile {
+public:
+    explicit SymbolFile(const char *name) {
+        void *handle = dlopen(name, RTLD_NOW | RTLD_NOLOAD);
+        link_map *map = nullptr;
+        char path[PATH_MAX];
+        if (handle == nullptr || dlinfo(handle, RTLD_DI_LINKMAP, &map) != 0 ||
+            realpath(map->l_name, path) == nullptr)
+            return;
+        dlclose(handle);
+        path_ = path;
+
+        int fd = open(path, O_RDONLY);
+        struct stat status{};
+        fstat(fd, &status);
+        size_ = status.st_size;
+        data_ = static_cast<char *>(mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0));
+        close(fd);
+
+        auto *header = reinterpret_cast<ElfW(Ehdr) *>(data_);
+        auto *sections = reinterpret_cast<ElfW(Shdr) *>(data_ + header->e_shoff);
+        for (int i = 0; i < header->e_shnum; i++) {
+            if (sections[i].sh_type != SHT_DYNSYM) continue;
+            symbols_ = reinterpret_cast<ElfW(Sym) *>(data_ + sections[i].sh_offset);
+            count_ = sections[i].sh_size / sizeof(ElfW(Sym));
+            strings_ = data_ + sections[sections[i].sh_link].sh_offset;
+        }
+    }
+
+    ~SymbolFile() {
+        if (data_ != nullptr) munmap(data_, size_);
+    }
+
+    const ElfW(Sym) *FindLinearly(const char *name) const {
+        for (std::size_t i = 0; i < count_; i++) {
+            if (strcmp(strings_ + symbols_[i].st_name, name) == 0) return symbols_ + i;
+        }
+        return nullptr;
+    }
+
+    /**
+     * Sample names of defined symbols evenly from the symbol table.
+     */
+    std::vector<const char *> Sample(std::size_t count) const {
+        std::vector<const char *> names;
+        for (std::size_t i = 0; i < count_ && names.size() < count; i += count_ / count) {
+            if (symbols_[i].st_shndx != SHN_UNDEF) names.push_back(strings_ + symbols_[i].st_name);
+        }
+        return names;
+    }
+
+    std::string path_;
+
+private:
+    char *data_ = nullptr;
+    std::size_t size_ = 0;
+    ElfW(Sym) *symbols_ = nullptr;
+    std::size_t count_ = 0;
+    const char *strings_ = nullptr;
+};
+
+/**
+ * libstdc++ has thousands of dynamic symbols, like libart.so in Android.
+ */
+static const SymbolFile &library() {
+    static SymbolFile file("libstdc++.so.6");
+    return file;
+}
+
+static void *fake_handle() {
+    static void *handle = fake_dlopen(library().path_.c_str(), RTLD_NOW);
+    return handle;
+}
+
+static constexpr std::size_t kSampleCount = 64;
+
+static void BM_LookupLinear(benchmark::State &state) {
+    std::vector<const char *> names = library().Sample(kSampleCount);
+    for (auto _ : state) {
+        for (const char *name : names) benchmark::DoNotOptimize(library().FindLinearly(name));
+    }
+    state.SetItemsProcessed(static_cast<std::int64_t>(state.iterations() * names.size()));
+}
+
+BENCHMARK(BM_LookupLinear);
+
+static void BM_LookupHashed(benchmark::State &state) {
+    std::vector<const char *> names = library().Sample(kSampleCount);
+    void *handle = fake_handle();
+    for (auto _ : state) {
+        for (const char *name : names) benchmark::DoNotOptimize(fake_dlsym(handle, name));
+    }
+    state.SetItemsProcessed(static_cast<std::int64_t>(state.iterations() * names.size()));
+}
+
+BENCHMARK(BM_LookupHashed);
+
+static void BM_LookupHashedBatch(benchmark::State &state) {
+    std::vector<const char *> names = library().Sample(kSampleCount);
+    std::vector<void *> results(names.size());
+    void *handle = fake_handle();
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(fake_dlsym_many(handle, names.data(), results.data(),
+                                                 static_cast<int>(names.size())));
+    }
+    state.SetItemsProcessed(static_cast<std::int64_t>(state.iterations() * names.size()));
+}
+
+BENCHMARK(BM_LookupHashedBatch);
+
+/**
+ * Look up absent symbols, which are mostly rejected by the bloom filter.
+ */
+static void BM_LookupHashedMissing(benchmark::State &state) {
+    std::vector<std::string> names;
+    for (std::size_t i = 0; i < kSampleCount; i++) names.push_back("missing_" + std::to_string(i));
+    void *handle = fake_handle();
+    for (auto _ : state) {
+        for (const auto &name : names) benchmark::DoNotOptimize(fake_dlsym(handle, name.c_str()));
+    }
+    state.SetItemsProcessed(static_cast<std::int64_t>(state.iterations() * names.size()));
+}
+
+BENCHMARK(BM_LookupHashedMissing);
+
+static void BM_LookupSystem(benchmark::State &state) {
+    std::vector<const char *> names = library().Sample(kSampleCount);
+    void *handle = dlopen("libstdc++.so.6", RTLD_NOW | RTLD_NOLOAD);
+    for (auto _ : state) {
+        for (const char *name : names) benchmark::DoNotOptimize(dlsym(handle, name));
+    }
+    state.SetItemsProcessed(static_cast<std::int64_t>(state.iterations() * names.size()));
+    dlclose(handle);
+}
+
+BENCHMARK(BM_LookupSystem);
+
+/**
+ * Get anonymous resident memory of current process in bytes, excluding file pages which are
+ * shared with page cache.
+ */
+static std::int64_t anonymous_resident_size() {
+    long pages = 0, resident = 0, shared = 0;
+    FILE *statm = fopen("/proc/self/statm", "r");
+    if (statm == nullptr) return 0;
+    if (fscanf(statm, "%ld %ld %ld", &pages, &resident, &shared) != 3) resident = shared = 0;
+    fclose(statm);
+    return static_cast<std::int64_t>(resident - shared) * sysconf(_SC_PAGESIZE);
+}
+
+/**
+ * Open a large library and resolve symbols, with symbol tables copied into heap or mapped from
+ * file. Anonymous memory kept by each handle is reported as a counter, which is measured before
+ * the heap is warmed up by the timed loop.
+ */
+static void BM_OpenLibrary(benchmark::State &state) {
+    const int flags = static_cast<int>(state.range(0));
+    std::vector<const char *> names = library().Sample(kSampleCount);
+
+    constexpr int kHandleCount = 16;
+    std::vector<void *> handles(kHandleCount);
+    std::int64_t before = anonymous_resident_size();
+    for (auto &handle : handles) {
+        handle = fake_dlopen(library().path_.c_str(), RTLD_NOW | flags);
+        for (const char *name : names) benchmark::DoNotOptimize(fake_dlsym(handle, name));
+    }
+    state.counters["anonymous_per_handle"] =
+            static_cast<double>(anonymous_resident_size() - before) / kHandleCount;
+    for (void *handle : handles) fake_dlclose(handle);
+
+    for (auto _ : state) {
+        void *handle = fake_dlopen(library().path_.c_str(), RTLD_NOW | flags);
+        for (const char *name : names) benchmark::DoNotOptimize(fake_dlsym(handle, name));
+        fake_dlclose(handle);
+    }
+}
+
+BENCHMARK(BM_OpenLibrary)->Arg(FAKE_DLOPEN_COPY_SECTIONS)->Arg(0);
@@ -0,0 +1,188 @@
+/*
+ * MIT License
+ *
+ * Copyright (C) 2021 M.D.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <climits>
+#include <cstdlib>
+#include <dlfcn.h>
+#include <filesystem>
+#include <link.h>
+#include <iterator>
+#include <string>
+#include <tuple>
+#include <unistd.h>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "library/nougat_dlfunctions/fake_dlfcn.h"
+
+/**
+ * Symbols with a single version, so that the default version found by dlsym() is the only one.
+ */
+static const char *const kLibcSymbols[] = {
+        "abort", "fopen", "getenv", "getpid", "malloc", "qsort", "strtol"
+};
+
+static const char *const kStdcxxSymbols[] = {
+        "_ZSt9terminatev", "_ZNSt9exceptionD1Ev", "_ZdlPv", "_ZdlPvm", "_Znwm"
+};
+
+/**
+ * Get the real path of a loaded library, which is the path shown in /proc/self/maps.
+ */
+static std::string loaded_library_path(const char *name) {
+    void *handle = dlopen(name, RTLD_NOW | RTLD_NOLOAD);
+    if (handle == nullptr) return "";
+    link_map *map = nullptr;
+    std::string result;
+    if (dlinfo(handle, RTLD_DI_LINKMAP, &map) == 0) {
+        char path[PATH_MAX];
+        if (realpath(map->l_name, path) != nullptr) result = path;
+    }
+    dlclose(handle);
+    return result;
+}
+
+/**
+ * Parameters are library name and flags of fake_dlopen().
+ */
+class FakeDlfcnTest : public testing::TestWithParam<std::tuple<const char *, int>> {
+protected:
+    void SetUp() override {
+        path_ = loaded_library_path(Name());
+        ASSERT_FALSE(path_.empty());
+        handle_ = fake_dlopen(path_.c_str(), RTLD_NOW | std::get<1>(GetParam()));
+        ASSERT_NE(nullptr, handle_);
+        system_handle_ = dlopen(Name(), RTLD_NOW | RTLD_NOLOAD);
+        ASSERT_NE(nullptr, system_handle_);
+    }
+
+    void TearDown() override {
+        if (handle_ != nullptr) fake_dlclose(handle_);
+        if (system_handle_ != nullptr) dlclose(system_handle_);
+    }
+
+    static const char *Name() {
+        return std::get<0>(GetParam());
+    }
+
+    static std::vector<const char *> Symbols() {
+        if (std::string(Name()) == "libc.so.6")
+            return {std::begin(kLibcSymbols), std::end(kLibcSymbols)};
+        return {std::begin(kStdcxxSymbols), std::end(kStdcxxSymbols)};
+    }
+
+    std::string path_;
+    void *handle_ = nullptr;
+    void *system_handle_ = nullptr;
+};
+
+TEST_P(FakeDlfcnTest, FindSymbols) {
+    for (const char *symbol : Symbols()) {
+        EXPECT_EQ(dlsym(system_handle_, symbol), fake_dlsym(handle_, symbol)) << symbol;
+    }
+}
+
+TEST_P(FakeDlfcnTest, MissSymbols) {
+    EXPECT_EQ(nullptr, fake_dlsym(handle_, "kaleidoscope_missing_symbol"));
+    EXPECT_EQ(nullptr, fake_dlsym(handle_, ""));
+    // Symbols imported from other libraries are not defined in the library.
+    const char *imported = std::string(Name()) == "libc.so.6" ? "_dl_argv" : "malloc";
+    EXPECT_EQ(nullptr, fake_dlsym(handle_, imported));
+}
+
+TEST_P(FakeDlfcnTest, FindSymbolsInBatch) {
+    std::vector<const char *> symbols = Symbols();
+    symbols.push_back("kaleidoscope_missing_symbol");
+    std::vector<void *> results(symbols.size());
+    EXPECT_EQ(static_cast<int>(symbols.size()) - 1,
+              fake_dlsym_many(handle_, symbols.data(), results.data(),
+                              static_cast<int>(symbols.size())));
+    for (std::size_t i = 0; i < symbols.size(); i++) {
+        EXPECT_EQ(fake_dlsym(handle_, symbols[i]), results[i]) << symbols[i];
+    }
+    EXPECT_EQ(nullptr, results.back());
+}
+
+INSTANTIATE_TEST_SUITE_P(SystemLibraries, FakeDlfcnTest,
+                         testing::Combine(testing::Values("libc.so.6", "libstdc++.so.6"),
+                                          testing::Values(0, FAKE_DLOPEN_COPY_SECTIONS)));
+
+TEST(FakeDlopenTest, OpenByBasename) {
+    void *handle = fake_dlopen("libc.so.6", RTLD_NOW);
+    ASSERT_NE(nullptr, handle);
+    void *system_handle = dlopen("libc.so.6", RTLD_NOW | RTLD_NOLOAD);
+    EXPECT_EQ(dlsym(system_handle, "getenv"), fake_dlsym(handle, "getenv"));
+    dlclose(system_handle);
+    fake_dlclose(handle);
+}
+
+TEST(FakeDlopenTest, MissLibrary) {
+    EXPECT_EQ(nullptr, fake_dlopen("libkaleidoscope-missing.so", RTLD_NOW));
+    EXPECT_EQ(nullptr, fake_dlopen("/kaleidoscope/missing/libc.so.6", RTLD_NOW));
+    EXPECT_EQ(nullptr, fake_dlopen("", RTLD_NOW));
+}
+
+TEST(FakeDlopenTest, OpenLibraryWithLongPath) {
+    // Lines of such library in /proc/self/maps are longer than 256 characters.
+    std::filesystem::path directory = std::filesystem::temp_directory_path() /
+                                      ("kaleidoscope-" + std::to_string(getpid()));
+    for (int i = 0; i < 8; i++) directory /= std::string(40, static_cast<char>('a' + i));
+    std::filesystem::create_directories(directory);
+    std::filesystem::path path = directory / "libkaleidoscope-long-path.so";
+    std::filesystem::copy_file(TEST_LIBRARY_PATH, path,
+                               std::filesystem::copy_options::overwrite_existing);
+    ASSERT_GT(path.string().size(), 256u);
+
+    void *system_handle = dlopen(path.c_str(), RTLD_NOW);
+    ASSERT_NE(nullptr, system_handle);
+    void *handle = fake_dlopen(path.c_str(), RTLD_NOW);
+    ASSERT_NE(nullptr, handle);
+    void *function = fake_dlsym(handle, "kaleidoscope_test_function");
+    EXPECT_EQ(dlsym(system_handle, "kaleidoscope_test_function"), function);
+    EXPECT_EQ(42, reinterpret_cast<int (*)()>(function)());
+
+    fake_dlclose(handle);
+    dlclose(system_handle);
+    std::filesystem::remove_all(std::filesystem::temp_directory_path() /
+                                ("kaleidoscope-" + std::to_string(getpid())));
+}
+
+TEST(FakeDlopenTest, FindModule) {
+    char path[PATH_MAX];
+    void *base = nullptr;
+    ASSERT_TRUE(fake_dlmodule("libc.so.6", path, sizeof(path), &base));
+    EXPECT_EQ(loaded_library_path("libc.so.6"), path);
+
+    // Offsets from the load base are the same as those found in the library.
+    void *handle = fake_dlopen(path, RTLD_NOW);
+    ASSERT_NE(nullptr, handle);
+    Dl_info info;
+    void *symbol = fake_dlsym(handle, "getenv");
+    ASSERT_NE(0, dladdr(symbol, &info));
+    EXPECT_EQ(info.dli_fbase, base);
+    fake_dlclose(handle);
+
+    EXPECT_FALSE(fake_dlmodule("libkaleidoscope-missing.so", path, sizeof(path), &base));
+}
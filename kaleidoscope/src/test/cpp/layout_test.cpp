@@ -0,0 +1,152 @@
+/*
+ * MIT License
+ *
+ * Copyright (C) 2021 M.D.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+#include <gtest/gtest.h>
+
+#include "runtime.h"
+
+using namespace moe::aoramd::kaleidoscope;
+
+#if defined(__aarch64__)
+static const int kGeneralRegisterCount = 7;
+#else
+static const int kGeneralRegisterCount = 5;
+#endif
+
+/**
+ * Registers passed to bridge method as parameters x3 ~ x7.
+ */
+static const std::int64_t kRegisters[runtime::ArgumentLayout::kExtraRegisterCount] = {
+        103, 104, 105, 106, 107
+};
+
+TEST(ArgumentLayoutTest, RejectInvalidShorty) {
+    runtime::ArgumentLayout layout;
+    EXPECT_FALSE(layout.Initialize("", true));
+    EXPECT_FALSE(layout.Initialize("VIX", true));
+    EXPECT_EQ(0u, layout.GetSlotCount());
+    EXPECT_FALSE(layout.Initialize(std::string(257, 'I').c_str(), true));
+    EXPECT_TRUE(layout.Initialize("V", true));
+    EXPECT_EQ(0u, layout.GetSlotCount());
+}
+
+TEST(ArgumentLayoutTest, SlotTypes) {
+    runtime::ArgumentLayout layout;
+    ASSERT_TRUE(layout.Initialize("ZIFL", false));
+    EXPECT_EQ('Z', layout.GetReturnType());
+    EXPECT_FALSE(layout.IsStatic());
+    ASSERT_EQ(4u, layout.GetSlotCount());
+    EXPECT_EQ('L', layout.GetSlotType(0));
+    EXPECT_EQ('I', layout.GetSlotType(1));
+    EXPECT_EQ('F', layout.GetSlotType(2));
+    EXPECT_EQ('L', layout.GetSlotType(3));
+
+    ASSERT_TRUE(layout.Initialize("DJ", true));
+    EXPECT_EQ('D', layout.GetReturnType());
+    EXPECT_TRUE(layout.IsStatic());
+    ASSERT_EQ(1u, layout.GetSlotCount());
+    EXPECT_EQ('J', layout.GetSlotType(0));
+}
+
+TEST(ArgumentLayoutTest, FillRegisters) {
+    runtime::ArgumentLayout layout;
+    ASSERT_TRUE(layout.Initialize("VIFJD", false));
+    ASSERT_EQ(5u, layout.GetSlotCount());
+
+    runtime::Box box;
+    box.register_1_ = 0x12345678;
+    box.register_2_ = 42;
+    float single = 1.5f;
+    double twice = 2.5;
+    std::uint32_t single_bits;
+    memcpy(&single_bits, &single, sizeof(single));
+    // Upper bits of floating register are undefined for float parameter.
+    box.floating_registers_[0] = 0xdeadbeef00000000 | single_bits;
+    memcpy(&box.floating_registers_[1], &twice, sizeof(twice));
+
+    std::int64_t data[5];
+    layout.Fill(&box, kRegisters, data);
+    EXPECT_EQ(0x12345678, data[0]);
+    EXPECT_EQ(42, data[1]);
+    EXPECT_EQ(single_bits, data[2]);
+    EXPECT_EQ(103, data[3]);
+    EXPECT_EQ(static_cast<std::int64_t>(box.floating_registers_[1]), data[4]);
+}
+
+TEST(ArgumentLayoutTest, FillStack) {
+    // Parameters spill to stack after general purpose registers are used up, and every
+    // parameter takes its place on stack.
+    std::string shorty = "V" + std::string(kGeneralRegisterCount, 'I') + "IJ";
+    runtime::ArgumentLayout layout;
+    ASSERT_TRUE(layout.Initialize(shorty.c_str(), true));
+    ASSERT_EQ(kGeneralRegisterCount + 2u, layout.GetSlotCount());
+
+    std::uint8_t stack[128];
+    memset(stack, 0xff, sizeof(stack));
+    std::size_t int_offset = sizeof(std::size_t) + kGeneralRegisterCount * 4;
+    std::uint32_t int_value = 0x80000001;
+    std::uint64_t long_value = 0x0123456789abcdef;
+    memcpy(stack + int_offset, &int_value, sizeof(int_value));
+    memcpy(stack + int_offset + 4, &long_value, sizeof(long_value));
+
+    runtime::Box box;
+    box.sp_pointer_ = reinterpret_cast<std::size_t>(stack);
+    box.register_1_ = 101;
+    box.register_2_ = 102;
+
+    std::int64_t data[runtime::ArgumentLayout::kMaxSlotCount];
+    layout.Fill(&box, kRegisters, data);
+    for (int i = 0; i < kGeneralRegisterCount; i++) EXPECT_EQ(101 + i, data[i]);
+    EXPECT_EQ(0x80000001, data[kGeneralRegisterCount]);
+    EXPECT_EQ(0x0123456789abcdef, data[kGeneralRegisterCount + 1]);
+}
+
+TEST(ArgumentLayoutTest, FillFloatingStack) {
+    std::string shorty = "VL" + std::string(9, 'D');
+    runtime::ArgumentLayout layout;
+    ASSERT_TRUE(layout.Initialize(shorty.c_str(), true));
+
+    std::uint8_t stack[128] = {};
+    // Object pointer and 8 doubles in registers are followed by the last double.
+    std::size_t offset = sizeof(std::size_t) + 4 + 8 * 8;
+    double value = -3.25;
+    memcpy(stack + offset, &value, sizeof(value));
+
+    runtime::Box box;
+    box.sp_pointer_ = reinterpret_cast<std::size_t>(stack);
+    box.register_1_ = 0x1000;
+    for (int i = 0; i < 8; i++) box.floating_registers_[i] = i;
+
+    std::int64_t data[10];
+    layout.Fill(&box, kRegisters, data);
+    EXPECT_EQ(0x1000, data[0]);
+    for (int i = 0; i < 8; i++) EXPECT_EQ(i, data[i + 1]);
+    double result;
+    memcpy(&result, &data[9], sizeof(result));
+    EXPECT_EQ(value, result);
+}
@@ -0,0 +1,416 @@
+/*
+ * MIT License
+ *
+ * Copyright (C) 2021 M.D.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "relocator.h"
+
+using namespace moe::aoramd::kaleidoscope;
+
+using Code = std::vector<std::uint32_t>;
+
+static constexpr std::uint64_t kSourceAddress = 0x7000001234;
+
+static constexpr std::uint32_t kLoadX17 = 0x58000051;     // ldr x17, #8
+static constexpr std::uint32_t kSkipLiteral = 0x14000003; // b #12
+static constexpr std::uint32_t kBranchX17 = 0xd61f0220;   // br x17
+
+static std::uint32_t adr(std::uint32_t rd, std::int64_t offset) {
+    return 0x10000000u | ((offset & 0x3) << 29) | (((offset >> 2) & 0x7ffff) << 5) | rd;
+}
+
+static std::uint32_t adrp(std::uint32_t rd, std::int64_t pages) {
+    return 0x90000000u | ((pages & 0x3) << 29) | (((pages >> 2) & 0x7ffff) << 5) | rd;
+}
+
+static std::uint32_t literal(std::uint32_t base, std::uint32_t rt, std::int64_t offset) {
+    return base | (((offset / 4) & 0x7ffff) << 5) | rt;
+}
+
+static std::uint32_t branch(std::uint32_t base, std::int64_t offset) {
+    return base | ((offset / 4) & 0x3ffffff);
+}
+
+static std::uint32_t compare_branch(std::uint32_t base, std::uint32_t rt, std::int64_t offset) {
+    return base | (((offset / 4) & 0x7ffff) << 5) | rt;
+}
+
+static std::uint32_t test_branch(std::uint32_t base, std::uint32_t rt, std::uint32_t bit,
+                                 std::int64_t offset) {
+    return base | ((bit >> 5) << 31) | ((bit & 0x1f) << 19) | (((offset / 4) & 0x3fff) << 5) | rt;
+}
+
+/**
+ * Relocate instructions located at kSourceAddress.
+ */
+static Code relocate(const Code &source, std::uint64_t address = kSourceAddress) {
+    Code result(source.size() * bridge::Arm64Relocator::kMaxRelocatedInstructionSize /
+                sizeof(std::uint32_t));
+    std::size_t size = bridge::Arm64Relocator::Relocate(source.data(), source.size(), address,
+                                                        result.data());
+    result.resize(size / sizeof(std::uint32_t));
+    return result;
+}
+
+static std::uint32_t quad(std::uint64_t value, int half) {
+    return static_cast<std::uint32_t>(value >> (32 * half));
+}
+
+TEST(Arm64RelocatorTest, CopyIndependentInstructions) {
+    Code source = {
+            0xd1400bf0, // sub x16, sp, #0x2000
+            0xb940021f, // ldr wzr, [x16]
+            0xf81e0fe0, // str x0, [sp, #-32]!
+            0xa9017bfd, // stp x29, x30, [sp, #16]
+            0xd503201f, // nop
+            0xd65f03c0, // ret
+    };
+    EXPECT_EQ(source, relocate(source));
+}
+
+TEST(Arm64RelocatorTest, RelocateAdr) {
+    std::uint64_t target = kSourceAddress - 8;
+    EXPECT_EQ((Code{0x58000043, kSkipLiteral, quad(target, 0), quad(target, 1)}),
+              relocate({adr(3, -8)}));
+    target = kSourceAddress + 0xfffff;
+    EXPECT_EQ((Code{0x58000043, kSkipLiteral, quad(target, 0), quad(target, 1)}),
+              relocate({adr(3, 0xfffff)}));
+}
+
+TEST(Arm64RelocatorTest, RelocateAdrp) {
+    std::uint64_t target = (kSourceAddress & ~0xfffull) + 0x2000;
+    EXPECT_EQ((Code{0x58000045, kSkipLiteral, quad(target, 0), quad(target, 1)}),
+              relocate({adrp(5, 2)}));
+    target = (kSourceAddress & ~0xfffull) - 0x7000;
+    EXPECT_EQ((Code{0x58000045, kSkipLiteral, quad(target, 0), quad(target, 1)}),
+              relocate({adrp(5, -7)}));
+}
+
+TEST(Arm64RelocatorTest, RelocateLoadLiteral) {
+    std::uint64_t target = kSourceAddress + 0x40;
+    Code head = {0x58000042, kSkipLiteral, quad(target, 0), quad(target, 1)};
+
+    Code expected = head;
+    expected.push_back(0xb9400042); // ldr w2, [x2]
+    EXPECT_EQ(expected, relocate({literal(0x18000000, 2, 0x40)}));
+
+    expected = head;
+    expected.push_back(0xf9400042); // ldr x2, [x2]
+    EXPECT_EQ(expected, relocate({literal(0x58000000, 2, 0x40)}));
+
+    expected = head;
+    expected.push_back(0xb9800042); // ldrsw x2, [x2]
+    EXPECT_EQ(expected, relocate({literal(0x98000000, 2, 0x40)}));
+}
+
+TEST(Arm64RelocatorTest, RelocateFloatingLoadLiteral) {
+    std::uint64_t target = kSourceAddress - 0x10;
+    Code head = {kLoadX17, kSkipLiteral, quad(target, 0), quad(target, 1)};
+
+    Code expected = head;
+    expected.push_back(0xbd400221); // ldr s1, [x17]
+    EXPECT_EQ(expected, relocate({literal(0x1c000000, 1, -0x10)}));
+
+    expected = head;
+    expected.push_back(0xfd400221); // ldr d1, [x17]
+    EXPECT_EQ(expected, relocate({literal(0x5c000000, 1, -0x10)}));
+
+    expected = head;
+    expected.push_back(0x3dc00221); // ldr q1, [x17]
+    EXPECT_EQ(expected, relocate({literal(0x9c000000, 1, -0x10)}));
+}
+
+TEST(Arm64RelocatorTest, DropPrefetchLiteral) {
+    EXPECT_EQ((Code{0xd503201f}), relocate({literal(0xd8000000, 0, 0x80)}));
+}
+
+TEST(Arm64RelocatorTest, RejectUnallocatedInstruction) {
+    EXPECT_TRUE(relocate({literal(0xdc000000, 0, 0x80)}).empty());
+}
+
+TEST(Arm64RelocatorTest, RelocateBranch) {
+    std::uint64_t target = kSourceAddress + 0x1000;
+    EXPECT_EQ((Code{kLoadX17, kBranchX17, quad(target, 0), quad(target, 1)}),
+              relocate({branch(0x14000000, 0x1000)}));
+}
+
+TEST(Arm64RelocatorTest, RelocateBranchWithLink) {
+    std::uint64_t target = kSourceAddress - 0x8000000;
+    EXPECT_EQ((Code{kLoadX17, kSkipLiteral, quad(target, 0), quad(target, 1), 0xd63f0220}),
+              relocate({branch(0x94000000, -0x8000000)}));
+}
+
+TEST(Arm64RelocatorTest, RelocateConditionalBranch) {
+    std::uint64_t target = kSourceAddress + 0x100;
+    // b.eq #0x100 -> b.ne #20
+    EXPECT_EQ((Code{0x540000a1, kLoadX17, kBranchX17, quad(target, 0), quad(target, 1)}),
+              relocate({compare_branch(0x54000000, 0x0, 0x100)}));
+    // b.lt #0x100 -> b.ge #20
+    EXPECT_EQ((Code{0x540000aa, kLoadX17, kBranchX17, quad(target, 0), quad(target, 1)}),
+              relocate({compare_branch(0x54000000, 0xb, 0x100)}));
+    // b.al #0x100 -> b #0x100
+    EXPECT_EQ((Code{kLoadX17, kBranchX17, quad(target, 0), quad(target, 1)}),
+              relocate({compare_branch(0x54000000, 0xe, 0x100)}));
+}
+
+TEST(Arm64RelocatorTest, RelocateCompareBranch) {
+    std::uint64_t target = kSourceAddress + 0x80;
+    // cbz w4, #0x80 -> cbnz w4, #20
+    EXPECT_EQ((Code{0x350000a4, kLoadX17, kBranchX17, quad(target, 0), quad(target, 1)}),
+              relocate({compare_branch(0x34000000, 4, 0x80)}));
+    // cbnz x4, #0x80 -> cbz x4, #20
+    EXPECT_EQ((Code{0xb40000a4, kLoadX17, kBranchX17, quad(target, 0), quad(target, 1)}),
+              relocate({compare_branch(0xb5000000, 4, 0x80)}));
+}
+
+TEST(Arm64RelocatorTest, RelocateTestBranch) {
+    std::uint64_t target = kSourceAddress - 0x20;
+    // tbz x7, #33, #-0x20 -> tbnz x7, #33, #20
+    EXPECT_EQ((Code{0xb70800a7, kLoadX17, kBranchX17, quad(target, 0), quad(target, 1)}),
+              relocate({test_branch(0x36000000, 7, 33, -0x20)}));
+    // tbnz w7, #3, #-0x20 -> tbz w7, #3, #20
+    EXPECT_EQ((Code{0x361800a7, kLoadX17, kBranchX17, quad(target, 0), quad(target, 1)}),
+              relocate({test_branch(0x37000000, 7, 3, -0x20)}));
+}
+
+TEST(Arm64RelocatorTest, RejectBranchIntoRelocatedCode) {
+    EXPECT_TRUE(relocate({0xd503201f, branch(0x14000000, -4)}).empty());
+    EXPECT_TRUE(relocate({compare_branch(0x34000000, 0, 4), 0xd503201f}).empty());
+    EXPECT_TRUE(relocate({0xd503201f, compare_branch(0x54000000, 1, -4)}).empty());
+}
+
+TEST(Arm64RelocatorTest, RelocatePrologue) {
+    // Instructions are relocated in order, and program counter of each one is its own address.
+    Code source = {
+            0xd1400bf0,                          // sub x16, sp, #0x2000
+            adr(0, 0x10),                        // adr x0, #0x10
+            compare_branch(0x34000000, 1, 0x20), // cbz w1, #0x20
+            branch(0x94000000, 0x40),            // bl #0x40
+    };
+    std::uint64_t adr_target = kSourceAddress + 4 + 0x10;
+    std::uint64_t cbz_target = kSourceAddress + 8 + 0x20;
+    std::uint64_t bl_target = kSourceAddress + 12 + 0x40;
+    Code expected = {
+            0xd1400bf0,
+            0x58000040, kSkipLiteral, quad(adr_target, 0), quad(adr_target, 1),
+            0x350000a1, kLoadX17, kBranchX17, quad(cbz_target, 0), quad(cbz_target, 1),
+            kLoadX17, kSkipLiteral, quad(bl_target, 0), quad(bl_target, 1), 0xd63f0220,
+    };
+    Code result = relocate(source);
+    EXPECT_EQ(expected, result);
+    EXPECT_LE(result.size() * sizeof(std::uint32_t),
+              source.size() * bridge::Arm64Relocator::kMaxRelocatedInstructionSize);
+}
+
+TEST(Arm64RelocatorTest, WriteJump) {
+    std::uint64_t target = 0x7000002244;
+    Code result(bridge::Arm64Relocator::kJumpSize / sizeof(std::uint32_t));
+    EXPECT_EQ(bridge::Arm64Relocator::kJumpSize,
+              bridge::Arm64Relocator::WriteJump(result.data(), target));
+    EXPECT_EQ((Code{kLoadX17, kBranchX17, quad(target, 0), quad(target, 1)}), result);
+}
+
+using Bytes = std::vector<std::uint8_t>;
+
+/**
+ * Relocate x86_64 instructions located at kSourceAddress, covering at least specified size of
+ * bytes. Only the first instruction is relocated by default.
+ */
+static Bytes relocate_x86_64(const Bytes &source, std::size_t size = 1,
+                             std::size_t *relocated_size = nullptr) {
+    Bytes padded = source;
+    padded.resize(source.size() + 16, 0x90);
+    Bytes result(bridge::X86_64Relocator::GetMaxRelocatedSize(size));
+    std::size_t origin_size = 0;
+    size = bridge::X86_64Relocator::Relocate(padded.data(), size, kSourceAddress, result.data(),
+                                             &origin_size);
+    if (relocated_size != nullptr) *relocated_size = origin_size;
+    result.resize(size);
+    return result;
+}
+
+static Bytes bytes_of(std::uint64_t value) {
+    Bytes result(sizeof(value));
+    memcpy(result.data(), &value, sizeof(value));
+    return result;
+}
+
+static Bytes concat(std::initializer_list<Bytes> parts) {
+    Bytes result;
+    for (auto &part : parts) result.insert(result.end(), part.begin(), part.end());
+    return result;
+}
+
+TEST(X86_64RelocatorTest, GetInstructionLength) {
+    const std::vector<Bytes> corpus = {
+            {0x55},                                           // push %rbp
+            {0x48, 0x89, 0xe5},                               // mov %rsp, %rbp
+            {0x48, 0x83, 0xec, 0x10},                         // sub $0x10, %rsp
+            {0x48, 0x81, 0xec, 0x00, 0x10, 0x00, 0x00},       // sub $0x1000, %rsp
+            {0x48, 0x89, 0x3c, 0x24},                         // mov %rdi, (%rsp)
+            {0x85, 0x84, 0x24, 0x00, 0xe0, 0xff, 0xff},       // test %eax, -0x2000(%rsp)
+            {0xf3, 0x0f, 0x1e, 0xfa},                         // endbr64
+            {0x64, 0x48, 0x8b, 0x04, 0x25, 0x28, 0, 0, 0},    // mov %fs:0x28, %rax
+            {0x48, 0xb8, 1, 2, 3, 4, 5, 6, 7, 8},             // movabs $0x0807060504030201, %rax
+            {0xf2, 0x0f, 0x11, 0x44, 0x24, 0x08},             // movsd %xmm0, 0x8(%rsp)
+            {0x66, 0x0f, 0x1f, 0x44, 0x00, 0x00},             // nopw 0x0(%rax, %rax, 1)
+            {0xb8, 0x01, 0x00, 0x00, 0x00},                   // mov $0x1, %eax
+            {0x66, 0xb8, 0x01, 0x00},                         // mov $0x1, %ax
+            {0xf6, 0x07, 0x01},                               // testb $0x1, (%rdi)
+            {0xf7, 0x07, 0x01, 0x00, 0x00, 0x00},             // testl $0x1, (%rdi)
+            {0xf7, 0x17},                                     // notl (%rdi)
+            {0x41, 0xff, 0xd3},                               // call *%r11
+            {0x0f, 0xb6, 0x47, 0x01},                         // movzbl 0x1(%rdi), %eax
+            {0x66, 0x0f, 0x3a, 0x0f, 0xc1, 0x08},             // palignr $0x8, %xmm1, %xmm0
+            {0x8b, 0x05, 0x10, 0x00, 0x00, 0x00},             // mov 0x10(%rip), %eax
+            {0x0f, 0x84, 0x10, 0x00, 0x00, 0x00},             // je +0x10
+            {0xc3},                                           // ret
+    };
+    for (auto &instruction : corpus) {
+        Bytes padded = instruction;
+        padded.resize(16, 0x90);
+        EXPECT_EQ(instruction.size(), bridge::X86_64Relocator::GetInstructionLength(padded.data()))
+                            << "first byte " << static_cast<int>(instruction[0]);
+    }
+}
+
+TEST(X86_64RelocatorTest, RejectUnsupportedInstruction) {
+    const std::vector<Bytes> corpus = {
+            {0xc5, 0xf8, 0x77},                               // vzeroupper
+            {0xe2, 0xfe},                                     // loop
+            {0xa1, 1, 2, 3, 4, 5, 6, 7, 8},                   // movabs 0x0807060504030201, %eax
+            {0x06},                                           // push %es
+    };
+    for (auto &instruction : corpus) {
+        Bytes padded = instruction;
+        padded.resize(16, 0x90);
+        EXPECT_EQ(0u, bridge::X86_64Relocator::GetInstructionLength(padded.data()));
+        EXPECT_TRUE(relocate_x86_64(instruction).empty());
+    }
+}
+
+TEST(X86_64RelocatorTest, CopyIndependentInstructions) {
+    Bytes source = {
+            0x55,                                             // push %rbp
+            0x48, 0x89, 0xe5,                                 // mov %rsp, %rbp
+            0x48, 0x83, 0xec, 0x10,                           // sub $0x10, %rsp
+            0x48, 0x89, 0x3c, 0x24,                           // mov %rdi, (%rsp)
+            0x48, 0x8d, 0x04, 0x16,                           // lea (%rsi, %rdx, 1), %rax
+            0xc3,                                             // ret
+    };
+    std::size_t relocated_size;
+    Bytes result = relocate_x86_64(source, 14, &relocated_size);
+    EXPECT_EQ(16u, relocated_size);
+    EXPECT_EQ(Bytes(source.begin(), source.begin() + 16), result);
+}
+
+TEST(X86_64RelocatorTest, RelocateJump) {
+    std::uint64_t target = kSourceAddress + 5 + 0x1000;
+    EXPECT_EQ(concat({{0xff, 0x25, 0, 0, 0, 0}, bytes_of(target)}),
+              relocate_x86_64({0xe9, 0x00, 0x10, 0x00, 0x00}));
+    target = kSourceAddress + 2 - 0x10;
+    EXPECT_EQ(concat({{0xff, 0x25, 0, 0, 0, 0}, bytes_of(target)}),
+              relocate_x86_64({0xeb, 0xf0}));
+}
+
+TEST(X86_64RelocatorTest, RelocateCall) {
+    std::uint64_t target = kSourceAddress + 5 - 0x100;
+    EXPECT_EQ(concat({{0xff, 0x15, 0x02, 0, 0, 0, 0xeb, 0x08}, bytes_of(target)}),
+              relocate_x86_64({0xe8, 0x00, 0xff, 0xff, 0xff}));
+}
+
+TEST(X86_64RelocatorTest, RelocateConditionalJump) {
+    // je +0x10 -> jne +14
+    std::uint64_t target = kSourceAddress + 2 + 0x10;
+    EXPECT_EQ(concat({{0x75, 0x0e, 0xff, 0x25, 0, 0, 0, 0}, bytes_of(target)}),
+              relocate_x86_64({0x74, 0x10}));
+    // jl +0x1000 -> jge +14
+    target = kSourceAddress + 6 + 0x1000;
+    EXPECT_EQ(concat({{0x7d, 0x0e, 0xff, 0x25, 0, 0, 0, 0}, bytes_of(target)}),
+              relocate_x86_64({0x0f, 0x8c, 0x00, 0x10, 0x00, 0x00}));
+}
+
+TEST(X86_64RelocatorTest, RelocateLoadEffectiveAddress) {
+    // lea 0x100(%rip), %rax -> movabs $target, %rax
+    std::uint64_t target = kSourceAddress + 7 + 0x100;
+    EXPECT_EQ(concat({{0x48, 0xb8}, bytes_of(target)}),
+              relocate_x86_64({0x48, 0x8d, 0x05, 0x00, 0x01, 0x00, 0x00}));
+    // lea -0x100(%rip), %r9 -> movabs $target, %r9
+    target = kSourceAddress + 7 - 0x100;
+    EXPECT_EQ(concat({{0x49, 0xb9}, bytes_of(target)}),
+              relocate_x86_64({0x4c, 0x8d, 0x0d, 0x00, 0xff, 0xff, 0xff}));
+}
+
+TEST(X86_64RelocatorTest, RelocateLoad) {
+    std::uint64_t target = kSourceAddress + 7 + 0x100;
+    // mov 0x100(%rip), %rax -> movabs $target, %rax; mov (%rax), %rax
+    EXPECT_EQ(concat({{0x48, 0xb8}, bytes_of(target), {0x48, 0x8b, 0x00}}),
+              relocate_x86_64({0x48, 0x8b, 0x05, 0x00, 0x01, 0x00, 0x00}));
+    // mov 0x100(%rip), %r12 -> movabs $target, %r12; mov (%r12), %r12
+    EXPECT_EQ(concat({{0x49, 0xbc}, bytes_of(target), {0x4d, 0x8b, 0x24, 0x24}}),
+              relocate_x86_64({0x4c, 0x8b, 0x25, 0x00, 0x01, 0x00, 0x00}));
+    // mov 0x100(%rip), %ebp -> movabs $target, %rbp; mov 0x0(%rbp), %ebp
+    target = kSourceAddress + 6 + 0x100;
+    EXPECT_EQ(concat({{0x48, 0xbd}, bytes_of(target), {0x40, 0x8b, 0x6d, 0x00}}),
+              relocate_x86_64({0x8b, 0x2d, 0x00, 0x01, 0x00, 0x00}));
+}
+
+TEST(X86_64RelocatorTest, AdjustRipRelativeDisplacement) {
+    // cmpl $0x0, 0x100(%rip)
+    Bytes source = {0x83, 0x3d, 0x00, 0x01, 0x00, 0x00, 0x00};
+    Bytes result(bridge::X86_64Relocator::GetMaxRelocatedSize(1));
+    auto destination = reinterpret_cast<std::uint64_t>(result.data());
+    std::size_t relocated_size;
+
+    // Target is still reachable.
+    std::uint64_t source_address = destination + 0x10000;
+    std::size_t size = bridge::X86_64Relocator::Relocate(source.data(), 1, source_address,
+                                                         result.data(), &relocated_size);
+    ASSERT_EQ(7u, size);
+    std::int32_t displacement;
+    memcpy(&displacement, result.data() + 2, sizeof(displacement));
+    EXPECT_EQ(source_address + 7 + 0x100, destination + 7 + displacement);
+
+    // Target is out of range.
+    source_address = destination + 0x100000000ull;
+    EXPECT_EQ(0u, bridge::X86_64Relocator::Relocate(source.data(), 1, source_address,
+                                                    result.data(), &relocated_size));
+}
+
+TEST(X86_64RelocatorTest, RejectBranchIntoRelocatedCode) {
+    EXPECT_TRUE(relocate_x86_64({0xeb, 0xfe}).empty());
+    EXPECT_TRUE(relocate_x86_64({0x74, 0x01, 0x90, 0x90}, 4).empty());
+}
+
+TEST(X86_64RelocatorTest, WriteJump) {
+    std::uint64_t target = 0x7000002244;
+    Bytes result(bridge::X86_64Relocator::kJumpSize);
+    EXPECT_EQ(bridge::X86_64Relocator::kJumpSize,
+              bridge::X86_64Relocator::WriteJump(result.data(), target));
+    EXPECT_EQ(concat({{0xff, 0x25, 0, 0, 0, 0}, bytes_of(target)}), result);
+}
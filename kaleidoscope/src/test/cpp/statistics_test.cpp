@@ -0,0 +1,104 @@
+/*
+ * MIT License
+ *
+ * Copyright (C) 2021 M.D.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <thread>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "statistics.h"
+
+using moe::aoramd::kaleidoscope::runtime::HookStatistics;
+
+TEST(HookStatisticsTest, BucketsCoverLatencies) {
+    // Lower bounds are strictly increasing, and every latency is in the bucket whose lower
+    // bound is the greatest one not greater than it.
+    for (std::size_t bucket = 1; bucket < HookStatistics::kBucketCount; bucket++) {
+        ASSERT_LT(HookStatistics::GetBucketLowerBound(bucket - 1),
+                  HookStatistics::GetBucketLowerBound(bucket));
+    }
+    for (std::size_t bucket = 0; bucket < HookStatistics::kBucketCount; bucket++) {
+        std::uint64_t lower_bound = HookStatistics::GetBucketLowerBound(bucket);
+        EXPECT_EQ(bucket, HookStatistics::GetBucket(lower_bound)) << lower_bound;
+        if (bucket + 1 < HookStatistics::kBucketCount) {
+            std::uint64_t upper_bound = HookStatistics::GetBucketLowerBound(bucket + 1) - 1;
+            EXPECT_EQ(bucket, HookStatistics::GetBucket(upper_bound)) << upper_bound;
+        }
+    }
+}
+
+TEST(HookStatisticsTest, BoundRelativeError) {
+    for (std::uint64_t latency = 1; latency < (1ull << 39); latency = latency * 3 + 1) {
+        std::uint64_t lower_bound =
+                HookStatistics::GetBucketLowerBound(HookStatistics::GetBucket(latency));
+        EXPECT_LE(lower_bound, latency);
+        EXPECT_LE(latency - lower_bound, latency / HookStatistics::kSubBucketCount) << latency;
+    }
+    EXPECT_EQ(HookStatistics::kBucketCount - 1, HookStatistics::GetBucket(UINT64_MAX));
+    EXPECT_EQ(HookStatistics::kBucketCount - 1,
+              HookStatistics::GetBucket(1ull << HookStatistics::kMaxLatencyBits));
+}
+
+TEST(HookStatisticsTest, RecordAndReset) {
+    HookStatistics statistics;
+    statistics.Record(0);
+    statistics.Record(100);
+    statistics.Record(100);
+    statistics.Record(1000000);
+
+    std::uint64_t call_count, total_latency, buckets[HookStatistics::kBucketCount];
+    statistics.Snapshot(&call_count, &total_latency, buckets);
+    EXPECT_EQ(4u, call_count);
+    EXPECT_EQ(1000200u, total_latency);
+    EXPECT_EQ(1u, buckets[0]);
+    EXPECT_EQ(2u, buckets[HookStatistics::GetBucket(100)]);
+    EXPECT_EQ(1u, buckets[HookStatistics::GetBucket(1000000)]);
+
+    statistics.Reset();
+    statistics.Snapshot(&call_count, &total_latency, buckets);
+    EXPECT_EQ(0u, call_count);
+    EXPECT_EQ(0u, total_latency);
+    for (std::uint64_t count : buckets) EXPECT_EQ(0u, count);
+}
+
+TEST(HookStatisticsTest, RecordOnMultipleThreads) {
+    const int kThreadCount = 8;
+    const std::uint64_t kRecordCount = 100000;
+    HookStatistics statistics;
+    std::vector<std::thread> threads;
+    for (int t = 0; t < kThreadCount; t++) {
+        threads.emplace_back([&statistics, t, kRecordCount] {
+            for (std::uint64_t i = 0; i < kRecordCount; i++) statistics.Record(t + 1);
+        });
+    }
+    for (auto &thread : threads) thread.join();
+
+    std::uint64_t call_count, total_latency, buckets[HookStatistics::kBucketCount];
+    statistics.Snapshot(&call_count, &total_latency, buckets);
+    EXPECT_EQ(kThreadCount * kRecordCount, call_count);
+    EXPECT_EQ(kRecordCount * kThreadCount * (kThreadCount + 1) / 2, total_latency);
+    std::uint64_t bucket_total = 0;
+    for (std::uint64_t count : buckets) bucket_total += count;
+    EXPECT_EQ(call_count, bucket_total);
+}
@@ -0,0 +1,128 @@
+/*
+ * MIT License
+ *
+ * Copyright (C) 2021 M.D.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <unistd.h>
+
+#include <gtest/gtest.h>
+
+#include "symbol_cache.h"
+
+using moe::aoramd::kaleidoscope::internal::SymbolCache;
+
+class SymbolCacheTest : public testing::Test {
+protected:
+    void SetUp() override {
+        directory_ = std::filesystem::temp_directory_path() /
+                     ("kaleidoscope-cache-" + std::to_string(getpid()));
+        std::filesystem::create_directories(directory_);
+        path_ = (directory_ / "libtest.so.symbols").string();
+        ASSERT_TRUE(SymbolCache::ReadKey(TEST_LIBRARY_PATH, &key_));
+    }
+
+    void TearDown() override {
+        std::filesystem::remove_all(directory_);
+    }
+
+    std::filesystem::path directory_;
+    std::string path_;
+    SymbolCache::Key key_;
+};
+
+TEST_F(SymbolCacheTest, ReadKey) {
+    EXPECT_FALSE(key_.build_id_.empty());
+    EXPECT_EQ(std::filesystem::file_size(TEST_LIBRARY_PATH), key_.size_);
+
+    SymbolCache::Key other;
+    ASSERT_TRUE(SymbolCache::ReadKey(TEST_LIBRARY_PATH, &other));
+    EXPECT_TRUE(key_ == other);
+
+    // Files without build id have no key.
+    std::ofstream(directory_ / "empty.so") << "not an elf file";
+    EXPECT_FALSE(SymbolCache::ReadKey((directory_ / "empty.so").c_str(), &other));
+    EXPECT_FALSE(SymbolCache::ReadKey((directory_ / "missing.so").c_str(), &other));
+}
+
+TEST_F(SymbolCacheTest, SaveAndLoad) {
+    SymbolCache cache(path_, key_);
+    EXPECT_FALSE(cache.Load());
+    cache.Put("_ZN3art6Thread14CurrentFromGdbEv", 0x123450);
+    cache.Put("kaleidoscope_test_function", 0x1000);
+    ASSERT_TRUE(cache.Save());
+
+    SymbolCache loaded(path_, key_);
+    ASSERT_TRUE(loaded.Load());
+    std::uint64_t offset = 0;
+    EXPECT_TRUE(loaded.Find("_ZN3art6Thread14CurrentFromGdbEv", &offset));
+    EXPECT_EQ(0x123450u, offset);
+    EXPECT_TRUE(loaded.Find("kaleidoscope_test_function", &offset));
+    EXPECT_EQ(0x1000u, offset);
+    EXPECT_FALSE(loaded.Find("kaleidoscope_missing_symbol", &offset));
+}
+
+TEST_F(SymbolCacheTest, SaveOnlyIfChanged) {
+    SymbolCache cache(path_, key_);
+    EXPECT_TRUE(cache.Save());
+    EXPECT_FALSE(std::filesystem::exists(path_));
+
+    cache.Put("kaleidoscope_test_function", 0x1000);
+    ASSERT_TRUE(cache.Save());
+    auto time = std::filesystem::last_write_time(path_);
+    cache.Put("kaleidoscope_test_function", 0x1000);
+    ASSERT_TRUE(cache.Save());
+    EXPECT_EQ(time, std::filesystem::last_write_time(path_));
+}
+
+TEST_F(SymbolCacheTest, InvalidateOnKeyMismatch) {
+    SymbolCache cache(path_, key_);
+    cache.Put("kaleidoscope_test_function", 0x1000);
+    ASSERT_TRUE(cache.Save());
+
+    SymbolCache::Key rebuilt = key_;
+    rebuilt.build_id_[0] ^= 0xff;
+    EXPECT_FALSE(SymbolCache(path_, rebuilt).Load());
+
+    SymbolCache::Key modified = key_;
+    modified.modification_time_++;
+    EXPECT_FALSE(SymbolCache(path_, modified).Load());
+
+    SymbolCache::Key resized = key_;
+    resized.size_++;
+    SymbolCache stale(path_, resized);
+    EXPECT_FALSE(stale.Load());
+    std::uint64_t offset;
+    EXPECT_FALSE(stale.Find("kaleidoscope_test_function", &offset));
+}
+
+TEST_F(SymbolCacheTest, RejectBrokenFile) {
+    SymbolCache cache(path_, key_);
+    cache.Put("kaleidoscope_test_function", 0x1000);
+    ASSERT_TRUE(cache.Save());
+
+    // Truncated files are rejected instead of being read out of bounds.
+    std::filesystem::resize_file(path_, std::filesystem::file_size(path_) - 1);
+    EXPECT_FALSE(SymbolCache(path_, key_).Load());
+}
@@ -0,0 +1,73 @@
+/*
+ * MIT License
+ *
+ * Copyright (C) 2021 M.D.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <benchmark/benchmark.h>
+
+#include "trace.h"
+
+using namespace moe::aoramd::kaleidoscope::runtime;
+
+static void DrainAll() {
+    TraceRecord records[256];
+    while (Trace::Drain(records, 256) > 0) {}
+}
+
+/**
+ * Record an event while tracing is stopped, which is the cost left in hot paths.
+ */
+static void BM_RecordDisabled(benchmark::State &state) {
+    Trace::SetEnabled(false);
+    int method;
+    for (auto _ : state) {
+        Trace::Record(TraceEvent::kEnter, &method, 0);
+        benchmark::ClobberMemory();
+    }
+}
+
+BENCHMARK(BM_RecordDisabled);
+
+/**
+ * Record an enter and an exit event with timestamps, draining the ring whenever half of it is
+ * filled, so that the cost of draining is included.
+ */
+static void BM_RecordEnabled(benchmark::State &state) {
+    Trace::SetEnabled(true);
+    DrainAll();
+    int method;
+    std::size_t count = 0;
+    for (auto _ : state) {
+        std::uint64_t start = Trace::Now();
+        Trace::Record(TraceEvent::kEnter, &method, start);
+        Trace::Record(TraceEvent::kExit, &method, start, Trace::Now() - start);
+        if (++count == Trace::kRingCapacity / 4) {
+            DrainAll();
+            count = 0;
+        }
+    }
+    Trace::SetEnabled(false);
+    DrainAll();
+    state.SetItemsProcessed(state.iterations());
+}
+
+BENCHMARK(BM_RecordEnabled);
@@ -0,0 +1,195 @@
+/*
+ * MIT License
+ *
+ * Copyright (C) 2021 M.D.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <atomic>
+#include <cstdio>
+#include <filesystem>
+#include <map>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "trace.h"
+
+using namespace moe::aoramd::kaleidoscope::runtime;
+
+class TraceTest : public testing::Test {
+protected:
+    void SetUp() override {
+        Trace::SetEnabled(true);
+        Drain();
+    }
+
+    void TearDown() override {
+        Trace::SetEnabled(false);
+        Drain();
+    }
+
+    static std::vector<TraceRecord> Drain() {
+        std::vector<TraceRecord> result;
+        TraceRecord records[64];
+        std::size_t count;
+        while ((count = Trace::Drain(records, 64)) > 0) {
+            result.insert(result.end(), records, records + count);
+        }
+        return result;
+    }
+};
+
+TEST_F(TraceTest, RecordAndDrain) {
+    int method;
+    std::uint64_t start = Trace::Now();
+    Trace::Record(TraceEvent::kInstall, &method, start, 10);
+    Trace::Record(TraceEvent::kEnter, &method, start + 1);
+    Trace::Record(TraceEvent::kExit, &method, start + 2, 1);
+    Trace::Record(TraceEvent::kRestore, &method, start + 3, 20);
+
+    std::vector<TraceRecord> records = Drain();
+    ASSERT_EQ(4u, records.size());
+    const TraceEvent events[] = {TraceEvent::kInstall, TraceEvent::kEnter, TraceEvent::kExit,
+                                 TraceEvent::kRestore};
+    for (std::size_t i = 0; i < records.size(); i++) {
+        EXPECT_EQ(start + i, records[i].timestamp_);
+        EXPECT_EQ(reinterpret_cast<std::uint64_t>(&method), records[i].method_);
+        EXPECT_EQ(static_cast<std::uint32_t>(gettid()), records[i].thread_id_);
+        EXPECT_EQ(events[i], records[i].event_);
+    }
+    EXPECT_EQ(10u, records[0].duration_);
+    EXPECT_EQ(0u, records[1].duration_);
+    EXPECT_TRUE(Drain().empty());
+}
+
+TEST_F(TraceTest, IgnoreWhenDisabled) {
+    Trace::SetEnabled(false);
+    Trace::Record(TraceEvent::kEnter, nullptr, Trace::Now());
+    EXPECT_TRUE(Drain().empty());
+
+    // Records saved before stopping are kept.
+    Trace::SetEnabled(true);
+    Trace::Record(TraceEvent::kEnter, nullptr, Trace::Now());
+    Trace::SetEnabled(false);
+    EXPECT_EQ(1u, Drain().size());
+}
+
+TEST_F(TraceTest, DropWhenFull) {
+    std::uint64_t dropped = Trace::GetDroppedCount();
+    for (std::size_t i = 0; i < Trace::kRingCapacity + 10; i++) {
+        Trace::Record(TraceEvent::kEnter, nullptr, i);
+    }
+    EXPECT_EQ(dropped + 10, Trace::GetDroppedCount());
+
+    // The oldest records are kept, and the ring is reusable after draining.
+    std::vector<TraceRecord> records = Drain();
+    ASSERT_EQ(Trace::kRingCapacity, records.size());
+    EXPECT_EQ(0u, records.front().timestamp_);
+    EXPECT_EQ(Trace::kRingCapacity - 1, records.back().timestamp_);
+    Trace::Record(TraceEvent::kExit, nullptr, 1);
+    EXPECT_EQ(1u, Drain().size());
+}
+
+TEST_F(TraceTest, DrainWhileRecordingOnMultipleThreads) {
+    const int kThreadCount = 4;
+    const std::uint64_t kRecordCount = 100000;
+    std::uint64_t dropped = Trace::GetDroppedCount();
+    std::atomic<int> running{kThreadCount};
+    std::vector<std::thread> threads;
+    for (int t = 0; t < kThreadCount; t++) {
+        threads.emplace_back([&running, kRecordCount] {
+            for (std::uint64_t i = 0; i < kRecordCount; i++) {
+                Trace::Record(TraceEvent::kEnter, nullptr, i);
+            }
+            running--;
+        });
+    }
+
+    // Records of each thread are drained in order without duplication.
+    std::map<std::uint32_t, std::uint64_t> next;
+    std::map<std::uint32_t, std::uint64_t> counts;
+    bool ordered = true;
+    auto consume = [&](const std::vector<TraceRecord> &records) {
+        for (const TraceRecord &record : records) {
+            auto found = next.find(record.thread_id_);
+            if (found != next.end() && record.timestamp_ < found->second) ordered = false;
+            next[record.thread_id_] = record.timestamp_ + 1;
+            counts[record.thread_id_]++;
+        }
+    };
+    while (running > 0) consume(Drain());
+    for (auto &thread : threads) thread.join();
+    consume(Drain());
+
+    EXPECT_TRUE(ordered);
+    EXPECT_EQ(static_cast<std::size_t>(kThreadCount), counts.size());
+    std::uint64_t total = 0;
+    for (auto &[thread_id, count] : counts) total += count;
+    EXPECT_EQ(kThreadCount * kRecordCount, total + Trace::GetDroppedCount() - dropped);
+}
+
+TEST_F(TraceTest, KeepRecordsOfExitedThread) {
+    std::uint32_t thread_id = 0;
+    std::thread thread([&thread_id] {
+        thread_id = static_cast<std::uint32_t>(gettid());
+        Trace::Record(TraceEvent::kEnter, nullptr, 1);
+    });
+    thread.join();
+    std::vector<TraceRecord> records = Drain();
+    ASSERT_EQ(1u, records.size());
+    EXPECT_EQ(thread_id, records[0].thread_id_);
+}
+
+TEST_F(TraceTest, Export) {
+    int method = 0;
+    Trace::Record(TraceEvent::kEnter, &method, 1);
+    Trace::Record(TraceEvent::kExit, &method, 5, 4);
+    std::filesystem::path path = std::filesystem::temp_directory_path() /
+                                 ("kaleidoscope-trace-" + std::to_string(getpid()));
+    std::size_t count = 0;
+    ASSERT_TRUE(Trace::Export(path.c_str(), &count));
+    EXPECT_EQ(2u, count);
+    EXPECT_TRUE(Drain().empty());
+
+    FILE *file = fopen(path.c_str(), "rb");
+    ASSERT_NE(nullptr, file);
+    std::uint32_t magic;
+    std::uint16_t version, record_size;
+    std::uint64_t dropped;
+    TraceRecord records[3];
+    ASSERT_EQ(1u, fread(&magic, sizeof(magic), 1, file));
+    ASSERT_EQ(1u, fread(&version, sizeof(version), 1, file));
+    ASSERT_EQ(1u, fread(&record_size, sizeof(record_size), 1, file));
+    ASSERT_EQ(1u, fread(&dropped, sizeof(dropped), 1, file));
+    EXPECT_EQ(2u, fread(records, sizeof(TraceRecord), 3, file));
+    fclose(file);
+    std::filesystem::remove(path);
+
+    EXPECT_EQ(Trace::kExportMagic, magic);
+    EXPECT_EQ(Trace::kExportVersion, version);
+    EXPECT_EQ(sizeof(TraceRecord), record_size);
+    EXPECT_EQ(TraceEvent::kExit, records[1].event_);
+    EXPECT_EQ(4u, records[1].duration_);
+
+    EXPECT_FALSE(Trace::Export("/kaleidoscope/missing/trace", &count));
+}
@@ -0,0 +1,96 @@
+/*
+ * MIT License
+ *
+ * Copyright (C) 2021 M.D.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+package moe.aoramd.kaleidoscope
+
+import io.mockk.*
+import moe.aoramd.kaleidoscope.internal.*
+import org.junit.Assert.assertArrayEquals
+import org.junit.Assert.assertEquals
+import org.junit.Assert.assertFalse
+import org.junit.Assert.assertNull
+import org.junit.Test
+import java.lang.reflect.Method
+import java.lang.reflect.Modifier
+
+class ArgumentsTest {
+
+    private fun layout(isStatic: Boolean, vararg parameterTypes: Class<*>): ArgumentLayout {
+        val method = mockk<Method>().apply {
+            every { modifiers } returns if (isStatic) Modifier.STATIC else Modifier.PUBLIC
+            every { this@apply.parameterTypes } returns arrayOf(*parameterTypes)
+        }
+        return ArgumentLayout(method)
+    }
+
+    @Test
+    fun testGet() {
+        val thiz = Any()
+        val parameter = Any()
+
+        val arguments = Arguments(
+            layout(
+                false,
+                Int::class.javaPrimitiveType!!,
+                Double::class.javaPrimitiveType!!,
+                Boolean::class.javaPrimitiveType!!,
+                Any::class.java
+            ),
+            longArrayOf(0L, -1L, 1.5.toRawBits(), 0x100L, 0L),
+            arrayOf(thiz, null, null, null, parameter)
+        )
+
+        assertEquals(4, arguments.size)
+        assertEquals(thiz, arguments.thiz)
+        assertEquals(-1, arguments.getInt(0))
+        assertEquals(1.5, arguments.getDouble(1), 0.0)
+        // Only the low byte of raw data is the boolean.
+        assertFalse(arguments.getBoolean(2))
+        assertEquals(parameter, arguments.getObject(3))
+        assertArrayEquals(arrayOf(-1, 1.5, false, parameter), arguments.toArray())
+    }
+
+    @Test
+    fun testGetWithStaticMethod() {
+        val arguments = Arguments(
+            layout(true, Long::class.javaPrimitiveType!!),
+            longArrayOf(Long.MIN_VALUE),
+            null
+        )
+
+        assertNull(arguments.thiz)
+        assertEquals(Long.MIN_VALUE, arguments.getLong(0))
+        assertEquals(Long.MIN_VALUE, arguments[0])
+    }
+
+    @Test(expected = ArgumentTypeNotMatchException::class)
+    fun testGetWithTypeNotMatch() {
+        Arguments(layout(true, Int::class.javaPrimitiveType!!), longArrayOf(0L), null).getLong(0)
+    }
+
+    @Test(expected = IndexOutOfBoundsException::class)
+    fun testGetWithIndexOutOfBounds() {
+        Arguments(layout(true, Int::class.javaPrimitiveType!!), longArrayOf(0L), null).getInt(1)
+    }
+}
@@ -27,48 +27,124 @@ package moe.aoramd.kaleidoscope
 import io.mockk.*
 import moe.aoramd.kaleidoscope.internal.*
 import org.junit.Assert.assertEquals
+import org.junit.Assert.assertFalse
 import org.junit.Assert.assertTrue
+import org.junit.Assert.fail
 import org.junit.Test
 import java.lang.reflect.Method
+import java.lang.reflect.Modifier
+
+/**
+ * Mock an insert result whose hook is not actually registered.
+ */
+internal inline fun <reified T : InsertBridgeResult> mockResult(): T =
+    mockk<T>(relaxed = true).apply {
+        mockkStatic(InsertBridgeResult::registerRecord)
+        justRun { registerRecord(any()) }
+    }
+
+/**
+ * Mock invokers of hooks, which get method ids by JNI.
+ */
+internal fun mockInvokers() {
+    mockkObject(Invoker)
+    every { Invoker.origin(any(), any()) } returns mockk(relaxed = true)
+    every { Invoker.target(any(), any()) } returns mockk(relaxed = true)
+}
+
+/**
+ * Mock a public instance method which can be set to Kaleidoscope. Its parameter types are
+ * read to create the argument layout of its hook.
+ */
+internal fun mockSource(
+    returnType: Class<*> = Void.TYPE,
+    parameterTypes: Array<Class<*>> = emptyArray()
+): Method = mockk<Method>().apply {
+    justRun { isAccessible = any() }
+
+    every { modifiers } returns Modifier.PUBLIC
+    every { this@apply.returnType } returns returnType
+    every { this@apply.parameterTypes } returns parameterTypes
+
+    mockkStatic(Method::forceLoad)
+    justRun { forceLoad() }
+}
 
 class ListenBuilderTest {
 
     @Test
     fun testBuild() {
-        val target = mockk<Method>()
+        mockInvokers()
+
+        val clone = mockk<Method>()
+        val result = mockResult<ListenResult>()
 
-        val result = mockk<InsertBridgeResult>().apply {
-            mockkStatic(RuntimeMethod::registerRecord)
-            justRun { originPointer.registerRecord(any()) }
+        val source = mockSource().apply {
+            mockkStatic(Method::listenBridge)
+            every { listenBridge(any()) } returns Pair(result, clone)
         }
 
-        val source = mockk<Method>().apply {
-            justRun { isAccessible = any() }
+        val beforeListener = mockk<(Any?, Arguments) -> Any?>()
+        val afterListener = mockk<(Any?, Arguments, Any?) -> Unit>()
 
-            mockkStatic(Method::forceLoad)
-            justRun { forceLoad() }
+        val scope = ListenBuilder(source)
+            .beforeArguments(beforeListener)
+            .afterArguments(afterListener)
+            .commit()
+
+        verify { source.mark() }
+        verify { source.isAccessible = true }
+        verify { source.forceLoad() }
+        verify { Invoker.origin(clone, result) }
+        assertTrue(scope is ListenScope)
+        scope as ListenScope
+        assertEquals(source, scope.source)
+        assertEquals(result, scope.result)
+        assertEquals(beforeListener, scope.before)
+        assertEquals(afterListener, scope.after)
+        assertEquals(0, scope.priority)
+
+        // Bridge code is inserted paused, and it is resumed after the hook is registered.
+        verifyOrder {
+            result.registerRecord(any<ListenHook>())
+            result.setPaused(false)
+        }
+    }
 
+    @Test
+    fun testBuildWithArrayListeners() {
+        mockInvokers()
+
+        val result = mockResult<ListenResult>()
+
+        val source = mockSource(parameterTypes = arrayOf(Int::class.javaPrimitiveType!!)).apply {
             mockkStatic(Method::listenBridge)
-            every { listenBridge() } returns Pair(result, target)
+            every { listenBridge(any()) } returns Pair(result, mockk())
         }
 
-        val beforeListener = mockk<(Any?, Array<Any?>) -> Any?>()
-        val afterListener = mockk<(Any?, Array<Any?>, Any?) -> Unit>()
+        val beforeListener = mockk<(Any?, Array<Any?>) -> Any?>().apply {
+            every { this@apply.invoke(any(), any()) } returns null
+        }
+        val afterListener = mockk<(Any?, Array<Any?>, Any?) -> Unit>().apply {
+            justRun { this@apply.invoke(any(), any(), any()) }
+        }
 
         val scope = ListenBuilder(source)
             .before(beforeListener)
             .after(afterListener)
-            .commit()
+            .commit() as ListenScope
 
-        verify { source.mark() }
-        verify { source.isAccessible = true }
-        verify { source.forceLoad() }
-        assertEquals(
-            ListenScope(beforeListener, afterListener, target, source, result),
-            scope
+        val thiz = Any()
+        val store = Any()
+        val arguments = Arguments(
+            ArgumentLayout(source), longArrayOf(0L, 42L), arrayOf(thiz, null)
         )
-        assertTrue(scope is ListenScope)
-        verify { result.originPointer.registerRecord(scope as ListenScope) }
+        scope.before(thiz, arguments)
+        scope.after(thiz, arguments, store)
+
+        // Parameters are decoded into an array once and passed to both listeners.
+        verify { beforeListener.invoke(thiz, arrayOf(42)) }
+        verify { afterListener.invoke(thiz, arrayOf(42), store) }
     }
 
     @Test(expected = DuplicateMarkException::class)
@@ -94,7 +170,7 @@ class ListenBuilderTest {
             justRun { forceLoad() }
 
             mockkStatic(Method::listenBridge)
-            every { listenBridge() } returns null
+            every { listenBridge(any()) } returns null
         }
 
         val scope = ListenBuilder(source)
@@ -106,31 +182,101 @@ class ListenBuilderTest {
         verify { source.unmark() }
         assertEquals(ErrorScope, scope)
     }
+
+    @Test
+    fun testBuildWithListenedMethod() {
+        mockInvokers()
+
+        val result = mockResult<ListenResult>()
+
+        val source = mockSource().apply {
+            mockkStatic(Method::listenBridge)
+            mockkStatic(Method::findListenHook)
+        }
+
+        val hook = ListenHook(source, mockk(), result)
+        val first = ListenScope(mockk(), mockk(), 0, hook).also { hook.attach(it) }
+        every { source.findListenHook() } returns hook
+
+        val scope = ListenBuilder(source)
+            .priority(1)
+            .commit()
+
+        // Scope is attached to the hook of the listened method without inserting bridge code.
+        verify(exactly = 0) { source.mark() }
+        verify(exactly = 0) { source.listenBridge(any()) }
+        assertTrue(scope is ListenScope)
+        scope as ListenScope
+        assertEquals(1, scope.priority)
+        assertTrue(hook.contains(first))
+        assertTrue(hook.contains(scope))
+    }
+
+    @Test
+    fun testBuildWithRestoringListenedMethod() {
+        mockInvokers()
+
+        val source = mockSource().apply {
+            mockkStatic(Method::listenBridge)
+            every { listenBridge(any()) } returns null
+
+            mockkStatic(Method::findListenHook)
+        }
+
+        // Hook whose last scope is restored is never attached to.
+        every { source.findListenHook() } returns ListenHook(source, mockk(), mockResult())
+
+        ListenBuilder(source).commit()
+
+        verify { source.mark() }
+        verify { source.listenBridge(0L) }
+    }
+
+    @Test
+    fun testBuildWithSampling() {
+        val source = mockSource().apply {
+            mockkStatic(Method::listenBridge)
+            every { listenBridge(any()) } returns null
+        }
+
+        ListenBuilder(source).commit()
+        verify { source.listenBridge(0L) }
+
+        ListenBuilder(source).sampleEvery(4).commit()
+        verify { source.listenBridge(4L) }
+
+        ListenBuilder(source).sample(0.1).commit()
+        verify { source.listenBridge(10L) }
+
+        ListenBuilder(source).sample(1.0).commit()
+        verify { source.listenBridge(1L) }
+    }
+
+    @Test(expected = SampleIntervalException::class)
+    fun testBuildWithInvalidSampleInterval() {
+        ListenBuilder(mockSource()).sampleEvery(0)
+    }
+
+    @Test(expected = SampleRateException::class)
+    fun testBuildWithInvalidSampleRate() {
+        ListenBuilder(mockSource()).sample(1.5)
+    }
 }
 
 class ReplaceBuilderTest {
 
     @Test
     fun testBuild() {
-        val returnType = Any::class.java
-        val parameterTypes = Array(10) { Any::class.java }
-
-        val source = mockk<Method>().apply {
-            justRun { isAccessible = any() }
+        mockInvokers()
 
-            every { this@apply.returnType } returns returnType
-            every { this@apply.parameterTypes } returns parameterTypes
+        val returnType = Any::class.java
+        val parameterTypes = Array<Class<*>>(10) { Any::class.java }
 
-            mockkStatic(Method::forceLoad)
-            justRun { forceLoad() }
-        }
+        val source = mockSource(returnType, parameterTypes)
 
-        val result = mockk<InsertBridgeResult>().apply {
+        val result = mockResult<ReplaceResult>().apply {
             mockkStatic(Method::replaceBridge)
             every { source.replaceBridge() } returns this
-
-            mockkStatic(RuntimeMethod::registerRecord)
-            justRun { originPointer.registerRecord(any()) }
         }
 
         val target = mockk<Method>().apply {
@@ -146,12 +292,15 @@ class ReplaceBuilderTest {
         verify { source.mark() }
         verify { source.isAccessible = true }
         verify { source.forceLoad() }
-        assertEquals(
-            ReplaceScope(target, source, result),
-            scope
-        )
-        assertTrue(scope is ReplaceScope)
-        verify { result.originPointer.registerRecord(scope as ReplaceScope) }
+        verify { target.isAccessible = true }
+        verify { Invoker.target(target, result) }
+        assertEquals(ReplaceScope(ReplaceHook(target, source, result)), scope)
+
+        // Bridge code is inserted paused, and it is resumed after the hook is registered.
+        verifyOrder {
+            result.registerRecord(any<ReplaceHook>())
+            result.setPaused(false)
+        }
     }
 
     @Test(expected = DuplicateMarkException::class)
@@ -213,4 +362,127 @@ class ReplaceBuilderTest {
         verify { source.unmark() }
         assertEquals(ErrorScope, scope)
     }
-}
\ No newline at end of file
+}
+
+class CommitAllTest {
+
+    @Test
+    fun testCommitAll() {
+        mockInvokers()
+
+        val result = mockResult<ListenResult>()
+
+        val succeededSource = mockSource().apply {
+            mockkStatic(Method::listenResult)
+            every { listenResult(1L) } returns Pair(result, mockk())
+        }
+
+        val failedSource = mockSource().apply {
+            mockkStatic(Method::listenResult)
+            every { listenResult(0L) } returns null
+        }
+
+        mockkStatic(::batchBridge)
+        every { batchBridge(any(), any(), any(), any()) } answers {
+            arg<LongArray>(3).apply {
+                this[0] = 10L
+                this[1] = 20L
+            }
+            longArrayOf(1L, 0L)
+        }
+
+        val beforeListener = mockk<(Any?, Arguments) -> Any?>()
+        val afterListener = mockk<(Any?, Arguments, Any?) -> Unit>()
+
+        val batch = listOf(
+            ListenBuilder(succeededSource)
+                .beforeArguments(beforeListener)
+                .afterArguments(afterListener)
+                .sampleEvery(2),
+            ListenBuilder(failedSource)
+        ).commitAll()
+
+        verify {
+            batchBridge(
+                arrayOf(succeededSource, failedSource),
+                booleanArrayOf(false, false),
+                longArrayOf(2L, 0L),
+                any()
+            )
+        }
+
+        verify { succeededSource.mark() }
+        verify { failedSource.mark() }
+        verify { failedSource.unmark() }
+        val scope = batch.scopes[0] as ListenScope
+        assertEquals(result, scope.result)
+        assertEquals(beforeListener, scope.before)
+        assertEquals(afterListener, scope.after)
+        verifyOrder {
+            result.registerRecord(any<ListenHook>())
+            result.setPaused(false)
+        }
+        assertEquals(ErrorScope, batch.scopes[1])
+        assertEquals(listOf(1), batch.failed)
+        assertEquals(10L, batch.prepareTime)
+        assertEquals(20L, batch.patchTime)
+    }
+
+    @Test
+    fun testCommitAllWithSameMethod() {
+        mockInvokers()
+
+        val registered = slot<Hook>()
+        val result = mockk<ListenResult>(relaxed = true).apply {
+            mockkStatic(InsertBridgeResult::registerRecord)
+            justRun { registerRecord(capture(registered)) }
+        }
+
+        val source = mockSource().apply {
+            mockkStatic(Method::listenResult)
+            every { listenResult(1L) } returns Pair(result, mockk())
+
+            mockkStatic(Method::findListenHook)
+            every { findListenHook() } answers {
+                if (registered.isCaptured) registered.captured as ListenHook else null
+            }
+        }
+
+        mockkStatic(::batchBridge)
+        every { batchBridge(any(), any(), any(), any()) } returns longArrayOf(1L)
+
+        val batch = listOf(
+            ListenBuilder(source),
+            ListenBuilder(source).priority(1)
+        ).commitAll()
+
+        // Bridge code is inserted once, and shared by both scopes.
+        verify { batchBridge(arrayOf(source), booleanArrayOf(false), longArrayOf(0L), any()) }
+        assertEquals(emptyList<Int>(), batch.failed)
+        val hook = registered.captured as ListenHook
+        assertTrue(hook.contains(batch.scopes[0] as ListenScope))
+        assertTrue(hook.contains(batch.scopes[1] as ListenScope))
+    }
+
+    @Test
+    fun testCommitAllWithMarkedMethod() {
+        val source = mockk<Method>().apply {
+            justRun { isAccessible = any() }
+
+            mockkStatic(Method::forceLoad)
+            justRun { forceLoad() }
+        }
+
+        val markedSource = mockk<Method>().apply {
+            mark()
+        }
+
+        try {
+            listOf(ListenBuilder(source), ListenBuilder(markedSource)).commitAll()
+            fail()
+        } catch (exception: DuplicateMarkException) {
+            // Prepared methods are unmarked.
+            assertFalse(source.unmark())
+        }
+    }
+}
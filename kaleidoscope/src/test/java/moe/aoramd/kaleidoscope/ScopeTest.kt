@@ -27,82 +27,162 @@ package moe.aoramd.kaleidoscope
 import io.mockk.*
 import moe.aoramd.kaleidoscope.internal.*
 import org.junit.Assert.assertEquals
+import org.junit.Assert.assertFalse
+import org.junit.Assert.assertTrue
 import org.junit.Test
-import java.lang.reflect.Method
+
+/**
+ * Create arguments of an invocation of [hook], whose source method has no parameter.
+ */
+private fun arguments(hook: Hook, thiz: Any): Arguments =
+    Arguments(hook.layout, longArrayOf(0L), arrayOf(thiz))
 
 class ListenScopeTest {
 
     @Test
     fun testInvoke() {
+        val invoker = mockk<Invoker>().apply {
+            every { this@apply.invoke(any()) } returns 42L
+        }
+        mockkObject(Invoker)
+        every { Invoker.origin(any(), any()) } returns invoker
+
         val listenerResult = Any()
 
-        val beforeListener = mockk<(Any?, Array<Any?>) -> Any?>().apply {
+        val beforeListener = mockk<(Any?, Arguments) -> Any?>().apply {
             every { this@apply.invoke(any(), any()) } returns listenerResult
         }
-        val afterListener = mockk<(Any?, Array<Any?>, Any?) -> Unit>().apply {
+        val afterListener = mockk<(Any?, Arguments, Any?) -> Unit>().apply {
             justRun { this@apply.invoke(any(), any(), any()) }
         }
 
-        val targetResult = Any()
+        val hook = ListenHook(mockSource(), mockk(), mockk(relaxed = true))
+        hook.attach(ListenScope(beforeListener, afterListener, 0, hook))
 
-        val target = mockk<Method>().apply {
-            every { this@apply.invoke(any(), *anyVararg()) } returns targetResult
+        val thiz = Any()
+        val arguments = arguments(hook, thiz)
+
+        assertEquals(42L, hook.invoke(arguments))
+        verifyOrder {
+            beforeListener.invoke(thiz, arguments)
+            invoker.invoke(arguments)
+            afterListener.invoke(thiz, arguments, listenerResult)
         }
+    }
 
-        val thiz = Any()
-        val parameters = Array<Any?>(10) { Any() }
+    @Test
+    fun testInvokeWithPriorities() {
+        mockInvokers()
+
+        val hook = ListenHook(mockSource(), mockk(), mockk(relaxed = true))
+        val calls = mutableListOf<String>()
+
+        fun attach(name: String, priority: Int) = hook.attach(
+            ListenScope(
+                { _, _ -> calls.add("before $name") },
+                { _, _, _ -> calls.add("after $name") },
+                priority, hook
+            )
+        )
+        attach("a", 0)
+        attach("b", 1)
+        attach("c", 0)
+        attach("d", -1)
+
+        hook.invoke(arguments(hook, Any()))
+
+        // Listeners of higher priority wrap the others, and ties keep the committed order.
+        assertEquals(
+            listOf(
+                "before b", "before a", "before c", "before d",
+                "after d", "after c", "after a", "after b"
+            ),
+            calls
+        )
+    }
 
-        val scopeResult = ListenScope(
-            beforeListener, afterListener, target,
-            mockk(), mockk()
-        ).invoke(thiz, parameters)
+    @Test
+    fun testPause() {
+        mockInvokers()
+
+        val result = mockk<ListenResult>(relaxed = true)
+        val hook = ListenHook(mockSource(), mockk(), result)
+        val calls = mutableListOf<String>()
+
+        val first = ListenScope({ _, _ -> calls.add("first") }, { _, _, _ -> }, 0, hook)
+            .also { hook.attach(it) }
+        val second = ListenScope({ _, _ -> calls.add("second") }, { _, _, _ -> }, 0, hook)
+            .also { hook.attach(it) }
+
+        // Listeners of paused scopes are skipped, and bridge code keeps running for the others.
+        first.pause()
+        hook.invoke(arguments(hook, Any()))
+        assertEquals(listOf("second"), calls)
+        verify(exactly = 0) { result.setPaused(true) }
+
+        // Bridge code is paused once all scopes are paused.
+        second.pause()
+        verify { result.setPaused(true) }
+
+        first.resume()
+        hook.invoke(arguments(hook, Any()))
+        assertEquals(listOf("second", "first"), calls)
+        verifyOrder {
+            result.setPaused(true)
+            result.setPaused(false)
+        }
+    }
 
-        verify { beforeListener.invoke(thiz, parameters) }
-        verify { afterListener.invoke(thiz, parameters, listenerResult) }
+    @Test
+    fun testPauseWithRestoredScope() {
+        mockInvokers()
 
-        verify { target.invoke(thiz, *parameters) }
-        assertEquals(targetResult, scopeResult)
+        val result = mockk<ListenResult>(relaxed = true)
+        val hook = ListenHook(mockSource(), mockk(), result)
+        val first = ListenScope(mockk(), mockk(), 0, hook).also { hook.attach(it) }
+        ListenScope(mockk(), mockk(), 0, hook).also { hook.attach(it) }
+
+        first.restore()
+        first.pause()
+
+        assertFalse(first.paused)
+        verify(exactly = 0) { result.setPaused(true) }
     }
 
     @Test
     fun testRestore() {
-        val source = mockk<Method>().apply {
+        mockInvokers()
+
+        val source = mockSource().apply {
             mark()
         }
 
-        val result = mockk<InsertBridgeResult>().apply {
-            justRun { restoreBridge() }
+        val result = mockk<ListenResult>(relaxed = true)
 
-            mockkStatic(RuntimeMethod::releaseRecord)
-            justRun { originPointer.releaseRecord() }
-        }
+        val hook = ListenHook(source, mockk(), result)
+        val first = ListenScope(mockk(), mockk(), 0, hook).also { hook.attach(it) }
+        val second = ListenScope(mockk(), mockk(), 0, hook).also { hook.attach(it) }
 
-        ListenScope(
-            mockk(), mockk(), mockk(),
-            source, result
-        ).restore()
+        // Bridge code is kept until the last scope is restored.
+        first.restore()
+        assertFalse(hook.contains(first))
+        verify(exactly = 0) { result.restoreBridge() }
 
+        second.restore()
+        assertTrue(hook.isEmpty)
         verify { result.restoreBridge() }
-        verify { result.originPointer.releaseRecord() }
+        assertFalse(source.unmark())
     }
 
     @Test(expected = RepeatInvokeRestoreException::class)
-    fun testRestoreWithUnmarkedMethod() {
-        val source = mockk<Method>()
+    fun testRepeatRestore() {
+        mockInvokers()
 
-        val result = mockk<InsertBridgeResult>().apply {
-            justRun { restoreBridge() }
+        val hook = ListenHook(mockSource(), mockk(), mockk(relaxed = true))
+        val scope = ListenScope(mockk(), mockk(), 0, hook).also { hook.attach(it) }
 
-            mockkStatic(RuntimeMethod::releaseRecord)
-            justRun { originPointer.releaseRecord() }
-        }
-
-        ListenScope(
-            mockk(), mockk(), mockk(),
-            source, result
-        ).restore()
-
-        verify { result.restoreBridge() }
+        scope.restore()
+        scope.restore()
     }
 }
 
@@ -112,51 +192,64 @@ class ReplaceScopeTest {
     fun testInvoke() {
         val targetResult = Any()
 
-        val target = mockk<Method>().apply {
-            every { this@apply.invoke(any(), *anyVararg()) } returns targetResult
+        val invoker = mockk<Invoker>().apply {
+            every { invokeObject(any()) } returns targetResult
         }
+        mockkObject(Invoker)
+        every { Invoker.target(any(), any()) } returns invoker
 
-        val thiz = Any()
-        val parameters = Array<Any?>(10) { Any() }
+        val hook = ReplaceHook(mockk(), mockSource(), mockk(relaxed = true))
+        val arguments = arguments(hook, Any())
 
-        val scopeResult = ReplaceScope(target, mockk(), mockk()).invoke(thiz, parameters)
-
-        verify { target.invoke(thiz, *parameters) }
-        assertEquals(targetResult, scopeResult)
+        assertEquals(targetResult, hook.invokeObject(arguments))
+        verify { invoker.invokeObject(arguments) }
     }
 
     @Test
     fun testRestore() {
-        val source = mockk<Method>().apply {
+        mockInvokers()
+
+        val source = mockSource().apply {
             mark()
         }
 
-        val result = mockk<InsertBridgeResult>().apply {
-            justRun { restoreBridge() }
-
-            mockkStatic(RuntimeMethod::releaseRecord)
-            justRun { originPointer.releaseRecord() }
-        }
+        val result = mockk<ReplaceResult>(relaxed = true)
 
-        ReplaceScope(mockk(), source, result).restore()
+        ReplaceScope(ReplaceHook(mockk(), source, result)).restore()
 
         verify { result.restoreBridge() }
-        verify { result.originPointer.releaseRecord() }
+        assertFalse(source.unmark())
     }
 
-    @Test(expected = RepeatInvokeRestoreException::class)
-    fun testRestoreWithUnmarkedMethod() {
-        val source = mockk<Method>()
+    @Test
+    fun testPause() {
+        mockInvokers()
+
+        val result = mockk<ReplaceResult>(relaxed = true)
+        val scope = ReplaceScope(ReplaceHook(mockk(), mockSource(), result))
 
-        val result = mockk<InsertBridgeResult>().apply {
-            justRun { restoreBridge() }
+        scope.pause()
+        verify { result.setPaused(true) }
 
-            mockkStatic(RuntimeMethod::releaseRecord)
-            justRun { originPointer.releaseRecord() }
+        scope.resume()
+        verifyOrder {
+            result.setPaused(true)
+            result.setPaused(false)
         }
 
-        ReplaceScope(mockk(), source, result).restore()
+        // Pausing has no effect once bridge code is restored.
+        scope.restore()
+        scope.pause()
+        verify(exactly = 1) { result.setPaused(true) }
+    }
 
-        verify { result.restoreBridge() }
+    @Test(expected = RepeatInvokeRestoreException::class)
+    fun testRepeatRestore() {
+        mockInvokers()
+
+        val scope = ReplaceScope(ReplaceHook(mockk(), mockSource(), mockk(relaxed = true)))
+
+        scope.restore()
+        scope.restore()
     }
-}
\ No newline at end of file
+}